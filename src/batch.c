@@ -0,0 +1,977 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* posix_madvise, sysconf */
+
+#include "batch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "extract.h"
+#include "launch.h"
+#include "rules.h"
+#include "statcache.h"
+#include "transform.h"
+#include "util.h"
+
+/* Written for the records that didn't match any rule */
+#define NO_MATCH "-"
+
+/* Size of the buffer for the arguments of a record, before using the heap */
+#define BATCH_ARGV_SZ 1024
+
+/* Maximum number of decisions waiting for the status of their files */
+#define BATCH_PENDING_MAX 1024
+
+/*
+ * Buffered output. If it's written to a file descriptor, it's flushed when the
+ * buffer is full; otherwise, the buffer grows as needed.
+ */
+typedef struct Output {
+    int fd; /* Negative if the output is kept in memory */
+    bool ok;
+    char* buf;
+    size_t len, sz;
+} Output;
+
+/*
+ * Range of the input processed by a single worker, along with its output. The
+ * chunks always end after a record delimiter, or at the end of the input.
+ */
+typedef struct Chunk {
+    size_t off, len;
+    Output out;
+} Chunk;
+
+/*
+ * Decision (or span, with '--extract') that is waiting for the status of its
+ * file, along with the ones after it, so they are written in order.
+ */
+typedef struct PendingRecord {
+    const char* text;
+    size_t off, len; /* Offset of the span in the input */
+    int rule;
+    int stat_id; /* See 'statcache_kind', or -1 if it's not a file */
+} PendingRecord;
+
+/*
+ * Decisions of a single thread that are only written when the files that they
+ * open are known to exist, see 'pending_flush'. The files are checked in
+ * batches, and the normalized records are copied to 'text' meanwhile.
+ */
+typedef struct Pending {
+    bool extract;
+    char delim;
+    PendingRecord records[BATCH_PENDING_MAX];
+    int num;
+    char* text; /* Of BATCH_BUF_SZ bytes, only used for '--batch' */
+    size_t text_len;
+    StatCache stats;
+} Pending;
+
+typedef struct Job Job;
+
+/*
+ * Thread of a parallel job, with its own rule set, since matching modifies it.
+ * Its 'range' contains the indexes of the chunks that it still has to process,
+ * see 'take_chunk'.
+ */
+typedef struct Worker {
+    Job* job;
+    RuleSet* rules;
+    RuleSet own_rules;
+    uint64_t range;
+    char* record; /* Of BATCH_BUF_SZ + 1 bytes, used for '--batch' */
+    Extractor extractor;
+    Pending* pending; /* Only used for '--existing' */
+} Worker;
+
+/*
+ * Input mapped in memory, split in chunks that are processed by all the
+ * workers in parallel. The chunks are processed in windows, so the output of
+ * a single window needs to be kept in memory before writing it in order.
+ */
+struct Job {
+    const char* data;
+    size_t len;
+    bool extract; /* Whether to call 'extract_chunk' or 'classify_chunk' */
+    char delim;
+    bool reference;
+
+    Chunk* chunks;
+    int chunks_num;
+    Worker* workers;
+    int workers_num;
+};
+
+/*----------------------------------------------------------------------------*/
+
+static bool write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        const ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += written;
+        len -= written;
+    }
+    return true;
+}
+
+static void output_flush(Output* out) {
+    if (out->ok && !write_all(out->fd, out->buf, out->len)) {
+        ERR("Could not write output: %s", strerror(errno));
+        out->ok = false;
+    }
+    out->len = 0;
+}
+
+/*
+ * Make room for at least one more byte in the output.
+ */
+static void output_reserve(Output* out) {
+    if (out->fd >= 0) {
+        output_flush(out);
+        return;
+    }
+
+    const size_t new_sz = (out->sz == 0) ? BATCH_BUF_SZ : out->sz * 2;
+    char* new_buf       = realloc(out->buf, new_sz);
+    if (new_buf == NULL) {
+        if (out->ok)
+            ERR("Could not allocate the output buffer.");
+        out->ok  = false;
+        out->len = 0;
+        return;
+    }
+    out->buf = new_buf;
+    out->sz  = new_sz;
+}
+
+static void output_write(Output* out, const char* str, size_t len) {
+    while (len > 0) {
+        if (out->len == out->sz)
+            output_reserve(out);
+        if (out->len == out->sz)
+            return;
+
+        size_t chunk = out->sz - out->len;
+        if (chunk > len)
+            chunk = len;
+
+        memcpy(&out->buf[out->len], str, chunk);
+        out->len += chunk;
+        str += chunk;
+        len -= chunk;
+    }
+}
+
+static inline void output_char(Output* out, char c) {
+    if (out->len == out->sz)
+        output_reserve(out);
+    if (out->len < out->sz)
+        out->buf[out->len++] = c;
+}
+
+static void output_size(Output* out, size_t num) {
+    char buf[20];
+    size_t i = sizeof(buf);
+    do {
+        buf[--i] = '0' + num % 10;
+        num /= 10;
+    } while (num > 0);
+    output_write(out, &buf[i], sizeof(buf) - i);
+}
+
+static void output_no_match(Output* out, char delim) {
+    output_write(out, NO_MATCH, sizeof(NO_MATCH) - 1);
+    output_char(out, delim);
+}
+
+/*
+ * Write the decision for the 'len' bytes of 'record', which matched the rule
+ * 'idx', or none if it's negative.
+ */
+static void output_decision(const RuleSet* rules, Output* out,
+                            const char* record, size_t len, int idx,
+                            char delim) {
+    if (idx < 0) {
+        output_no_match(out, delim);
+        return;
+    }
+
+    const Rule* rule = &rules->rules[idx];
+    output_write(out, rule->name, strlen(rule->name));
+
+    /* The arguments of most records fit in the stack */
+    char local[BATCH_ARGV_SZ];
+    const size_t buf_sz = launch_argv_size(rules, idx, len);
+    char* buf = (buf_sz <= sizeof(local)) ? local : malloc(buf_sz);
+
+    const char* argv[LAUNCH_MAX_ARGS + 1];
+    const int argc =
+      (buf == NULL) ? -1
+                    : launch_argv(rules, idx, record, len, buf, buf_sz, argv);
+    for (int i = 0; i < argc; i++) {
+        output_char(out, '\t');
+        output_write(out, argv[i], strlen(argv[i]));
+    }
+    output_char(out, delim);
+
+    if (buf != local)
+        free(buf);
+}
+
+/*
+ * Write the 'len' bytes of 'text', a span that matched the rule 'idx', which
+ * starts 'off' bytes after the beginning of the input.
+ */
+static void output_span(const RuleSet* rules, Output* out, const char* text,
+                        size_t off, size_t len, int idx) {
+    const char* name = rules->rules[idx].name;
+    output_size(out, off);
+    output_char(out, '\t');
+    output_size(out, len);
+    output_char(out, '\t');
+    output_write(out, name, strlen(name));
+    output_char(out, '\t');
+    output_write(out, text, len);
+    output_char(out, '\n');
+}
+
+/*----------------------------------------------------------------------------*/
+/* Existing files */
+
+/*
+ * Allocate the pending decisions of a thread. Returns NULL on errors.
+ */
+static Pending* pending_new(bool extract, char delim) {
+    Pending* pending = malloc(sizeof(Pending));
+    if (pending == NULL)
+        return NULL;
+
+    pending->extract  = extract;
+    pending->delim    = delim;
+    pending->num      = 0;
+    pending->text     = extract ? NULL : malloc(BATCH_BUF_SZ);
+    pending->text_len = 0;
+    if ((!extract && pending->text == NULL) ||
+        !statcache_init(&pending->stats)) {
+        free(pending->text);
+        free(pending);
+        return NULL;
+    }
+
+    return pending;
+}
+
+static void pending_free(Pending* pending) {
+    if (pending == NULL)
+        return;
+
+    statcache_free(&pending->stats);
+    free(pending->text);
+    free(pending);
+}
+
+/*
+ * Check the files of the pending decisions, and write them in order. The
+ * records whose files are not regular files are written as NO_MATCH, and the
+ * spans are omitted.
+ */
+static void pending_flush(Pending* pending, const RuleSet* rules,
+                          Output* out) {
+    statcache_run(&pending->stats);
+
+    for (int i = 0; i < pending->num; i++) {
+        const PendingRecord* record = &pending->records[i];
+        const bool exists =
+          record->stat_id < 0 ||
+          statcache_kind(&pending->stats, record->stat_id) == STAT_REGULAR;
+
+        if (pending->extract && exists)
+            output_span(rules, out, record->text, record->off, record->len,
+                        record->rule);
+        else if (!pending->extract)
+            output_decision(rules, out, record->text, record->len,
+                            exists ? record->rule : -1, pending->delim);
+    }
+
+    pending->num      = 0;
+    pending->text_len = 0;
+}
+
+/*
+ * Write the decision for the 'len' bytes of 'text', or the span that starts
+ * 'off' bytes after the beginning of the input, once its file is checked. The
+ * text of a span should be valid until the next flush.
+ */
+static void pending_add(Pending* pending, const RuleSet* rules, Output* out,
+                        const char* text, size_t off, size_t len, int idx) {
+    const size_t path_len =
+      (idx < 0) ? 0 : rule_kind_path_len(rules->rules[idx].kind, text, len);
+
+    /* Nothing to wait for */
+    if (path_len == 0 && pending->num == 0) {
+        if (pending->extract)
+            output_span(rules, out, text, off, len, idx);
+        else
+            output_decision(rules, out, text, len, idx, pending->delim);
+        return;
+    }
+
+    if (pending->num == BATCH_PENDING_MAX ||
+        (!pending->extract && pending->text_len + len > BATCH_BUF_SZ))
+        pending_flush(pending, rules, out);
+
+    int stat_id = -1;
+    if (path_len > 0) {
+        stat_id = statcache_add(&pending->stats, text, path_len);
+        if (stat_id < 0) {
+            pending_flush(pending, rules, out);
+            stat_id = statcache_add(&pending->stats, text, path_len);
+        }
+    }
+
+    /* The buffer of the records is reused, see 'classify_chunk' */
+    if (!pending->extract) {
+        text = memcpy(&pending->text[pending->text_len], text, len);
+        pending->text_len += len;
+    }
+
+    PendingRecord* record = &pending->records[pending->num++];
+    record->text          = text;
+    record->off           = off;
+    record->len           = len;
+    record->rule          = idx;
+    record->stat_id       = stat_id;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Classify a single record, which is modified in-place, and write the decision
+ * to the output; or add it to 'pending', if not NULL.
+ */
+static void process_record(RuleSet* rules, Output* out, Pending* pending,
+                           char* record, char delim, bool reference) {
+    /* The records have no room after them, see 'transform_normalize' */
+    size_t len = strlen(record);
+    record     = transform_normalize(record, &len, len + 1);
+
+    const int idx = reference ? ruleset_match_reference_len(rules, record, len)
+                              : ruleset_match_len(rules, record, len);
+    if (pending != NULL)
+        pending_add(pending, rules, out, record, 0, len, idx);
+    else
+        output_decision(rules, out, record, len, idx, delim);
+}
+
+/*
+ * Read the whole file into a new buffer, for the files that can't be mapped.
+ * Returns NULL on errors.
+ */
+static char* read_all(int fd, size_t* len) {
+    size_t sz  = BATCH_BUF_SZ;
+    char* data = malloc(sz);
+    if (data == NULL)
+        return NULL;
+
+    *len = 0;
+    for (;;) {
+        if (*len == sz) {
+            sz *= 2;
+            char* bigger = realloc(data, sz);
+            if (bigger == NULL) {
+                free(data);
+                return NULL;
+            }
+            data = bigger;
+        }
+
+        const ssize_t got = read(fd, &data[*len], sz - *len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0) {
+            free(data);
+            return NULL;
+        }
+        if (got == 0)
+            return data;
+        *len += got;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Parallel jobs */
+
+/*
+ * The range of a worker is stored in a single integer, so it can be modified
+ * atomically by its owner and by the thieves: the first chunk is in the high
+ * half, and the chunk after the last one in the low half.
+ */
+static inline uint64_t range_pack(uint32_t first, uint32_t end) {
+    return (uint64_t)first << 32 | end;
+}
+
+static inline uint32_t range_first(uint64_t range) {
+    return range >> 32;
+}
+
+static inline uint32_t range_end(uint64_t range) {
+    return range & 0xFFFFFFFF;
+}
+
+/*
+ * Take the first chunk from the range of 'worker', which doesn't need to be
+ * the caller. Returns -1 if the range is empty.
+ */
+static int take_chunk(Worker* worker) {
+    uint64_t range = __atomic_load_n(&worker->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        const uint32_t first = range_first(range);
+        const uint32_t end   = range_end(range);
+        if (first >= end)
+            return -1;
+
+        if (__atomic_compare_exchange_n(&worker->range,
+                                        &range,
+                                        range_pack(first + 1, end),
+                                        false,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            return first;
+    }
+}
+
+/*
+ * Move the second half of the biggest range of the other workers to the range
+ * of 'thief', which should be empty. Returns false if there was nothing left.
+ */
+static bool steal_chunks(Worker* thief) {
+    Job* job = thief->job;
+    for (;;) {
+        Worker* victim  = NULL;
+        uint64_t range  = 0;
+        uint32_t amount = 0;
+        for (int i = 0; i < job->workers_num; i++) {
+            Worker* worker    = &job->workers[i];
+            const uint64_t r  = __atomic_load_n(&worker->range,
+                                                __ATOMIC_ACQUIRE);
+            const uint32_t sz = range_end(r) - range_first(r);
+            if (worker != thief && range_first(r) < range_end(r) &&
+                sz > amount) {
+                victim = worker;
+                range  = r;
+                amount = sz;
+            }
+        }
+        if (victim == NULL)
+            return false;
+
+        /* Leave the first half to the victim, who is working on it */
+        const uint32_t end   = range_end(range);
+        const uint32_t first = end - (amount + 1) / 2;
+        if (__atomic_compare_exchange_n(&victim->range,
+                                        &range,
+                                        range_pack(range_first(range), first),
+                                        false,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&thief->range,
+                             range_pack(first, end),
+                             __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+}
+
+/*
+ * Classify the records of a chunk, with the same results as 'batch_run' when
+ * reading them sequentially.
+ */
+static void classify_chunk(Worker* worker, Chunk* chunk) {
+    const Job* job    = worker->job;
+    const char* start = &job->data[chunk->off];
+    const char* end   = start + chunk->len;
+
+    while (start < end) {
+        const char* record_end = memchr(start, job->delim, end - start);
+        const bool terminated  = (record_end != NULL);
+        if (!terminated)
+            record_end = end;
+
+        /* Records that wouldn't fit in the buffer of 'batch_run' */
+        const size_t len = record_end - start;
+        if (len >= BATCH_BUF_SZ) {
+            if (worker->pending != NULL)
+                pending_flush(worker->pending, worker->rules, &chunk->out);
+            output_no_match(&chunk->out, job->delim);
+        } else if (terminated || len > 0) {
+            memcpy(worker->record, start, len);
+            worker->record[len] = '\0';
+            process_record(worker->rules,
+                           &chunk->out,
+                           worker->pending,
+                           worker->record,
+                           job->delim,
+                           job->reference);
+        }
+
+        start = record_end + 1;
+    }
+
+    if (worker->pending != NULL)
+        pending_flush(worker->pending, worker->rules, &chunk->out);
+}
+
+static void extract_chunk(Worker* worker, Chunk* chunk) {
+    const Job* job   = worker->job;
+    const char* text = &job->data[chunk->off];
+
+    Extractor* ex = &worker->extractor;
+    extract_init(ex, worker->rules, text, chunk->len);
+
+    ExtractSpan span;
+    while (extract_next(ex, &span)) {
+        const char* span_text = &text[span.off];
+        const size_t off      = chunk->off + span.off;
+        if (worker->pending != NULL)
+            pending_add(worker->pending, worker->rules, &chunk->out,
+                        span_text, off, span.len, span.rule);
+        else
+            output_span(worker->rules, &chunk->out, span_text, off, span.len,
+                        span.rule);
+    }
+
+    if (worker->pending != NULL)
+        pending_flush(worker->pending, worker->rules, &chunk->out);
+}
+
+/*
+ * Process chunks until there are none left, first from the range of the
+ * worker, and then from the other ones.
+ */
+static void* worker_main(void* arg) {
+    Worker* worker = arg;
+    Job* job       = worker->job;
+
+    do {
+        int idx;
+        while ((idx = take_chunk(worker)) >= 0) {
+            if (job->extract)
+                extract_chunk(worker, &job->chunks[idx]);
+            else
+                classify_chunk(worker, &job->chunks[idx]);
+        }
+    } while (steal_chunks(worker));
+
+    return NULL;
+}
+
+/*
+ * Split the input after 'off' in chunks, until there are 'job->chunks_num' of
+ * them or until the end of the input. Returns the number of chunks.
+ */
+static int split_chunks(Job* job, size_t off) {
+    const char delim = job->extract ? '\n' : job->delim;
+
+    int num = 0;
+    while (num < job->chunks_num && off < job->len) {
+        size_t end = off + BATCH_CHUNK_SZ;
+        if (end >= job->len) {
+            end = job->len;
+        } else {
+            const char* next =
+              memchr(&job->data[end], delim, job->len - end);
+            end = (next == NULL) ? job->len : (size_t)(next - job->data) + 1;
+        }
+
+        Chunk* chunk   = &job->chunks[num++];
+        chunk->off     = off;
+        chunk->len     = end - off;
+        chunk->out.len = 0;
+        chunk->out.ok  = true;
+        off            = end;
+    }
+
+    return num;
+}
+
+/*
+ * Process the whole input of the job in windows, writing the output of the
+ * chunks to 'out_fd' in order. Returns false on errors.
+ */
+static bool job_run(Job* job, int out_fd) {
+    bool ok    = true;
+    size_t off = 0;
+    while (ok && off < job->len) {
+        const int num = split_chunks(job, off);
+        off           = job->chunks[num - 1].off + job->chunks[num - 1].len;
+
+        /* Give the same amount of consecutive chunks to each worker */
+        for (int i = 0; i < job->workers_num; i++) {
+            const uint32_t first = (uint64_t)num * i / job->workers_num;
+            const uint32_t end = (uint64_t)num * (i + 1) / job->workers_num;
+            job->workers[i].range = range_pack(first, end);
+        }
+
+        /*
+         * If a thread can't be created, the rest of the workers will steal its
+         * chunks, so it's not a problem.
+         */
+        pthread_t threads[BATCH_MAX_JOBS];
+        bool started[BATCH_MAX_JOBS];
+        for (int i = 1; i < job->workers_num; i++)
+            started[i] = pthread_create(&threads[i],
+                                        NULL,
+                                        worker_main,
+                                        &job->workers[i]) == 0;
+        worker_main(&job->workers[0]);
+        for (int i = 1; i < job->workers_num; i++)
+            if (started[i])
+                pthread_join(threads[i], NULL);
+
+        for (int i = 0; i < num && ok; i++) {
+            const Output* out = &job->chunks[i].out;
+            if (!out->ok) {
+                ok = false;
+            } else if (!write_all(out_fd, out->buf, out->len)) {
+                ERR("Could not write output: %s", strerror(errno));
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+/*
+ * Process the 'len' bytes of 'data' with 'jobs' threads, the first of them
+ * using 'rules'. If 'existing' is true, the files are checked before writing
+ * the output, see 'pending_flush'. See 'job_run'.
+ */
+static bool run_parallel(RuleSet* rules, const char* data, size_t len,
+                         int out_fd, bool extract, char delim, bool reference,
+                         bool existing, int jobs) {
+    if (len == 0)
+        return true;
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > BATCH_MAX_JOBS)
+        jobs = BATCH_MAX_JOBS;
+
+    Job job = {
+        .data        = data,
+        .len         = len,
+        .extract     = extract,
+        .delim       = delim,
+        .reference   = reference,
+        .chunks_num  = jobs * BATCH_CHUNKS_PER_JOB,
+        .workers_num = jobs,
+    };
+
+    job.chunks  = calloc(job.chunks_num, sizeof(Chunk));
+    job.workers = calloc(job.workers_num, sizeof(Worker));
+    if (job.chunks == NULL || job.workers == NULL) {
+        ERR("Could not allocate the parallel job.");
+        free(job.chunks);
+        free(job.workers);
+        return false;
+    }
+    for (int i = 0; i < job.chunks_num; i++)
+        job.chunks[i].out.fd = -1;
+
+    bool ok = true;
+    int workers_ready;
+    for (workers_ready = 0; workers_ready < job.workers_num; workers_ready++) {
+        Worker* worker = &job.workers[workers_ready];
+        worker->job    = &job;
+        worker->rules  = rules;
+        if (workers_ready > 0) {
+            if (!ruleset_load(&worker->own_rules, rules->path)) {
+                ok = false;
+                break;
+            }
+            worker->rules = &worker->own_rules;
+        }
+
+        if (!extract) {
+            worker->record = malloc(BATCH_BUF_SZ + 1);
+            if (worker->record == NULL) {
+                ERR("Could not allocate the record buffer.");
+                workers_ready++;
+                ok = false;
+                break;
+            }
+        }
+
+        if (existing) {
+            worker->pending = pending_new(extract, delim);
+            if (worker->pending == NULL) {
+                ERR("Could not allocate the pending decisions.");
+                workers_ready++;
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    if (ok)
+        ok = job_run(&job, out_fd);
+
+    for (int i = 0; i < workers_ready; i++) {
+        if (i > 0)
+            ruleset_free(&job.workers[i].own_rules);
+        free(job.workers[i].record);
+        pending_free(job.workers[i].pending);
+    }
+    for (int i = 0; i < job.chunks_num; i++)
+        free(job.chunks[i].out.buf);
+    free(job.chunks);
+    free(job.workers);
+    return ok;
+}
+
+/*
+ * Map the regular file 'fd' in memory. Returns NULL on errors, or if the file
+ * is empty or not a regular file.
+ */
+static char* map_file(int fd, size_t* len) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return NULL;
+
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+    *len = st.st_size;
+    return data;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int batch_default_jobs(void) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    return (cpus > BATCH_MAX_JOBS) ? BATCH_MAX_JOBS : (int)cpus;
+}
+
+bool batch_run(RuleSet* rules, int in_fd, int out_fd, char delim,
+               bool reference, bool existing, int jobs) {
+    /* Regular files are split in chunks, see 'run_parallel' */
+    size_t mapped_len;
+    char* mapped = map_file(in_fd, &mapped_len);
+    if (mapped != NULL) {
+        const bool ok = run_parallel(rules,
+                                     mapped,
+                                     mapped_len,
+                                     out_fd,
+                                     false,
+                                     delim,
+                                     reference,
+                                     existing,
+                                     jobs);
+        munmap(mapped, mapped_len);
+        return ok;
+    }
+
+    Pending* pending = NULL;
+    if (existing) {
+        pending = pending_new(false, delim);
+        if (pending == NULL) {
+            ERR("Could not allocate the pending decisions.");
+            return false;
+        }
+    }
+
+    /* Extra byte for terminating the last record */
+    static char in[BATCH_BUF_SZ + 1];
+    static char out_buf[BATCH_BUF_SZ];
+    Output out = {
+        .fd  = out_fd,
+        .ok  = true,
+        .buf = out_buf,
+        .len = 0,
+        .sz  = sizeof(out_buf),
+    };
+
+    size_t len    = 0;
+    bool skipping = false;
+    for (;;) {
+        /*
+         * The files of the records that were read at once are checked at
+         * once, before waiting for more.
+         */
+        if (pending != NULL)
+            pending_flush(pending, rules, &out);
+
+        const ssize_t got = read(in_fd, &in[len], BATCH_BUF_SZ - len);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            ERR("Could not read input: %s", strerror(errno));
+            output_flush(&out);
+            pending_free(pending);
+            return false;
+        }
+        len += got;
+
+        /* Process all the complete records in the buffer */
+        char* start     = in;
+        char* const end = &in[len];
+        char* record_end;
+        while ((record_end = memchr(start, delim, end - start)) != NULL) {
+            *record_end = '\0';
+            if (skipping)
+                output_no_match(&out, delim);
+            else
+                process_record(rules, &out, pending, start, delim, reference);
+            skipping = false;
+            start    = record_end + 1;
+        }
+
+        size_t remaining = end - start;
+        if (got == 0) {
+            /* Last record, without a terminator */
+            *end = '\0';
+            if (skipping)
+                output_no_match(&out, delim);
+            else if (remaining > 0)
+                process_record(rules, &out, pending, start, delim, reference);
+            break;
+        }
+
+        /* The record doesn't fit in the buffer, ignore the rest of it */
+        if (remaining == BATCH_BUF_SZ) {
+            skipping  = true;
+            remaining = 0;
+        }
+
+        memmove(in, start, remaining);
+        len = remaining;
+    }
+
+    if (pending != NULL)
+        pending_flush(pending, rules, &out);
+    pending_free(pending);
+    output_flush(&out);
+    return out.ok;
+}
+
+bool batch_extract(RuleSet* rules, const char* path, int out_fd,
+                   bool existing, int jobs) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ERR("Could not open '%s': %s", path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ERR("Could not stat '%s': %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    /* Empty files can't be mapped, but there is nothing to do anyway */
+    size_t len   = 0;
+    char* mapped = NULL;
+    char* data   = NULL;
+    if (S_ISREG(st.st_mode)) {
+        mapped = map_file(fd, &len);
+        if (mapped == NULL && st.st_size > 0) {
+            ERR("Could not map '%s': %s", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+    } else {
+        data = read_all(fd, &len);
+        if (data == NULL) {
+            ERR("Could not read '%s': %s", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+
+    const bool ok = run_parallel(rules,
+                                 (mapped != NULL) ? mapped : data,
+                                 len,
+                                 out_fd,
+                                 true,
+                                 '\n',
+                                 false,
+                                 existing,
+                                 jobs);
+
+    if (mapped != NULL)
+        munmap(mapped, len);
+    free(data);
+    return ok;
+}
+
+char** batch_read_records(int in_fd, char delim, int* num) {
+    size_t len;
+    char* data = read_all(in_fd, &len);
+    if (data == NULL)
+        return NULL;
+
+    /* The last record might not be terminated, so there is one more */
+    int max = 1;
+    for (size_t i = 0; i < len; i++)
+        if (data[i] == delim)
+            max++;
+
+    const size_t strs_off = (max + 1) * sizeof(char*);
+    char** records        = malloc(strs_off + len + 1);
+    if (records == NULL) {
+        free(data);
+        return NULL;
+    }
+    char* strs = (char*)records + strs_off;
+    memcpy(strs, data, len);
+    strs[len] = delim;
+    free(data);
+
+    *num = 0;
+    for (char *start = strs, *end; start <= &strs[len]; start = end + 1) {
+        end  = memchr(start, delim, &strs[len] + 1 - start);
+        *end = '\0';
+        if (end > start)
+            records[(*num)++] = start;
+    }
+    records[*num] = NULL;
+    return records;
+}
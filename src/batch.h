@@ -0,0 +1,72 @@
+
+#ifndef BATCH_H_
+#define BATCH_H_ 1
+
+#include <stdbool.h>
+
+#include "rules.h"
+
+/*
+ * Size of the input and output buffers. Records longer than this are not
+ * classified.
+ */
+#define BATCH_BUF_SZ (1024 * 1024)
+
+/*
+ * Inputs that can be mapped in memory are split in chunks of at least this
+ * size, which are processed in parallel. The output of BATCH_CHUNKS_PER_JOB
+ * chunks per thread is kept in memory before writing it, in order.
+ */
+#define BATCH_CHUNK_SZ       (1024 * 1024)
+#define BATCH_CHUNKS_PER_JOB 8
+#define BATCH_MAX_JOBS       256
+
+/*
+ * Return the number of threads that should be used by default, one for each
+ * online processor.
+ */
+int batch_default_jobs(void);
+
+/*
+ * Read records terminated by 'delim' from 'in_fd', and write one decision for
+ * each of them to 'out_fd', without launching anything. Each decision is the
+ * name of the matched rule and the argument vector that would be executed,
+ * separated by tabs and terminated by 'delim'; or just "-" if no rule matched.
+ *
+ * If 'reference' is true, 'ruleset_match_reference' is used for matching.
+ * If 'existing' is true, the records that would open a local file (see
+ * 'rule_kind_path_len') are written as "-" unless it's an existing regular
+ * file, relative to the current directory. The files are checked in batches,
+ * see "statcache.h".
+ *
+ * If 'in_fd' is a regular file, it's mapped in memory and classified by 'jobs'
+ * threads, each of them with its own copy of the rule set; the output is the
+ * same as with a single thread. Returns false on I/O errors.
+ */
+bool batch_run(RuleSet* rules, int in_fd, int out_fd, char delim,
+               bool reference, bool existing, int jobs);
+
+/*
+ * Read every record terminated by 'delim' from 'in_fd', for opening them at
+ * once instead of classifying them with 'batch_run'. Returns a vector of the
+ * non-empty records, terminated by NULL, whose number is stored in 'num'; or
+ * NULL on errors. The vector and the records are a single allocation, so they
+ * should be freed with a single call to free(3).
+ */
+char** batch_read_records(int in_fd, char delim, int* num);
+
+/*
+ * Write every span of the file at 'path' that matches a rule to 'out_fd', in
+ * the order they appear. Each span is written as its byte offset, length, the
+ * name of the matched rule and its text, separated by tabs and terminated by a
+ * newline. See 'extract_next'. If 'existing' is true, the spans that open a
+ * file that doesn't exist are omitted, just like in 'batch_run'.
+ *
+ * Regular files are mapped in memory instead of being read, so they can be
+ * bigger than the available memory. The file is scanned by 'jobs' threads, just
+ * like in 'batch_run'. Returns false on I/O errors.
+ */
+bool batch_extract(RuleSet* rules, const char* path, int out_fd,
+                   bool existing, int jobs);
+
+#endif /* BATCH_H_ */
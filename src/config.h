@@ -6,7 +6,7 @@
 #define CMD_IMAGE   "nsxiv"
 #define CMD_VIDEO   "mpv"
 
-/* These programs will be launched in another st instance. See ST_LAUNCH() */
+/* These programs will be launched in another st instance. See launch_argv() */
 #define CMD_EDITOR "nvim"
 #define CMD_MAN    "man"
 
@@ -19,10 +19,22 @@
 #define REGEX_URL     "^https?://.+"
 #define REGEX_PDF     REGEX_EXTENSION("pdf")
 #define REGEX_MAN     "^[a-zA-Z0-9_-]+\\([0-9]\\)$"
-#define REGEX_LINECOL "^.+:[0-9]+.*"
+#define REGEX_LINECOL "^([^:]+):([0-9]+)(:([0-9]+))?.*"
+#define REGEX_MSVC    "^([^(]*\\.[^(]*)\\(([0-9]+)(,([0-9]+))?\\).*"
+
+/*
+ * Arguments for CMD_EDITOR with REGEX_LINECOL and REGEX_MSVC, whose first group
+ * is the file, the second one is the line, and the fourth one is the column.
+ * See launch_argv() for the syntax.
+ */
+static const char* linecol_args[] = {
+    "$1",
+    "+call cursor($2,${4:-0})",
+    NULL,
+};
 
 /* Regex patterns of filenames used with CMD_EDITOR */
-const char* editor_patterns[] = {
+static const char* editor_patterns[] = {
     REGEX_EXTENSION("c"),
     REGEX_EXTENSION("h"),
     REGEX_EXTENSION("cpp"),
@@ -42,7 +54,7 @@ const char* editor_patterns[] = {
 };
 
 /* Regex patterns of filenames used with CMD_IMAGE */
-const char* image_patterns[] = {
+static const char* image_patterns[] = {
     REGEX_EXTENSION("png"),
     REGEX_EXTENSION("jpg"),
     REGEX_EXTENSION("jpeg"),
@@ -55,7 +67,7 @@ const char* image_patterns[] = {
 };
 
 /* Regex patterns of filenames used with CMD_VIDEO */
-const char* video_patterns[] = {
+static const char* video_patterns[] = {
     REGEX_EXTENSION("mp4"),
     REGEX_EXTENSION("mkv"),
     REGEX_EXTENSION("avi"),
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* shm_open, O_CLOEXEC, clock_gettime */
+
+#include "decisions.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Version of the layout of the table, and of the matching semantics. It's part
+ * of the name of the shared object, so different versions of the program don't
+ * share their tables.
+ */
+#define DECISIONS_VERSION 3
+
+/*----------------------------------------------------------------------------*/
+
+static uint64_t hash_key(const char* str, size_t len) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)str[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+/*
+ * Checksum of an entry, see 'DecisionSlot'. The fields are hashed in the same
+ * way as the key, after it.
+ */
+static uint32_t slot_check(uint64_t rules_hash, int32_t rule, const char* str,
+                           size_t len) {
+    const uint64_t fields[] = { rules_hash, (uint32_t)rule, len };
+
+    uint64_t hash = hash_key(str, len);
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        for (int j = 0; j < 64; j += 8)
+            hash = (hash ^ ((fields[i] >> j) & 0xFF)) * 0x100000001B3ULL;
+    return hash ^ (hash >> 32);
+}
+
+/*
+ * Seconds of CLOCK_MONOTONIC, which is the same for every process, and doesn't
+ * jump when the time of the system is changed.
+ */
+static uint32_t now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+/*----------------------------------------------------------------------------*/
+
+DecisionTable* decisions_open(void) {
+    char name[DECISIONS_NAME_SZ];
+    snprintf(name, sizeof(name), "/plumber-decisions-%d-%d",
+             DECISIONS_VERSION, (int)getuid());
+
+    /* The new object is filled with zeros, so it's an empty table */
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size < sizeof(DecisionTable) &&
+         ftruncate(fd, sizeof(DecisionTable)) != 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    DecisionTable* table = mmap(NULL, sizeof(DecisionTable),
+                                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (table == MAP_FAILED) ? NULL : table;
+}
+
+void decisions_close(DecisionTable* table) {
+    if (table != NULL)
+        munmap(table, sizeof(DecisionTable));
+}
+
+bool decisions_lookup(const DecisionTable* table, uint64_t rules_hash,
+                      const char* str, size_t len, int* rule) {
+    if (len > DECISIONS_KEY_SZ)
+        return false;
+
+    const uint64_t hash      = hash_key(str, len);
+    const DecisionSlot* slot = &table->slots[hash % DECISIONS_SLOTS];
+
+    const uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+        return false;
+
+    /*
+     * The slot might be overwritten while we read it, in which case 'seq'
+     * changes and the result is discarded. The key is compared in place,
+     * since a torn read can only make it differ. A writer whose slot was taken
+     * over can still be writing it without changing 'seq', so the entry is
+     * also checked against its checksum.
+     */
+    const bool same = slot->tag == (uint32_t)(hash >> 32) &&
+                      slot->len == len && slot->rules_hash == rules_hash &&
+                      memcmp(slot->key, str, len) == 0;
+    const int32_t result = slot->rule;
+    const uint32_t check = slot->check;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!same || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq ||
+        check != slot_check(rules_hash, result, str, len))
+        return false;
+
+    *rule = result;
+    return true;
+}
+
+void decisions_store(DecisionTable* table, uint64_t rules_hash,
+                     const char* str, size_t len, int rule) {
+    if (len > DECISIONS_KEY_SZ)
+        return;
+
+    const uint64_t hash = hash_key(str, len);
+    DecisionSlot* slot  = &table->slots[hash % DECISIONS_SLOTS];
+
+    /*
+     * Claim the slot by making 'seq' odd, along with the current time. If
+     * someone else is writing it, skip it, unless the writer claimed it too
+     * long ago; then, it probably died while writing, and the slot would be
+     * skipped forever, so take it over with the next odd value. A writer that
+     * was only stopped for that long might still write the slot after it was
+     * released, so the checksum is written last, and readers ignore the slot
+     * until it matches the rest of the entry again.
+     */
+    const uint32_t now     = now_sec();
+    uint64_t seq           = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    const uint32_t counter = (uint32_t)seq;
+    if ((counter & 1) && now - (uint32_t)(seq >> 32) < DECISIONS_STALE_SEC)
+        return;
+
+    const uint32_t claimed = (counter & 1) ? counter + 2 : counter + 1;
+    uint64_t claim         = DECISIONS_CLAIM(claimed, now);
+    if (!__atomic_compare_exchange_n(&slot->seq, &seq, claim, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->rule       = rule;
+    slot->rules_hash = rules_hash;
+    slot->tag        = hash >> 32;
+    slot->len        = len;
+    memcpy(slot->key, str, len);
+    slot->check = slot_check(rules_hash, rule, str, len);
+
+    /* Unless the slot was taken over, since we were stopped for too long */
+    __atomic_compare_exchange_n(&slot->seq, &claim, claimed + 1, false,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,93 @@
+
+#ifndef DECISIONS_H_
+#define DECISIONS_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of strings whose rule is remembered, see 'DecisionTable' */
+#define DECISIONS_SLOTS 1024
+
+/* Maximum length of the strings that can be remembered */
+#define DECISIONS_KEY_SZ 224
+
+/*
+ * Seconds after which a slot that is still being written is assumed to belong
+ * to a process that died while writing it, so it can be taken over.
+ */
+#define DECISIONS_STALE_SEC 2
+
+/* Value of 'DecisionSlot.seq' while it's claimed by a writer */
+#define DECISIONS_CLAIM(COUNTER, SEC) \
+    (((uint64_t)(SEC) << 32) | (uint32_t)(COUNTER))
+
+/* Size of the buffers for the name of the shared memory object */
+#define DECISIONS_NAME_SZ 64
+
+/*
+ * Slot of a 'DecisionTable'. The counter in the low 32 bits of 'seq' is odd
+ * while the slot is being written, and it changes after each write, so readers
+ * can detect that they read a slot while it was being written (see
+ * 'decisions_lookup'). While it's odd, the high 32 bits are the time when the
+ * writer claimed the slot, in seconds of CLOCK_MONOTONIC.
+ *
+ * A writer whose slot was taken over (see 'decisions_store') might still be
+ * writing it after 'seq' is even again, so 'check' is a checksum of the rest of
+ * the entry, written last, and readers ignore the entries that don't match it.
+ */
+typedef struct DecisionSlot {
+    uint64_t seq;
+    uint64_t rules_hash; /* See 'ruleset_hash' */
+    int32_t rule;
+    uint32_t tag; /* High 32 bits of the hash of the key */
+    uint32_t len;
+    uint32_t check; /* Of 'rules_hash', 'rule', 'len' and 'key' */
+    char key[DECISIONS_KEY_SZ];
+} DecisionSlot;
+
+/*
+ * Rules matched by some recent strings, shared by all the processes of the user
+ * through a small table in shared memory (see shm_overview(7)). The slot of a
+ * string is its hash modulo DECISIONS_SLOTS, and it's replaced by the last
+ * string with the same slot, so the table never grows.
+ *
+ * The table is read and written without locks, and each slot is written by a
+ * single process at a time; the others skip it until the write is finished. If
+ * a writer doesn't finish in DECISIONS_STALE_SEC, e.g. because it was killed,
+ * the next writer takes the slot over, so it isn't skipped forever.
+ */
+typedef struct DecisionTable {
+    DecisionSlot slots[DECISIONS_SLOTS];
+} DecisionTable;
+
+/*
+ * Map the table of the user in memory, creating it if necessary. Returns NULL
+ * on errors. The table should be closed with 'decisions_close'.
+ */
+DecisionTable* decisions_open(void);
+
+/*
+ * Unmap a table opened with 'decisions_open'.
+ */
+void decisions_close(DecisionTable* table);
+
+/*
+ * Look up the rule that matched the 'len' bytes of 'str' in the rule set whose
+ * hash is 'rules_hash', and store it in '*rule', which might be -1 if none of
+ * them matched. Returns false if the string is not in the table, or if it's
+ * being written, or if its checksum doesn't match.
+ */
+bool decisions_lookup(const DecisionTable* table, uint64_t rules_hash,
+                      const char* str, size_t len, int* rule);
+
+/*
+ * Remember that the 'len' bytes of 'str' matched 'rule' in the rule set whose
+ * hash is 'rules_hash'. Strings longer than DECISIONS_KEY_SZ are ignored, and
+ * so are the slots that are being written by other processes, unless they were
+ * claimed more than DECISIONS_STALE_SEC ago.
+ */
+void decisions_store(DecisionTable* table, uint64_t rules_hash,
+                     const char* str, size_t len, int rule);
+
+#endif /* DECISIONS_H_ */
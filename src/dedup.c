@@ -0,0 +1,157 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* shm_open, clock_gettime */
+
+#include "dedup.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Size of the buffer for the current directory, if 'cwd' is NULL */
+#define CWD_SZ 4096
+
+/*
+ * Table of recent launches, shared by all the processes of the user. Each slot
+ * contains the high 32 bits of the hash of a command, and the low 32 bits of
+ * the monotonic time when it was launched, in milliseconds. The slot of a
+ * command is its hash modulo DEDUP_SLOTS.
+ */
+typedef struct DedupTable {
+    uint64_t slots[DEDUP_SLOTS];
+} DedupTable;
+
+/* Table mapped by 'get_table', which is kept until the process exits */
+static DedupTable* g_table = NULL;
+
+/*----------------------------------------------------------------------------*/
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t len) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+/*
+ * FNV-1a hash of the directory and the arguments, including their terminating
+ * null bytes, so different splits of the same text are different commands.
+ */
+static uint64_t hash_launch(const char* cwd, const char* const* argv) {
+    uint64_t hash = hash_bytes(0xCBF29CE484222325, cwd, strlen(cwd) + 1);
+    for (int i = 0; argv[i] != NULL; i++)
+        hash = hash_bytes(hash, argv[i], strlen(argv[i]) + 1);
+    return hash;
+}
+
+static uint32_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * Map the shared table in memory, creating it if necessary. Returns NULL on
+ * errors.
+ */
+static DedupTable* get_table(void) {
+    DedupTable* table = __atomic_load_n(&g_table, __ATOMIC_ACQUIRE);
+    if (table != NULL)
+        return table;
+
+    char name[DEDUP_NAME_SZ];
+    snprintf(name, sizeof(name), "/plumber-launches-%d", (int)getuid());
+
+    /* The new object is filled with zeros, so it's an empty table */
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size < sizeof(DedupTable) &&
+         ftruncate(fd, sizeof(DedupTable)) != 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    table = mmap(NULL, sizeof(DedupTable), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+    close(fd);
+    if (table == MAP_FAILED)
+        return NULL;
+
+    /* Another thread might have mapped it first */
+    DedupTable* expected = NULL;
+    if (!__atomic_compare_exchange_n(&g_table, &expected, table, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(table, sizeof(DedupTable));
+        table = expected;
+    }
+
+    return table;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool dedup_check(const char* cwd, const char* const* argv, uint32_t window_ms) {
+    if (window_ms == 0)
+        return false;
+
+    char cwd_buf[CWD_SZ];
+    if (cwd == NULL)
+        cwd = (getcwd(cwd_buf, sizeof(cwd_buf)) != NULL) ? cwd_buf : "";
+
+    DedupTable* table = get_table();
+    if (table == NULL)
+        return false;
+
+    const uint64_t hash = hash_launch(cwd, argv);
+    const uint32_t tag  = hash >> 32;
+    const uint32_t now  = now_ms();
+    uint64_t* slot      = &table->slots[hash % DEDUP_SLOTS];
+
+    /*
+     * Two clicks can arrive at the same time, so the slot is checked and
+     * replaced at once; only the process that replaces it launches the command.
+     * The times wrap around every 49 days, but only their difference is used.
+     */
+    uint64_t old = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    do {
+        const uint32_t old_tag  = old >> 32;
+        const uint32_t old_time = old & 0xFFFFFFFF;
+        if (old != 0 && old_tag == tag &&
+            (uint32_t)(now - old_time) < window_ms)
+            return true;
+    } while (!__atomic_compare_exchange_n(slot, &old,
+                                          ((uint64_t)tag << 32) | now, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return false;
+}
@@ -0,0 +1,28 @@
+
+#ifndef DEDUP_H_
+#define DEDUP_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of recent launches remembered, see 'dedup_check' */
+#define DEDUP_SLOTS 64
+
+/* Size of the buffers for the name of the shared memory object */
+#define DEDUP_NAME_SZ 64
+
+/*
+ * Check if the command in 'argv' was launched from the 'cwd' directory (or
+ * from the current one, if NULL) in the last 'window_ms' milliseconds, by any
+ * process of the user. Otherwise, the launch is recorded, and false is
+ * returned.
+ *
+ * The recent launches are stored in a small table in shared memory (see
+ * shm_overview(7)), where each command is identified by a hash. Different
+ * commands with the same hash are only confused within the same window, and
+ * the table is updated atomically, so it can be used by multiple processes and
+ * threads at once. If the table can't be opened, always returns false.
+ */
+bool dedup_check(const char* cwd, const char* const* argv, uint32_t window_ms);
+
+#endif /* DEDUP_H_ */
@@ -0,0 +1,919 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "dfa.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+
+#include "util.h"
+
+/*
+ * Maximum number of NFA nodes. Bounded repetitions like "a{2,200}" are
+ * expanded, so they can easily reach this limit.
+ */
+#define MAX_NODES 16384
+
+/*
+ * Maximum value in bounded repetitions, just like RE_DUP_MAX in regcomp(3).
+ */
+#define MAX_REPEAT 255
+
+/* Flags for 'closure' */
+#define CLOSURE_BOL 0x1 /* We are at the start of the input */
+#define CLOSURE_EOL 0x2 /* We are at the end of the input */
+
+typedef struct Frag {
+    int start, end; /* The 'end' is always a DFANODE_EPS with no 'out' */
+} Frag;
+
+typedef struct Parser {
+    Dfa* dfa;
+    const char* pat;
+    size_t pos;
+    bool ok;
+} Parser;
+
+/*----------------------------------------------------------------------------*/
+/* Memory helpers */
+
+/*
+ * Make sure that '*arr' has room for at least 'num' elements of 'elem_sz'
+ * bytes, updating '*sz'. Returns false on allocation errors.
+ */
+static bool reserve(void* arr, int* sz, int num, size_t elem_sz) {
+    void** parr = arr;
+    if (num <= *sz)
+        return true;
+
+    int new_sz = (*sz > 0) ? *sz : 16;
+    while (new_sz < num)
+        new_sz *= 2;
+
+    void* tmp = realloc(*parr, (size_t)new_sz * elem_sz);
+    if (tmp == NULL)
+        return false;
+
+    *parr = tmp;
+    *sz   = new_sz;
+    return true;
+}
+
+static inline bool set_has(const DfaSet* set, int c) {
+    return set->bits[c / 32] & (1u << (c % 32));
+}
+
+static inline void set_add(DfaSet* set, int c) {
+    set->bits[c / 32] |= 1u << (c % 32);
+}
+
+/*----------------------------------------------------------------------------*/
+/* NFA construction */
+
+static int new_node(Parser* p, int type) {
+    Dfa* dfa = p->dfa;
+    if (dfa->nodes_num >= MAX_NODES ||
+        !reserve(&dfa->nodes, &dfa->nodes_sz, dfa->nodes_num + 1,
+                 sizeof(DfaNode))) {
+        p->ok = false;
+        return -1;
+    }
+
+    DfaNode* node = &dfa->nodes[dfa->nodes_num];
+    node->type    = type;
+    node->out     = -1;
+    node->out1    = -1;
+    node->set     = -1;
+    node->id      = -1;
+    return dfa->nodes_num++;
+}
+
+static Frag frag_empty(Parser* p) {
+    const int node = new_node(p, DFANODE_EPS);
+    return (Frag){ node, node };
+}
+
+static Frag frag_single(Parser* p, int type) {
+    Frag ret;
+    ret.start = new_node(p, type);
+    ret.end   = new_node(p, DFANODE_EPS);
+    if (p->ok)
+        p->dfa->nodes[ret.start].out = ret.end;
+    return ret;
+}
+
+/*
+ * Create a fragment that consumes a single byte from 'set', adding the other
+ * case of each letter, since all patterns are case-insensitive.
+ */
+static Frag frag_set(Parser* p, const DfaSet* set, bool negate) {
+    Dfa* dfa = p->dfa;
+    if (!reserve(&dfa->sets, &dfa->sets_sz, dfa->sets_num + 1,
+                 sizeof(DfaSet))) {
+        p->ok = false;
+        return (Frag){ -1, -1 };
+    }
+
+    DfaSet* folded = &dfa->sets[dfa->sets_num];
+    memset(folded, 0, sizeof(DfaSet));
+    for (int c = 0; c < 256; c++) {
+        if (set_has(set, c)) {
+            set_add(folded, tolower(c));
+            set_add(folded, toupper(c));
+        }
+    }
+
+    if (negate) {
+        for (int i = 0; i < LENGTH(folded->bits); i++)
+            folded->bits[i] = ~folded->bits[i];
+
+        /* Strings can't contain null bytes */
+        folded->bits[0] &= ~1u;
+    }
+
+    Frag ret = frag_single(p, DFANODE_CHAR);
+    if (p->ok)
+        dfa->nodes[ret.start].set = dfa->sets_num++;
+    return ret;
+}
+
+static Frag frag_char(Parser* p, int c) {
+    DfaSet set = { { 0 } };
+    set_add(&set, c);
+    return frag_set(p, &set, false);
+}
+
+static Frag frag_concat(Parser* p, Frag a, Frag b) {
+    if (!p->ok)
+        return a;
+
+    p->dfa->nodes[a.end].out = b.start;
+    return (Frag){ a.start, b.end };
+}
+
+static Frag frag_alt(Parser* p, Frag a, Frag b) {
+    const int split = new_node(p, DFANODE_SPLIT);
+    const int end   = new_node(p, DFANODE_EPS);
+    if (!p->ok)
+        return a;
+
+    p->dfa->nodes[split].out  = a.start;
+    p->dfa->nodes[split].out1 = b.start;
+    p->dfa->nodes[a.end].out  = end;
+    p->dfa->nodes[b.end].out  = end;
+    return (Frag){ split, end };
+}
+
+static Frag frag_star(Parser* p, Frag a) {
+    const int split = new_node(p, DFANODE_SPLIT);
+    const int end   = new_node(p, DFANODE_EPS);
+    if (!p->ok)
+        return a;
+
+    p->dfa->nodes[split].out  = a.start;
+    p->dfa->nodes[split].out1 = end;
+    p->dfa->nodes[a.end].out  = split;
+    return (Frag){ split, end };
+}
+
+static Frag frag_plus(Parser* p, Frag a) {
+    const Frag star = frag_star(p, a);
+    return (Frag){ a.start, star.end };
+}
+
+static Frag frag_quest(Parser* p, Frag a) {
+    const int split = new_node(p, DFANODE_SPLIT);
+    const int end   = new_node(p, DFANODE_EPS);
+    if (!p->ok)
+        return a;
+
+    p->dfa->nodes[split].out  = a.start;
+    p->dfa->nodes[split].out1 = end;
+    p->dfa->nodes[a.end].out  = end;
+    return (Frag){ split, end };
+}
+
+/*----------------------------------------------------------------------------*/
+/* Parser */
+
+static Frag parse_alt(Parser* p, int depth);
+
+static inline char peek(const Parser* p) {
+    return p->pat[p->pos];
+}
+
+static bool parse_number(Parser* p, int* result) {
+    if (!isdigit((unsigned char)peek(p)))
+        return false;
+
+    int num = 0;
+    while (isdigit((unsigned char)peek(p))) {
+        num = num * 10 + (p->pat[p->pos++] - '0');
+        if (num > MAX_REPEAT)
+            return false;
+    }
+
+    *result = num;
+    return true;
+}
+
+/*
+ * Parse a "[:name:]" character class inside a bracket expression, starting
+ * after the "[:".
+ */
+static bool parse_class(Parser* p, DfaSet* set) {
+    static const struct {
+        const char* name;
+        int (*func)(int);
+    } classes[] = {
+        { "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+        { "upper", isupper }, { "lower", islower }, { "space", isspace },
+        { "blank", isblank }, { "punct", ispunct }, { "print", isprint },
+        { "graph", isgraph }, { "cntrl", iscntrl }, { "xdigit", isxdigit },
+    };
+
+    const char* name = &p->pat[p->pos];
+    const char* end  = strstr(name, ":]");
+    if (end == NULL)
+        return false;
+
+    for (int i = 0; i < LENGTH(classes); i++) {
+        const size_t len = strlen(classes[i].name);
+        if ((size_t)(end - name) != len || strncmp(name, classes[i].name, len))
+            continue;
+
+        for (int c = 1; c < 256; c++)
+            if (classes[i].func(c))
+                set_add(set, c);
+
+        p->pos += len + 2;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Parse a bracket expression, starting after the '['.
+ */
+static Frag parse_bracket(Parser* p) {
+    DfaSet set = { { 0 } };
+
+    const bool negate = (peek(p) == '^');
+    if (negate)
+        p->pos++;
+
+    /* A ']' right after the opening bracket is a literal */
+    bool first = true;
+    for (;;) {
+        const unsigned char c = peek(p);
+        if (c == '\0') {
+            p->ok = false;
+            return (Frag){ -1, -1 };
+        }
+
+        if (c == ']' && !first)
+            break;
+        first = false;
+
+        if (c == '[' && p->pat[p->pos + 1] == ':') {
+            p->pos += 2;
+            if (!parse_class(p, &set)) {
+                p->ok = false;
+                return (Frag){ -1, -1 };
+            }
+            continue;
+        }
+
+        /* Collating symbols and equivalence classes are not supported */
+        if (c == '[' &&
+            (p->pat[p->pos + 1] == '.' || p->pat[p->pos + 1] == '=')) {
+            p->ok = false;
+            return (Frag){ -1, -1 };
+        }
+
+        p->pos++;
+        if (peek(p) == '-' && p->pat[p->pos + 1] != ']' &&
+            p->pat[p->pos + 1] != '\0') {
+            const unsigned char last = p->pat[p->pos + 1];
+            if (last < c || last == '[') {
+                p->ok = false;
+                return (Frag){ -1, -1 };
+            }
+
+            for (int i = c; i <= last; i++)
+                set_add(&set, i);
+            p->pos += 2;
+        } else {
+            set_add(&set, c);
+        }
+    }
+
+    p->pos++;
+    return frag_set(p, &set, negate);
+}
+
+static Frag parse_atom(Parser* p, int depth) {
+    const char c = p->pat[p->pos++];
+    switch (c) {
+        case '(': {
+            Frag ret = (peek(p) == ')') ? frag_empty(p)
+                                        : parse_alt(p, depth + 1);
+            if (peek(p) != ')')
+                p->ok = false;
+            p->pos++;
+            return ret;
+        }
+
+        case '^':
+            return frag_single(p, DFANODE_BOL);
+
+        case '$':
+            return frag_single(p, DFANODE_EOL);
+
+        case '.': {
+            DfaSet set = { { 0 } };
+            return frag_set(p, &set, true);
+        }
+
+        case '[':
+            return parse_bracket(p);
+
+        case '\\': {
+            /*
+             * Only escaped punctuation is supported, since GNU extensions like
+             * "\w" or back-references can't be represented. The word and
+             * buffer anchors ("\<", "\>", "\`" and "\'") are punctuation too,
+             * but regcomp(3) doesn't treat them as literals.
+             */
+            const unsigned char escaped = p->pat[p->pos++];
+            if (escaped == '\0' || isalnum(escaped) ||
+                strchr("<>`'", escaped) != NULL) {
+                p->ok = false;
+                return (Frag){ -1, -1 };
+            }
+            return frag_char(p, escaped);
+        }
+
+        case ')':
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            /* Undefined by POSIX */
+            p->ok = false;
+            return (Frag){ -1, -1 };
+
+        default:
+            return frag_char(p, (unsigned char)c);
+    }
+}
+
+/*
+ * Parse an atom along with all of its postfix operators. Bounded repetitions
+ * are expanded by parsing the same atom multiple times.
+ */
+static Frag parse_repeat(Parser* p, int depth) {
+    const size_t atom_pos = p->pos;
+    Frag ret              = parse_atom(p, depth);
+
+    const int type    = p->ok ? (int)p->dfa->nodes[ret.start].type : -1;
+    const bool anchor = (type == DFANODE_BOL || type == DFANODE_EOL);
+
+    for (bool first = true; p->ok; first = false) {
+        const char c = peek(p);
+        if (c != '*' && c != '+' && c != '?' && c != '{')
+            break;
+
+        /*
+         * Repeating anchors is not supported. Since bounded repetitions parse
+         * the atom again, they can't be stacked after other operators either.
+         */
+        if (anchor || (c == '{' && !first)) {
+            p->ok = false;
+            break;
+        }
+
+        p->pos++;
+        if (c == '*') {
+            ret = frag_star(p, ret);
+            continue;
+        } else if (c == '+') {
+            ret = frag_plus(p, ret);
+            continue;
+        } else if (c == '?') {
+            ret = frag_quest(p, ret);
+            continue;
+        }
+
+        /* Bounded repetition: "{min}", "{min,}" or "{min,max}" */
+        int min, max;
+        if (!parse_number(p, &min)) {
+            p->ok = false;
+            break;
+        }
+
+        max = min;
+        if (peek(p) == ',') {
+            p->pos++;
+            max = -1;
+            if (peek(p) != '}' && (!parse_number(p, &max) || max < min)) {
+                p->ok = false;
+                break;
+            }
+        }
+
+        if (peek(p) != '}') {
+            p->ok = false;
+            break;
+        }
+        const size_t end_pos = p->pos + 1;
+
+        /*
+         * We already parsed the first copy of the atom; build the rest by
+         * parsing it again. The mandatory copies are concatenated, and then
+         * the optional ones.
+         */
+        Frag result = (min == 0) ? frag_empty(p) : ret;
+        for (int i = 1; p->ok && i < min; i++) {
+            p->pos = atom_pos;
+            result = frag_concat(p, result, parse_atom(p, depth));
+        }
+
+        if (max < 0) {
+            Frag copy = ret;
+            if (min > 0) {
+                p->pos = atom_pos;
+                copy   = parse_atom(p, depth);
+            }
+            result = frag_concat(p, result, frag_star(p, copy));
+        } else {
+            for (int i = min; p->ok && i < max; i++) {
+                Frag copy = ret;
+                if (i > 0) {
+                    p->pos = atom_pos;
+                    copy   = parse_atom(p, depth);
+                }
+                result = frag_concat(p, result, frag_quest(p, copy));
+            }
+        }
+
+        p->pos = end_pos;
+        ret    = result;
+    }
+
+    return ret;
+}
+
+static Frag parse_concat(Parser* p, int depth) {
+    Frag ret = frag_empty(p);
+    while (p->ok) {
+        const char c = peek(p);
+        if (c == '\0' || c == '|' || (c == ')' && depth > 0))
+            break;
+
+        ret = frag_concat(p, ret, parse_repeat(p, depth));
+    }
+
+    return ret;
+}
+
+static Frag parse_alt(Parser* p, int depth) {
+    Frag ret = parse_concat(p, depth);
+    while (p->ok && peek(p) == '|') {
+        p->pos++;
+        ret = frag_alt(p, ret, parse_concat(p, depth));
+    }
+
+    return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+/* DFA construction */
+
+/*
+ * Compute the epsilon closure of the 'seeds', and store the nodes that are
+ * relevant for a DFA state (bytes, anchors and matches) in 'dfa->scratch'.
+ * Returns the number of stored nodes.
+ */
+static int closure(Dfa* dfa, const int* seeds, int seeds_num, int flags) {
+    if (++dfa->mark_gen == 0) {
+        memset(dfa->marks, 0, dfa->nodes_num * sizeof(uint32_t));
+        dfa->mark_gen = 1;
+    }
+
+    int stack_num = 0;
+    for (int i = 0; i < seeds_num; i++)
+        dfa->stack[stack_num++] = seeds[i];
+
+    int ret = 0;
+    while (stack_num > 0) {
+        const int idx = dfa->stack[--stack_num];
+        if (idx < 0 || dfa->marks[idx] == dfa->mark_gen)
+            continue;
+        dfa->marks[idx] = dfa->mark_gen;
+
+        const DfaNode* node = &dfa->nodes[idx];
+        switch (node->type) {
+            case DFANODE_CHAR:
+            case DFANODE_MATCH:
+                dfa->scratch[ret++] = idx;
+                break;
+
+            case DFANODE_EOL:
+                dfa->scratch[ret++] = idx;
+                if (flags & CLOSURE_EOL)
+                    dfa->stack[stack_num++] = node->out;
+                break;
+
+            case DFANODE_BOL:
+                if (flags & CLOSURE_BOL)
+                    dfa->stack[stack_num++] = node->out;
+                break;
+
+            case DFANODE_SPLIT:
+                dfa->stack[stack_num++] = node->out1;
+                /* fallthrough */
+            case DFANODE_EPS:
+                dfa->stack[stack_num++] = node->out;
+                break;
+        }
+    }
+
+    return ret;
+}
+
+static int compare_ints(const void* a, const void* b) {
+    const int x = *(const int*)a;
+    const int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Append the sorted, unique IDs of the DFANODE_MATCH nodes in 'nodes' to
+ * 'dfa->accept'. Returns the number of appended IDs, or -1 on error.
+ */
+static int push_accept(Dfa* dfa, const int* nodes, int nodes_num) {
+    int num = 0;
+    for (int i = 0; i < nodes_num; i++) {
+        const DfaNode* node = &dfa->nodes[nodes[i]];
+        if (node->type != DFANODE_MATCH)
+            continue;
+
+        if (!reserve(&dfa->accept, &dfa->accept_sz, dfa->accept_num + num + 1,
+                     sizeof(int)))
+            return -1;
+        dfa->accept[dfa->accept_num + num++] = node->id;
+    }
+
+    int* ids = &dfa->accept[dfa->accept_num];
+    qsort(ids, num, sizeof(int), compare_ints);
+
+    int unique = 0;
+    for (int i = 0; i < num; i++)
+        if (unique == 0 || ids[unique - 1] != ids[i])
+            ids[unique++] = ids[i];
+
+    dfa->accept_num += unique;
+    return unique;
+}
+
+static uint32_t hash_nodes(const int* nodes, int num) {
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < num; i++) {
+        hash ^= (uint32_t)nodes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool grow_index(Dfa* dfa) {
+    const int new_sz = (dfa->index_sz > 0) ? dfa->index_sz * 2 : 256;
+    int* new_index   = malloc(new_sz * sizeof(int));
+    if (new_index == NULL)
+        return false;
+
+    for (int i = 0; i < new_sz; i++)
+        new_index[i] = -1;
+
+    for (int i = 0; i < dfa->states_num; i++) {
+        uint32_t pos = dfa->states[i].hash & (new_sz - 1);
+        while (new_index[pos] >= 0)
+            pos = (pos + 1) & (new_sz - 1);
+        new_index[pos] = i;
+    }
+
+    free(dfa->index);
+    dfa->index    = new_index;
+    dfa->index_sz = new_sz;
+    return true;
+}
+
+/*
+ * Return the DFA state for the 'num' NFA nodes in 'dfa->scratch', creating it
+ * if needed. Returns -1 on error, or if the state limit was reached.
+ *
+ * The initial state is never shared with other states, since its anchors
+ * behave differently.
+ */
+static int get_state(Dfa* dfa, int num, bool initial) {
+    int* nodes = dfa->scratch;
+    qsort(nodes, num, sizeof(int), compare_ints);
+
+    /* Keep the hash table at most half full */
+    if ((dfa->states_num + 1) * 2 > dfa->index_sz && !grow_index(dfa))
+        return -1;
+
+    const uint32_t hash = hash_nodes(nodes, num);
+    uint32_t pos        = hash & (dfa->index_sz - 1);
+    for (; dfa->index[pos] >= 0; pos = (pos + 1) & (dfa->index_sz - 1)) {
+        const DfaState* state = &dfa->states[dfa->index[pos]];
+        if (!initial && state->hash == hash && state->nodes_num == num &&
+            !memcmp(&dfa->pool[state->nodes_off], nodes, num * sizeof(int)))
+            return dfa->index[pos];
+    }
+
+    if (dfa->states_num >= DFA_MAX_STATES)
+        return -1;
+
+    const int old_sz = dfa->states_sz;
+    if (!reserve(&dfa->states, &dfa->states_sz, dfa->states_num + 1,
+                 sizeof(DfaState)) ||
+        !reserve(&dfa->pool, &dfa->pool_sz, dfa->pool_num + num, sizeof(int)))
+        return -1;
+
+    if (dfa->states_sz != old_sz) {
+        int32_t* trans =
+          realloc(dfa->trans, (size_t)dfa->states_sz * dfa->classes_num *
+                                sizeof(int32_t));
+        if (trans == NULL)
+            return -1;
+        dfa->trans = trans;
+    }
+
+    const int idx    = dfa->states_num;
+    DfaState* state  = &dfa->states[idx];
+    state->hash      = hash;
+    state->nodes_off = dfa->pool_num;
+    state->nodes_num = num;
+    memcpy(&dfa->pool[dfa->pool_num], nodes, num * sizeof(int));
+    dfa->pool_num += num;
+
+    for (int i = 0; i < dfa->classes_num; i++)
+        dfa->trans[(size_t)idx * dfa->classes_num + i] = -1;
+
+    state->accept_off = dfa->accept_num;
+    state->accept_num = push_accept(dfa, nodes, num);
+    if (state->accept_num < 0)
+        return -1;
+
+    state->accept_min =
+      (state->accept_num > 0) ? dfa->accept[state->accept_off] : INT_MAX;
+    state->live_min = INT_MAX;
+    for (int i = 0; i < num; i++)
+        if (dfa->nodes[nodes[i]].id < state->live_min)
+            state->live_min = dfa->nodes[nodes[i]].id;
+
+    /*
+     * Patterns that would match if the input ended in this state, by going
+     * through the DFANODE_EOL nodes. Note that the closure overwrites the
+     * scratch buffer, but we already saved the nodes in the pool.
+     */
+    int eol_num = 0;
+    for (int i = 0; i < num; i++) {
+        const int node = dfa->pool[state->nodes_off + i];
+        if (dfa->nodes[node].type == DFANODE_EOL)
+            dfa->seeds[eol_num++] = node;
+    }
+
+    const int flags     = CLOSURE_EOL | (initial ? CLOSURE_BOL : 0);
+    const int eof_nodes = closure(dfa, dfa->seeds, eol_num, flags);
+
+    state->eof_off = dfa->accept_num;
+    state->eof_num = push_accept(dfa, dfa->scratch, eof_nodes);
+    if (state->eof_num < 0)
+        return -1;
+
+    if (!initial)
+        dfa->index[pos] = idx;
+    dfa->states_num++;
+    return idx;
+}
+
+/*
+ * Build the transition of 'from' with the byte class 'cls'. Since the search is
+ * unanchored, the start of all patterns is added to every state.
+ */
+static int add_transition(Dfa* dfa, int from, int cls) {
+    const int byte        = dfa->class_bytes[cls];
+    const DfaState* state = &dfa->states[from];
+
+    int* seeds    = dfa->seeds;
+    int seeds_num = 0;
+    for (int i = 0; i < state->nodes_num; i++) {
+        const DfaNode* node = &dfa->nodes[dfa->pool[state->nodes_off + i]];
+        if (node->type == DFANODE_CHAR && set_has(&dfa->sets[node->set], byte))
+            seeds[seeds_num++] = node->out;
+    }
+    for (int i = 0; i < dfa->starts_num; i++)
+        seeds[seeds_num++] = dfa->starts[i];
+
+    const int num = closure(dfa, seeds, seeds_num, 0);
+    const int to  = get_state(dfa, num, false);
+    if (to >= 0)
+        dfa->trans[(size_t)from * dfa->classes_num + cls] = to;
+    return to;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void dfa_init(Dfa* dfa) {
+    memset(dfa, 0, sizeof(Dfa));
+    dfa->initial = -1;
+}
+
+void dfa_free(Dfa* dfa) {
+    free(dfa->nodes);
+    free(dfa->sets);
+    free(dfa->starts);
+    free(dfa->states);
+    free(dfa->trans);
+    free(dfa->index);
+    free(dfa->pool);
+    free(dfa->accept);
+    free(dfa->marks);
+    free(dfa->stack);
+    free(dfa->seeds);
+    free(dfa->scratch);
+    dfa_init(dfa);
+}
+
+bool dfa_add(Dfa* dfa, const char* pat, int id) {
+    const int old_nodes = dfa->nodes_num;
+    const int old_sets  = dfa->sets_num;
+
+    Parser p = {
+        .dfa = dfa,
+        .pat = pat,
+        .pos = 0,
+        .ok  = true,
+    };
+
+    Frag frag = parse_alt(&p, 0);
+    if (p.ok && peek(&p) != '\0')
+        p.ok = false;
+
+    const int match = new_node(&p, DFANODE_MATCH);
+    if (p.ok)
+        dfa->nodes[frag.end].out = match;
+
+    if (!p.ok || !reserve(&dfa->starts, &dfa->starts_sz, dfa->starts_num + 1,
+                          sizeof(int))) {
+        dfa->nodes_num = old_nodes;
+        dfa->sets_num  = old_sets;
+        return false;
+    }
+
+    for (int i = old_nodes; i < dfa->nodes_num; i++)
+        dfa->nodes[i].id = id;
+
+    dfa->starts[dfa->starts_num++] = frag.start;
+    return true;
+}
+
+bool dfa_finish(Dfa* dfa) {
+    /*
+     * Split the bytes into equivalence classes, so the bytes that belong to
+     * the same sets share their transitions.
+     */
+    int classes[256] = { 0 };
+    int num          = 1;
+    for (int i = 0; i < dfa->sets_num; i++) {
+        /* Move the bytes of the set to a new class, splitting the old one */
+        int split[256];
+        for (int j = 0; j < num; j++)
+            split[j] = -1;
+
+        int next = num;
+        for (int c = 0; c < 256; c++) {
+            if (!set_has(&dfa->sets[i], c))
+                continue;
+
+            const int old = classes[c];
+            if (split[old] < 0)
+                split[old] = next++;
+            classes[c] = split[old];
+        }
+
+        /* Renumber, since some of the old classes might be empty now */
+        int renumber[512];
+        for (int j = 0; j < next; j++)
+            renumber[j] = -1;
+
+        num = 0;
+        for (int c = 0; c < 256; c++) {
+            if (renumber[classes[c]] < 0)
+                renumber[classes[c]] = num++;
+            classes[c] = renumber[classes[c]];
+        }
+    }
+
+    dfa->classes_num = num;
+    for (int c = 255; c >= 0; c--) {
+        dfa->classes[c]                  = classes[c];
+        dfa->class_bytes[dfa->classes[c]] = c;
+    }
+
+    /*
+     * Each node can be pushed to the closure stack once per incoming edge, and
+     * there are at most two per node, plus the seeds.
+     */
+    const int nodes = (dfa->nodes_num > 0) ? dfa->nodes_num : 1;
+    const int seeds = nodes + dfa->starts_num;
+    dfa->marks      = calloc(nodes, sizeof(uint32_t));
+    dfa->stack      = malloc((2 * nodes + seeds) * sizeof(int));
+    dfa->seeds      = malloc(seeds * sizeof(int));
+    dfa->scratch    = malloc(nodes * sizeof(int));
+    if (dfa->marks == NULL || dfa->stack == NULL || dfa->seeds == NULL ||
+        dfa->scratch == NULL || !grow_index(dfa))
+        return false;
+
+    const int num_initial =
+      closure(dfa, dfa->starts, dfa->starts_num, CLOSURE_BOL);
+    dfa->initial = get_state(dfa, num_initial, true);
+    return dfa->initial >= 0;
+}
+
+bool dfa_build_all(Dfa* dfa) {
+    /* New states are appended, so they are visited by the same loop */
+    for (int state = 0; state < dfa->states_num; state++)
+        for (int cls = 0; cls < dfa->classes_num; cls++)
+            if (dfa->trans[(size_t)state * dfa->classes_num + cls] < 0 &&
+                add_transition(dfa, state, cls) < 0)
+                return false;
+
+    return true;
+}
+
+int dfa_match(Dfa* dfa, const char* str, size_t len, int limit) {
+    const uint8_t* classes = dfa->classes;
+    const int classes_num  = dfa->classes_num;
+    const int32_t* trans   = dfa->trans;
+    const DfaState* states = dfa->states;
+
+    int state = dfa->initial;
+    int best  = limit;
+    for (size_t i = 0; i < len; i++) {
+        const DfaState* cur = &states[state];
+        if (cur->accept_min < best)
+            best = cur->accept_min;
+
+        /* None of the remaining patterns could improve the result */
+        if (cur->live_min >= best)
+            return (best < limit) ? best : -1;
+
+        const int cls = classes[(unsigned char)str[i]];
+        int next      = trans[(size_t)state * classes_num + cls];
+        if (next < 0) {
+            next = add_transition(dfa, state, cls);
+            if (next < 0)
+                return DFA_FAIL;
+
+            /* The arrays might have been reallocated */
+            trans  = dfa->trans;
+            states = dfa->states;
+        }
+
+        state = next;
+    }
+
+    const DfaState* last = &states[state];
+    if (last->accept_min < best)
+        best = last->accept_min;
+    if (last->eof_num > 0 && dfa->accept[last->eof_off] < best)
+        best = dfa->accept[last->eof_off];
+
+    return (best < limit) ? best : -1;
+}
@@ -0,0 +1,135 @@
+
+#ifndef DFA_H_
+#define DFA_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Returned by 'dfa_match' when the state limit was reached. The caller should
+ * fall back to a different matching method.
+ */
+#define DFA_FAIL (-2)
+
+/*
+ * Maximum number of DFA states that will be built before giving up.
+ */
+#define DFA_MAX_STATES 4096
+
+/*
+ * Node of the Thompson NFA built from the patterns. The DFA states are sets of
+ * these nodes.
+ */
+typedef struct DfaNode {
+    enum {
+        DFANODE_CHAR,  /* Consume a byte in 'set', go to 'out' */
+        DFANODE_EPS,   /* Go to 'out' without consuming anything */
+        DFANODE_SPLIT, /* Go to 'out' and 'out1' */
+        DFANODE_BOL,   /* Go to 'out' if we are at the start of the input */
+        DFANODE_EOL,   /* Go to 'out' if we are at the end of the input */
+        DFANODE_MATCH, /* Pattern with identifier 'id' matched */
+    } type;
+    int out, out1;
+    int set; /* For DFANODE_CHAR, index in 'Dfa.sets' */
+    int id;  /* ID of the pattern that contains this node */
+} DfaNode;
+
+typedef struct DfaSet {
+    uint32_t bits[256 / 32];
+} DfaSet;
+
+typedef struct DfaState {
+    int accept_min; /* Lowest ID in the 'accept' list, or INT_MAX */
+    int live_min;   /* Lowest ID that can still match from here, or INT_MAX */
+    uint32_t hash;
+    int nodes_off, nodes_num;   /* NFA nodes, inside 'Dfa.pool' */
+    int accept_off, accept_num; /* Sorted pattern IDs, inside 'Dfa.accept' */
+    int eof_off, eof_num;       /* Same, but only at the end of the input */
+} DfaState;
+
+/*
+ * Deterministic automaton over the union of many ERE patterns, built lazily
+ * from a Thompson NFA as the input is scanned. Only a subset of the POSIX ERE
+ * syntax is supported, see 'dfa_add'. Just like 'pattern_compile', patterns
+ * are case-insensitive.
+ */
+typedef struct Dfa {
+    /* NFA, built with 'dfa_add' */
+    DfaNode* nodes;
+    int nodes_num, nodes_sz;
+    DfaSet* sets;
+    int sets_num, sets_sz;
+    int* starts;
+    int starts_num, starts_sz;
+
+    /* Byte equivalence classes, built with 'dfa_finish' */
+    uint8_t classes[256];
+    uint8_t class_bytes[256]; /* A representative byte for each class */
+    int classes_num;
+
+    /* DFA states and transitions, built by 'dfa_match' when needed */
+    DfaState* states;
+    int states_num, states_sz;
+    int32_t* trans; /* Size is 'states_sz * classes_num'; -1 if unknown */
+    int* index;     /* Hash table of state indexes; -1 if empty */
+    int index_sz;
+    int* pool;
+    int pool_num, pool_sz;
+    int* accept;
+    int accept_num, accept_sz;
+    int initial;
+
+    /* Scratch space used while building states */
+    uint32_t* marks;
+    uint32_t mark_gen;
+    int* stack;
+    int* seeds;
+    int* scratch;
+} Dfa;
+
+/*
+ * Initialize an empty automaton.
+ */
+void dfa_init(Dfa* dfa);
+
+/*
+ * Free all memory used by the automaton.
+ */
+void dfa_free(Dfa* dfa);
+
+/*
+ * Add the ERE pattern 'pat' to the automaton, which will be reported as 'id'
+ * when it matches. Returns false if the pattern is invalid or uses syntax that
+ * is not supported (e.g. back-references or collating elements), in which case
+ * the automaton is left unchanged.
+ */
+bool dfa_add(Dfa* dfa, const char* pat, int id);
+
+/*
+ * Prepare the automaton for matching, after all the patterns were added.
+ * Returns false on allocation errors.
+ */
+bool dfa_finish(Dfa* dfa);
+
+/*
+ * Build all the states and transitions of the automaton in advance, instead of
+ * doing it lazily from 'dfa_match'. Returns false if the state limit was
+ * reached, in which case the automaton can still be used lazily.
+ *
+ * Once it succeeds, 'dfa_match' doesn't modify the automaton anymore, so it can
+ * be called from multiple threads at once, and it never fails.
+ */
+bool dfa_build_all(Dfa* dfa);
+
+/*
+ * Scan the 'len' bytes of 'str' once, and return the lowest ID of the patterns
+ * that matched it (with the same semantics as regexec(3), without flags), -1 if
+ * none of them matched, or DFA_FAIL if the automaton grew too much.
+ *
+ * Only IDs lower than 'limit' are reported, so the scan stops as soon as none
+ * of them can match. Use INT_MAX for reporting any ID.
+ */
+int dfa_match(Dfa* dfa, const char* str, size_t len, int limit);
+
+#endif /* DFA_H_ */
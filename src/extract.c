@@ -0,0 +1,143 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "extract.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "rules.h"
+#include "transform.h"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Bytes that every span should contain, one of them at least: "://" of URLs,
+ * ":" of line numbers, "(" of man pages, and "." or "/" of file names.
+ */
+static inline bool is_trigger(char c) {
+    return c == ':' || c == '(' || c == '.' || c == '/';
+}
+
+/*
+ * Bytes that separate words.
+ */
+static inline bool is_delimiter(char c) {
+    const unsigned char u = (unsigned char)c;
+    return u <= ' ' || u == 0x7F || c == '\"' || c == '\'' || c == '`' ||
+           c == '<' || c == '>';
+}
+
+/*
+ * Return the position of the first trigger byte in the buffer, starting at
+ * 'pos', or 'len' if there are none. This is where most of the time is spent,
+ * so 32 bytes are checked at once when SSE2 is available.
+ */
+static size_t find_trigger(const char* buf, size_t pos, size_t len) {
+#ifdef __SSE2__
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i paren = _mm_set1_epi8('(');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i one   = _mm_set1_epi8(1);
+
+    /* Since '.' is 0x2E and '/' is 0x2F, setting the lowest bit covers both */
+    while (pos + 32 <= len) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)&buf[pos]);
+        const __m128i b = _mm_loadu_si128((const __m128i*)&buf[pos + 16]);
+        const __m128i ma =
+          _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(a, colon),
+                                    _mm_cmpeq_epi8(a, paren)),
+                       _mm_cmpeq_epi8(_mm_or_si128(a, one), slash));
+        const __m128i mb =
+          _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b, colon),
+                                    _mm_cmpeq_epi8(b, paren)),
+                       _mm_cmpeq_epi8(_mm_or_si128(b, one), slash));
+        const unsigned mask = (unsigned)_mm_movemask_epi8(ma) |
+                              (unsigned)_mm_movemask_epi8(mb) << 16;
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+#endif
+
+    for (; pos < len; pos++)
+        if (is_trigger(buf[pos]))
+            return pos;
+    return len;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool extract_is_delimiter(char c) {
+    return is_delimiter(c);
+}
+
+void extract_init(Extractor* ex, RuleSet* rules, const char* buf, size_t len) {
+    ex->rules = rules;
+    ex->buf   = buf;
+    ex->len   = len;
+    ex->pos   = 0;
+}
+
+bool extract_next(Extractor* ex, ExtractSpan* span) {
+    const char* buf  = ex->buf;
+    const size_t len = ex->len;
+
+    while (ex->pos < len) {
+        const size_t trigger = find_trigger(buf, ex->pos, len);
+        if (trigger >= len)
+            break;
+
+        /*
+         * Expand the trigger to the whole word. The start is never before the
+         * previous position, since the words before it were already checked.
+         */
+        size_t start = trigger;
+        while (start > ex->pos && !is_delimiter(buf[start - 1]))
+            start--;
+        size_t end = trigger + 1;
+        while (end < len && !is_delimiter(buf[end]))
+            end++;
+        ex->pos = end;
+
+        transform_trim(buf, &start, &end);
+        if (end == start || end - start > EXTRACT_MAX_SPAN)
+            continue;
+
+        /* The rules need a null-terminated string */
+        memcpy(ex->word, &buf[start], end - start);
+        ex->word[end - start] = '\0';
+
+        const int idx = ruleset_match(ex->rules, ex->word);
+        if (idx < 0)
+            continue;
+
+        span->off  = start;
+        span->len  = end - start;
+        span->rule = idx;
+        return true;
+    }
+
+    ex->pos = len;
+    return false;
+}
@@ -0,0 +1,59 @@
+
+#ifndef EXTRACT_H_
+#define EXTRACT_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "rules.h"
+
+/*
+ * Maximum length of a span. Longer words are never reported.
+ */
+#define EXTRACT_MAX_SPAN 4096
+
+/*
+ * Span of a text buffer that matched a rule.
+ */
+typedef struct ExtractSpan {
+    size_t off, len; /* Bytes inside the buffer */
+    int rule;        /* Index in 'RuleSet.rules' */
+} ExtractSpan;
+
+/*
+ * Iterator over the spans of a text buffer, see 'extract_next'.
+ */
+typedef struct Extractor {
+    RuleSet* rules;
+    const char* buf;
+    size_t len;
+    size_t pos; /* Where the next candidate will be searched */
+    char word[EXTRACT_MAX_SPAN + 1];
+} Extractor;
+
+/*
+ * Return true if 'c' separates the words of the buffer. See 'extract_next'.
+ */
+bool extract_is_delimiter(char c);
+
+/*
+ * Start iterating over the 'len' bytes of 'buf', which doesn't need to be
+ * null-terminated, and must be valid until the iteration ends.
+ */
+void extract_init(Extractor* ex, RuleSet* rules, const char* buf, size_t len);
+
+/*
+ * Find the next span of the buffer that matches a rule, and store it in
+ * 'span'. Returns false when there are no more spans.
+ *
+ * The buffer is split in words, delimited by spaces, control characters,
+ * quotes and angle brackets. Only the words that contain a ':', '(', '.' or
+ * '/' are candidates, and they are found without looking at the rest of the
+ * bytes; therefore, a lone "Makefile" is not a candidate. Opening brackets at
+ * the start of a word, trailing punctuation and unbalanced closing brackets are
+ * not part of the span, so "(see mmap(2))." reports "mmap(2)". The rest of the
+ * word must match a rule as a whole.
+ */
+bool extract_next(Extractor* ex, ExtractSpan* span);
+
+#endif /* EXTRACT_H_ */
@@ -0,0 +1,770 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _DEFAULT_SOURCE /* d_type, st_mtim */
+
+#include "fileindex.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "mapfile.h"
+#include "util.h"
+
+#define INDEX_MAGIC   "plumbidx"
+#define INDEX_VERSION 2
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Header of the index file, followed by the sections in the same order as the
+ * fields of 'FileIndex'.
+ */
+typedef struct IndexHeader {
+    MapFileHeader file;
+
+    /* Sizes of the structures, which depend on the compiler */
+    uint32_t dir_sz, entry_sz;
+
+    int64_t built;
+
+    int32_t dirs_num, entries_num, files_num, strings_sz;
+    uint32_t buckets_num;
+} IndexHeader;
+
+typedef struct Sections {
+    uint64_t dirs, entries, order, buckets, strings;
+    uint64_t end;
+} Sections;
+
+/*
+ * Index being built by 'fileindex_update', from the directories and from the
+ * previous index.
+ */
+typedef struct Builder {
+    const FileIndex* old; /* Or NULL */
+
+    FileIndexDir* dirs;
+    int32_t dirs_num, dirs_sz;
+    FileIndexEntry* entries;
+    int32_t entries_num, entries_sz;
+    char* strings;
+    int32_t strings_num, strings_sz;
+
+    bool failed; /* Allocation failed, the index is incomplete */
+} Builder;
+
+/* Entry being sorted, along with its name */
+typedef struct SortedEntry {
+    const char* name;
+    FileIndexEntry entry;
+} SortedEntry;
+
+/*
+ * Whether 'fileindex_resolve' missed a file in an outdated index since the last
+ * call to 'fileindex_wait_miss'.
+ */
+static pthread_mutex_t g_miss_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_miss_cond  = PTHREAD_COND_INITIALIZER;
+static bool g_missed               = false;
+
+/*----------------------------------------------------------------------------*/
+
+static uint32_t hash_name(const char* str, size_t len) {
+    /* FNV-1a */
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)str[i]) * 0x01000193;
+    return hash;
+}
+
+static inline int64_t mtime_ns(const struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static bool get_sections(const IndexHeader* header, Sections* s) {
+    if (header->dirs_num < 0 || header->entries_num < 0 ||
+        header->files_num < 0 || header->files_num > header->entries_num ||
+        header->strings_sz <= 0 || header->buckets_num == 0 ||
+        (header->buckets_num & (header->buckets_num - 1)) != 0)
+        return false;
+
+    const uint64_t buckets_num = (uint64_t)header->buckets_num + 1;
+
+    uint64_t end = sizeof(IndexHeader);
+    s->dirs =
+      mapfile_push_section(&end, header->dirs_num, sizeof(FileIndexDir));
+    s->entries =
+      mapfile_push_section(&end, header->entries_num, sizeof(FileIndexEntry));
+    s->order = mapfile_push_section(&end, header->files_num, sizeof(int32_t));
+    s->buckets = mapfile_push_section(&end, buckets_num, sizeof(uint32_t));
+    s->strings =
+      mapfile_push_section(&end, header->strings_sz, sizeof(char));
+    s->end = end;
+    return true;
+}
+
+/*
+ * Check that the indexes stored in the entry are inside the index, so it can
+ * be used without more checks.
+ */
+static bool valid_entry(const FileIndex* index, int32_t i) {
+    if (i < 0 || i >= index->entries_num)
+        return false;
+
+    const FileIndexEntry* entry = &index->entries[i];
+    return entry->name >= 0 && entry->name < index->strings_sz &&
+           entry->dir >= 0 && entry->dir < index->dirs_num &&
+           entry->subdir >= FILEINDEX_VANISHED &&
+           entry->subdir < index->dirs_num;
+}
+
+static bool valid_dir(const FileIndex* index, int32_t i) {
+    if (i < 0 || i >= index->dirs_num)
+        return false;
+
+    const FileIndexDir* dir = &index->dirs[i];
+    return dir->path >= 0 && dir->path < index->strings_sz && dir->first >= 0 &&
+           dir->num >= 0 && dir->first <= index->entries_num - dir->num;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Building */
+
+static bool grow(void** arr, int32_t* sz, int32_t needed, size_t elem_sz) {
+    if (needed <= *sz)
+        return true;
+
+    int32_t new_sz = (*sz > 0) ? *sz : 64;
+    while (new_sz < needed) {
+        if (new_sz > INT32_MAX / 2)
+            return false;
+        new_sz *= 2;
+    }
+
+    void* new_arr = realloc(*arr, (size_t)new_sz * elem_sz);
+    if (new_arr == NULL)
+        return false;
+
+    *arr = new_arr;
+    *sz  = new_sz;
+    return true;
+}
+
+static int32_t push_string(Builder* b, const char* str, size_t len) {
+    if (len >= (size_t)(INT32_MAX - b->strings_num) ||
+        !grow((void**)&b->strings, &b->strings_sz,
+              b->strings_num + (int32_t)len + 1, sizeof(char))) {
+        b->failed = true;
+        return -1;
+    }
+
+    const int32_t off = b->strings_num;
+    memcpy(&b->strings[off], str, len);
+    b->strings[off + len] = '\0';
+    b->strings_num += len + 1;
+    return off;
+}
+
+static int32_t push_dir(Builder* b, const char* path, size_t len,
+                        int64_t mtime) {
+    if (!grow((void**)&b->dirs, &b->dirs_sz, b->dirs_num + 1,
+              sizeof(FileIndexDir))) {
+        b->failed = true;
+        return -1;
+    }
+
+    const int32_t path_off = push_string(b, path, len);
+    if (path_off < 0)
+        return -1;
+
+    FileIndexDir* dir = &b->dirs[b->dirs_num];
+    dir->path         = path_off;
+    dir->first        = b->entries_num;
+    dir->num          = 0;
+    dir->mtime_ns     = mtime;
+    return b->dirs_num++;
+}
+
+static void push_entry(Builder* b, int32_t dir, const char* name, bool is_dir) {
+    if (!grow((void**)&b->entries, &b->entries_sz, b->entries_num + 1,
+              sizeof(FileIndexEntry))) {
+        b->failed = true;
+        return;
+    }
+
+    const size_t len       = strlen(name);
+    const int32_t name_off = push_string(b, name, len);
+    if (name_off < 0)
+        return;
+
+    FileIndexEntry* entry = &b->entries[b->entries_num++];
+    entry->name           = name_off;
+    entry->dir            = dir;
+    entry->subdir         = is_dir ? FILEINDEX_VANISHED : FILEINDEX_FILE;
+    entry->hash           = hash_name(name, len);
+    b->dirs[dir].num++;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    return strcmp(((const SortedEntry*)a)->name, ((const SortedEntry*)b)->name);
+}
+
+/*
+ * Sort the entries of a directory by name, so the entries of the next update
+ * can be found with a binary search.
+ */
+static void sort_entries(Builder* b, int32_t dir) {
+    FileIndexEntry* entries = &b->entries[b->dirs[dir].first];
+    const int32_t num       = b->dirs[dir].num;
+    if (num < 2)
+        return;
+
+    SortedEntry* sorted = malloc(num * sizeof(SortedEntry));
+    if (sorted == NULL) {
+        b->failed = true;
+        return;
+    }
+
+    for (int32_t i = 0; i < num; i++) {
+        sorted[i].name  = &b->strings[entries[i].name];
+        sorted[i].entry = entries[i];
+    }
+    qsort(sorted, num, sizeof(SortedEntry), compare_entries);
+    for (int32_t i = 0; i < num; i++)
+        entries[i] = sorted[i].entry;
+
+    free(sorted);
+}
+
+/*
+ * Add the entries of the directory at 'path', reading them from the disk.
+ */
+static void read_entries(Builder* b, int32_t dir, const char* path) {
+    DIR* dp = opendir(path);
+    if (dp == NULL)
+        return;
+
+    const int fd = dirfd(dp);
+    struct dirent* ent;
+    while ((ent = readdir(dp)) != NULL) {
+        /* Hidden files, along with "." and ".." */
+        if (ent->d_name[0] == '.')
+            continue;
+
+        bool is_dir = (ent->d_type == DT_DIR);
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                     S_ISDIR(st.st_mode);
+        }
+
+        push_entry(b, dir, ent->d_name, is_dir);
+    }
+    closedir(dp);
+
+    if (!b->failed)
+        sort_entries(b, dir);
+}
+
+/*
+ * Add the entries of the directory 'old_dir' of the previous index, which
+ * didn't change.
+ */
+static void copy_entries(Builder* b, int32_t dir, int32_t old_dir) {
+    const FileIndex* old   = b->old;
+    const FileIndexDir* od = &old->dirs[old_dir];
+    for (int32_t i = od->first; i < od->first + od->num; i++) {
+        if (!valid_entry(old, i))
+            continue;
+        const FileIndexEntry* entry = &old->entries[i];
+        push_entry(b, dir, &old->strings[entry->name],
+                   entry->subdir != FILEINDEX_FILE);
+    }
+}
+
+/*
+ * Return the index of the directory called 'name' inside 'old_dir' in the
+ * previous index, or -1 if there is none.
+ */
+static int32_t find_old_subdir(const FileIndex* old, int32_t old_dir,
+                               const char* name) {
+    if (old == NULL || !valid_dir(old, old_dir))
+        return -1;
+
+    int32_t lo = old->dirs[old_dir].first;
+    int32_t hi = lo + old->dirs[old_dir].num;
+    while (lo < hi) {
+        const int32_t mid = lo + (hi - lo) / 2;
+        if (!valid_entry(old, mid))
+            return -1;
+
+        const int cmp = strcmp(&old->strings[old->entries[mid].name], name);
+        if (cmp == 0)
+            return (old->entries[mid].subdir >= 0) ? old->entries[mid].subdir
+                                                   : -1;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return -1;
+}
+
+/*
+ * Add the directory at 'path', whose length is 'len', and everything inside
+ * it. The buffer of 'path' has FILEINDEX_PATH_SZ bytes, and it's used for the
+ * paths of the subdirectories. The directory was 'old_dir' in the previous
+ * index, or -1 if it's new. Returns the index of the directory, or -1 if it
+ * doesn't exist.
+ */
+static int32_t walk(Builder* b, char* path, size_t len, int32_t old_dir) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return -1;
+
+    const int64_t mtime = mtime_ns(&st);
+    const int32_t dir   = push_dir(b, path, len, mtime);
+    if (dir < 0)
+        return -1;
+
+    /* The entries of a directory only change with its modification time */
+    const FileIndex* old = b->old;
+    if (old != NULL && valid_dir(old, old_dir) &&
+        old->dirs[old_dir].mtime_ns == mtime)
+        copy_entries(b, dir, old_dir);
+    else
+        read_entries(b, dir, path);
+
+    const int32_t first = b->dirs[dir].first;
+    const int32_t num   = b->dirs[dir].num;
+    for (int32_t i = first; i < first + num && !b->failed; i++) {
+        if (b->entries[i].subdir == FILEINDEX_FILE)
+            continue;
+
+        const char* name     = &b->strings[b->entries[i].name];
+        const size_t sub_len = len + 1 + strlen(name);
+        if (sub_len >= FILEINDEX_PATH_SZ)
+            continue;
+
+        path[len] = '/';
+        strcpy(&path[len + 1], name);
+        const int32_t old_sub = find_old_subdir(old, old_dir, name);
+        const int32_t subdir  = walk(b, path, sub_len, old_sub);
+        path[len]             = '\0';
+
+        b->entries[i].subdir = (subdir >= 0) ? subdir : FILEINDEX_VANISHED;
+    }
+
+    return dir;
+}
+
+/*
+ * Return the index of the root directory at 'path' in the previous index, or
+ * -1 if it was not indexed.
+ */
+static int32_t find_old_root(const FileIndex* old, const char* path) {
+    if (old == NULL)
+        return -1;
+
+    /* Linear, but only done once for each root */
+    for (int32_t i = 0; i < old->dirs_num; i++)
+        if (valid_dir(old, i) &&
+            !strcmp(&old->strings[old->dirs[i].path], path))
+            return i;
+
+    return -1;
+}
+
+/*
+ * Write the index in the builder to 'path', atomically.
+ */
+static bool save_index(const Builder* b, const char* path) {
+    int32_t files_num = 0;
+    for (int32_t i = 0; i < b->entries_num; i++)
+        if (b->entries[i].subdir == FILEINDEX_FILE)
+            files_num++;
+
+    uint32_t buckets_num = 1;
+    while (buckets_num < (uint32_t)files_num)
+        buckets_num *= 2;
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.dir_sz      = sizeof(FileIndexDir);
+    header.entry_sz    = sizeof(FileIndexEntry);
+    header.built       = time(NULL);
+    header.dirs_num    = b->dirs_num;
+    header.entries_num = b->entries_num;
+    header.files_num   = files_num;
+    header.strings_sz  = (b->strings_num > 0) ? b->strings_num : 1;
+    header.buckets_num = buckets_num;
+
+    Sections s;
+    if (!get_sections(&header, &s))
+        return false;
+    mapfile_init_header(&header.file, INDEX_MAGIC, INDEX_VERSION,
+                        sizeof(IndexHeader), s.end);
+
+    char* buf = calloc(1, s.end);
+    if (buf == NULL)
+        return false;
+
+    memcpy(buf, &header, sizeof(header));
+    if (b->dirs_num > 0)
+        memcpy(&buf[s.dirs], b->dirs, b->dirs_num * sizeof(FileIndexDir));
+    if (b->entries_num > 0)
+        memcpy(&buf[s.entries], b->entries,
+               b->entries_num * sizeof(FileIndexEntry));
+    if (b->strings_num > 0)
+        memcpy(&buf[s.strings], b->strings, b->strings_num);
+
+    /* Counting sort of the files by their bucket */
+    uint32_t* buckets = (uint32_t*)&buf[s.buckets];
+    int32_t* order    = (int32_t*)&buf[s.order];
+    for (int32_t i = 0; i < b->entries_num; i++)
+        if (b->entries[i].subdir == FILEINDEX_FILE)
+            buckets[(b->entries[i].hash & (buckets_num - 1)) + 1]++;
+    for (uint32_t i = 0; i < buckets_num; i++)
+        buckets[i + 1] += buckets[i];
+    for (int32_t i = 0; i < b->entries_num; i++) {
+        if (b->entries[i].subdir != FILEINDEX_FILE)
+            continue;
+        const uint32_t bucket = b->entries[i].hash & (buckets_num - 1);
+        order[buckets[bucket]++] = i;
+    }
+
+    /* Restore the start of each bucket, which was moved to the next one */
+    for (uint32_t i = buckets_num; i > 0; i--)
+        buckets[i] = buckets[i - 1];
+    buckets[0] = 0;
+
+    const bool ok = mapfile_save(path, buf, s.end);
+    free(buf);
+    return ok;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Lookups */
+
+/*
+ * Length of the common prefix of two paths, in complete components.
+ */
+static size_t common_prefix(const char* a, const char* b) {
+    size_t common = 0;
+    size_t i      = 0;
+    for (; a[i] != '\0' && a[i] == b[i]; i++)
+        if (a[i] == '/')
+            common = i;
+    if (a[i] == '\0' && (b[i] == '/' || b[i] == '\0'))
+        common = i;
+    return common;
+}
+
+/*
+ * Write the path of the file of entry 'i' to 'buf'. Returns false if it
+ * doesn't fit.
+ */
+static bool entry_path(const FileIndex* index, int32_t i, char* buf,
+                       size_t buf_sz) {
+    const FileIndexEntry* entry = &index->entries[i];
+    if (!valid_dir(index, entry->dir))
+        return false;
+
+    const int written = snprintf(buf, buf_sz, "%s/%s",
+                                 &index->strings[index->dirs[entry->dir].path],
+                                 &index->strings[entry->name]);
+    return written > 0 && (size_t)written < buf_sz;
+}
+
+/*
+ * Check if the path ends with the 'len' bytes of 'name', after a '/'.
+ */
+static bool has_suffix(const char* path, const char* name, size_t len) {
+    const size_t path_len = strlen(path);
+    return path_len > len && path[path_len - len - 1] == '/' &&
+           !memcmp(&path[path_len - len], name, len);
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool fileindex_path(const char* roots, char* buf, size_t buf_sz) {
+    /* An index for each list of roots, so they don't replace each other */
+    return mapfile_cache_path("index", roots, buf, buf_sz);
+}
+
+bool fileindex_open(FileIndex* index, const char* path) {
+    size_t size;
+    void* map = mapfile_open(path, INDEX_MAGIC, INDEX_VERSION,
+                             sizeof(IndexHeader), &size);
+    if (map == NULL)
+        return false;
+
+    const IndexHeader* header = map;
+    Sections s;
+    if (header->dir_sz != sizeof(FileIndexDir) ||
+        header->entry_sz != sizeof(FileIndexEntry) ||
+        !get_sections(header, &s) || s.end != size) {
+        mapfile_close(map, size);
+        return false;
+    }
+
+    const char* bytes  = map;
+    index->map         = map;
+    index->map_sz      = size;
+    index->built       = header->built;
+    index->dirs        = (const FileIndexDir*)&bytes[s.dirs];
+    index->dirs_num    = header->dirs_num;
+    index->entries     = (const FileIndexEntry*)&bytes[s.entries];
+    index->entries_num = header->entries_num;
+    index->order       = (const int32_t*)&bytes[s.order];
+    index->files_num   = header->files_num;
+    index->buckets     = (const uint32_t*)&bytes[s.buckets];
+    index->buckets_num = header->buckets_num;
+    index->strings     = &bytes[s.strings];
+    index->strings_sz  = header->strings_sz;
+
+    /* The rest of the index is checked when used */
+    if (index->strings[index->strings_sz - 1] != '\0' ||
+        index->buckets[index->buckets_num] > (uint32_t)index->files_num) {
+        ERR("Ignoring corrupted file index \"%s\".", path);
+        fileindex_close(index);
+        return false;
+    }
+
+    return true;
+}
+
+void fileindex_close(FileIndex* index) {
+    if (index->map != NULL)
+        mapfile_close(index->map, index->map_sz);
+    index->map = NULL;
+}
+
+/*
+ * Look up the 'len' bytes of 'name' in the index at 'path', like
+ * 'fileindex_find', and store whether the index is newer than
+ * FILEINDEX_MIN_AGE in '*fresh'.
+ */
+static bool lookup(const char* path, const char* name, size_t len,
+                   const char* cwd, char* buf, size_t buf_sz, bool* fresh) {
+    FileIndex index;
+    *fresh = false;
+    if (!fileindex_open(&index, path))
+        return false;
+
+    const bool found = fileindex_find(&index, name, len, cwd, buf, buf_sz);
+    *fresh           = (time(NULL) - index.built < FILEINDEX_MIN_AGE);
+    fileindex_close(&index);
+    return found;
+}
+
+static void unlock_miss(void* arg) {
+    (void)arg;
+    pthread_mutex_unlock(&g_miss_lock);
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool fileindex_update(const char* roots, const char* path) {
+    FileIndex old;
+    const bool has_old = fileindex_open(&old, path);
+
+    Builder b;
+    memset(&b, 0, sizeof(b));
+    b.old = has_old ? &old : NULL;
+
+    char dir[FILEINDEX_PATH_SZ];
+    for (const char* root = roots; *root != '\0';) {
+        size_t len       = strcspn(root, ":");
+        const char* next = (root[len] == ':') ? &root[len + 1] : &root[len];
+
+        /* Without trailing slashes, except for "/" itself */
+        while (len > 1 && root[len - 1] == '/')
+            len--;
+        if (len > 0 && len < sizeof(dir)) {
+            memcpy(dir, root, len);
+            dir[len] = '\0';
+            walk(&b, dir, (len == 1 && *dir == '/') ? 0 : len,
+                 find_old_root(b.old, dir));
+        }
+
+        root = next;
+    }
+
+    if (has_old)
+        fileindex_close(&old);
+
+    bool ok = false;
+    if (b.failed) {
+        ERR("Could not allocate the file index.");
+    } else {
+        ok = save_index(&b, path);
+    }
+
+    free(b.dirs);
+    free(b.entries);
+    free(b.strings);
+    return ok;
+}
+
+bool fileindex_find(const FileIndex* index, const char* name, size_t len,
+                    const char* cwd, char* buf, size_t buf_sz) {
+    /* The files are indexed by their base name */
+    const char* base = name;
+    for (size_t i = 0; i < len; i++)
+        if (name[i] == '/')
+            base = &name[i + 1];
+    const size_t base_len = &name[len] - base;
+    if (base_len == 0)
+        return false;
+
+    const uint32_t hash   = hash_name(base, base_len);
+    const uint32_t bucket = hash & (index->buckets_num - 1);
+    const uint32_t start  = index->buckets[bucket];
+    const uint32_t end    = index->buckets[bucket + 1];
+    if (end > (uint32_t)index->files_num || start > end)
+        return false;
+
+    bool found        = false;
+    size_t best_score = 0;
+    char path[FILEINDEX_PATH_SZ];
+    for (uint32_t i = start; i < end; i++) {
+        const int32_t e = index->order[i];
+        if (!valid_entry(index, e) || index->entries[e].hash != hash ||
+            index->entries[e].subdir != FILEINDEX_FILE ||
+            strlen(&index->strings[index->entries[e].name]) != base_len ||
+            memcmp(&index->strings[index->entries[e].name], base, base_len))
+            continue;
+
+        if (!entry_path(index, e, path, sizeof(path)) ||
+            !has_suffix(path, name, len) || access(path, F_OK) != 0)
+            continue;
+
+        /* The files closer to the working directory are preferred */
+        const size_t score = (cwd == NULL) ? 0 : common_prefix(cwd, path);
+        if (found && score <= best_score)
+            continue;
+        if (strlen(path) >= buf_sz)
+            continue;
+
+        strcpy(buf, path);
+        found      = true;
+        best_score = score;
+    }
+
+    return found;
+}
+
+size_t fileindex_resolve(const char* cwd, const char* str, size_t len,
+                         char* buf, size_t buf_sz, bool update) {
+    const char* roots = getenv("PLUMBER_ROOTS");
+    if (roots == NULL || *roots == '\0')
+        return 0;
+
+    size_t name_len = 0;
+    while (name_len < len && str[name_len] != ':' && str[name_len] != '(')
+        name_len++;
+    if (name_len == 0 || str[0] == '/')
+        return 0;
+
+    /* Files that exist don't need to be resolved */
+    char path[FILEINDEX_PATH_SZ];
+    const int written =
+      (cwd == NULL)
+        ? snprintf(path, sizeof(path), "%.*s", (int)name_len, str)
+        : snprintf(path, sizeof(path), "%s/%.*s", cwd, (int)name_len, str);
+    if (written < 0 || (size_t)written >= sizeof(path) ||
+        access(path, F_OK) == 0)
+        return 0;
+
+    char index_path[FILEINDEX_PATH_SZ];
+    if (!fileindex_path(roots, index_path, sizeof(index_path)))
+        return 0;
+
+    /*
+     * Look up the file in the current index. If it's not there, the index
+     * might be outdated, so update it and try again, unless it was updated
+     * recently; or let someone else update it, for the next lookups.
+     */
+    bool fresh;
+    bool found =
+      lookup(index_path, str, name_len, cwd, path, sizeof(path), &fresh);
+    if (!found && !fresh && update) {
+        found = fileindex_update(roots, index_path) &&
+                lookup(index_path, str, name_len, cwd, path, sizeof(path),
+                       &fresh);
+    } else if (!found && !fresh) {
+        pthread_mutex_lock(&g_miss_lock);
+        g_missed = true;
+        pthread_cond_broadcast(&g_miss_cond);
+        pthread_mutex_unlock(&g_miss_lock);
+    }
+
+    if (!found)
+        return 0;
+
+    const size_t path_len = strlen(path);
+    const size_t rest_len = len - name_len;
+    if (path_len + rest_len >= buf_sz)
+        return 0;
+
+    memcpy(buf, path, path_len);
+    memcpy(&buf[path_len], &str[name_len], rest_len);
+    buf[path_len + rest_len] = '\0';
+    return path_len + rest_len;
+}
+
+void fileindex_wait_miss(void) {
+    pthread_mutex_lock(&g_miss_lock);
+    pthread_cleanup_push(unlock_miss, NULL);
+    while (!g_missed)
+        pthread_cond_wait(&g_miss_cond, &g_miss_lock);
+    g_missed = false;
+    pthread_cleanup_pop(1);
+}
+
+bool fileindex_refresh(void) {
+    const char* roots = getenv("PLUMBER_ROOTS");
+    char index_path[FILEINDEX_PATH_SZ];
+    if (roots == NULL || *roots == '\0' ||
+        !fileindex_path(roots, index_path, sizeof(index_path)))
+        return false;
+
+    FileIndex index;
+    if (fileindex_open(&index, index_path)) {
+        const bool fresh = (time(NULL) - index.built < FILEINDEX_MIN_AGE);
+        fileindex_close(&index);
+        if (fresh)
+            return true;
+    }
+
+    return fileindex_update(roots, index_path);
+}
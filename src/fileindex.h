@@ -0,0 +1,131 @@
+
+#ifndef FILEINDEX_H_
+#define FILEINDEX_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size of the buffers for the paths of the index and of the indexed files */
+#define FILEINDEX_PATH_SZ 4096
+
+/*
+ * Minimum age of the index, in seconds, before a failed lookup updates it.
+ * Updating it reads every directory, so names that are not files (e.g. in
+ * compiler messages) shouldn't do it often.
+ */
+#define FILEINDEX_MIN_AGE 30
+
+/* Values of 'FileIndexEntry.subdir' for entries that are not directories */
+#define FILEINDEX_FILE     (-1)
+#define FILEINDEX_VANISHED (-2) /* Directory that was removed while indexing */
+
+/*
+ * Directory inside a 'FileIndex'. Its entries are 'FileIndex.entries[first]'
+ * to 'FileIndex.entries[first + num - 1]', sorted by name.
+ */
+typedef struct FileIndexDir {
+    int32_t path; /* Offset in 'FileIndex.strings' */
+    int32_t first, num;
+    int64_t mtime_ns;
+} FileIndexDir;
+
+typedef struct FileIndexEntry {
+    int32_t name;   /* Offset in 'FileIndex.strings' */
+    int32_t dir;    /* Index of the directory that contains it */
+    int32_t subdir; /* Index of the directory itself, or FILEINDEX_FILE */
+    uint32_t hash;  /* Of the name */
+} FileIndexEntry;
+
+/*
+ * Index of the names of the files inside some directories (the roots of the
+ * projects of the user), mapped in memory.
+ *
+ * The files are found with a hash table of their names: the files whose hash
+ * modulo 'buckets_num' is B are the entries 'order[buckets[B]]' to
+ * 'order[buckets[B + 1] - 1]'. The modification time of each directory is
+ * stored too, so 'fileindex_update' only needs to read the directories that
+ * changed since the last update.
+ */
+typedef struct FileIndex {
+    void* map;
+    size_t map_sz;
+    int64_t built; /* Time of the update that wrote the index */
+
+    const FileIndexDir* dirs;
+    int32_t dirs_num;
+    const FileIndexEntry* entries;
+    int32_t entries_num;
+    const int32_t* order;
+    int32_t files_num;
+    const uint32_t* buckets;
+    uint32_t buckets_num;
+    const char* strings;
+    int32_t strings_sz;
+} FileIndex;
+
+/*
+ * Write the path of the index of the 'roots', a list of directories separated
+ * by ':', to 'buf', which has 'buf_sz' bytes. The index is stored in
+ * "$XDG_CACHE_HOME/plumber" or in "$HOME/.cache/plumber". Returns false if the
+ * path can't be built.
+ */
+bool fileindex_path(const char* roots, char* buf, size_t buf_sz);
+
+/*
+ * Map the index at 'path' in memory. Returns false if it doesn't exist, or if
+ * it was written by a different version of the program. The index should be
+ * closed with 'fileindex_close'.
+ */
+bool fileindex_open(FileIndex* index, const char* path);
+
+/*
+ * Unmap an index opened with 'fileindex_open'.
+ */
+void fileindex_close(FileIndex* index);
+
+/*
+ * Write the index of the 'roots' to 'path', reusing the entries of the
+ * directories whose modification time didn't change since the last update.
+ * Hidden files and directories are ignored, and symbolic links are not
+ * followed. The index is replaced atomically. Returns false on errors.
+ */
+bool fileindex_update(const char* roots, const char* path);
+
+/*
+ * Find an existing file whose path ends with the 'len' bytes of 'name' (e.g.
+ * "foo.c" or "src/foo.c"), and write its path to 'buf', which has 'buf_sz'
+ * bytes. If multiple files match, the one closest to 'cwd' is used. Returns
+ * false if there are none.
+ */
+bool fileindex_find(const FileIndex* index, const char* name, size_t len,
+                    const char* cwd, char* buf, size_t buf_sz);
+
+/*
+ * Resolve the path at the start of the 'len' bytes of 'str', which ends before
+ * the first ':' or '(' (e.g. "foo.c:42"), if it doesn't exist relative to
+ * 'cwd' (or the current directory, if NULL). The file is looked up in the index
+ * of the directories of "$PLUMBER_ROOTS". If it's not found, and the index is
+ * older than FILEINDEX_MIN_AGE, the index is updated if 'update' is true;
+ * otherwise, the threads waiting in 'fileindex_wait_miss' are woken up, and the
+ * file is not resolved. On success, the resolved path followed by the rest of
+ * 'str' is written to 'buf', which has 'buf_sz' bytes, and its length is
+ * returned. Otherwise, returns zero.
+ */
+size_t fileindex_resolve(const char* cwd, const char* str, size_t len,
+                         char* buf, size_t buf_sz, bool update);
+
+/*
+ * Wait until 'fileindex_resolve' doesn't find a file in an outdated index that
+ * it didn't update, so the caller can update it with 'fileindex_refresh'
+ * without delaying the lookups. It's a cancellation point.
+ */
+void fileindex_wait_miss(void);
+
+/*
+ * Update the index of the directories of "$PLUMBER_ROOTS", unless it was
+ * updated less than FILEINDEX_MIN_AGE seconds ago. Returns false on errors.
+ */
+bool fileindex_refresh(void);
+
+#endif /* FILEINDEX_H_ */
@@ -0,0 +1,300 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE /* struct ucred */
+
+#include "ipc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "util.h"
+
+/* Maximum number of pending connections, see listen(2) */
+#define LISTEN_BACKLOG 64
+
+/* Used when "$XDG_RUNTIME_DIR" is not set, see 'ipc_socket_path' */
+#define FALLBACK_DIR "/tmp/plumber-%d"
+
+/*----------------------------------------------------------------------------*/
+
+static bool fill_addr(struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    return ipc_socket_path(addr->sun_path, sizeof(addr->sun_path));
+}
+
+static bool write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        const ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += written;
+        len -= written;
+    }
+    return true;
+}
+
+/*
+ * Check if the socket path is inside FALLBACK_DIR, which is in a directory that
+ * every user can write to.
+ */
+static bool uses_fallback(void) {
+    const char* env = getenv("PLUMBER_SOCKET");
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    return (env == NULL || *env == '\0') && (dir == NULL || *dir == '\0');
+}
+
+/*
+ * Create FALLBACK_DIR, only accessible by our user. If it already exists, it
+ * must be a directory owned by us, and not accessible by other users;
+ * otherwise, someone else could replace our socket. Returns false if it can't
+ * be used.
+ */
+static bool make_private_dir(void) {
+    char dir[sizeof(((struct sockaddr_un*)NULL)->sun_path)];
+    snprintf(dir, sizeof(dir), FALLBACK_DIR, (int)getuid());
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        ERR("Could not create '%s': %s", dir, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != getuid() || (st.st_mode & 0077) != 0) {
+        ERR("Refusing to use '%s', it's not a private directory.", dir);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Remove the socket at 'path' if it's stale, i.e. if it's a socket owned by
+ * our user. Returns false if there is something else at that path.
+ */
+static bool remove_stale(const char* path) {
+    struct stat st;
+    if (lstat(path, &st) != 0)
+        return errno == ENOENT;
+
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid()) {
+        ERR("Refusing to replace '%s', it's not our socket.", path);
+        return false;
+    }
+
+    return unlink(path) == 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool ipc_socket_path(char* buf, size_t buf_sz) {
+    int written;
+
+    const char* env = getenv("PLUMBER_SOCKET");
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    if (env != NULL && *env != '\0')
+        written = snprintf(buf, buf_sz, "%s", env);
+    else if (dir != NULL && *dir != '\0')
+        written = snprintf(buf, buf_sz, "%s/plumber.sock", dir);
+    else
+        written = snprintf(buf, buf_sz, FALLBACK_DIR "/plumber.sock",
+                           (int)getuid());
+
+    return written > 0 && (size_t)written < buf_sz;
+}
+
+int ipc_connect(void) {
+    struct sockaddr_un addr;
+    if (!fill_addr(&addr))
+        return -1;
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    /* Don't hang forever if the daemon is stuck; we can fall back */
+    const struct timeval timeout = {
+        .tv_sec  = IPC_TIMEOUT_MS / 1000,
+        .tv_usec = (IPC_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    /*
+     * We execute the commands of the replies, so the daemon must be ours, and
+     * not a server of another user listening on the same path.
+     */
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+        cred_len != sizeof(cred) || cred.uid != getuid()) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int ipc_listen(void) {
+    struct sockaddr_un addr;
+    if (!fill_addr(&addr)) {
+        ERR("Socket path is too long.");
+        return -1;
+    }
+
+    if (uses_fallback() && !make_private_dir())
+        return -1;
+
+    /* Another daemon is already listening */
+    const int other = ipc_connect();
+    if (other >= 0) {
+        close(other);
+        ERR("Daemon already running at '%s'.", addr.sun_path);
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ERR("Could not create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Remove the stale socket, and only allow connections from our user */
+    if (!remove_stale(addr.sun_path)) {
+        close(fd);
+        return -1;
+    }
+    const mode_t old_umask = umask(0077);
+    const int bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_umask);
+
+    if (bound != 0 || listen(fd, LISTEN_BACKLOG) != 0) {
+        ERR("Could not listen on '%s': %s", addr.sun_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+size_t ipc_pack(char* buf, size_t buf_sz, const char* const* strs, int num) {
+    size_t len = sizeof(ipc_len_t);
+    for (int i = 0; i < num; i++) {
+        const size_t str_len = strlen(strs[i]) + 1;
+        if (len + str_len > buf_sz || len + str_len > IPC_MAX_FRAME)
+            return 0;
+
+        memcpy(&buf[len], strs[i], str_len);
+        len += str_len;
+    }
+
+    const ipc_len_t payload = len - sizeof(ipc_len_t);
+    memcpy(buf, &payload, sizeof(ipc_len_t));
+    return len;
+}
+
+long ipc_frame_size(const char* buf, size_t len) {
+    if (len < sizeof(ipc_len_t))
+        return 0;
+
+    ipc_len_t payload;
+    memcpy(&payload, buf, sizeof(ipc_len_t));
+    if (payload > IPC_MAX_FRAME - sizeof(ipc_len_t))
+        return -1;
+
+    const size_t total = sizeof(ipc_len_t) + payload;
+    return (len >= total) ? (long)total : 0;
+}
+
+int ipc_unpack(const char* frame, const char** strs, int max) {
+    ipc_len_t payload;
+    memcpy(&payload, frame, sizeof(ipc_len_t));
+
+    const char* str = frame + sizeof(ipc_len_t);
+    const char* end = str + payload;
+
+    /* The last string must be terminated */
+    if (payload > 0 && end[-1] != '\0')
+        return -1;
+
+    int num = 0;
+    while (str < end) {
+        if (num >= max)
+            return -1;
+        strs[num++] = str;
+        str += strlen(str) + 1;
+    }
+
+    strs[num] = NULL;
+    return num;
+}
+
+int ipc_request(int fd,
+                const char* const* strs,
+                int num,
+                char* buf,
+                size_t buf_sz,
+                const char** reply,
+                int max) {
+    const size_t len = ipc_pack(buf, buf_sz, strs, num);
+    if (len == 0 || !write_all(fd, buf, len))
+        return -1;
+
+    size_t received = 0;
+    long frame_size;
+    while ((frame_size = ipc_frame_size(buf, received)) == 0) {
+        if (received >= buf_sz)
+            return -1;
+
+        const ssize_t got = read(fd, &buf[received], buf_sz - received);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        received += got;
+    }
+
+    if (frame_size < 0)
+        return -1;
+
+    return ipc_unpack(buf, reply, max);
+}
@@ -0,0 +1,92 @@
+
+#ifndef IPC_H_
+#define IPC_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Messages between plumber(1) and plumberd(1) are frames of NUL-terminated
+ * strings, prefixed by the size of the payload. Requests start with the name
+ * of the request (see below), and replies start with the index of the matched
+ * rule, or "-1".
+ */
+typedef uint32_t ipc_len_t;
+
+/* Maximum size of a frame, including the header */
+#define IPC_MAX_FRAME 65536
+
+/* Maximum number of strings in a frame */
+#define IPC_MAX_STRINGS 16
+
+/* Timeout of the client for each read or write to the socket */
+#define IPC_TIMEOUT_MS 1000
+
+/*
+ * Requests:
+ *   - "classify" [CWD] ARG: Reply with the rule index, and the argument vector
+ *     that should be executed. If 'ARG' is a relative path, it's relative to
+ *     the optional 'CWD' directory.
+ *   - "launch" CWD ARG: Execute the command in the background, from the 'CWD'
+ *     directory, and reply with the rule index.
+ */
+#define IPC_CLASSIFY "classify"
+#define IPC_LAUNCH   "launch"
+
+/*
+ * Write the path of the daemon socket to 'buf'. It's "$PLUMBER_SOCKET" if set,
+ * "$XDG_RUNTIME_DIR/plumber.sock" otherwise, or "/tmp/plumber-UID/plumber.sock"
+ * as a last resort. Returns false if it doesn't fit.
+ */
+bool ipc_socket_path(char* buf, size_t buf_sz);
+
+/*
+ * Connect to the daemon socket. Returns the file descriptor, or -1 if the
+ * daemon is not running, or if the process listening on the socket belongs to
+ * another user.
+ */
+int ipc_connect(void);
+
+/*
+ * Bind and listen on the daemon socket, removing it first if it's stale. In
+ * the last resort directory of 'ipc_socket_path', the directory is created
+ * only accessible by our user. Files that are not sockets of our user are never
+ * removed. Returns a non-blocking file descriptor, or -1 on error.
+ */
+int ipc_listen(void);
+
+/*
+ * Write a frame with the 'num' strings in 'strs' to 'buf', returning its size,
+ * or zero if it doesn't fit in 'buf_sz' bytes.
+ */
+size_t ipc_pack(char* buf, size_t buf_sz, const char* const* strs, int num);
+
+/*
+ * Get the total size of the frame at the start of 'buf', if the first 'len'
+ * bytes contain a full frame. Returns zero if the frame is incomplete, or -1 if
+ * it's invalid.
+ */
+long ipc_frame_size(const char* buf, size_t len);
+
+/*
+ * Split the strings of a complete frame, storing up to 'max' of them in 'strs',
+ * followed by NULL; so it should have room for 'max + 1' elements. Returns the
+ * number of strings, or -1 if the frame is invalid.
+ */
+int ipc_unpack(const char* frame, const char** strs, int max);
+
+/*
+ * Send a request with the 'num' strings in 'strs' to the daemon, and wait for
+ * the reply, which is stored in 'buf' and split into 'reply' (see
+ * 'ipc_unpack'). Returns the number of strings in the reply, or -1 on error.
+ */
+int ipc_request(int fd,
+                const char* const* strs,
+                int num,
+                char* buf,
+                size_t buf_sz,
+                const char** reply,
+                int max);
+
+#endif /* IPC_H_ */
@@ -0,0 +1,415 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE /* POSIX_SPAWN_SETSID, posix_spawn_file_actions_*_np */
+
+#include "launch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <regex.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "dedup.h"
+#include "nvim.h"
+#include "rules.h"
+#include "trace.h"
+
+/* Editor that can be reused through its socket, see "nvim.h" */
+#define REMOTE_EDITOR "nvim"
+
+/* Terminal used for the rules with LAUNCHMODE_TERMINAL */
+#define TERMINAL_CMD "st"
+#define TERMINAL_ARG "-e"
+
+/*
+ * The posix_spawn(3) file actions for changing the directory of the child and
+ * for closing its descriptors are extensions of glibc 2.34. Without them, the
+ * child is created with fork(2) instead. It can be overridden by defining it
+ * as 0 or 1.
+ */
+#ifndef LAUNCH_SPAWN_NP
+#if defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 34)
+#define LAUNCH_SPAWN_NP 1
+#endif
+#endif
+#endif
+#ifndef LAUNCH_SPAWN_NP
+#define LAUNCH_SPAWN_NP 0
+#endif
+
+/*
+ * Buffer where the arguments are written, one after the other.
+ */
+typedef struct Arena {
+    char* buf;
+    size_t sz, len;
+    bool ok; /* False if something didn't fit */
+} Arena;
+
+/*----------------------------------------------------------------------------*/
+
+static void arena_write(Arena* arena, const char* str, size_t len) {
+    if (arena->len + len > arena->sz) {
+        arena->ok = false;
+        return;
+    }
+
+    memcpy(&arena->buf[arena->len], str, len);
+    arena->len += len;
+}
+
+/*
+ * Write the group 'group' of 'str' to the arena, or 'fallback' if it's empty
+ * or if it didn't participate in the match.
+ */
+static void write_group(Arena* arena, const char* str, const regmatch_t* groups,
+                        int group, const char* fallback, size_t fallback_len) {
+    const regmatch_t* match = &groups[group];
+    if (match->rm_so >= 0 && match->rm_eo > match->rm_so)
+        arena_write(arena, &str[match->rm_so], match->rm_eo - match->rm_so);
+    else
+        arena_write(arena, fallback, fallback_len);
+}
+
+/*
+ * Expand the 'template' with the 'groups' of 'str', as described in
+ * 'launch_argv', and return the null-terminated result inside the arena.
+ */
+static const char* expand_template(Arena* arena, const char* template,
+                                   const char* str, const regmatch_t* groups) {
+    const char* result = &arena->buf[arena->len];
+
+    const char* p = template;
+    while (*p != '\0') {
+        const char* dollar = strchr(p, '$');
+        if (dollar == NULL) {
+            arena_write(arena, p, strlen(p));
+            break;
+        }
+        arena_write(arena, p, dollar - p);
+        p = dollar + 1;
+
+        if (*p == '$') {
+            arena_write(arena, "$", 1);
+            p++;
+        } else if (isdigit((unsigned char)*p)) {
+            write_group(arena, str, groups, *p - '0', "", 0);
+            p++;
+        } else if (*p == '{' && isdigit((unsigned char)p[1]) &&
+                   !strncmp(&p[2], ":-", 2) && strchr(p, '}') != NULL) {
+            const char* fallback = &p[4];
+            const char* end      = strchr(fallback, '}');
+            write_group(arena, str, groups, p[1] - '0', fallback,
+                        end - fallback);
+            p = end + 1;
+        } else {
+            /* Not a reference, so it's a literal dollar sign */
+            arena_write(arena, "$", 1);
+        }
+    }
+
+    arena_write(arena, "", 1);
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+
+size_t launch_argv_size(const RuleSet* set, int rule, size_t len) {
+    const char* const* args = set->rules[rule].args;
+    if (args == NULL)
+        return len + 1;
+
+    /* Each reference is replaced by a group or a default, up to 'len' bytes */
+    size_t size = 0;
+    for (int i = 0; args[i] != NULL; i++) {
+        size += strlen(args[i]) + 1;
+        for (const char* p = args[i]; (p = strchr(p, '$')) != NULL; p++)
+            size += len;
+    }
+
+    return size;
+}
+
+int launch_argv(const RuleSet* set, int rule, const char* str, size_t len,
+                char* buf, size_t buf_sz, const char** argv) {
+    const Rule* r = &set->rules[rule];
+    Arena arena   = {
+          .buf = buf,
+          .sz  = buf_sz,
+          .len = 0,
+          .ok  = true,
+    };
+
+    int argc = 0;
+
+    /* Execute command from new st(1) instance */
+    if (r->mode == LAUNCHMODE_TERMINAL) {
+        argv[argc++] = TERMINAL_CMD;
+        argv[argc++] = TERMINAL_ARG;
+    }
+
+    argv[argc++] = r->cmd;
+
+    if (r->args == NULL) {
+        argv[argc++] = &arena.buf[arena.len];
+        arena_write(&arena, str, len);
+        arena_write(&arena, "", 1);
+    } else {
+        /*
+         * The rule was already matched, probably by the DFA, which doesn't
+         * know the position of the groups.
+         */
+        regmatch_t groups[LAUNCH_MAX_GROUPS];
+        groups[0].rm_so = 0;
+        groups[0].rm_eo = len;
+        if (!set->is_compiled[rule] ||
+            regexec(&set->compiled[rule], str, LAUNCH_MAX_GROUPS, groups,
+                    REG_STARTEND) != 0)
+            return -1;
+
+        for (int i = 0; r->args[i] != NULL && argc < LAUNCH_MAX_ARGS; i++)
+            argv[argc++] = expand_template(&arena, r->args[i], str, groups);
+    }
+
+    argv[argc] = NULL;
+    return arena.ok ? argc : -1;
+}
+
+/*
+ * Check if the command 'other' has a single argument after the first 'prefix'
+ * elements of 'cmd', see 'launch_group'.
+ */
+static bool same_prefix(const LaunchCommand* cmd, const LaunchCommand* other,
+                        int prefix) {
+    if (other->argv == NULL || !other->ends_with_arg)
+        return false;
+
+    for (int i = 0; i < prefix; i++)
+        if (other->argv[i] == NULL || strcmp(cmd->argv[i], other->argv[i]))
+            return false;
+
+    return other->argv[prefix] != NULL && other->argv[prefix + 1] == NULL;
+}
+
+int launch_group(LaunchCommand* cmds, int num, int first, const char** argv) {
+    LaunchCommand* cmd = &cmds[first];
+    cmd->grouped       = true;
+
+    int argc = 0;
+    while (cmd->argv[argc] != NULL) {
+        argv[argc] = cmd->argv[argc];
+        argc++;
+    }
+    if (!cmd->ends_with_arg || argc < 2) {
+        argv[argc] = NULL;
+        return argc;
+    }
+
+    const int prefix = argc - 1;
+    for (int i = first + 1; i < num; i++) {
+        if (cmds[i].grouped || !same_prefix(cmd, &cmds[i], prefix))
+            continue;
+        cmds[i].grouped = true;
+
+        /* Opening the same file twice is usually not useful */
+        const char* arg = cmds[i].argv[prefix];
+        bool repeated   = false;
+        for (int j = prefix; j < argc && !repeated; j++)
+            repeated = !strcmp(argv[j], arg);
+        if (!repeated)
+            argv[argc++] = arg;
+    }
+
+    argv[argc] = NULL;
+    return argc;
+}
+
+bool launch_remote(const char* cwd, const char* const* argv) {
+    /* The command itself, even if it would be executed from a terminal */
+    if (!strcmp(argv[0], TERMINAL_CMD) && argv[1] != NULL &&
+        !strcmp(argv[1], TERMINAL_ARG))
+        argv += 2;
+    if (argv[0] == NULL || argv[1] == NULL)
+        return false;
+
+    const char* slash = strrchr(argv[0], '/');
+    const char* cmd   = (slash == NULL) ? argv[0] : slash + 1;
+
+    enum ENvimRequest req;
+    if (!strcmp(cmd, REMOTE_EDITOR))
+        req = NVIM_EDIT;
+    else if (!strcmp(argv[0], rule_kind_cmd(RULE_MAN)) && argv[2] == NULL)
+        req = NVIM_MAN;
+    else
+        return false;
+
+    char path[NVIM_PATH_SZ];
+    if (!nvim_socket_path(path, sizeof(path)))
+        return false;
+
+    const int64_t start = TRACE_START();
+    const bool ok       = nvim_open(path, req, cwd, &argv[1]);
+    TRACE_END(TRACE_REMOTE, -1, start);
+    return ok;
+}
+
+#if LAUNCH_SPAWN_NP
+bool launch_detached(const char* cwd, const char* const* argv) {
+    extern char** environ;
+
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return false;
+
+    posix_spawnattr_t attr;
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return false;
+    }
+
+    /*
+     * The command shouldn't inherit the sockets of the daemon, or the signals
+     * that the caller blocks or ignores.
+     */
+    sigset_t no_signals, default_signals;
+    sigemptyset(&no_signals);
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    sigaddset(&default_signals, SIGCHLD);
+
+    bool ok =
+      posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                       O_RDONLY, 0) == 0 &&
+      posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1) ==
+        0 &&
+      (cwd == NULL ||
+       posix_spawn_file_actions_addchdir_np(&actions, cwd) == 0) &&
+      posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID |
+                                        POSIX_SPAWN_SETSIGMASK |
+                                        POSIX_SPAWN_SETSIGDEF) == 0 &&
+      posix_spawnattr_setsigmask(&attr, &no_signals) == 0 &&
+      posix_spawnattr_setsigdefault(&attr, &default_signals) == 0;
+
+    /*
+     * Unlike fork(2), this doesn't copy the memory of the caller, and it
+     * returns as soon as the command is executed.
+     */
+    pid_t pid;
+    if (ok) {
+        const int64_t start = TRACE_START();
+        ok = posix_spawnp(&pid, argv[0], &actions, &attr, (char* const*)argv,
+                          environ) == 0;
+        TRACE_END(TRACE_EXEC, -1, start);
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return ok;
+}
+#else  /* !LAUNCH_SPAWN_NP */
+/*
+ * Prepare the child like the file actions and attributes of the posix_spawn(3)
+ * version, and execute the command. If it fails, 'errno' is written to
+ * 'err_fd', which is closed on success.
+ */
+static void exec_child(const char* cwd, const char* const* argv, int err_fd,
+                       long max_fd) {
+    setsid();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGPIPE, &action, NULL);
+    sigaction(SIGCHLD, &action, NULL);
+
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    sigprocmask(SIG_SETMASK, &no_signals, NULL);
+
+    const int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd >= 0 && dup2(null_fd, STDIN_FILENO) >= 0 &&
+        (cwd == NULL || chdir(cwd) == 0)) {
+        for (long fd = STDERR_FILENO + 1; fd < max_fd; fd++)
+            if (fd != err_fd)
+                close(fd);
+        execvp(argv[0], (char* const*)argv);
+    }
+
+    const int err = errno;
+    if (write(err_fd, &err, sizeof(err)) < 0)
+        _exit(126);
+    _exit(127);
+}
+
+bool launch_detached(const char* cwd, const char* const* argv) {
+    /* Reports the errors of the child, it's closed when the command starts */
+    int err_pipe[2];
+    if (pipe(err_pipe) != 0)
+        return false;
+    fcntl(err_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(err_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0)
+        max_fd = 1024;
+
+    const int64_t start = TRACE_START();
+    const pid_t pid     = fork();
+    if (pid == 0)
+        exec_child(cwd, argv, err_pipe[1], max_fd);
+    close(err_pipe[1]);
+
+    int err = 0;
+    ssize_t got;
+    do {
+        got = read(err_pipe[0], &err, sizeof(err));
+    } while (got < 0 && errno == EINTR);
+    close(err_pipe[0]);
+    TRACE_END(TRACE_EXEC, -1, start);
+
+    /* The child exited without executing the command */
+    if (pid > 0 && got != 0)
+        waitpid(pid, NULL, 0);
+
+    return pid > 0 && got == 0;
+}
+#endif /* !LAUNCH_SPAWN_NP */
+
+bool launch_command(const char* cwd, const char* const* argv) {
+    uint32_t window_ms = LAUNCH_DEDUP_MS;
+    const char* env    = getenv("PLUMBER_DEDUP_MS");
+    if (env != NULL && *env != '\0')
+        window_ms = strtoul(env, NULL, 10);
+
+    if (dedup_check(cwd, argv, window_ms))
+        return true;
+
+    return launch_remote(cwd, argv) || launch_detached(cwd, argv);
+}
@@ -0,0 +1,98 @@
+
+#ifndef LAUNCH_H_
+#define LAUNCH_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "rules.h"
+
+/*
+ * Maximum number of arguments in the vector built by 'launch_argv', not
+ * including the terminating NULL.
+ */
+#define LAUNCH_MAX_ARGS 8
+
+/*
+ * Maximum number of groups of a pattern that can be used in the argument
+ * templates, including the whole match ("$0").
+ */
+#define LAUNCH_MAX_GROUPS 10
+
+/*
+ * Milliseconds during which launching the same command again is ignored, see
+ * 'launch_command'. It can be overwritten with "$PLUMBER_DEDUP_MS".
+ */
+#define LAUNCH_DEDUP_MS 500
+
+/*
+ * Command for opening a single argument, see 'launch_group'.
+ */
+typedef struct LaunchCommand {
+    const char* const* argv; /* NULL-terminated, or NULL if no rule matched */
+    bool ends_with_arg;      /* Only the last element is the argument */
+    bool grouped;            /* Already part of a command of 'launch_group' */
+} LaunchCommand;
+
+/*
+ * Return the size of the buffer needed by 'launch_argv' for building the
+ * arguments of the specified rule with a string of 'len' bytes.
+ */
+size_t launch_argv_size(const RuleSet* set, int rule, size_t len);
+
+/*
+ * Build the argument vector for executing the command of the specified rule
+ * with the 'len' bytes of 'str', which were matched by the rule. The vector is
+ * NULL-terminated, and it should have room for LAUNCH_MAX_ARGS + 1 elements.
+ * The arguments are written to 'buf', which should have 'buf_sz' bytes (see
+ * 'launch_argv_size'). Returns the number of arguments, or -1 on errors.
+ *
+ * The arguments of the rule are built from its templates, where "$N" is
+ * replaced by the N-th group of the pattern (or by an empty string, if it
+ * didn't participate in the match), "${N:-TEXT}" is the same but with a default
+ * text, and "$$" is a literal dollar sign. If the rule has no templates, the
+ * only argument is 'str'.
+ */
+int launch_argv(const RuleSet* set, int rule, const char* str, size_t len,
+                char* buf, size_t buf_sz, const char** argv);
+
+/*
+ * Open the arguments of the command in 'argv' in a running editor, instead of
+ * executing it: if the command is nvim(1) or man(1), and an nvim instance is
+ * listening on the socket of 'nvim_socket_path'. Relative paths are relative
+ * to 'cwd', if not NULL. Returns false if the command should be executed.
+ */
+bool launch_remote(const char* cwd, const char* const* argv);
+
+/*
+ * Execute the command in 'argv' in the background, from the 'cwd' directory,
+ * or from the current one if it's NULL. The command runs in a new session,
+ * with its standard input from "/dev/null" and without the other descriptors
+ * of the caller, which doesn't need to wait for it; but the process is still
+ * its child, so it should ignore SIGCHLD if it doesn't exit soon. Returns false
+ * if the process couldn't be created.
+ */
+bool launch_detached(const char* cwd, const char* const* argv);
+
+/*
+ * Launch the command in 'argv' from 'cwd', or from the current directory if
+ * it's NULL: in a running editor if possible (see 'launch_remote'), or with
+ * 'launch_detached' otherwise. If the same command was launched from the same
+ * directory in the last LAUNCH_DEDUP_MS milliseconds, e.g. because of a double
+ * click, it's not launched again, and true is returned. Returns false if the
+ * command couldn't be launched.
+ */
+bool launch_command(const char* cwd, const char* const* argv);
+
+/*
+ * Build in 'argv' a single command for opening the argument of 'cmds[first]'
+ * and the arguments of the next commands (up to 'num') that only differ from it
+ * in the last element, e.g. "nsxiv a.png b.png" from "nsxiv a.png" and "nsxiv
+ * b.png". Commands that don't end with their argument are never grouped, and
+ * repeated arguments are only added once. The commands that were used are
+ * marked as grouped. The vector is NULL-terminated, and it should have room for
+ * LAUNCH_MAX_ARGS + num + 1 elements. Returns the number of arguments.
+ */
+int launch_group(LaunchCommand* cmds, int num, int first, const char** argv);
+
+#endif /* LAUNCH_H_ */
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "linecache.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extract.h"
+#include "rules.h"
+#include "util.h"
+
+/* Number of entries of the cache for each row of the terminal */
+#define ENTRIES_PER_ROW 4
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Hash the contents of a line, 8 bytes at a time.
+ */
+static uint64_t hash_line(const char* text, size_t len) {
+    const uint64_t mul = 0x9E3779B97F4A7C15ULL;
+
+    uint64_t hash = len * mul;
+    size_t i      = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, &text[i], sizeof(word));
+        hash = (hash ^ word) * mul;
+        hash ^= hash >> 32;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, &text[i], len - i);
+    hash = (hash ^ tail) * mul;
+    return hash ^ (hash >> 29);
+}
+
+/*
+ * Same as 'reserve' in "dfa.c".
+ */
+static bool reserve(void* arr, int* sz, int num, size_t elem_sz) {
+    if (num <= *sz)
+        return true;
+
+    int new_sz = (*sz > 0) ? *sz : 16;
+    while (new_sz < num)
+        new_sz *= 2;
+
+    void* new_arr = realloc(*(void**)arr, new_sz * elem_sz);
+    if (new_arr == NULL)
+        return false;
+
+    *(void**)arr = new_arr;
+    *sz          = new_sz;
+    return true;
+}
+
+static bool push_span(LineCache* cache, int* num, const ExtractSpan* span) {
+    if (!reserve(&cache->scratch, &cache->scratch_sz, *num + 1,
+                 sizeof(ExtractSpan)))
+        return false;
+
+    cache->scratch[(*num)++] = *span;
+    return true;
+}
+
+/*
+ * Scan the bytes of 'text' in ['start', 'end'), which should be word
+ * boundaries, and append the spans to the scratch buffer.
+ */
+static bool scan_region(LineCache* cache, int* num, const char* text,
+                        size_t start, size_t end) {
+    Extractor* ex = &cache->extractor;
+    extract_init(ex, cache->rules, &text[start], end - start);
+    cache->scanned += end - start;
+
+    ExtractSpan span;
+    while (extract_next(ex, &span)) {
+        span.off += start;
+        if (!push_span(cache, num, &span))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Find the spans of 'text' in the scratch buffer, reusing the spans of 'base',
+ * which contains the previous text of the same row. Returns the number of
+ * spans, or -1 on allocation errors.
+ */
+static int scan_changes(LineCache* cache, const LineEntry* base,
+                        const char* text, size_t len) {
+    int num = 0;
+    if (base == NULL)
+        return scan_region(cache, &num, text, 0, len) ? num : -1;
+
+    /* Bytes that didn't change at the start and at the end of the line */
+    const size_t max = (base->len < len) ? base->len : len;
+    size_t prefix    = 0;
+    while (prefix < max && base->text[prefix] == text[prefix])
+        prefix++;
+    size_t suffix = 0;
+    while (suffix < max - prefix &&
+           base->text[base->len - suffix - 1] == text[len - suffix - 1])
+        suffix++;
+
+    /*
+     * Extend the modified region to the surrounding word boundaries, since a
+     * word that crosses the edit might have changed its meaning.
+     */
+    size_t start = prefix;
+    while (start > 0 && !extract_is_delimiter(text[start - 1]))
+        start--;
+    size_t end = len - suffix;
+    while (end < len && !extract_is_delimiter(text[end]))
+        end++;
+
+    /* The same region in the old line, whose spans are discarded */
+    const size_t old_end = end + base->len - len;
+
+    for (int i = 0; i < base->spans_num; i++) {
+        const ExtractSpan* span = &base->spans[i];
+        if (span->off + span->len <= start && !push_span(cache, &num, span))
+            return -1;
+    }
+
+    if (!scan_region(cache, &num, text, start, end))
+        return -1;
+
+    for (int i = 0; i < base->spans_num; i++) {
+        ExtractSpan span = base->spans[i];
+        if (span.off < old_end)
+            continue;
+
+        span.off = span.off + len - base->len;
+        if (!push_span(cache, &num, &span))
+            return -1;
+    }
+
+    return num;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool linecache_init(LineCache* cache, RuleSet* rules, int rows) {
+    if (rows < 1)
+        rows = 1;
+
+    int entries = 1;
+    while (entries < rows * ENTRIES_PER_ROW)
+        entries *= 2;
+
+    cache->rules      = rules;
+    cache->entries_sz = entries;
+    cache->entries    = calloc(entries, sizeof(LineEntry));
+    cache->rows       = malloc(rows * sizeof(int));
+    cache->row_hashes = malloc(rows * sizeof(uint64_t));
+    cache->rows_num   = rows;
+    cache->scratch    = NULL;
+    cache->scratch_sz = 0;
+    cache->scanned    = 0;
+    if (cache->entries == NULL || cache->rows == NULL ||
+        cache->row_hashes == NULL) {
+        ERR("Could not allocate the line cache.");
+        linecache_free(cache);
+        return false;
+    }
+
+    for (int i = 0; i < rows; i++)
+        cache->rows[i] = -1;
+
+    return true;
+}
+
+void linecache_free(LineCache* cache) {
+    if (cache->entries != NULL) {
+        for (int i = 0; i < cache->entries_sz; i++) {
+            free(cache->entries[i].text);
+            free(cache->entries[i].spans);
+        }
+    }
+
+    free(cache->entries);
+    free(cache->rows);
+    free(cache->row_hashes);
+    free(cache->scratch);
+    cache->entries = NULL;
+    cache->rows    = NULL;
+    cache->scratch = NULL;
+}
+
+const LineEntry* linecache_get(LineCache* cache, int row, const char* text,
+                               size_t len) {
+    const uint64_t hash = hash_line(text, len);
+    LineEntry* entry    = &cache->entries[hash & (cache->entries_sz - 1)];
+    const bool has_row  = (row >= 0 && row < cache->rows_num);
+
+    if (entry->used && entry->hash == hash && entry->len == len &&
+        !memcmp(entry->text, text, len)) {
+        if (has_row) {
+            cache->rows[row]       = entry - cache->entries;
+            cache->row_hashes[row] = hash;
+        }
+        return entry;
+    }
+
+    /* The previous line of the row, unless its entry was replaced */
+    const LineEntry* base = NULL;
+    if (has_row && cache->rows[row] >= 0) {
+        base = &cache->entries[cache->rows[row]];
+        if (!base->used || base->hash != cache->row_hashes[row])
+            base = NULL;
+    }
+
+    /* The spans are built in the scratch buffer, 'base' might be 'entry' */
+    const int num = scan_changes(cache, base, text, len);
+    if (num < 0)
+        return NULL;
+
+    if (len + 1 > entry->text_sz) {
+        char* new_text = realloc(entry->text, len + 1);
+        if (new_text == NULL)
+            return NULL;
+        entry->text    = new_text;
+        entry->text_sz = len + 1;
+    }
+    memcpy(entry->text, text, len);
+    entry->len  = len;
+    entry->hash = hash;
+    entry->used = true;
+
+    /* Swap the buffers, to avoid copying the spans */
+    ExtractSpan* spans = entry->spans;
+    const int spans_sz = entry->spans_sz;
+    entry->spans       = cache->scratch;
+    entry->spans_sz    = cache->scratch_sz;
+    entry->spans_num   = num;
+    cache->scratch     = spans;
+    cache->scratch_sz  = spans_sz;
+
+    if (has_row) {
+        cache->rows[row]       = entry - cache->entries;
+        cache->row_hashes[row] = hash;
+    }
+    return entry;
+}
@@ -0,0 +1,73 @@
+
+#ifndef LINECACHE_H_
+#define LINECACHE_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "extract.h"
+#include "rules.h"
+
+/*
+ * Line whose spans were found by 'linecache_get', along with a copy of its
+ * text.
+ */
+typedef struct LineEntry {
+    bool used;
+    uint64_t hash;
+    char* text;
+    size_t len, text_sz;
+    ExtractSpan* spans;
+    int spans_num, spans_sz;
+} LineEntry;
+
+/*
+ * Cache of the spans of the lines of a terminal, indexed by the hash of their
+ * contents, so lines are only scanned when they change, even if they move to a
+ * different row.
+ *
+ * When the contents of a row change, only the words around the modified bytes
+ * are scanned again, and the spans of the rest of the line are reused.
+ */
+typedef struct LineCache {
+    RuleSet* rules;
+    LineEntry* entries;
+    int entries_sz; /* Always a power of two */
+
+    /* Entry and hash of the last line of each row, for incremental scans */
+    int* rows;
+    uint64_t* row_hashes;
+    int rows_num;
+
+    Extractor extractor;
+    ExtractSpan* scratch;
+    int scratch_sz;
+
+    size_t scanned; /* Total number of bytes scanned, for statistics */
+} LineCache;
+
+/*
+ * Initialize the cache for a terminal with 'rows' rows, whose lines will be
+ * matched against 'rules'. The rule set should not be modified by matching,
+ * see 'ruleset_freeze'. Returns false on allocation errors.
+ */
+bool linecache_init(LineCache* cache, RuleSet* rules, int rows);
+
+/*
+ * Free all the memory used by the cache.
+ */
+void linecache_free(LineCache* cache);
+
+/*
+ * Return the entry with the spans of the 'len' bytes of 'text', which is
+ * currently displayed in 'row'. The entry is valid until the next call. Returns
+ * NULL on allocation errors.
+ *
+ * Rows outside of the range specified in 'linecache_init' are supported, but
+ * they are always scanned completely when they change.
+ */
+const LineEntry* linecache_get(LineCache* cache, int row, const char* text,
+                               size_t len);
+
+#endif /* LINECACHE_H_ */
@@ -0,0 +1,277 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* pread, st_mtim */
+
+#include "magic.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "rules.h"
+#include "util.h"
+
+/* Size of the buffer for joining relative paths to the working directory */
+#define MAGIC_PATH_SZ 4096
+
+/* Part of a signature: the bytes that should be at an offset of the file */
+#define PART(OFF, STR) { OFF, STR, sizeof(STR) - 1 }
+
+/*----------------------------------------------------------------------------*/
+
+typedef struct MagicPart {
+    size_t off;
+    const char* bytes;
+    size_t len;
+} MagicPart;
+
+/*
+ * Signature of a file format, which matches if all of its parts match. The
+ * signatures are checked in order.
+ */
+typedef struct Signature {
+    MagicPart parts[2];
+    enum ERuleKind kind;
+} Signature;
+
+static const Signature signatures[] = {
+    { { PART(0, "%PDF-") }, RULE_PDF },
+
+    { { PART(0, "\x89PNG\r\n\x1A\n") }, RULE_IMAGE },
+    { { PART(0, "\xFF\xD8\xFF") }, RULE_IMAGE },
+    { { PART(0, "GIF87a") }, RULE_IMAGE },
+    { { PART(0, "GIF89a") }, RULE_IMAGE },
+    { { PART(0, "RIFF"), PART(8, "WEBP") }, RULE_IMAGE },
+    { { PART(4, "ftypavif") }, RULE_IMAGE },
+    { { PART(4, "ftypheic") }, RULE_IMAGE },
+
+    { { PART(0, "\x1A\x45\xDF\xA3") }, RULE_VIDEO }, /* Matroska and WebM */
+    { { PART(0, "RIFF"), PART(8, "AVI ") }, RULE_VIDEO },
+    { { PART(4, "ftyp") }, RULE_VIDEO }, /* MP4 and QuickTime */
+    { { PART(0, "OggS") }, RULE_VIDEO },
+};
+
+/*----------------------------------------------------------------------------*/
+
+static bool matches(const Signature* sig, const unsigned char* head,
+                    size_t len) {
+    for (int i = 0; i < LENGTH(sig->parts); i++) {
+        const MagicPart* part = &sig->parts[i];
+        if (part->bytes == NULL)
+            break;
+        if (part->off + part->len > len ||
+            memcmp(&head[part->off], part->bytes, part->len) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * BMP images start with "BM", followed by the file size, 4 reserved bytes that
+ * are zero, the offset of the pixels, and the size of the DIB header, which is
+ * one of the sizes of its known versions.
+ */
+static bool is_bmp(const unsigned char* head, size_t len) {
+    static const uint32_t dib_sizes[] = { 12, 40, 52, 56, 108, 124 };
+
+    if (len < 18 || head[0] != 'B' || head[1] != 'M' ||
+        memcmp(&head[6], "\0\0\0\0", 4) != 0)
+        return false;
+
+    const uint32_t dib_size = (uint32_t)head[14] | (uint32_t)head[15] << 8 |
+                              (uint32_t)head[16] << 16 |
+                              (uint32_t)head[17] << 24;
+    for (int i = 0; i < LENGTH(dib_sizes); i++)
+        if (dib_size == dib_sizes[i])
+            return true;
+
+    return false;
+}
+
+static inline bool is_pnm_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+           c == '\f';
+}
+
+/*
+ * Netpbm images start with "P1" to "P6", followed by the width and the height
+ * as decimal numbers, and by the maximum value of a pixel except for bitmaps
+ * ("P1" and "P4"). The numbers are separated by whitespace, and comments that
+ * start with '#' can appear between them.
+ */
+static bool is_netpbm(const unsigned char* head, size_t len) {
+    if (len < 3 || head[0] != 'P' || head[1] < '1' || head[1] > '6')
+        return false;
+
+    const int numbers = (head[1] == '1' || head[1] == '4') ? 2 : 3;
+    size_t i          = 2;
+    for (int n = 0; n < numbers; n++) {
+        /* At least one whitespace character or comment before each number */
+        const size_t separator = i;
+        while (i < len && (is_pnm_space(head[i]) || head[i] == '#')) {
+            if (head[i] == '#')
+                while (i < len && head[i] != '\n')
+                    i++;
+            else
+                i++;
+        }
+        if (i == separator)
+            return false;
+
+        const size_t digits = i;
+        while (i < len && head[i] >= '0' && head[i] <= '9')
+            i++;
+        if (i == digits || (i < len && !is_pnm_space(head[i])))
+            return false;
+    }
+
+    /* A single whitespace character before the pixels */
+    return i < len;
+}
+
+/*
+ * Text files don't contain null bytes, nor control characters other than the
+ * usual whitespace, backspace, form feed and escape. Bytes above 0x7F are
+ * assumed to be part of UTF-8 sequences.
+ */
+static bool is_text(const unsigned char* head, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        const unsigned char c = head[i];
+        if (c < ' ' && c != '\t' && c != '\n' && c != '\r' && c != '\b' &&
+            c != '\f' && c != '\v' && c != 0x1B)
+            return false;
+        if (c == 0x7F)
+            return false;
+    }
+
+    return true;
+}
+
+static inline int64_t mtime_ns(const struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static MagicEntry* cache_slot(MagicCache* cache, const struct stat* st) {
+    const uint64_t key = ((uint64_t)st->st_dev * 0x9E3779B97F4A7C15ULL) ^
+                         (uint64_t)st->st_ino;
+    const uint64_t hash = key * 0xFF51AFD7ED558CCDULL;
+    return &cache->entries[(hash >> 32) & (MAGIC_CACHE_SZ - 1)];
+}
+
+static bool entry_matches(const MagicEntry* entry, const struct stat* st) {
+    return entry->used && entry->dev == st->st_dev &&
+           entry->ino == st->st_ino && entry->mtime_ns == mtime_ns(st) &&
+           entry->size == st->st_size;
+}
+
+/*
+ * Read the first bytes of the regular file at 'path', whose status should
+ * match 'st', and classify them. Returns -1 on errors too.
+ */
+static int classify_file(const char* path, const struct stat* st) {
+    const int fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    /* The file might have been replaced after checking its status */
+    struct stat fd_st;
+    if (fstat(fd, &fd_st) != 0 || !S_ISREG(fd_st.st_mode) ||
+        fd_st.st_ino != st->st_ino || fd_st.st_dev != st->st_dev) {
+        close(fd);
+        return -1;
+    }
+
+    unsigned char head[MAGIC_HEAD_SZ];
+    size_t len = 0;
+    while (len < sizeof(head)) {
+        const ssize_t got = pread(fd, &head[len], sizeof(head) - len, len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0) {
+            close(fd);
+            return -1;
+        }
+        if (got == 0)
+            break;
+        len += got;
+    }
+
+    close(fd);
+    return magic_classify_head(head, len);
+}
+
+/*----------------------------------------------------------------------------*/
+
+void magic_cache_init(MagicCache* cache) {
+    for (int i = 0; i < MAGIC_CACHE_SZ; i++)
+        cache->entries[i].used = false;
+}
+
+int magic_classify_head(const unsigned char* head, size_t len) {
+    for (int i = 0; i < LENGTH(signatures); i++)
+        if (matches(&signatures[i], head, len))
+            return signatures[i].kind;
+
+    if (is_bmp(head, len) || is_netpbm(head, len))
+        return RULE_IMAGE;
+
+    return is_text(head, len) ? RULE_EDITOR : -1;
+}
+
+int magic_classify(MagicCache* cache, const char* cwd, const char* path) {
+    if (*path == '\0')
+        return -1;
+
+    char joined[MAGIC_PATH_SZ];
+    if (cwd != NULL && *path != '/') {
+        const int written = snprintf(joined, sizeof(joined), "%s/%s", cwd,
+                                     path);
+        if (written < 0 || (size_t)written >= sizeof(joined))
+            return -1;
+        path = joined;
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+
+    MagicEntry* entry = (cache == NULL) ? NULL : cache_slot(cache, &st);
+    if (entry != NULL && entry_matches(entry, &st))
+        return entry->kind;
+
+    const int kind = classify_file(path, &st);
+    if (entry != NULL) {
+        entry->used     = true;
+        entry->dev      = st.st_dev;
+        entry->ino      = st.st_ino;
+        entry->mtime_ns = mtime_ns(&st);
+        entry->size     = st.st_size;
+        entry->kind     = kind;
+    }
+
+    return kind;
+}
@@ -0,0 +1,62 @@
+
+#ifndef MAGIC_H_
+#define MAGIC_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rules.h"
+
+/* Number of bytes read from the start of each file */
+#define MAGIC_HEAD_SZ 512
+
+/* Number of files remembered by a 'MagicCache', must be a power of two */
+#define MAGIC_CACHE_SZ 256
+
+/*
+ * Kind of a file, identified by its device, inode, modification time and size.
+ * If any of them changes, the file is read again.
+ */
+typedef struct MagicEntry {
+    bool used;
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_ns;
+    off_t size;
+    int kind; /* Result of 'magic_classify' */
+} MagicEntry;
+
+/*
+ * Results of 'magic_classify', indexed by the inode of the files. When two
+ * files share a slot, the last one replaces the other.
+ */
+typedef struct MagicCache {
+    MagicEntry entries[MAGIC_CACHE_SZ];
+} MagicCache;
+
+/*
+ * Initialize an empty cache.
+ */
+void magic_cache_init(MagicCache* cache);
+
+/*
+ * Return the kind of the regular file at 'path', from the signature of its
+ * first MAGIC_HEAD_SZ bytes: RULE_PDF, RULE_IMAGE, RULE_VIDEO, or RULE_EDITOR
+ * for text. Returns -1 if the file doesn't exist, or if its contents are not
+ * recognized.
+ *
+ * Relative paths are relative to 'cwd', if not NULL. If 'cache' is not NULL,
+ * the file is only read if it's not in the cache; otherwise, only its status is
+ * checked. The cache is not thread-safe.
+ */
+int magic_classify(MagicCache* cache, const char* cwd, const char* path);
+
+/*
+ * Same as 'magic_classify', but for the first 'len' bytes of a file, which
+ * should be MAGIC_HEAD_SZ unless the file is smaller.
+ */
+int magic_classify_head(const unsigned char* head, size_t len);
+
+#endif /* MAGIC_H_ */
@@ -18,19 +18,19 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include "pattern.h"
+#include "batch.h"
+#include "ipc.h"
+#include "launch.h"
+#include "plumber.h"
+#include "prefetch.h"
+#include "rules.h"
+#include "trace.h"
 #include "transform.h"
 #include "util.h"
-#include "config.h"
-
-/* Used to execute commands */
-#define LAUNCH(CMD, ...) execlp(CMD, CMD, __VA_ARGS__, NULL)
-
-/* Execute command from new st(1) instance */
-#define ST_LAUNCH(...) execlp("st", "st", "-e", __VA_ARGS__, NULL)
 
 /* Used for the output of "--help" */
 #define HELP_LINE(STR, DESC, ...)                                              \
@@ -46,6 +46,216 @@ enum EExitCodes {
     EXITHELP        = 3, /* The only command-line argument was '--help' */
 };
 
+/* Returned by 'classify_remote' if the daemon could not be used */
+#define DAEMON_UNAVAILABLE (-2)
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * State shared by the classification of all the arguments, see 'classify_arg'.
+ */
+typedef struct Classifier {
+    bool reference;   /* See "--reference" */
+    int daemon_fd;    /* Connection with plumberd(1), or -1 */
+    Plumber* plumber; /* Only built if the daemon can't be used */
+} Classifier;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Ask plumberd(1) to classify 'arg' through the connection in 'fd', so we don't
+ * need to build the rule set. Returns the index of the matched rule, or -1 if
+ * none matched; and the argument vector that should be executed is stored in
+ * 'cmd', which should have room for IPC_MAX_STRINGS + 1 elements, and which is
+ * only valid until the next call. If the daemon could not be used, returns
+ * DAEMON_UNAVAILABLE.
+ */
+static int classify_remote(int fd, const char* arg, const char** cmd) {
+    static char buf[IPC_MAX_FRAME];
+
+    if (fd < 0)
+        return DAEMON_UNAVAILABLE;
+
+    /* The daemon needs our directory for reading relative paths */
+    static char cwd[IPC_MAX_FRAME / 2];
+    const char* req[3];
+    int req_num    = 0;
+    req[req_num++] = IPC_CLASSIFY;
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        req[req_num++] = cwd;
+    req[req_num++] = arg;
+
+    /* The reply starts with the rule index, followed by the vector */
+    const char* reply[IPC_MAX_STRINGS + 1];
+    const int num = ipc_request(fd, req, req_num, buf, sizeof(buf), reply,
+                                IPC_MAX_STRINGS);
+    if (num < 1)
+        return DAEMON_UNAVAILABLE;
+
+    const int idx = atoi(reply[0]);
+    if (idx >= 0 && num < 2)
+        return DAEMON_UNAVAILABLE;
+
+    for (int i = 1; i <= num; i++)
+        cmd[i - 1] = reply[i];
+    return idx;
+}
+
+/*
+ * Build the rule set from the rules file of the user, if it exists, or from
+ * "config.h" otherwise.
+ */
+static bool load_rules(RuleSet* rules) {
+    const int64_t start = TRACE_START();
+
+    char path[RULES_PATH_SZ];
+    const bool has_file = ruleset_default_path(path, sizeof(path));
+    const bool ok       = ruleset_load(rules, has_file ? path : NULL);
+
+    TRACE_END(TRACE_LOAD, -1, start);
+    return ok;
+}
+
+/*
+ * Return a copy of the NULL-terminated vector 'argv', allocated as a single
+ * block, or NULL on errors.
+ */
+static const char* const* copy_argv(const char* const* argv) {
+    size_t argc = 0, size = 0;
+    for (; argv[argc] != NULL; argc++)
+        size += strlen(argv[argc]) + 1;
+
+    const char** copy = malloc((argc + 1) * sizeof(char*) + size);
+    if (copy == NULL)
+        return NULL;
+
+    char* strs = (char*)&copy[argc + 1];
+    for (size_t i = 0; i < argc; i++) {
+        const size_t len = strlen(argv[i]) + 1;
+        copy[i]          = memcpy(strs, argv[i], len);
+        strs += len;
+    }
+    copy[argc] = NULL;
+    return copy;
+}
+
+/*
+ * Find the command for opening 'arg', which might be modified, and store it in
+ * 'command'. The command is asked to the daemon if possible, or built from the
+ * rule set otherwise. Returns false if no rule matched.
+ */
+static bool classify_arg(Classifier* c, char* arg, LaunchCommand* command) {
+    command->argv          = NULL;
+    command->ends_with_arg = false;
+    command->grouped       = false;
+
+    /*
+     * Normalize the argument, e.g. removing the quotes around it. It's copied
+     * to a bigger buffer if possible, so a leading "~" can be expanded. The
+     * daemon normalizes the original argument by itself.
+     */
+    static char input[IPC_MAX_FRAME];
+    size_t len   = strlen(arg);
+    size_t size  = len + 1;
+    char* target = arg;
+    int64_t start = TRACE_START();
+    if (size <= sizeof(input)) {
+        target = memcpy(input, arg, size);
+        size   = sizeof(input);
+    }
+    target = transform_normalize(target, &len, size);
+    TRACE_END(TRACE_NORMALIZE, -1, start);
+
+    /*
+     * If the daemon is running, it already has the rule set built, and it
+     * gives us the command that we should execute. Otherwise, fall back to
+     * matching the rules ourselves.
+     */
+    const char* cmd[IPC_MAX_STRINGS + 1];
+    char* buf = NULL;
+    start     = TRACE_START();
+    int idx   = classify_remote(c->daemon_fd, arg, cmd);
+    TRACE_END(TRACE_DAEMON, idx, start);
+
+    if (idx == DAEMON_UNAVAILABLE) {
+        /* Don't try again with the next arguments */
+        if (c->daemon_fd >= 0) {
+            close(c->daemon_fd);
+            c->daemon_fd = -1;
+        }
+
+        /*
+         * Build the rule set once, and find the first rule that matches the
+         * argument. The rules are sorted by priority, see 'ruleset_init'.
+         */
+        if (c->plumber == NULL) {
+            start      = TRACE_START();
+            const int flags = c->reference ? PLUMBER_REFERENCE
+                                           : PLUMBER_REMEMBER;
+            c->plumber      = plumber_new(flags | PLUMBER_CHECK_MAN);
+            if (c->plumber == NULL)
+                return false;
+            TRACE_END(TRACE_LOAD, -1, start);
+        }
+
+        idx = plumber_classify(c->plumber, target, len);
+
+        /* Files without a known name might still be recognized */
+        if (idx < 0) {
+            start = TRACE_START();
+            idx   = plumber_classify_file(c->plumber, target);
+            TRACE_END(TRACE_SNIFF, idx, start);
+        }
+
+        /* Source files might be relative to another directory */
+        static char resolved[IPC_MAX_FRAME];
+        start = TRACE_START();
+        const size_t resolved_len =
+          (idx < 0) ? 0
+                    : plumber_resolve(c->plumber, idx, NULL, target, len,
+                                      resolved, sizeof(resolved));
+        if (resolved_len > 0 &&
+            plumber_classify(c->plumber, resolved, resolved_len) == idx) {
+            target = resolved;
+            len    = resolved_len;
+        }
+        TRACE_END(TRACE_RESOLVE, -1, start);
+
+        if (idx >= 0) {
+            start               = TRACE_START();
+            const size_t buf_sz = plumber_argv_size(c->plumber, idx, len);
+            buf                 = malloc(buf_sz);
+            if (buf == NULL || plumber_argv(c->plumber, idx, target, len, buf,
+                                            buf_sz, cmd) < 0)
+                idx = -1;
+            TRACE_END(TRACE_ARGV, idx, start);
+        }
+
+        /* The daemon does this by itself, see 'handle_request' */
+        if (idx >= 0) {
+            start = TRACE_START();
+            plumber_prefetch(c->plumber, idx, NULL, target, len);
+            TRACE_END(TRACE_PREFETCH, idx, start);
+        }
+    }
+
+    if (idx >= 0) {
+        int argc = 0;
+        while (cmd[argc] != NULL)
+            argc++;
+
+        /*
+         * The commands that only receive the argument can open the rest of
+         * the arguments with the same rule at once.
+         */
+        command->argv          = copy_argv(cmd);
+        command->ends_with_arg = argc > 1 && !strcmp(cmd[argc - 1], target);
+    }
+
+    free(buf);
+    return command->argv != NULL;
+}
+
 /*----------------------------------------------------------------------------*/
 /* Main function */
 
@@ -56,70 +266,190 @@ int main(int argc, char** argv) {
 
     if (argc == 2 && !strcmp(argv[1], "--help")) {
         fprintf(stderr,
-                "Usage: %s [REGEXP]\n"
+                "Usage: %s [--reference] [REGEXP...]\n"
+                "       %s [--reference] [--jobs N] [--existing] --batch "
+                "[--null] < INPUT\n"
+                "       %s [--reference] --batch --launch [--null] < INPUT\n"
+                "       %s [--jobs N] [--existing] --extract FILE\n"
                 "Examples:\n",
+                argv[0],
+                argv[0],
+                argv[0],
                 argv[0]);
-        HELP_LINE("https://example.com", "Open in browser (%s)", CMD_BROWSER);
-        HELP_LINE("file.pdf", "Open in PDF viewer (%s)", CMD_PDF);
-        HELP_LINE("cmd(1)", "Open man page (%s)", CMD_MAN);
-        HELP_LINE("image.png", "Open in image viewer (%s)", CMD_IMAGE);
-        HELP_LINE("video.mkv", "Open in video player (%s)", CMD_VIDEO);
-        HELP_LINE("file.txt", "Open in text editor (%s)", CMD_EDITOR);
-        HELP_LINE("source.c:13:5", "Open at line and column (%s)", CMD_EDITOR);
+        HELP_LINE("https://example.com",
+                  "Open in browser (%s)",
+                  rule_kind_cmd(RULE_URL));
+        HELP_LINE("file.pdf",
+                  "Open in PDF viewer (%s)",
+                  rule_kind_cmd(RULE_PDF));
+        HELP_LINE("cmd(1)", "Open man page (%s)", rule_kind_cmd(RULE_MAN));
+        HELP_LINE("image.png",
+                  "Open in image viewer (%s)",
+                  rule_kind_cmd(RULE_IMAGE));
+        HELP_LINE("video.mkv",
+                  "Open in video player (%s)",
+                  rule_kind_cmd(RULE_VIDEO));
+        HELP_LINE("file.txt",
+                  "Open in text editor (%s)",
+                  rule_kind_cmd(RULE_EDITOR));
+        HELP_LINE("source.c:13:5",
+                  "Open at line and column (%s)",
+                  rule_kind_cmd(RULE_LINECOL));
+        HELP_LINE("source.c(13,5)",
+                  "Same, from MSVC-style messages (%s)",
+                  rule_kind_cmd(RULE_LINECOL));
+        HELP_LINE("a.png b.png",
+                  "Open both in a single image viewer (%s)",
+                  rule_kind_cmd(RULE_IMAGE));
         return EXITHELP;
     }
 
     /*
-     * If the argument contains quotes in the start or end of the string, trim
-     * them in-place.
+     * Parse the options before the argument:
+     *   --reference: Match the patterns one by one with regexec(3), instead of
+     *                using the DFA. Useful for comparing both methods.
+     *   --batch:     Classify each line of the standard input, without
+     *                launching anything. See 'batch_run'.
+     *   --launch:    Open the records of '--batch' instead, like the
+     *                arguments.
+     *   --null:      Records of '--batch' are terminated by '\0', not '\n'.
+     *   --extract:   Print the spans of the file in the next argument that
+     *                match a rule. See 'batch_extract'.
+     *   --jobs:      Number of threads used by '--batch' and '--extract', in
+     *                the next argument. Defaults to the number of processors.
+     *   --existing:  Ignore the results of '--batch' and '--extract' that
+     *                open files that don't exist.
      */
-    transform_trim_quotes(argv[1]);
+    bool reference      = false;
+    bool batch          = false;
+    bool launch         = false;
+    bool existing       = false;
+    char delim          = '\n';
+    const char* extract = NULL;
+    int jobs            = batch_default_jobs();
+    int arg_idx         = 1;
+    for (; arg_idx < argc; arg_idx++) {
+        if (!strcmp(argv[arg_idx], "--reference"))
+            reference = true;
+        else if (!strcmp(argv[arg_idx], "--batch"))
+            batch = true;
+        else if (!strcmp(argv[arg_idx], "--launch"))
+            launch = true;
+        else if (!strcmp(argv[arg_idx], "--null"))
+            delim = '\0';
+        else if (!strcmp(argv[arg_idx], "--existing"))
+            existing = true;
+        else if (!strcmp(argv[arg_idx], "--extract") && arg_idx + 1 < argc)
+            extract = argv[++arg_idx];
+        else if (!strcmp(argv[arg_idx], "--jobs") && arg_idx + 1 < argc)
+            jobs = atoi(argv[++arg_idx]);
+        else
+            break;
+    }
+
+    if (jobs < 1 || (launch && !batch) || (existing && launch))
+        return EXITINVALIDARGS;
 
     /*
-     * FIXME: Launch commands like "vim" and "man" inside the same shell as ST,
-     * instead of the caller. This is a ST issue.
-     *
-     * NOTE: From here, test the regex of the arguments and launch the asociated
-     * program. The ones checked first obviously have more priority, so they
-     * should be the most specific ones.
-     *
-     * NOTE: Most macros use LAUNCH to simply run the command, but others use
-     * the ST_LAUNCH macro, which opens another st(1) instance
+     * With "$PLUMBER_TRACE", the time of each phase is written to a file.
+     * There might be too many strings in the batch modes, so only the
+     * histograms are written at the end.
      */
+    const bool many = extract != NULL || (batch && !launch);
+    trace_init(many ? TRACE_HISTOGRAMS : TRACE_RECORDS);
+
+    if (extract != NULL) {
+        if (arg_idx != argc || batch || reference)
+            return EXITINVALIDARGS;
+
+        RuleSet rules;
+        if (!load_rules(&rules))
+            return EXITFAILURE;
+
+        const bool ok =
+          batch_extract(&rules, extract, STDOUT_FILENO, existing, jobs);
+        ruleset_free(&rules);
+        trace_dump();
+        return ok ? EXITSUCCESS : EXITFAILURE;
+    }
 
-    /* URLs */
-    if (pattern_matches(argv[1], REGEX_URL))
-        return LAUNCH(CMD_BROWSER, argv[1]);
+    if (batch && !launch) {
+        if (arg_idx != argc)
+            return EXITINVALIDARGS;
 
-    /* PDF files */
-    if (pattern_matches(argv[1], REGEX_PDF))
-        return LAUNCH(CMD_PDF, argv[1]);
+        RuleSet rules;
+        if (!load_rules(&rules))
+            return EXITFAILURE;
 
-    /* Man pages */
-    if (pattern_matches(argv[1], REGEX_MAN))
-        return ST_LAUNCH(CMD_MAN, argv[1]);
+        const bool ok = batch_run(&rules,
+                                  STDIN_FILENO,
+                                  STDOUT_FILENO,
+                                  delim,
+                                  reference,
+                                  existing,
+                                  jobs);
+        ruleset_free(&rules);
+        trace_dump();
+        return ok ? EXITSUCCESS : EXITFAILURE;
+    }
 
-    /* Filenames with line and col number (e.g. compiler errors)
-     * Filenames with just line number (e.g. grep output) */
-    if (pattern_matches(argv[1], REGEX_LINECOL)) {
-        const char* line_arg = transform_line_to_vim(argv[1]);
-        return ST_LAUNCH(CMD_EDITOR, argv[1], line_arg);
+    /*
+     * We expect at least one argument after the options, or the records of
+     * the standard input with "--launch".
+     */
+    char** args = &argv[arg_idx];
+    int num     = argc - arg_idx;
+    if (launch) {
+        if (num != 0)
+            return EXITINVALIDARGS;
+        args = batch_read_records(STDIN_FILENO, delim, &num);
+        if (args == NULL)
+            return EXITFAILURE;
     }
+    if (num < 1)
+        return EXITINVALIDARGS;
 
-    /* Iterate file extensions that should be opened with an image viewer */
-    for (int i = 0; i < LENGTH(image_patterns); i++)
-        if (pattern_matches(argv[1], image_patterns[i]))
-            return LAUNCH(CMD_IMAGE, argv[1]);
+    Classifier classifier = {
+        .reference = reference,
+        .daemon_fd = reference ? -1 : ipc_connect(),
+        .plumber   = NULL,
+    };
 
-    /* Iterate file extensions that should be opened with an video player */
-    for (int i = 0; i < LENGTH(video_patterns); i++)
-        if (pattern_matches(argv[1], video_patterns[i]))
-            return LAUNCH(CMD_VIDEO, argv[1]);
+    LaunchCommand* commands = malloc(num * sizeof(LaunchCommand));
+    const char** group      = malloc((LAUNCH_MAX_ARGS + num + 1) *
+                                     sizeof(char*));
+    if (commands == NULL || group == NULL)
+        return EXITFAILURE;
+
+    bool ok = true;
+    for (int i = 0; i < num; i++)
+        if (!classify_arg(&classifier, args[i], &commands[i]))
+            ok = false;
+
+    if (classifier.daemon_fd >= 0)
+        close(classifier.daemon_fd);
+
+    /*
+     * The commands are executed in the background, so the caller doesn't wait
+     * for them. The arguments opened with the same command are grouped, so
+     * e.g. a single image viewer is executed for all the images.
+     *
+     * FIXME: Launch commands like "vim" and "man" inside the same shell as ST,
+     * instead of a new terminal. This is a ST issue.
+     */
+    for (int i = 0; i < num; i++) {
+        if (commands[i].argv == NULL || commands[i].grouped)
+            continue;
+
+        launch_group(commands, num, i, group);
+        if (!launch_command(NULL, group))
+            ok = false;
+    }
+    trace_counter("prefetch_bytes", prefetch_total());
 
-    /* Iterate file extensions that should be opened with a text editor */
-    for (int i = 0; i < LENGTH(editor_patterns); i++)
-        if (pattern_matches(argv[1], editor_patterns[i]))
-            return ST_LAUNCH(CMD_EDITOR, argv[1]);
+    /* The commands are not freed, since we are exiting */
+    if (ok)
+        return EXITSUCCESS;
 
 #ifdef DEBUG
     ERR("Invalid pattern. Dumping arguments...");
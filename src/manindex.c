@@ -0,0 +1,699 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _DEFAULT_SOURCE /* d_type, popen, st_mtim */
+
+#include "manindex.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "mapfile.h"
+#include "rules.h"
+#include "trace.h"
+#include "util.h"
+
+#define INDEX_MAGIC   "plumbman"
+#define INDEX_VERSION 2
+
+/* Command that prints the directories of the manual pages, see 'get_manpath' */
+#define MANPATH_CMD "manpath 2>/dev/null"
+
+#define ROOTS_MAGIC   "plumbmpt"
+#define ROOTS_VERSION 1
+
+/* Size of the buffers for the values of the variables that affect manpath(1) */
+#define ROOTS_KEY_SZ (MANINDEX_PATH_SZ * 2)
+
+/* Extensions of the compressed pages, removed before the section */
+static const char* compressed_exts[] = {
+    ".gz", ".bz2", ".xz", ".lzma", ".zst", ".Z",
+};
+
+/*
+ * Configuration files of man(1), which change the output of manpath(1), along
+ * with "~/.manpath".
+ */
+static const char* manpath_configs[] = {
+    "/etc/manpath.config", /* man-db on Debian */
+    "/etc/man_db.conf",    /* man-db elsewhere */
+    "/etc/man.conf",       /* mandoc */
+};
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Header of the index file, followed by the sections in the same order as the
+ * fields of 'ManIndex'.
+ */
+typedef struct IndexHeader {
+    MapFileHeader file;
+
+    /* Sizes of the structures, which depend on the compiler */
+    uint32_t dir_sz, page_sz;
+
+    int32_t dirs_num, pages_num, strings_sz;
+} IndexHeader;
+
+typedef struct Sections {
+    uint64_t dirs, pages, strings;
+    uint64_t end;
+} Sections;
+
+/*
+ * Index being built by 'manindex_update'.
+ */
+typedef struct Builder {
+    ManIndexDir* dirs;
+    int32_t dirs_num, dirs_sz;
+    ManIndexPage* pages;
+    int32_t pages_num, pages_sz;
+    char* strings;
+    int32_t strings_num, strings_sz;
+
+    bool failed; /* Allocation failed, the index is incomplete */
+} Builder;
+
+/*
+ * Header of the file with the output of manpath(1), which is followed by it,
+ * including the null terminator. See 'get_manpath'.
+ */
+typedef struct RootsHeader {
+    MapFileHeader file;
+
+    /* Of 'manpath_configs' and "~/.manpath", or -1 if they don't exist */
+    int64_t config_mtimes[LENGTH(manpath_configs) + 1];
+} RootsHeader;
+
+/* Page being sorted, along with its name */
+typedef struct SortedPage {
+    const char* name;
+    ManIndexPage page;
+} SortedPage;
+
+/*
+ * Output of manpath(1) for the values of "$MANPATH" and "$PATH" in
+ * 'g_manpath_key'. It's only updated when they change, so the command is
+ * executed at most once per process, and it's also stored in the cache
+ * directory for the next processes (see 'get_manpath').
+ */
+static pthread_mutex_t g_manpath_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool g_manpath_cached          = false;
+static bool g_manpath_ok              = false;
+static char g_manpath_key[ROOTS_KEY_SZ];
+static char g_manpath[MANINDEX_PATH_SZ];
+
+/*----------------------------------------------------------------------------*/
+
+static inline int64_t mtime_ns(const struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static bool get_sections(const IndexHeader* header, Sections* s) {
+    if (header->dirs_num < 0 || header->pages_num < 0 ||
+        header->strings_sz <= 0)
+        return false;
+
+    uint64_t end = sizeof(IndexHeader);
+    s->dirs = mapfile_push_section(&end, header->dirs_num, sizeof(ManIndexDir));
+    s->pages =
+      mapfile_push_section(&end, header->pages_num, sizeof(ManIndexPage));
+    s->strings =
+      mapfile_push_section(&end, header->strings_sz, sizeof(char));
+    s->end = end;
+    return true;
+}
+
+/*
+ * Compare the name and section of a page with the 'len' bytes of 'name' and
+ * 'section', like strcmp(3).
+ */
+static int compare_page(const ManIndex* index, const ManIndexPage* page,
+                        const char* name, size_t len, char section) {
+    if (page->name < 0 || page->name >= index->strings_sz)
+        return -1;
+
+    const char* page_name = &index->strings[page->name];
+    const int cmp         = strncmp(page_name, name, len);
+    if (cmp != 0)
+        return cmp;
+    if (page_name[len] != '\0')
+        return 1;
+
+    return (unsigned char)page->section - (unsigned char)section;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Building */
+
+static bool grow(void** arr, int32_t* sz, int32_t needed, size_t elem_sz) {
+    if (needed <= *sz)
+        return true;
+
+    int32_t new_sz = (*sz > 0) ? *sz : 64;
+    while (new_sz < needed) {
+        if (new_sz > INT32_MAX / 2)
+            return false;
+        new_sz *= 2;
+    }
+
+    void* new_arr = realloc(*arr, (size_t)new_sz * elem_sz);
+    if (new_arr == NULL)
+        return false;
+
+    *arr = new_arr;
+    *sz  = new_sz;
+    return true;
+}
+
+static int32_t push_string(Builder* b, const char* str, size_t len) {
+    if (len >= (size_t)(INT32_MAX - b->strings_num) ||
+        !grow((void**)&b->strings, &b->strings_sz,
+              b->strings_num + (int32_t)len + 1, sizeof(char))) {
+        b->failed = true;
+        return -1;
+    }
+
+    const int32_t off = b->strings_num;
+    memcpy(&b->strings[off], str, len);
+    b->strings[off + len] = '\0';
+    b->strings_num += len + 1;
+    return off;
+}
+
+/*
+ * Add the directory at 'path', if it exists. Returns false otherwise.
+ */
+static bool push_dir(Builder* b, const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+
+    if (!grow((void**)&b->dirs, &b->dirs_sz, b->dirs_num + 1,
+              sizeof(ManIndexDir))) {
+        b->failed = true;
+        return false;
+    }
+
+    const int32_t path_off = push_string(b, path, strlen(path));
+    if (path_off < 0)
+        return false;
+
+    b->dirs[b->dirs_num].path     = path_off;
+    b->dirs[b->dirs_num].mtime_ns = mtime_ns(&st);
+    b->dirs_num++;
+    return true;
+}
+
+/*
+ * Add the page in the file called 'file' (e.g. "printf.3.gz"), if the name has
+ * a section.
+ */
+static void push_page(Builder* b, const char* file) {
+    size_t len = strlen(file);
+    for (int i = 0; i < LENGTH(compressed_exts); i++) {
+        const size_t ext_len = strlen(compressed_exts[i]);
+        if (len > ext_len &&
+            !strcmp(&file[len - ext_len], compressed_exts[i])) {
+            len -= ext_len;
+            break;
+        }
+    }
+
+    /* The name might contain dots too, e.g. "systemd.unit.5" */
+    size_t dot = len;
+    while (dot > 0 && file[dot - 1] != '.')
+        dot--;
+    if (dot < 2 || dot == len)
+        return;
+
+    if (!grow((void**)&b->pages, &b->pages_sz, b->pages_num + 1,
+              sizeof(ManIndexPage))) {
+        b->failed = true;
+        return;
+    }
+
+    const int32_t name_off = push_string(b, file, dot - 1);
+    if (name_off < 0)
+        return;
+
+    b->pages[b->pages_num].name    = name_off;
+    b->pages[b->pages_num].section = file[dot];
+    b->pages_num++;
+}
+
+/*
+ * Add the section directories ("man1", "man3p", etc.) inside the root at
+ * 'path', and the pages inside them.
+ */
+static void read_root(Builder* b, const char* path) {
+    if (!push_dir(b, path))
+        return;
+
+    DIR* root = opendir(path);
+    if (root == NULL)
+        return;
+
+    char section_path[MANINDEX_PATH_SZ];
+    struct dirent* ent;
+    while ((ent = readdir(root)) != NULL && !b->failed) {
+        if (strncmp(ent->d_name, "man", 3) != 0 || ent->d_name[3] == '\0')
+            continue;
+
+        const int written = snprintf(section_path, sizeof(section_path),
+                                     "%s/%s", path, ent->d_name);
+        if (written < 0 || (size_t)written >= sizeof(section_path) ||
+            !push_dir(b, section_path))
+            continue;
+
+        DIR* section = opendir(section_path);
+        if (section == NULL)
+            continue;
+
+        struct dirent* page;
+        while ((page = readdir(section)) != NULL && !b->failed)
+            if (page->d_name[0] != '.' && page->d_type != DT_DIR)
+                push_page(b, page->d_name);
+        closedir(section);
+    }
+    closedir(root);
+}
+
+static int compare_sorted(const void* a, const void* b) {
+    const SortedPage* pa = a;
+    const SortedPage* pb = b;
+    const int cmp        = strcmp(pa->name, pb->name);
+    if (cmp != 0)
+        return cmp;
+
+    return (unsigned char)pa->page.section - (unsigned char)pb->page.section;
+}
+
+/*
+ * Sort the pages by name and section, and remove the repeated ones (e.g. from
+ * different roots).
+ */
+static void sort_pages(Builder* b) {
+    if (b->pages_num < 2)
+        return;
+
+    SortedPage* sorted = malloc(b->pages_num * sizeof(SortedPage));
+    if (sorted == NULL) {
+        b->failed = true;
+        return;
+    }
+
+    for (int32_t i = 0; i < b->pages_num; i++) {
+        sorted[i].name = &b->strings[b->pages[i].name];
+        sorted[i].page = b->pages[i];
+    }
+    qsort(sorted, b->pages_num, sizeof(SortedPage), compare_sorted);
+
+    int32_t num = 0;
+    for (int32_t i = 0; i < b->pages_num; i++)
+        if (num == 0 || compare_sorted(&sorted[num - 1], &sorted[i]) != 0)
+            sorted[num++] = sorted[i];
+    for (int32_t i = 0; i < num; i++)
+        b->pages[i] = sorted[i].page;
+    b->pages_num = num;
+
+    free(sorted);
+}
+
+/*
+ * Write the index in the builder to 'path', atomically.
+ */
+static bool save_index(const Builder* b, const char* path) {
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.dir_sz     = sizeof(ManIndexDir);
+    header.page_sz    = sizeof(ManIndexPage);
+    header.dirs_num   = b->dirs_num;
+    header.pages_num  = b->pages_num;
+    header.strings_sz = (b->strings_num > 0) ? b->strings_num : 1;
+
+    Sections s;
+    if (!get_sections(&header, &s))
+        return false;
+    mapfile_init_header(&header.file, INDEX_MAGIC, INDEX_VERSION,
+                        sizeof(IndexHeader), s.end);
+
+    char* buf = calloc(1, s.end);
+    if (buf == NULL)
+        return false;
+
+    memcpy(buf, &header, sizeof(header));
+    if (b->dirs_num > 0)
+        memcpy(&buf[s.dirs], b->dirs, b->dirs_num * sizeof(ManIndexDir));
+    if (b->pages_num > 0)
+        memcpy(&buf[s.pages], b->pages, b->pages_num * sizeof(ManIndexPage));
+    if (b->strings_num > 0)
+        memcpy(&buf[s.strings], b->strings, b->strings_num);
+
+    const bool ok = mapfile_save(path, buf, s.end);
+    free(buf);
+    return ok;
+}
+
+/*
+ * Write the first line of the output of manpath(1) to 'buf', without the
+ * newline. Returns false if it can't be executed, or if the line is empty or
+ * doesn't fit.
+ */
+static bool run_manpath(char* buf, size_t buf_sz) {
+    FILE* fp = popen(MANPATH_CMD, "r");
+    if (fp == NULL)
+        return false;
+
+    /* The status is ignored, the daemon doesn't wait for its children */
+    const bool got = fgets(buf, buf_sz, fp) != NULL;
+    pclose(fp);
+    if (!got)
+        return false;
+
+    const size_t len = strcspn(buf, "\n");
+    if (buf[len] != '\n' && len + 1 >= buf_sz)
+        return false;
+    buf[len] = '\0';
+    return len > 0;
+}
+
+/*
+ * Store the modification times of the configuration files of man(1) in
+ * 'mtimes', see 'RootsHeader'.
+ */
+static void get_config_mtimes(int64_t* mtimes) {
+    char user_config[MANINDEX_PATH_SZ] = "";
+    const char* home                   = getenv("HOME");
+    if (home != NULL && *home != '\0')
+        snprintf(user_config, sizeof(user_config), "%s/.manpath", home);
+
+    for (int i = 0; i <= LENGTH(manpath_configs); i++) {
+        const char* path =
+          (i < LENGTH(manpath_configs)) ? manpath_configs[i] : user_config;
+
+        struct stat st;
+        mtimes[i] = (*path != '\0' && stat(path, &st) == 0) ? mtime_ns(&st)
+                                                            : -1;
+    }
+}
+
+/*
+ * Read the output of manpath(1) stored in 'path' by 'save_roots' into 'buf',
+ * if the configuration files of man(1) didn't change since then.
+ */
+static bool load_roots(const char* path, const int64_t* mtimes, char* buf,
+                       size_t buf_sz) {
+    size_t size;
+    void* map = mapfile_open(path, ROOTS_MAGIC, ROOTS_VERSION,
+                             sizeof(RootsHeader), &size);
+    if (map == NULL)
+        return false;
+
+    const RootsHeader* header = map;
+    const char* roots         = (const char*)map + sizeof(RootsHeader);
+    const size_t len          = size - sizeof(RootsHeader);
+    const bool ok = memcmp(header->config_mtimes, mtimes,
+                           sizeof(header->config_mtimes)) == 0 &&
+                    len > 1 && len <= buf_sz && strlen(roots) == len - 1;
+    if (ok)
+        memcpy(buf, roots, len);
+
+    mapfile_close(map, size);
+    return ok;
+}
+
+/*
+ * Store the output of manpath(1) in 'path', along with the modification times
+ * of the configuration files of man(1).
+ */
+static void save_roots(const char* path, const int64_t* mtimes,
+                       const char* roots) {
+    const size_t len  = strlen(roots) + 1;
+    const size_t size = sizeof(RootsHeader) + len;
+    char* buf         = calloc(1, size);
+    if (buf == NULL)
+        return;
+
+    RootsHeader* header = (RootsHeader*)buf;
+    mapfile_init_header(&header->file, ROOTS_MAGIC, ROOTS_VERSION,
+                        sizeof(RootsHeader), size);
+    memcpy(header->config_mtimes, mtimes, sizeof(header->config_mtimes));
+    memcpy(&buf[sizeof(RootsHeader)], roots, len);
+
+    mapfile_save(path, buf, size);
+    free(buf);
+}
+
+/*
+ * Write the directories of the manual pages according to manpath(1) to 'buf',
+ * for the current value of "$MANPATH". The output depends on it, on "$PATH",
+ * and on the configuration of man(1), so it's stored in a file named after the
+ * variables, along with the modification times of the configuration files; the
+ * command is only executed if they changed. Failures are not stored, since
+ * manpath(1) might be installed later. Returns false if the command failed, or
+ * if the directories don't fit.
+ */
+static bool get_manpath(const char* env, char* buf, size_t buf_sz) {
+    const char* path_env = getenv("PATH");
+    char key[ROOTS_KEY_SZ];
+    const int key_len = snprintf(key, sizeof(key), "%s\n%s",
+                                 (env != NULL) ? env : "unset",
+                                 (path_env != NULL) ? path_env : "");
+    if (key_len < 0 || (size_t)key_len >= sizeof(key))
+        return false;
+
+    pthread_mutex_lock(&g_manpath_lock);
+    if (!g_manpath_cached || strcmp(g_manpath_key, key) != 0) {
+        int64_t mtimes[LENGTH(manpath_configs) + 1];
+        get_config_mtimes(mtimes);
+
+        char path[MAPFILE_PATH_SZ];
+        const bool stored = mapfile_cache_path("roots", key, path,
+                                               sizeof(path));
+        g_manpath_ok = stored &&
+                       load_roots(path, mtimes, g_manpath, sizeof(g_manpath));
+        if (!g_manpath_ok) {
+            g_manpath_ok = run_manpath(g_manpath, sizeof(g_manpath));
+            if (g_manpath_ok && stored)
+                save_roots(path, mtimes, g_manpath);
+        }
+
+        strcpy(g_manpath_key, key);
+        g_manpath_cached = true;
+    }
+
+    const bool ok = g_manpath_ok && strlen(g_manpath) < buf_sz;
+    if (ok)
+        strcpy(buf, g_manpath);
+    pthread_mutex_unlock(&g_manpath_lock);
+    return ok;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool manindex_roots(char* buf, size_t buf_sz) {
+    /*
+     * Empty elements stand for the directories that man(1) uses by default,
+     * which depend on its configuration, so only manpath(1) knows them.
+     */
+    const char* env = getenv("MANPATH");
+    const size_t len = (env != NULL) ? strlen(env) : 0;
+    if (len == 0 || env[0] == ':' || env[len - 1] == ':' ||
+        strstr(env, "::") != NULL)
+        return get_manpath(env, buf, buf_sz);
+
+    if (len >= buf_sz)
+        return false;
+    memcpy(buf, env, len + 1);
+    return true;
+}
+
+bool manindex_path(const char* roots, char* buf, size_t buf_sz) {
+    /* An index for each list of roots, so they don't replace each other */
+    return mapfile_cache_path("man", roots, buf, buf_sz);
+}
+
+bool manindex_open(ManIndex* index, const char* path) {
+    size_t size;
+    void* map = mapfile_open(path, INDEX_MAGIC, INDEX_VERSION,
+                             sizeof(IndexHeader), &size);
+    if (map == NULL)
+        return false;
+
+    const IndexHeader* header = map;
+    Sections s;
+    if (header->dir_sz != sizeof(ManIndexDir) ||
+        header->page_sz != sizeof(ManIndexPage) ||
+        !get_sections(header, &s) || s.end != size) {
+        mapfile_close(map, size);
+        return false;
+    }
+
+    const char* bytes = map;
+    index->map        = map;
+    index->map_sz     = size;
+    index->dirs       = (const ManIndexDir*)&bytes[s.dirs];
+    index->dirs_num   = header->dirs_num;
+    index->pages      = (const ManIndexPage*)&bytes[s.pages];
+    index->pages_num  = header->pages_num;
+    index->strings    = &bytes[s.strings];
+    index->strings_sz = header->strings_sz;
+
+    /* The offsets of the strings are checked when used */
+    if (index->strings[index->strings_sz - 1] != '\0') {
+        ERR("Ignoring corrupted manual page index \"%s\".", path);
+        manindex_close(index);
+        return false;
+    }
+
+    return true;
+}
+
+void manindex_close(ManIndex* index) {
+    if (index->map != NULL)
+        mapfile_close(index->map, index->map_sz);
+    index->map = NULL;
+}
+
+bool manindex_update(const char* roots, const char* path) {
+    Builder b;
+    memset(&b, 0, sizeof(b));
+
+    char dir[MANINDEX_PATH_SZ];
+    for (const char* root = roots; *root != '\0';) {
+        const size_t len = strcspn(root, ":");
+        if (len > 0 && len < sizeof(dir)) {
+            memcpy(dir, root, len);
+            dir[len] = '\0';
+            read_root(&b, dir);
+        }
+
+        root = (root[len] == ':') ? &root[len + 1] : &root[len];
+    }
+
+    if (!b.failed)
+        sort_pages(&b);
+
+    bool ok = false;
+    if (b.failed) {
+        ERR("Could not allocate the manual page index.");
+    } else {
+        ok = save_index(&b, path);
+    }
+
+    free(b.dirs);
+    free(b.pages);
+    free(b.strings);
+    return ok;
+}
+
+bool manindex_outdated(const ManIndex* index) {
+    for (int32_t i = 0; i < index->dirs_num; i++) {
+        const ManIndexDir* dir = &index->dirs[i];
+        if (dir->path < 0 || dir->path >= index->strings_sz)
+            return true;
+
+        struct stat st;
+        if (stat(&index->strings[dir->path], &st) != 0 ||
+            mtime_ns(&st) != dir->mtime_ns)
+            return true;
+    }
+
+    return false;
+}
+
+bool manindex_find(const ManIndex* index, const char* name, size_t len,
+                   char section) {
+    int32_t lo = 0;
+    int32_t hi = index->pages_num;
+    while (lo < hi) {
+        const int32_t mid = lo + (hi - lo) / 2;
+        const int cmp =
+          compare_page(index, &index->pages[mid], name, len, section);
+        if (cmp == 0)
+            return true;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return false;
+}
+
+bool manindex_exists(const char* str, size_t len) {
+    /* The name and the section, e.g. "printf(3)" */
+    const char* paren = memchr(str, '(', len);
+    if (paren == NULL || paren == str || (size_t)(paren - str) + 1 >= len)
+        return true;
+    const size_t name_len = paren - str;
+    const char section    = paren[1];
+
+    char roots[MANINDEX_PATH_SZ];
+    char path[MANINDEX_PATH_SZ];
+    if (!manindex_roots(roots, sizeof(roots)) ||
+        !manindex_path(roots, path, sizeof(path)))
+        return true;
+
+    /*
+     * Look up the page in the current index. If it's not there, but some
+     * directory changed, the page might have been installed since it was
+     * written, so update it and try again.
+     */
+    for (int attempt = 0; attempt < 2; attempt++) {
+        ManIndex index;
+        if (manindex_open(&index, path)) {
+            const bool found = manindex_find(&index, str, name_len, section);
+            const bool empty = index.pages_num == 0;
+            const bool outdated = !found && manindex_outdated(&index);
+            manindex_close(&index);
+
+            if (found || (!outdated && empty))
+                return true;
+            if (!outdated)
+                return false;
+        }
+
+        if (attempt > 0 || !manindex_update(roots, path))
+            return true;
+    }
+
+    return true;
+}
+
+int manindex_filter(RuleSet* set, const char* str, size_t len, int rule) {
+    if (rule < 0 || set->rules[rule].kind != RULE_MAN)
+        return rule;
+
+    const int64_t start = TRACE_START();
+    while (rule >= 0 && set->rules[rule].kind == RULE_MAN &&
+           !manindex_exists(str, len))
+        rule = ruleset_match_after(set, str, len, rule);
+    TRACE_END(TRACE_MAN, rule, start);
+
+    return rule;
+}
@@ -0,0 +1,111 @@
+
+#ifndef MANINDEX_H_
+#define MANINDEX_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rules.h"
+
+/* Size of the buffers for the paths of the index and of the directories */
+#define MANINDEX_PATH_SZ 4096
+
+/*
+ * Directory of manual pages inside a 'ManIndex', either one of the roots or a
+ * section inside it (e.g. "/usr/share/man/man3").
+ */
+typedef struct ManIndexDir {
+    int32_t path; /* Offset in 'ManIndex.strings' */
+    int64_t mtime_ns;
+} ManIndexDir;
+
+typedef struct ManIndexPage {
+    int32_t name; /* Offset in 'ManIndex.strings' */
+    char section; /* First character of the section, e.g. '3' for "3pm" */
+} ManIndexPage;
+
+/*
+ * Index of the names and sections of the manual pages, mapped in memory. The
+ * pages are sorted by name and section, so they are found with a binary
+ * search. The modification time of each directory is stored too, so
+ * 'manindex_outdated' can check if a page might have been installed since the
+ * index was written.
+ */
+typedef struct ManIndex {
+    void* map;
+    size_t map_sz;
+
+    const ManIndexDir* dirs;
+    int32_t dirs_num;
+    const ManIndexPage* pages;
+    int32_t pages_num;
+    const char* strings;
+    int32_t strings_sz;
+} ManIndex;
+
+/*
+ * Write the list of directories with manual pages, separated by ':', to 'buf',
+ * which has 'buf_sz' bytes. It's "$MANPATH", unless it's not set or it has
+ * empty elements, which stand for the default directories of man(1); in that
+ * case, it's the output of manpath(1). Returns false if it doesn't fit, or if
+ * manpath(1) failed, since the directories are unknown.
+ */
+bool manindex_roots(char* buf, size_t buf_sz);
+
+/*
+ * Write the path of the index of the 'roots' to 'buf', which has 'buf_sz'
+ * bytes. The index is stored in "$XDG_CACHE_HOME/plumber" or in
+ * "$HOME/.cache/plumber". Returns false if the path can't be built.
+ */
+bool manindex_path(const char* roots, char* buf, size_t buf_sz);
+
+/*
+ * Map the index at 'path' in memory. Returns false if it doesn't exist, or if
+ * it was written by a different version of the program. The index should be
+ * closed with 'manindex_close'.
+ */
+bool manindex_open(ManIndex* index, const char* path);
+
+/*
+ * Unmap an index opened with 'manindex_open'.
+ */
+void manindex_close(ManIndex* index);
+
+/*
+ * Write the index of the pages in the "man*" directories of the 'roots' to
+ * 'path'. The index is replaced atomically. Returns false on errors.
+ */
+bool manindex_update(const char* roots, const char* path);
+
+/*
+ * Check if the modification time of some directory of the index changed since
+ * it was written.
+ */
+bool manindex_outdated(const ManIndex* index);
+
+/*
+ * Check if there is a page called like the 'len' bytes of 'name' in the
+ * section that starts with 'section'.
+ */
+bool manindex_find(const ManIndex* index, const char* name, size_t len,
+                   char section);
+
+/*
+ * Check if the manual page in the 'len' bytes of 'str' (e.g. "printf(3)")
+ * exists. The page is looked up in the index of the directories of
+ * 'manindex_roots', which is updated if the page is not found and some
+ * directory changed. If the directories are unknown, if the index can't be
+ * used, or if it's empty, returns true, since it can't tell.
+ */
+bool manindex_exists(const char* str, size_t len);
+
+/*
+ * If 'rule' opens manual pages, but the page in the 'len' bytes of 'str'
+ * doesn't exist (see 'manindex_exists'), return the next rule that matches the
+ * string, with 'ruleset_match_after'; otherwise, return 'rule' itself. It
+ * shouldn't be called from multiple threads at once with the same rule set.
+ */
+int manindex_filter(RuleSet* set, const char* str, size_t len, int rule);
+
+#endif /* MANINDEX_H_ */
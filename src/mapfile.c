@@ -0,0 +1,155 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* mkstemp */
+
+#include "mapfile.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Create the parent directories of 'path', ignoring the errors, which will be
+ * reported when creating the file itself.
+ */
+static void make_parents(const char* path) {
+    char tmp[MAPFILE_PATH_SZ];
+    if (snprintf(tmp, sizeof(tmp), "%s", path) >= (int)sizeof(tmp))
+        return;
+
+    for (char* p = &tmp[1]; (p = strchr(p, '/')) != NULL; p++) {
+        *p = '\0';
+        mkdir(tmp, 0700);
+        *p = '/';
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+uint64_t mapfile_hash(const char* str) {
+    /* FNV-1a */
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (; *str != '\0'; str++)
+        hash = (hash ^ (unsigned char)*str) * 0x100000001B3ULL;
+    return hash;
+}
+
+bool mapfile_cache_path(const char* prefix, const char* key, char* buf,
+                        size_t buf_sz) {
+    const unsigned long long hash = mapfile_hash(key);
+
+    int written;
+    const char* dir  = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (dir != NULL && *dir != '\0')
+        written = snprintf(buf, buf_sz, "%s/plumber/%s-%016llx", dir, prefix,
+                           hash);
+    else if (home != NULL && *home != '\0')
+        written = snprintf(buf, buf_sz, "%s/.cache/plumber/%s-%016llx", home,
+                           prefix, hash);
+    else
+        return false;
+
+    return written > 0 && (size_t)written < buf_sz;
+}
+
+uint64_t mapfile_push_section(uint64_t* end, uint64_t num, size_t elem_sz) {
+    const uint64_t mask = MAPFILE_ALIGN - 1;
+    const uint64_t off  = (*end + mask) & ~mask;
+    *end                = off + num * elem_sz;
+    return off;
+}
+
+void mapfile_init_header(MapFileHeader* header, const char* magic,
+                         uint32_t version, size_t header_sz, uint64_t size) {
+    memcpy(header->magic, magic, sizeof(header->magic));
+    header->version   = version;
+    header->header_sz = header_sz;
+    header->size      = size;
+}
+
+void* mapfile_open(const char* path, const char* magic, uint32_t version,
+                   size_t header_sz, size_t* size) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < header_sz) {
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const MapFileHeader* header = map;
+    if (memcmp(header->magic, magic, sizeof(header->magic)) != 0 ||
+        header->version != version || header->header_sz != header_sz ||
+        header->size != (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return map;
+}
+
+void mapfile_close(void* map, size_t size) {
+    munmap(map, size);
+}
+
+bool mapfile_save(const char* path, const void* buf, size_t size) {
+    char tmp[MAPFILE_PATH_SZ];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+        return false;
+
+    make_parents(path);
+    const int fd = mkstemp(tmp);
+    if (fd < 0)
+        return false;
+
+    const char* bytes = buf;
+    bool ok           = true;
+    for (size_t written = 0; ok && written < size;) {
+        const ssize_t result = write(fd, &bytes[written], size - written);
+        if (result >= 0)
+            written += result;
+        else if (errno != EINTR)
+            ok = false;
+    }
+    ok = (close(fd) == 0) && ok && rename(tmp, path) == 0;
+
+    if (!ok)
+        unlink(tmp);
+    return ok;
+}
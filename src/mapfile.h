@@ -0,0 +1,79 @@
+
+#ifndef MAPFILE_H_
+#define MAPFILE_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size of the buffers for the paths of the mapped files */
+#define MAPFILE_PATH_SZ 4096
+
+/* Alignment of each section of a mapped file */
+#define MAPFILE_ALIGN 8
+
+/*
+ * Start of the header of every file written by 'mapfile_save', which is
+ * followed by the rest of the header and by its sections. The caches and
+ * indexes are only read by the same build of the program that wrote them, so
+ * the sizes of the structures are stored, and the byte order is the native
+ * one.
+ */
+typedef struct MapFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_sz; /* Of the whole header */
+    uint64_t size;      /* Of the whole file */
+} MapFileHeader;
+
+/*
+ * Hash of a null-terminated string, used for naming the files.
+ */
+uint64_t mapfile_hash(const char* str);
+
+/*
+ * Write the path of a file inside the cache directory of the user, named after
+ * 'prefix' and the hash of 'key', e.g. a cache for each rules file so they
+ * don't replace each other. Returns false if there is no cache directory, or if
+ * the path doesn't fit.
+ */
+bool mapfile_cache_path(const char* prefix, const char* key, char* buf,
+                        size_t buf_sz);
+
+/*
+ * Append a section of 'num' elements of 'elem_sz' bytes, aligned to
+ * MAPFILE_ALIGN, at the offset '*end', and return its offset.
+ */
+uint64_t mapfile_push_section(uint64_t* end, uint64_t num, size_t elem_sz);
+
+/*
+ * Fill the common part of a header of 'header_sz' bytes for a file of 'size'
+ * bytes. Only the first 8 bytes of 'magic' are stored, so it should have at
+ * least 7 characters.
+ */
+void mapfile_init_header(MapFileHeader* header, const char* magic,
+                         uint32_t version, size_t header_sz, uint64_t size);
+
+/*
+ * Map the file at 'path' in memory, read-only, and store its size in '*size'.
+ * Returns NULL if the file can't be mapped, or if its header doesn't have the
+ * same magic, version and size of the header as the arguments, or a different
+ * size than the file. The rest of the header and the sections should be checked
+ * by the caller.
+ */
+void* mapfile_open(const char* path, const char* magic, uint32_t version,
+                   size_t header_sz, size_t* size);
+
+/*
+ * Unmap a file mapped with 'mapfile_open'.
+ */
+void mapfile_close(void* map, size_t size);
+
+/*
+ * Write the 'size' bytes of 'buf' to 'path', creating its parent directories.
+ * A temporary file is written and renamed, so readers never see half of it.
+ * Returns false on errors.
+ */
+bool mapfile_save(const char* path, const void* buf, size_t size);
+
+#endif /* MAPFILE_H_ */
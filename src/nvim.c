@@ -0,0 +1,381 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* getuid */
+
+#include "nvim.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Identifier of our request, there's only one for each connection */
+#define MSG_ID 1
+
+/*
+ * Executed by the editor with the kind of request, the working directory (or
+ * an empty string) and the list of arguments. The commands of the arguments are
+ * executed as if they were passed to nvim(1).
+ */
+static const char lua_code[] =
+  "local kind, cwd, args = ...\n"
+  "if kind == 'man' then\n"
+  "  vim.cmd.Man(args[1])\n"
+  "  return\n"
+  "end\n"
+  "for _, arg in ipairs(args) do\n"
+  "  if arg:sub(1, 1) == '+' then\n"
+  "    vim.cmd(arg:sub(2))\n"
+  "  else\n"
+  "    if arg:sub(1, 1) ~= '/' and cwd ~= '' then\n"
+  "      arg = cwd .. '/' .. arg\n"
+  "    end\n"
+  "    vim.cmd.drop(vim.fn.fnameescape(arg))\n"
+  "  end\n"
+  "end\n";
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Buffer for encoding a message with msgpack. See:
+ * https://github.com/msgpack/msgpack/blob/master/spec.md
+ */
+typedef struct Writer {
+    char buf[NVIM_MAX_MSG];
+    size_t len;
+    bool ok; /* False if the message didn't fit */
+} Writer;
+
+static void write_bytes(Writer* w, const void* bytes, size_t len) {
+    if (!w->ok || len > sizeof(w->buf) - w->len) {
+        w->ok = false;
+        return;
+    }
+
+    memcpy(&w->buf[w->len], bytes, len);
+    w->len += len;
+}
+
+static void write_byte(Writer* w, unsigned char c) {
+    write_bytes(w, &c, 1);
+}
+
+static void write_be32(Writer* w, unsigned char type, uint32_t num) {
+    const unsigned char bytes[] = {
+        type, num >> 24, (num >> 16) & 0xFF, (num >> 8) & 0xFF, num & 0xFF,
+    };
+    write_bytes(w, bytes, sizeof(bytes));
+}
+
+static void write_array(Writer* w, uint32_t num) {
+    if (num < 16)
+        write_byte(w, 0x90 | num);
+    else
+        write_be32(w, 0xDD, num);
+}
+
+static void write_uint(Writer* w, uint32_t num) {
+    if (num < 128)
+        write_byte(w, num);
+    else
+        write_be32(w, 0xCE, num);
+}
+
+static void write_str(Writer* w, const char* str) {
+    const size_t len = strlen(str);
+    if (len < 32)
+        write_byte(w, 0xA0 | len);
+    else
+        write_be32(w, 0xDB, len);
+    write_bytes(w, str, len);
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Read a big-endian number of 'len' bytes at '*pos', and advance it. Returns
+ * false if the buffer ends before.
+ */
+static bool read_be(const unsigned char* buf, size_t buf_len, size_t* pos,
+                    int len, uint64_t* num) {
+    if (buf_len - *pos < (size_t)len)
+        return false;
+
+    *num = 0;
+    for (int i = 0; i < len; i++)
+        *num = (*num << 8) | buf[(*pos)++];
+    return true;
+}
+
+/*
+ * Skip the msgpack object at '*pos'. Returns false if the object is invalid,
+ * or if the buffer ends before it.
+ */
+static bool skip_object(const unsigned char* buf, size_t len, size_t* pos,
+                        int depth) {
+    if (*pos >= len || depth > 32)
+        return false;
+
+    const unsigned char type = buf[(*pos)++];
+    uint64_t size  = 0; /* Bytes of a string, binary or extension */
+    uint64_t items = 0; /* Objects of an array, or twice the pairs of a map */
+
+    if (type <= 0x7F || type >= 0xE0 || type == 0xC0 || type == 0xC2 ||
+        type == 0xC3) {
+        /* Fixed integers, nil and booleans */
+    } else if ((type & 0xF0) == 0x80) {
+        items = (uint64_t)(type & 0x0F) * 2;
+    } else if ((type & 0xF0) == 0x90) {
+        items = type & 0x0F;
+    } else if ((type & 0xE0) == 0xA0) {
+        size = type & 0x1F;
+    } else {
+        uint64_t num;
+        switch (type) {
+            case 0xC4: /* bin 8, 16, 32 */
+            case 0xD9: /* str 8, 16, 32 */
+                if (!read_be(buf, len, pos, 1, &size))
+                    return false;
+                break;
+            case 0xC5:
+            case 0xDA:
+                if (!read_be(buf, len, pos, 2, &size))
+                    return false;
+                break;
+            case 0xC6:
+            case 0xDB:
+                if (!read_be(buf, len, pos, 4, &size))
+                    return false;
+                break;
+            case 0xC7: /* ext 8, 16, 32, with the type after the size */
+            case 0xC8:
+            case 0xC9:
+                if (!read_be(buf, len, pos, 1 << (type - 0xC7), &size))
+                    return false;
+                size++;
+                break;
+            case 0xCA: /* float 32, 64 */
+            case 0xCB:
+                size = (type == 0xCA) ? 4 : 8;
+                break;
+            case 0xCC: /* uint and int 8, 16, 32, 64 */
+            case 0xCD:
+            case 0xCE:
+            case 0xCF:
+                size = 1 << (type - 0xCC);
+                break;
+            case 0xD0:
+            case 0xD1:
+            case 0xD2:
+            case 0xD3:
+                size = 1 << (type - 0xD0);
+                break;
+            case 0xD4: /* fixext 1, 2, 4, 8, 16 */
+            case 0xD5:
+            case 0xD6:
+            case 0xD7:
+            case 0xD8:
+                size = (1 << (type - 0xD4)) + 1;
+                break;
+            case 0xDC: /* array 16, 32 */
+            case 0xDD:
+                if (!read_be(buf, len, pos, (type == 0xDC) ? 2 : 4, &num))
+                    return false;
+                items = num;
+                break;
+            case 0xDE: /* map 16, 32 */
+            case 0xDF:
+                if (!read_be(buf, len, pos, (type == 0xDE) ? 2 : 4, &num))
+                    return false;
+                items = num * 2;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (size > len - *pos)
+        return false;
+    *pos += size;
+
+    for (uint64_t i = 0; i < items; i++)
+        if (!skip_object(buf, len, pos, depth + 1))
+            return false;
+
+    return true;
+}
+
+/*
+ * Check if the response in the 'len' bytes of 'buf' is complete. If it is,
+ * '*success' is set to true if it's the response to our request, without
+ * errors.
+ */
+static bool parse_response(const unsigned char* buf, size_t len,
+                           bool* success) {
+    size_t pos = 0;
+    if (!skip_object(buf, len, &pos, 0))
+        return false;
+
+    /* [1, MSG_ID, error, result], where the error should be nil */
+    *success = len >= 4 && buf[0] == 0x94 && buf[1] == 1 && buf[2] == MSG_ID &&
+               buf[3] == 0xC0;
+    return true;
+}
+
+/*
+ * Connect to the socket at 'path', without blocking if nothing is listening.
+ * Returns -1 on errors.
+ */
+static int connect_socket(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Wait until the socket is ready for the specified 'events', up to
+ * NVIM_TIMEOUT_MS.
+ */
+static bool wait_socket(int fd, short events) {
+    struct pollfd pfd = {
+        .fd     = fd,
+        .events = events,
+    };
+
+    int result;
+    do {
+        result = poll(&pfd, 1, NVIM_TIMEOUT_MS);
+    } while (result < 0 && errno == EINTR);
+
+    return result > 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool nvim_socket_path(char* buf, size_t buf_sz) {
+    int written;
+
+    const char* env = getenv("PLUMBER_NVIM");
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    if (env != NULL && *env != '\0')
+        written = snprintf(buf, buf_sz, "%s", env);
+    else if (dir != NULL && *dir != '\0')
+        written = snprintf(buf, buf_sz, "%s/plumber-nvim.sock", dir);
+    else
+        written =
+          snprintf(buf, buf_sz, "/tmp/plumber-nvim-%d.sock", (int)getuid());
+
+    return written > 0 && (size_t)written < buf_sz;
+}
+
+bool nvim_open(const char* path, enum ENvimRequest req, const char* cwd,
+               const char* const* args) {
+    int args_num = 0;
+    while (args[args_num] != NULL)
+        args_num++;
+    if (args_num == 0)
+        return false;
+
+    /* [0, MSG_ID, "nvim_exec_lua", [lua_code, [kind, cwd, [args...]]]] */
+    Writer w;
+    w.len = 0;
+    w.ok  = true;
+    write_array(&w, 4);
+    write_uint(&w, 0);
+    write_uint(&w, MSG_ID);
+    write_str(&w, "nvim_exec_lua");
+    write_array(&w, 2);
+    write_str(&w, lua_code);
+    write_array(&w, 3);
+    write_str(&w, (req == NVIM_MAN) ? "man" : "edit");
+    write_str(&w, (cwd == NULL) ? "" : cwd);
+    write_array(&w, args_num);
+    for (int i = 0; i < args_num; i++)
+        write_str(&w, args[i]);
+    if (!w.ok)
+        return false;
+
+    const int fd = connect_socket(path);
+    if (fd < 0)
+        return false;
+
+    for (size_t written = 0; written < w.len;) {
+        if (!wait_socket(fd, POLLOUT)) {
+            close(fd);
+            return false;
+        }
+
+        /* The editor might close the socket, don't get killed by SIGPIPE */
+        const ssize_t result =
+          send(fd, &w.buf[written], w.len - written, MSG_NOSIGNAL);
+        if (result < 0 && errno != EINTR && errno != EAGAIN) {
+            close(fd);
+            return false;
+        }
+        if (result > 0)
+            written += result;
+    }
+
+    /* The response is small, unless the editor reports a long error */
+    unsigned char response[NVIM_MAX_MSG];
+    size_t len   = 0;
+    bool success = false;
+    while (!parse_response(response, len, &success)) {
+        if (len == sizeof(response) || !wait_socket(fd, POLLIN)) {
+            close(fd);
+            return false;
+        }
+
+        const ssize_t result =
+          read(fd, &response[len], sizeof(response) - len);
+        if (result == 0 || (result < 0 && errno != EINTR)) {
+            close(fd);
+            return false;
+        }
+        if (result > 0)
+            len += result;
+    }
+
+    close(fd);
+    return success;
+}
@@ -0,0 +1,42 @@
+
+#ifndef NVIM_H_
+#define NVIM_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Timeout for each read or write to the socket of the editor */
+#define NVIM_TIMEOUT_MS 1000
+
+/* Size of the buffers for the path of the socket, as in sockaddr_un(7) */
+#define NVIM_PATH_SZ 108
+
+/* Maximum size of the messages sent to the editor */
+#define NVIM_MAX_MSG 8192
+
+/*
+ * What should be opened in the editor, see 'nvim_open'.
+ */
+enum ENvimRequest {
+    NVIM_EDIT, /* Files, and "+CMD" commands, like the arguments of nvim(1) */
+    NVIM_MAN,  /* Manual page, with the ":Man" command */
+};
+
+/*
+ * Write the path of the socket of the nvim(1) instance that should be reused to
+ * 'buf'. It's "$PLUMBER_NVIM" if set, "$XDG_RUNTIME_DIR/plumber-nvim.sock"
+ * otherwise, or "/tmp/plumber-nvim-UID.sock" as a last resort. The editor
+ * should be started with "nvim --listen PATH". Returns false if it doesn't fit.
+ */
+bool nvim_socket_path(char* buf, size_t buf_sz);
+
+/*
+ * Ask the nvim(1) instance listening at 'path' to open the NULL-terminated
+ * 'args', using its msgpack-RPC API. Relative paths are relative to 'cwd', if
+ * not NULL. Returns false if nothing is listening at 'path', or if the request
+ * failed, in which case a new editor should be launched.
+ */
+bool nvim_open(const char* path, enum ENvimRequest req, const char* cwd,
+               const char* const* args);
+
+#endif /* NVIM_H_ */
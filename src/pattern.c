@@ -20,33 +20,177 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
+#include <ctype.h>
 #include <regex.h>
 
 #include "util.h"
 
 #define MAX_REGEX_GROUPS 10
 
+/* Maximum number of atoms of the patterns checked by 'pattern_disjoint' */
+#define MAX_ATOMS 256
+
+/* Atoms of a pattern that don't always match the same character */
+#define ATOM_OTHER (-1)
+
 /*
- * Returns true if string `str' mathes regex pattern `pat'.
- *
- * Pattern uses ERE syntax:
- * https://www.gnu.org/software/sed/manual/html_node/BRE-syntax.html
+ * Sequence of atoms of a pattern, without the anchors. Each atom is a literal
+ * character, in lowercase, or ATOM_OTHER.
  */
-bool pattern_matches(const char* str, const char* pat) {
-    static regex_t r;
+typedef struct Atoms {
+    int atoms[MAX_ATOMS];
+    int num;
+    bool starts, ends; /* Anchored with "^" and "$" */
+} Atoms;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Return the position after the bracket expression at 'pos', or 0 if it's not
+ * closed.
+ */
+static size_t skip_bracket(const char* pat, size_t pos) {
+    pos++;
+    if (pat[pos] == '^')
+        pos++;
+    if (pat[pos] == ']')
+        pos++;
+
+    while (pat[pos] != ']') {
+        if (pat[pos] == '\0')
+            return 0;
+
+        /* Classes like "[:alpha:]", which contain a closing bracket */
+        if (pat[pos] == '[' && pat[pos + 1] != '\0' &&
+            strchr(":.=", pat[pos + 1]) != NULL) {
+            const char* end = strchr(&pat[pos + 2], pat[pos + 1]);
+            while (end != NULL && end[1] != ']')
+                end = strchr(&end[1], pat[pos + 1]);
+            if (end == NULL)
+                return 0;
+            pos = end + 2 - pat;
+        } else {
+            pos++;
+        }
+    }
+
+    return pos + 1;
+}
+
+/*
+ * Split the ERE pattern 'pat' into atoms. A repeated or optional atom is not
+ * a literal, since it might not match the same number of characters. Returns
+ * false if the pattern has alternatives, or if it's too long.
+ */
+static bool split_atoms(const char* pat, Atoms* result) {
+    result->num    = 0;
+    result->starts = (pat[0] == '^');
+    result->ends   = false;
+
+    size_t pos = result->starts ? 1 : 0;
+    while (pat[pos] != '\0') {
+        if (result->num >= MAX_ATOMS - 1)
+            return false;
+
+        const char c = pat[pos];
+        int atom     = ATOM_OTHER;
+        if (c == '|') {
+            return false;
+        } else if (c == '$' && pat[pos + 1] == '\0') {
+            result->ends = true;
+            break;
+        } else if (c == '*' || c == '+' || c == '?' || c == '{') {
+            if (c == '{') {
+                const char* end = strchr(&pat[pos], '}');
+                if (end == NULL)
+                    return false;
+                pos = end - pat;
+            }
+            pos++;
+
+            /* The quantifier applies to the previous atom, if any */
+            if (result->num > 0) {
+                result->atoms[result->num - 1] = ATOM_OTHER;
+                continue;
+            }
+        } else if (c == '[') {
+            pos = skip_bracket(pat, pos);
+            if (pos == 0)
+                return false;
+        } else if (c == '\\') {
+            /*
+             * Escaped punctuation is literal, except for the GNU word and
+             * buffer anchors, which don't match any character. They are
+             * treated like the rest (e.g. back-references or "\b"), where the
+             * comparison of the atoms stops.
+             */
+            const unsigned char escaped = pat[pos + 1];
+            if (ispunct(escaped) && strchr("<>`'", escaped) == NULL)
+                atom = tolower(escaped);
+            pos += (pat[pos + 1] == '\0') ? 1 : 2;
+        } else if (c == '.' || c == '(' || c == ')' || c == '^' || c == '$') {
+            pos++;
+        } else {
+            atom = tolower((unsigned char)c);
+            pos++;
+        }
+
+        result->atoms[result->num++] = atom;
+    }
+
+    return true;
+}
+
+/*
+ * Check if the literal atoms at the start of 'a' and 'b' differ at some
+ * position. The atoms are compared in reverse if 'reverse' is true.
+ */
+static bool literals_differ(const Atoms* a, const Atoms* b, bool reverse) {
+    for (int i = 0; i < a->num && i < b->num; i++) {
+        const int x = a->atoms[reverse ? a->num - 1 - i : i];
+        const int y = b->atoms[reverse ? b->num - 1 - i : i];
+        if (x == ATOM_OTHER || y == ATOM_OTHER)
+            return false;
+        if (x != y)
+            return true;
+    }
+
+    return false;
+}
 
+/*----------------------------------------------------------------------------*/
+
+bool pattern_compile(regex_t* r, const char* pat) {
     /* Compile regex pattern ignoring case */
-    if (regcomp(&r, pat, REG_EXTENDED | REG_ICASE)) {
-        ERR("regcomp returned an error code for pattern \"%s\"", pat);
+    const int code = regcomp(r, pat, REG_EXTENDED | REG_ICASE);
+    if (code != 0) {
+        char err[100];
+        regerror(code, r, err, sizeof(err));
+        ERR("regcomp returned an error for pattern \"%s\": %s", pat, err);
         return false;
     }
 
-    const int code = regexec(&r, str, 0, NULL, 0);
-    regfree(&r);
+    return true;
+}
+
+bool pattern_disjoint(const char* a, const char* b) {
+    Atoms atoms_a, atoms_b;
+    if (!split_atoms(a, &atoms_a) || !split_atoms(b, &atoms_b))
+        return false;
+
+    /* The patterns are compiled with REG_ICASE, so the atoms are lowercase */
+    return (atoms_a.starts && atoms_b.starts &&
+            literals_differ(&atoms_a, &atoms_b, false)) ||
+           (atoms_a.ends && atoms_b.ends &&
+            literals_differ(&atoms_a, &atoms_b, true));
+}
 
+bool pattern_matches_compiled(const char* str, const regex_t* r) {
+    const int code = regexec(r, str, 0, NULL, 0);
     if (code > REG_NOMATCH) {
         char err[100];
-        regerror(code, &r, err, sizeof(err));
+        regerror(code, r, err, sizeof(err));
         ERR("regexec returned an error: %s", err);
         return false;
     }
@@ -56,6 +200,37 @@ bool pattern_matches(const char* str, const char* pat) {
     return code == REG_NOERROR;
 }
 
+bool pattern_matches_len(const char* str, size_t len, const regex_t* r) {
+    /* The bounds of the string are passed in the first match */
+    regmatch_t bounds = { .rm_so = 0, .rm_eo = len };
+
+    const int code = regexec(r, str, 1, &bounds, REG_STARTEND);
+    if (code > REG_NOMATCH) {
+        char err[100];
+        regerror(code, r, err, sizeof(err));
+        ERR("regexec returned an error: %s", err);
+        return false;
+    }
+
+    return code == REG_NOERROR;
+}
+
+/*
+ * Returns true if string `str' mathes regex pattern `pat'.
+ *
+ * Pattern uses ERE syntax:
+ * https://www.gnu.org/software/sed/manual/html_node/BRE-syntax.html
+ */
+bool pattern_matches(const char* str, const char* pat) {
+    regex_t r;
+    if (!pattern_compile(&r, pat))
+        return false;
+
+    const bool result = pattern_matches_compiled(str, &r);
+    regfree(&r);
+    return result;
+}
+
 /*
  * Try to find parenthesized `group' of `pat' in `str'. Write the `start' and
  * `end' of the group match, and return true on success.
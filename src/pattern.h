@@ -3,6 +3,35 @@
 #define PATTERN_H_ 1
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <regex.h>
+
+/*
+ * Compile the regex pattern 'pat' into 'r', using the same flags as the rest of
+ * the functions in this file. Returns true on success. The caller is
+ * responsible for calling regfree(3) on success.
+ */
+bool pattern_compile(regex_t* r, const char* pat);
+
+/*
+ * Return true if string 'str' mathes regex pattern 'pat', which was already
+ * compiled with 'pattern_compile'.
+ */
+bool pattern_matches_compiled(const char* str, const regex_t* r);
+
+/*
+ * Same as 'pattern_matches_compiled', but for the 'len' bytes of 'str', which
+ * don't need to be null-terminated.
+ */
+bool pattern_matches_len(const char* str, size_t len, const regex_t* r);
+
+/*
+ * Return true if no string can match both the regex patterns 'a' and 'b',
+ * judging by the literal text after their "^" anchor and before their "$"
+ * anchor (e.g. "^ftp://.+" and "^https?://.+"). Returns false if they might
+ * match the same string, or if the patterns are too complex to tell.
+ */
+bool pattern_disjoint(const char* a, const char* b);
 
 /*
  * Return true if string 'str' mathes regex pattern 'pat'.
@@ -0,0 +1,252 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "plumber.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "decisions.h"
+#include "fileindex.h"
+#include "launch.h"
+#include "linecache.h"
+#include "magic.h"
+#include "manindex.h"
+#include "prefetch.h"
+#include "rules.h"
+#include "util.h"
+
+#if PLUMBER_MAX_ARGS < LAUNCH_MAX_ARGS
+#error "PLUMBER_MAX_ARGS is smaller than LAUNCH_MAX_ARGS"
+#endif
+
+struct Plumber {
+    RuleSet rules;
+    bool reference;
+
+    /* Kinds of the files classified by their contents */
+    MagicCache magic;
+    pthread_mutex_t magic_lock;
+
+    /* Shared results of 'plumber_classify', or NULL */
+    DecisionTable* decisions;
+    uint64_t rules_hash;
+
+    /* Skip the missing manual pages, which might compile more patterns */
+    bool check_man;
+    pthread_mutex_t man_lock;
+};
+
+struct PlumberLines {
+    LineCache cache;
+};
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Check if some pattern of the rule set is matched with regexec(3). Otherwise,
+ * matching a short string is about as fast as looking it up in the shared
+ * table, whose pages aren't even mapped in a new process.
+ */
+static bool uses_regexec(const RuleSet* set) {
+    for (int i = 0; i < set->num; i++)
+        if (set->matchers[i] == MATCHER_REGEX)
+            return true;
+
+    return false;
+}
+
+/*----------------------------------------------------------------------------*/
+
+Plumber* plumber_new(int flags) {
+    Plumber* plumber = malloc(sizeof(Plumber));
+    if (plumber == NULL) {
+        ERR("Could not allocate rule set.");
+        return NULL;
+    }
+
+    char path[RULES_PATH_SZ];
+    const bool has_file = !(flags & PLUMBER_BUILTIN) &&
+                          ruleset_default_path(path, sizeof(path));
+
+    plumber->reference = (flags & PLUMBER_REFERENCE) != 0;
+    if (!ruleset_load(&plumber->rules, has_file ? path : NULL)) {
+        free(plumber);
+        return NULL;
+    }
+
+    magic_cache_init(&plumber->magic);
+    pthread_mutex_init(&plumber->magic_lock, NULL);
+
+    plumber->check_man = (flags & PLUMBER_CHECK_MAN) != 0;
+    pthread_mutex_init(&plumber->man_lock, NULL);
+
+    plumber->decisions = NULL;
+
+    /* After this, matching doesn't modify the rule set */
+    if (!ruleset_freeze(&plumber->rules, plumber->reference)) {
+        ERR("Could not prepare the rule set for matching.");
+        plumber_free(plumber);
+        return NULL;
+    }
+
+    /* It's just an optimization, so it's fine if it can't be opened */
+    if ((flags & PLUMBER_REMEMBER) && !plumber->reference &&
+        uses_regexec(&plumber->rules)) {
+        plumber->decisions  = decisions_open();
+        plumber->rules_hash = ruleset_hash(&plumber->rules);
+    }
+
+    return plumber;
+}
+
+void plumber_free(Plumber* plumber) {
+    if (plumber == NULL)
+        return;
+
+    ruleset_free(&plumber->rules);
+    decisions_close(plumber->decisions);
+    pthread_mutex_destroy(&plumber->magic_lock);
+    pthread_mutex_destroy(&plumber->man_lock);
+    free(plumber);
+}
+
+int plumber_classify(Plumber* plumber, const char* str, size_t len) {
+    int rule;
+    if (plumber->decisions == NULL ||
+        !decisions_lookup(plumber->decisions, plumber->rules_hash, str, len,
+                          &rule)) {
+        rule = plumber->reference
+                 ? ruleset_match_reference_len(&plumber->rules, str, len)
+                 : ruleset_match_len(&plumber->rules, str, len);
+
+        if (plumber->decisions != NULL)
+            decisions_store(plumber->decisions, plumber->rules_hash, str, len,
+                            rule);
+    }
+
+    /* Not remembered, since the page might be installed later */
+    if (plumber->check_man && rule >= 0 &&
+        plumber->rules.rules[rule].kind == RULE_MAN) {
+        pthread_mutex_lock(&plumber->man_lock);
+        rule = manindex_filter(&plumber->rules, str, len, rule);
+        pthread_mutex_unlock(&plumber->man_lock);
+    }
+
+    return rule;
+}
+
+int plumber_classify_file(Plumber* plumber, const char* path) {
+    pthread_mutex_lock(&plumber->magic_lock);
+    const int kind = magic_classify(&plumber->magic, NULL, path);
+    pthread_mutex_unlock(&plumber->magic_lock);
+
+    return (kind < 0) ? -1 : ruleset_find_kind(&plumber->rules, kind);
+}
+
+size_t plumber_resolve(const Plumber* plumber, int rule, const char* cwd,
+                       const char* str, size_t len, char* buf,
+                       size_t buf_sz) {
+    if (!rule_kind_opens_source(plumber->rules.rules[rule].kind))
+        return 0;
+
+    return fileindex_resolve(cwd, str, len, buf, buf_sz, true);
+}
+
+const char* plumber_rule_name(const Plumber* plumber, int rule) {
+    return plumber->rules.rules[rule].name;
+}
+
+size_t plumber_argv_size(const Plumber* plumber, int rule, size_t len) {
+    return launch_argv_size(&plumber->rules, rule, len);
+}
+
+int plumber_argv(const Plumber* plumber, int rule, const char* str, size_t len,
+                 char* buf, size_t buf_sz, const char** argv) {
+    return launch_argv(&plumber->rules, rule, str, len, buf, buf_sz, argv);
+}
+
+size_t plumber_prefetch(const Plumber* plumber, int rule, const char* cwd,
+                        const char* str, size_t len) {
+    if (!rule_kind_prefetches(plumber->rules.rules[rule].kind))
+        return 0;
+
+    return prefetch_file(cwd, str, len);
+}
+
+bool plumber_launch(const Plumber* plumber, int rule, const char* str,
+                    size_t len) {
+    plumber_prefetch(plumber, rule, NULL, str, len);
+
+    const size_t buf_sz = launch_argv_size(&plumber->rules, rule, len);
+    char* buf           = malloc(buf_sz);
+    if (buf == NULL)
+        return false;
+
+    const char* argv[LAUNCH_MAX_ARGS + 1];
+    const bool result =
+      launch_argv(&plumber->rules, rule, str, len, buf, buf_sz, argv) >= 0 &&
+      launch_command(NULL, argv);
+
+    free(buf);
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Terminal lines */
+
+PlumberLines* plumber_lines_new(Plumber* plumber, int rows) {
+    PlumberLines* lines = malloc(sizeof(PlumberLines));
+    if (lines == NULL) {
+        ERR("Could not allocate the line cache.");
+        return NULL;
+    }
+
+    if (!linecache_init(&lines->cache, &plumber->rules, rows)) {
+        free(lines);
+        return NULL;
+    }
+
+    return lines;
+}
+
+void plumber_lines_free(PlumberLines* lines) {
+    if (lines == NULL)
+        return;
+
+    linecache_free(&lines->cache);
+    free(lines);
+}
+
+int plumber_lines_spans(PlumberLines* lines, int row, const char* text,
+                        size_t len, PlumberSpan* spans, int max) {
+    const LineEntry* entry = linecache_get(&lines->cache, row, text, len);
+    if (entry == NULL)
+        return -1;
+
+    for (int i = 0; i < entry->spans_num && i < max; i++) {
+        spans[i].off  = entry->spans[i].off;
+        spans[i].len  = entry->spans[i].len;
+        spans[i].rule = entry->spans[i].rule;
+    }
+
+    return entry->spans_num;
+}
@@ -0,0 +1,185 @@
+
+#ifndef PLUMBER_H_
+#define PLUMBER_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Public interface of libplumber, for matching the rules of plumber(1) without
+ * executing it.
+ */
+
+/*
+ * Maximum number of arguments in the vector built by 'plumber_argv', not
+ * including the terminating NULL.
+ */
+#define PLUMBER_MAX_ARGS 8
+
+/*
+ * Flags for 'plumber_new'.
+ */
+enum EPlumberFlags {
+    PLUMBER_REFERENCE = 1 << 0, /* Try each pattern in order with regexec(3) */
+    PLUMBER_BUILTIN   = 1 << 1, /* Ignore the rules file of the user */
+    PLUMBER_REMEMBER  = 1 << 2, /* Share the results, see 'plumber_classify' */
+    PLUMBER_CHECK_MAN = 1 << 3, /* Skip missing manual pages, same */
+};
+
+/*
+ * Compiled rule set. The contents are private.
+ */
+typedef struct Plumber Plumber;
+
+/*
+ * Build the rule set, with the 'EPlumberFlags' in 'flags'. The rules are read
+ * from the rules file of the user ("$PLUMBER_RULES", or "plumber/rules" inside
+ * the configuration directory) if it exists; otherwise, the rules built into
+ * the library are used. Returns NULL on errors. The result should be freed with
+ * 'plumber_free'.
+ */
+Plumber* plumber_new(int flags);
+
+/*
+ * Free a rule set returned by 'plumber_new'.
+ */
+void plumber_free(Plumber* plumber);
+
+/*
+ * Return the index of the rule with more priority that matches the 'len' bytes
+ * of 'str', which don't need to be null-terminated; or -1 if none of them
+ * matched.
+ *
+ * This function can be called from multiple threads at once, and it doesn't
+ * allocate memory, unless some pattern in "config.h" is not supported by the
+ * DFA, or PLUMBER_REFERENCE was used; in which case regexec(3) is called.
+ *
+ * With PLUMBER_REMEMBER, if some pattern needs regexec(3), the results for
+ * short strings are remembered in a fixed-size table in shared memory, used by
+ * every process of the user with the same rules, so matching a string that was
+ * classified recently is a single lookup. It's ignored with PLUMBER_REFERENCE.
+ *
+ * With PLUMBER_CHECK_MAN, if the string is a manual page (e.g. "foo(1)") that
+ * is not installed, the next rule that matches is returned instead. The pages
+ * are looked up in an index of the directories of "$MANPATH", which is stored
+ * in the cache directory, and updated when they change.
+ */
+int plumber_classify(Plumber* plumber, const char* str, size_t len);
+
+/*
+ * Return the index of the rule for opening the file at 'path', judged by its
+ * first bytes instead of its name (e.g. a PNG image without an extension); or
+ * -1 if the file doesn't exist, or its format is unknown. Meant as a fallback
+ * for when 'plumber_classify' doesn't match the path.
+ *
+ * The results are cached by the inode and modification time of the files, so
+ * the same file is only read once. This function can be called from multiple
+ * threads at once.
+ */
+int plumber_classify_file(Plumber* plumber, const char* path);
+
+/*
+ * If the specified rule opens source files (e.g. "foo.c:42"), and the file in
+ * the 'len' bytes of 'str' doesn't exist relative to 'cwd' (or the current
+ * directory, if NULL), look for it inside the directories of "$PLUMBER_ROOTS".
+ * On success, the string with the resolved path is written to 'buf', which has
+ * 'buf_sz' bytes, and its length is returned; it should be classified again.
+ * Otherwise, returns zero.
+ *
+ * The files are found with an index of their names, which is only updated when
+ * a file is not found.
+ */
+size_t plumber_resolve(const Plumber* plumber, int rule, const char* cwd,
+                       const char* str, size_t len, char* buf, size_t buf_sz);
+
+/*
+ * Return the name of the specified rule (e.g. "url" or "editor").
+ */
+const char* plumber_rule_name(const Plumber* plumber, int rule);
+
+/*
+ * Return the size of the buffer needed by 'plumber_argv' for opening a string
+ * of 'len' bytes with the specified rule.
+ */
+size_t plumber_argv_size(const Plumber* plumber, int rule, size_t len);
+
+/*
+ * Build the argument vector for opening the 'len' bytes of 'str' with the
+ * specified rule, which should be the result of 'plumber_classify'. The vector
+ * is NULL-terminated, and it should have room for PLUMBER_MAX_ARGS + 1
+ * elements. The arguments are written to 'buf', which should have 'buf_sz'
+ * bytes (see 'plumber_argv_size'). Returns the number of arguments, or -1 if
+ * they don't fit.
+ *
+ * The string is not modified, and the vector only points to 'buf' and to
+ * constant strings, so this function can be called from multiple threads.
+ */
+int plumber_argv(const Plumber* plumber, int rule, const char* str, size_t len,
+                 char* buf, size_t buf_sz, const char** argv);
+
+/*
+ * If the specified rule opens big files (PDFs, images and videos), and the
+ * 'len' bytes of 'str' are the path of a file, relative to 'cwd' if not NULL,
+ * ask the kernel to start reading it in the background, so it's opened faster.
+ * This is done by 'plumber_launch', but it can also be called earlier, e.g.
+ * when the text is hovered. At most "$PLUMBER_PREFETCH_MB" megabytes (16 by
+ * default) are read. Returns the number of bytes that will be read.
+ */
+size_t plumber_prefetch(const Plumber* plumber, int rule, const char* cwd,
+                        const char* str, size_t len);
+
+/*
+ * Open the 'len' bytes of 'str' with the specified rule, which should be the
+ * result of 'plumber_classify'. The command is executed in the background, and
+ * detached from the caller; unless it's an editor that is already running (see
+ * "$PLUMBER_NVIM" in the README). The process is a child of the caller, which
+ * should ignore SIGCHLD if it runs for long. Launching the same command again
+ * in less than "$PLUMBER_DEDUP_MS" milliseconds does nothing. Returns false if
+ * it couldn't be executed.
+ */
+bool plumber_launch(const Plumber* plumber, int rule, const char* str,
+                    size_t len);
+
+/*----------------------------------------------------------------------------*/
+/* Terminal lines */
+
+/*
+ * Span of a line that matched a rule.
+ */
+typedef struct PlumberSpan {
+    size_t off, len; /* Bytes inside the line */
+    int rule;        /* Same as the result of 'plumber_classify' */
+} PlumberSpan;
+
+/*
+ * Cache of the spans of the lines displayed in a terminal. The contents are
+ * private.
+ */
+typedef struct PlumberLines PlumberLines;
+
+/*
+ * Create a cache for a terminal with 'rows' rows, whose lines will be matched
+ * against the rules of 'plumber', which should outlive the cache. Returns NULL
+ * on errors. The result should be freed with 'plumber_lines_free'.
+ */
+PlumberLines* plumber_lines_new(Plumber* plumber, int rows);
+
+/*
+ * Free a cache returned by 'plumber_lines_new'.
+ */
+void plumber_lines_free(PlumberLines* lines);
+
+/*
+ * Find the words of the 'len' bytes of 'text', which is displayed in 'row',
+ * that match a rule; and store up to 'max' of them in 'spans'. Returns the
+ * total number of spans, which might be greater than 'max', or -1 on errors.
+ *
+ * Lines that were already scanned, even in other rows, are not scanned again.
+ * If the text of the row changed since the last call, only the words around
+ * the bytes that changed are scanned. A cache can't be used from multiple
+ * threads at once.
+ */
+int plumber_lines_spans(PlumberLines* lines, int row, const char* text,
+                        size_t len, PlumberSpan* spans, int max);
+
+#endif /* PLUMBER_H_ */
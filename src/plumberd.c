@@ -0,0 +1,479 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE /* accept4 */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "fileindex.h"
+#include "ipc.h"
+#include "magic.h"
+#include "prefetch.h"
+#include "rules.h"
+#include "server.h"
+#include "trace.h"
+#include "util.h"
+
+/* Maximum number of events returned by each epoll_wait(2) call */
+#define MAX_EVENTS 64
+
+/* Time to wait for more changes to the rules file before reloading it */
+#define RELOAD_DELAY_MS 50
+
+/* Number of events between each call to 'ruleset_reorder' */
+#define REORDER_EVENTS 256
+
+enum EExitCodes {
+    EXITSUCCESS     = 0,
+    EXITFAILURE     = 1, /* Could not start listening */
+    EXITINVALIDARGS = 2, /* Command-line arguments were invalid */
+};
+
+/*
+ * Directory of the rules file, watched by the reload thread.
+ */
+typedef struct Watch {
+    int fd;
+    const char* path; /* Of the rules file */
+    const char* name; /* Base name of the rules file */
+} Watch;
+
+static volatile sig_atomic_t g_quit = 0;
+static volatile sig_atomic_t g_dump = 0;
+
+/* Current and retired rule sets, see 'ServerRules' */
+static ServerRules g_rules;
+
+/* Kinds of the files classified by their contents, only used by main thread */
+static MagicCache g_magic;
+
+/*----------------------------------------------------------------------------*/
+
+static void handle_signal(int sig) {
+    if (sig == SIGUSR1)
+        g_dump = 1;
+    else
+        g_quit = 1;
+}
+
+/*
+ * Start watching the directory of the rules file at 'path', which should
+ * outlive the watch. The directory is watched instead of the file, since most
+ * editors replace the file when saving it. Returns false on errors.
+ */
+static bool watch_init(Watch* watch, const char* path) {
+    const char* slash = strrchr(path, '/');
+    char dir[RULES_PATH_SZ];
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (slash == path)
+        strcpy(dir, "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+
+    watch->path = path;
+    watch->name = (slash == NULL) ? path : slash + 1;
+    watch->fd   = inotify_init1(IN_CLOEXEC);
+    if (watch->fd < 0) {
+        ERR("Could not initialize inotify: %s", strerror(errno));
+        return false;
+    }
+
+    const uint32_t mask =
+      IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+    if (inotify_add_watch(watch->fd, dir, mask) < 0) {
+        /* Without the directory, there's nothing to reload */
+        if (errno != ENOENT)
+            ERR("Could not watch \"%s\": %s", dir, strerror(errno));
+        close(watch->fd);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Check if any of the 'len' bytes of inotify events in 'buf' refer to the rules
+ * file.
+ */
+static bool is_rules_event(const Watch* watch, const char* buf, size_t len) {
+    for (size_t pos = 0; pos < len;) {
+        const struct inotify_event* event =
+          (const struct inotify_event*)&buf[pos];
+        if ((event->mask & IN_Q_OVERFLOW) ||
+            (event->len > 0 && !strcmp(event->name, watch->name)))
+            return true;
+        pos += sizeof(struct inotify_event) + event->len;
+    }
+
+    return false;
+}
+
+/*
+ * Wait for changes to the rules file, and publish a new rule set after each of
+ * them. The rule sets are built by this thread, so the requests are never
+ * delayed; and if the new rules are invalid, the old ones are kept.
+ */
+static void* reload_thread(void* arg) {
+    const Watch* watch = arg;
+
+    union {
+        struct inotify_event event;
+        char buf[4096];
+    } events;
+
+    for (;;) {
+        const ssize_t len = read(watch->fd, events.buf, sizeof(events.buf));
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0) {
+            ERR("Could not read inotify events: %s", strerror(errno));
+            return NULL;
+        }
+        if (!is_rules_event(watch, events.buf, len))
+            continue;
+
+        /* Editors might write the file in multiple steps, wait for the rest */
+        struct pollfd pfd = {
+            .fd     = watch->fd,
+            .events = POLLIN,
+        };
+        while (poll(&pfd, 1, RELOAD_DELAY_MS) > 0 &&
+               read(watch->fd, events.buf, sizeof(events.buf)) > 0)
+            continue;
+
+        /* Don't stop while building the rule set, it would be leaked */
+        int state;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+        if (!server_rules_reload(&g_rules, watch->path))
+            ERR("Keeping the previous rules.");
+        pthread_setcancelstate(state, NULL);
+    }
+}
+
+/*
+ * Update the index of "$PLUMBER_ROOTS" after the requests that didn't find a
+ * file in it, so they don't wait for the directories to be read; the next
+ * requests will find the new files.
+ */
+static void* index_thread(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        fileindex_wait_miss();
+
+        /* Don't stop while writing the index, the builder would be leaked */
+        int state;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+        if (!fileindex_refresh())
+            ERR("Could not update the file index.");
+        pthread_setcancelstate(state, NULL);
+    }
+
+    return NULL;
+}
+
+/*
+ * Create a thread that doesn't receive the signals, which should be handled by
+ * the main thread (see 'handle_signal'). Returns the result of
+ * pthread_create(3).
+ */
+static int create_thread(pthread_t* thread, void* (*func)(void*), void* arg) {
+    sigset_t signals, old_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    const int result = pthread_create(thread, NULL, func, arg);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    return result;
+}
+
+/*
+ * Start the reload thread for the rules file at 'path'. Returns false if the
+ * file can't be watched.
+ */
+static bool start_reload(Watch* watch, pthread_t* thread, const char* path) {
+    if (!watch_init(watch, path))
+        return false;
+
+    const int result = create_thread(thread, reload_thread, watch);
+    if (result != 0) {
+        ERR("Could not create the reload thread: %s", strerror(result));
+        close(watch->fd);
+        return false;
+    }
+
+    return true;
+}
+
+static void close_client(int epoll_fd, Client* client) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client);
+}
+
+/*
+ * Handle the pending requests of the client, and write as much of the reply as
+ * possible. Returns false if the connection should be closed.
+ */
+static bool process_client(RuleSet* rules, int epoll_fd, Client* client) {
+    for (;;) {
+        /* Flush the pending reply first */
+        while (client->out_pos < client->out_len) {
+            const ssize_t written =
+              write(client->fd, &client->out[client->out_pos],
+                    client->out_len - client->out_pos);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (written <= 0)
+                return false;
+            client->out_pos += written;
+        }
+
+        if (client->out_pos < client->out_len)
+            break;
+        client->out_len = client->out_pos = 0;
+
+        const long frame_size = ipc_frame_size(client->in, client->in_len);
+        if (frame_size < 0)
+            return false;
+        if (frame_size == 0)
+            break;
+
+        if (!server_handle_request(rules, &g_magic, client, client->in))
+            return false;
+
+        client->in_len -= frame_size;
+        memmove(client->in, &client->in[frame_size], client->in_len);
+    }
+
+    /* Wait until we can write the rest of the reply, or read more requests */
+    struct epoll_event event = {
+        .events   = (client->out_len > 0) ? EPOLLOUT : EPOLLIN,
+        .data.ptr = client,
+    };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event) == 0;
+}
+
+static bool read_client(Client* client) {
+    for (;;) {
+        if (client->in_len >= sizeof(client->in))
+            return ipc_frame_size(client->in, client->in_len) != 0;
+
+        const ssize_t got = read(client->fd, &client->in[client->in_len],
+                                 sizeof(client->in) - client->in_len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (got <= 0)
+            return false;
+        client->in_len += got;
+    }
+}
+
+static void accept_clients(int epoll_fd, int listen_fd) {
+    for (;;) {
+        const int fd =
+          accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                ERR("Could not accept connection: %s", strerror(errno));
+            return;
+        }
+
+        Client* client = calloc(1, sizeof(Client));
+        if (client == NULL) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+
+        struct epoll_event event = {
+            .events   = EPOLLIN,
+            .data.ptr = client,
+        };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            free(client);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Main function */
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        fprintf(stderr,
+                "Usage: %s\n"
+                "Serve plumber(1) requests from a Unix socket.\n",
+                argv[0]);
+        return EXITINVALIDARGS;
+    }
+
+    /* Measure the phases of the requests, see "trace.h" */
+    const bool tracing = trace_init(TRACE_HISTOGRAMS);
+
+    /* The rules file of the user, or the rules of "config.h" */
+    char path[RULES_PATH_SZ];
+    const bool has_path = ruleset_file_path(path, sizeof(path));
+
+    if (!server_rules_init(&g_rules, has_path ? path : NULL))
+        return EXITFAILURE;
+    magic_cache_init(&g_magic);
+
+    const int listen_fd = ipc_listen();
+    if (listen_fd < 0) {
+        server_rules_free(&g_rules);
+        return EXITFAILURE;
+    }
+
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_event = {
+        .events   = EPOLLIN,
+        .data.ptr = NULL,
+    };
+    if (epoll_fd < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) != 0) {
+        ERR("Could not initialize epoll: %s", strerror(errno));
+        return EXITFAILURE;
+    }
+
+    /* Stop cleanly, and don't die if a client closes the connection early */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Write the histograms of the phases on SIGUSR1, and when exiting */
+    if (tracing)
+        sigaction(SIGUSR1, &action, NULL);
+
+    /* The launched commands are reaped by the kernel, see 'launch_detached' */
+    signal(SIGCHLD, SIG_IGN);
+
+    /* Reload the rules when the file changes, even if it didn't exist */
+    Watch watch;
+    pthread_t reload;
+    const bool reloading = has_path && start_reload(&watch, &reload, path);
+
+    /* Update the file index in the background, see 'fileindex_resolve' */
+    const char* roots = getenv("PLUMBER_ROOTS");
+    pthread_t indexer;
+    int indexer_result = -1;
+    if (roots != NULL && *roots != '\0') {
+        indexer_result = create_thread(&indexer, index_thread, NULL);
+        if (indexer_result != 0)
+            ERR("Could not create the index thread: %s",
+                strerror(indexer_result));
+    }
+
+    int events_num = 0;
+
+    while (!g_quit) {
+        if (g_dump) {
+            g_dump = 0;
+            trace_dump();
+            trace_counter("prefetch_bytes", prefetch_total());
+        }
+
+        struct epoll_event events[MAX_EVENTS];
+        const int num = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (num < 0) {
+            if (errno == EINTR)
+                continue;
+            ERR("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < num; i++) {
+            Client* client = events[i].data.ptr;
+            if (client == NULL) {
+                accept_clients(epoll_fd, listen_fd);
+                continue;
+            }
+
+            RuleSet* rules    = server_rules_get(&g_rules);
+            const bool hangup = events[i].events & (EPOLLERR | EPOLLHUP);
+            if (hangup || !read_client(client) ||
+                !process_client(rules, epoll_fd, client))
+                close_client(epoll_fd, client);
+        }
+
+        /* We are not using any rule set here */
+        server_rules_reclaim(&g_rules);
+
+        /* Try the rules that match more often first, we are the only reader */
+        events_num += num;
+        if (events_num >= REORDER_EVENTS) {
+            RuleSet* rules = server_rules_get(&g_rules);
+#ifdef DEBUG
+            double by_priority, by_hits;
+            if (ruleset_order_steps(rules, &by_priority, &by_hits))
+                ERR("Patterns tried per match: %.2f by priority, %.2f by hits.",
+                    by_priority, by_hits);
+#endif
+            ruleset_reorder(rules);
+            events_num = 0;
+        }
+    }
+
+    if (reloading) {
+        pthread_cancel(reload);
+        pthread_join(reload, NULL);
+        close(watch.fd);
+    }
+    if (indexer_result == 0) {
+        pthread_cancel(indexer);
+        pthread_join(indexer, NULL);
+    }
+
+    struct sockaddr_un addr;
+    if (ipc_socket_path(addr.sun_path, sizeof(addr.sun_path)))
+        unlink(addr.sun_path);
+
+    trace_dump();
+    trace_counter("prefetch_bytes", prefetch_total());
+    close(listen_fd);
+    close(epoll_fd);
+    server_rules_free(&g_rules);
+    return EXITSUCCESS;
+}
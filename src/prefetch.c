@@ -0,0 +1,85 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* posix_fadvise */
+
+#include "prefetch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Size of the buffer for joining relative paths to the working directory */
+#define PREFETCH_PATH_SZ 4096
+
+/* Bytes requested by every call, see 'prefetch_total' */
+static uint64_t g_total = 0;
+
+/*----------------------------------------------------------------------------*/
+
+size_t prefetch_file(const char* cwd, const char* path, size_t len) {
+    size_t max_mb   = PREFETCH_MAX_MB;
+    const char* env = getenv("PLUMBER_PREFETCH_MB");
+    if (env != NULL && *env != '\0')
+        max_mb = strtoul(env, NULL, 10);
+    if (max_mb == 0 || len == 0 || len >= PREFETCH_PATH_SZ)
+        return 0;
+
+    char joined[PREFETCH_PATH_SZ];
+    const bool relative = cwd != NULL && *path != '/';
+    const int written   = snprintf(joined, sizeof(joined), "%s%s%.*s",
+                                   relative ? cwd : "", relative ? "/" : "",
+                                   (int)len, path);
+    if (written < 0 || (size_t)written >= sizeof(joined))
+        return 0;
+
+    /* Don't block if it's a FIFO, it's checked after opening it */
+    const int fd = open(joined, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    /*
+     * The read-ahead is started in the background, and the pages stay in the
+     * cache after closing the file.
+     */
+    size_t size = max_mb * 1024 * 1024;
+    if ((uint64_t)st.st_size < size)
+        size = st.st_size;
+    if (posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED) != 0)
+        size = 0;
+    close(fd);
+
+    __atomic_fetch_add(&g_total, size, __ATOMIC_RELAXED);
+    return size;
+}
+
+uint64_t prefetch_total(void) {
+    return __atomic_load_n(&g_total, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,31 @@
+
+#ifndef PREFETCH_H_
+#define PREFETCH_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Maximum number of bytes read ahead from the start of each file, in MiB. It
+ * can be overwritten with "$PLUMBER_PREFETCH_MB", where zero disables it.
+ */
+#define PREFETCH_MAX_MB 16
+
+/*
+ * Ask the kernel to start reading the first bytes of the file at the 'len'
+ * bytes of 'path' into the page cache, up to PREFETCH_MAX_MB, so the command
+ * that opens it doesn't wait for the disk (or the network) as much. The path is
+ * relative to 'cwd', if not NULL. This function doesn't wait for the data, so
+ * it can be called right before launching the command, or when the text is
+ * hovered. Returns the number of bytes that were requested, which is zero if
+ * the path is not a regular file.
+ */
+size_t prefetch_file(const char* cwd, const char* path, size_t len);
+
+/*
+ * Return the total number of bytes requested by 'prefetch_file' in this
+ * process, for tuning PREFETCH_MAX_MB.
+ */
+uint64_t prefetch_total(void);
+
+#endif /* PREFETCH_H_ */
@@ -0,0 +1,436 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* st_mtim */
+
+#include "rulecache.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "dfa.h"
+#include "mapfile.h"
+#include "rules.h"
+#include "suffix.h"
+#include "util.h"
+
+/* Identifies the cache files. Change the version when the format changes */
+#define CACHE_MAGIC   "plumbrc"
+#define CACHE_VERSION 2
+
+/*
+ * Size of a suffix table inside the cache.
+ */
+typedef struct CacheTable {
+    int32_t entries_num, entries_sz;
+    int32_t strings_num;
+    int32_t max_len;
+} CacheTable;
+
+/*
+ * Header at the start of the cache, followed by the sections described in
+ * 'Sections'.
+ */
+typedef struct CacheHeader {
+    MapFileHeader file;
+
+    /* Sizes of the structures, which depend on the compiler */
+    uint32_t rule_sz, state_sz, entry_sz;
+
+    /* Status of the rules file when the cache was built */
+    uint64_t src_dev, src_ino, src_size;
+    int64_t src_mtime_sec, src_mtime_nsec;
+    int64_t src_ctime_sec, src_ctime_nsec;
+
+    int32_t rules_num, args_num, strings_sz;
+
+    int32_t states_num, classes_num, accept_num, initial;
+    uint8_t classes[256];
+
+    CacheTable extensions, filenames;
+} CacheHeader;
+
+/*
+ * Offsets of the sections that follow the header, computed from the header.
+ */
+typedef struct Sections {
+    uint64_t rules, args, strings;
+    uint64_t states, trans, accept;
+    uint64_t ext_entries, ext_strings;
+    uint64_t fn_entries, fn_strings;
+    uint64_t end;
+} Sections;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Compute the offsets of the sections of the cache. Returns false if any of the
+ * sizes in the header is negative.
+ */
+static bool get_sections(const CacheHeader* header, Sections* s) {
+    if (header->rules_num < 0 || header->args_num < 0 ||
+        header->strings_sz < 0 || header->states_num < 0 ||
+        header->classes_num < 0 || header->accept_num < 0 ||
+        header->extensions.entries_sz < 0 ||
+        header->extensions.strings_num < 0 ||
+        header->filenames.entries_sz < 0 || header->filenames.strings_num < 0)
+        return false;
+
+    const uint64_t trans_num =
+      (uint64_t)header->states_num * header->classes_num;
+
+    const CacheTable* ext = &header->extensions;
+    const CacheTable* fn  = &header->filenames;
+
+    uint64_t end = sizeof(CacheHeader);
+    s->rules =
+      mapfile_push_section(&end, header->rules_num, sizeof(RuleCacheRule));
+    s->args = mapfile_push_section(&end, header->args_num, sizeof(int32_t));
+    s->states =
+      mapfile_push_section(&end, header->states_num, sizeof(DfaState));
+    s->trans  = mapfile_push_section(&end, trans_num, sizeof(int32_t));
+    s->accept = mapfile_push_section(&end, header->accept_num, sizeof(int));
+    s->ext_entries =
+      mapfile_push_section(&end, ext->entries_sz, sizeof(SuffixEntry));
+    s->ext_strings =
+      mapfile_push_section(&end, ext->strings_num, sizeof(char));
+    s->fn_entries =
+      mapfile_push_section(&end, fn->entries_sz, sizeof(SuffixEntry));
+    s->fn_strings = mapfile_push_section(&end, fn->strings_num, sizeof(char));
+    s->strings =
+      mapfile_push_section(&end, header->strings_sz, sizeof(char));
+    s->end = end;
+    return true;
+}
+
+static void set_source(CacheHeader* header, const struct stat* src) {
+    header->src_dev        = src->st_dev;
+    header->src_ino        = src->st_ino;
+    header->src_size       = src->st_size;
+    header->src_mtime_sec  = src->st_mtim.tv_sec;
+    header->src_mtime_nsec = src->st_mtim.tv_nsec;
+    header->src_ctime_sec  = src->st_ctim.tv_sec;
+    header->src_ctime_nsec = src->st_ctim.tv_nsec;
+}
+
+/*
+ * Check that the header, whose common part was already checked by
+ * 'mapfile_open', was written by this build of the program for the rules file
+ * whose status is 'src'.
+ */
+static bool valid_header(const CacheHeader* header, const struct stat* src) {
+    CacheHeader expected;
+    memset(&expected, 0, sizeof(expected));
+    set_source(&expected, src);
+
+    return header->rule_sz == sizeof(RuleCacheRule) &&
+           header->state_sz == sizeof(DfaState) &&
+           header->entry_sz == sizeof(SuffixEntry) &&
+           header->src_dev == expected.src_dev &&
+           header->src_ino == expected.src_ino &&
+           header->src_size == expected.src_size &&
+           header->src_mtime_sec == expected.src_mtime_sec &&
+           header->src_mtime_nsec == expected.src_mtime_nsec &&
+           header->src_ctime_sec == expected.src_ctime_sec &&
+           header->src_ctime_nsec == expected.src_ctime_nsec;
+}
+
+/*
+ * Check that the indexes stored in the cache are inside their sections, so a
+ * corrupted cache can't make the matchers read outside of the mapping.
+ */
+static bool valid_contents(const RuleCache* cache, const CacheHeader* header) {
+    const int32_t strings_sz = header->strings_sz;
+    if (cache->rules_num < 1 || strings_sz < 1 ||
+        cache->strings[strings_sz - 1] != '\0')
+        return false;
+
+    /* Every list of templates should be terminated */
+    if (cache->args_num > 0 && cache->args[cache->args_num - 1] != -1)
+        return false;
+    for (int i = 0; i < cache->args_num; i++)
+        if (cache->args[i] < -1 || cache->args[i] >= strings_sz)
+            return false;
+
+    for (int i = 0; i < cache->rules_num; i++) {
+        const RuleCacheRule* rule = &cache->rules[i];
+        if (rule->name < 0 || rule->name >= strings_sz || rule->pattern < 0 ||
+            rule->pattern >= strings_sz || rule->cmd < 0 ||
+            rule->cmd >= strings_sz || rule->args < -1 ||
+            rule->args >= cache->args_num || rule->kind < 0 ||
+            rule->kind > RULE_CUSTOM || rule->mode < LAUNCHMODE_DIRECT ||
+            rule->mode > LAUNCHMODE_TERMINAL || rule->matcher < MATCHER_REGEX ||
+            rule->matcher > MATCHER_FILENAME)
+            return false;
+    }
+
+    /* The DFA reports the indexes of the rules, which should exist */
+    const Dfa* dfa = &cache->dfa;
+    if (dfa->classes_num < 1 || dfa->classes_num > 256 ||
+        dfa->states_num < 1 || dfa->initial < 0 ||
+        dfa->initial >= dfa->states_num)
+        return false;
+    for (int c = 0; c < 256; c++)
+        if (dfa->classes[c] >= dfa->classes_num)
+            return false;
+    for (int i = 0; i < dfa->accept_num; i++)
+        if (dfa->accept[i] < 0 || dfa->accept[i] >= cache->rules_num)
+            return false;
+    for (int i = 0; i < dfa->states_num; i++) {
+        const DfaState* state = &dfa->states[i];
+        if ((state->accept_min != INT_MAX &&
+             (state->accept_min < 0 ||
+              state->accept_min >= cache->rules_num)) ||
+            state->eof_num < 0 || state->eof_off < 0 ||
+            state->eof_off > dfa->accept_num - state->eof_num)
+            return false;
+    }
+    const size_t trans_num = (size_t)dfa->states_num * dfa->classes_num;
+    for (size_t i = 0; i < trans_num; i++)
+        if (dfa->trans[i] < 0 || dfa->trans[i] >= dfa->states_num)
+            return false;
+
+    const SuffixTable* tables[] = { &cache->extensions, &cache->filenames };
+    for (int i = 0; i < LENGTH(tables); i++) {
+        const SuffixTable* table = tables[i];
+        if (table->entries_num == 0)
+            continue;
+
+        /* Lookups stop at an empty entry, so there should be one at least */
+        if (table->entries_sz < 1 ||
+            (table->entries_sz & (table->entries_sz - 1)) != 0 ||
+            table->entries_num >= table->entries_sz || table->max_len < 0)
+            return false;
+        for (int j = 0; j < table->entries_sz; j++) {
+            const SuffixEntry* entry = &table->entries[j];
+            if (entry->id >= cache->rules_num ||
+                (entry->id >= 0 &&
+                 (entry->str_off < 0 || entry->len < 0 ||
+                  entry->str_off > table->strings_num - entry->len)))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Point the suffix table to its section of the cache.
+ */
+static void map_table(SuffixTable* table, const CacheTable* sizes, char* map,
+                      uint64_t entries_off, uint64_t strings_off) {
+    suffix_init(table);
+    table->entries     = (SuffixEntry*)&map[entries_off];
+    table->entries_num = sizes->entries_num;
+    table->entries_sz  = sizes->entries_sz;
+    table->strings     = &map[strings_off];
+    table->strings_num = sizes->strings_num;
+    table->strings_sz  = sizes->strings_num;
+    table->max_len     = sizes->max_len;
+}
+
+static void save_table(CacheTable* sizes, const SuffixTable* table) {
+    sizes->entries_num = table->entries_num;
+    sizes->entries_sz  = table->entries_sz;
+    sizes->strings_num = table->strings_num;
+    sizes->max_len     = table->max_len;
+}
+
+static void write_table(char* buf, const SuffixTable* table,
+                        uint64_t entries_off, uint64_t strings_off) {
+    if (table->entries_sz > 0)
+        memcpy(&buf[entries_off], table->entries,
+               table->entries_sz * sizeof(SuffixEntry));
+    if (table->strings_num > 0)
+        memcpy(&buf[strings_off], table->strings, table->strings_num);
+}
+
+/*
+ * Append a string to the strings section, and return its offset.
+ */
+static int32_t push_string(char* strings, int32_t* len, const char* str) {
+    const int32_t off = *len;
+    const size_t sz   = strlen(str) + 1;
+    if (strings != NULL)
+        memcpy(&strings[off], str, sz);
+    *len += sz;
+    return off;
+}
+
+/*
+ * Write the rules, templates and strings of the rule set, or just count them
+ * if the sections are NULL.
+ */
+static void write_rules(const RuleSet* set, RuleCacheRule* rules,
+                        int32_t* args, int32_t* args_num, char* strings,
+                        int32_t* strings_sz) {
+    *args_num   = 0;
+    *strings_sz = 0;
+    for (int i = 0; i < set->num; i++) {
+        const Rule* rule = &set->rules[i];
+        RuleCacheRule entry;
+        entry.name    = push_string(strings, strings_sz, rule->name);
+        entry.pattern = push_string(strings, strings_sz, rule->pattern);
+        entry.cmd     = push_string(strings, strings_sz, rule->cmd);
+        entry.kind    = rule->kind;
+        entry.mode    = rule->mode;
+        entry.matcher = set->matchers[i];
+        entry.args    = -1;
+
+        if (rule->args != NULL) {
+            entry.args = *args_num;
+            for (int j = 0; rule->args[j] != NULL; j++) {
+                const int32_t off =
+                  push_string(strings, strings_sz, rule->args[j]);
+                if (args != NULL)
+                    args[*args_num] = off;
+                (*args_num)++;
+            }
+            if (args != NULL)
+                args[*args_num] = -1;
+            (*args_num)++;
+        }
+
+        if (rules != NULL)
+            rules[i] = entry;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool rulecache_path(const char* rules_path, char* buf, size_t buf_sz) {
+    /* A cache for each rules file, so they don't replace each other */
+    return mapfile_cache_path("rules", rules_path, buf, buf_sz);
+}
+
+bool rulecache_open(RuleCache* cache, const char* path,
+                    const struct stat* src) {
+    size_t size;
+    void* map = mapfile_open(path, CACHE_MAGIC, CACHE_VERSION,
+                             sizeof(CacheHeader), &size);
+    if (map == NULL)
+        return false;
+
+    const CacheHeader* header = map;
+    Sections s;
+    if (!valid_header(header, src) || !get_sections(header, &s) ||
+        s.end != size) {
+        mapfile_close(map, size);
+        return false;
+    }
+
+    char* bytes     = map;
+    cache->map      = map;
+    cache->map_sz   = size;
+    cache->rules    = (const RuleCacheRule*)&bytes[s.rules];
+    cache->rules_num = header->rules_num;
+    cache->args     = (const int32_t*)&bytes[s.args];
+    cache->args_num = header->args_num;
+    cache->strings  = &bytes[s.strings];
+
+    /* A complete DFA, so 'dfa_match' never needs to modify it */
+    Dfa* dfa = &cache->dfa;
+    dfa_init(dfa);
+    memcpy(dfa->classes, header->classes, sizeof(dfa->classes));
+    dfa->classes_num = header->classes_num;
+    dfa->states      = (DfaState*)&bytes[s.states];
+    dfa->states_num  = header->states_num;
+    dfa->states_sz   = header->states_num;
+    dfa->trans       = (int32_t*)&bytes[s.trans];
+    dfa->accept      = (int*)&bytes[s.accept];
+    dfa->accept_num  = header->accept_num;
+    dfa->accept_sz   = header->accept_num;
+    dfa->initial     = header->initial;
+
+    map_table(&cache->extensions, &header->extensions, bytes, s.ext_entries,
+              s.ext_strings);
+    map_table(&cache->filenames, &header->filenames, bytes, s.fn_entries,
+              s.fn_strings);
+
+    if (!valid_contents(cache, header)) {
+        ERR("Ignoring corrupted cache \"%s\".", path);
+        rulecache_close(cache);
+        return false;
+    }
+
+    return true;
+}
+
+void rulecache_close(RuleCache* cache) {
+    if (cache->map != NULL)
+        mapfile_close(cache->map, cache->map_sz);
+    cache->map = NULL;
+}
+
+bool rulecache_save(const RuleSet* set, const char* path,
+                    const struct stat* src) {
+    /* Only complete automatons can be saved */
+    const Dfa* dfa         = &set->dfa;
+    const size_t trans_num = (size_t)dfa->states_num * dfa->classes_num;
+    for (size_t i = 0; i < trans_num; i++)
+        if (dfa->trans[i] < 0)
+            return false;
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.rule_sz   = sizeof(RuleCacheRule);
+    header.state_sz  = sizeof(DfaState);
+    header.entry_sz  = sizeof(SuffixEntry);
+    set_source(&header, src);
+
+    header.rules_num = set->num;
+    write_rules(set, NULL, NULL, &header.args_num, NULL, &header.strings_sz);
+    header.states_num  = dfa->states_num;
+    header.classes_num = dfa->classes_num;
+    header.accept_num  = dfa->accept_num;
+    header.initial     = dfa->initial;
+    memcpy(header.classes, dfa->classes, sizeof(header.classes));
+    save_table(&header.extensions, &set->extensions);
+    save_table(&header.filenames, &set->filenames);
+
+    Sections s;
+    if (!get_sections(&header, &s))
+        return false;
+    mapfile_init_header(&header.file, CACHE_MAGIC, CACHE_VERSION,
+                        sizeof(CacheHeader), s.end);
+
+    char* buf = calloc(1, s.end);
+    if (buf == NULL)
+        return false;
+
+    memcpy(buf, &header, sizeof(header));
+    write_rules(set, (RuleCacheRule*)&buf[s.rules], (int32_t*)&buf[s.args],
+                &header.args_num, &buf[s.strings], &header.strings_sz);
+    memcpy(&buf[s.states], dfa->states, dfa->states_num * sizeof(DfaState));
+    memcpy(&buf[s.trans], dfa->trans, trans_num * sizeof(int32_t));
+    if (dfa->accept_num > 0)
+        memcpy(&buf[s.accept], dfa->accept, dfa->accept_num * sizeof(int));
+    write_table(buf, &set->extensions, s.ext_entries, s.ext_strings);
+    write_table(buf, &set->filenames, s.fn_entries, s.fn_strings);
+
+    const bool ok = mapfile_save(path, buf, s.end);
+    free(buf);
+    return ok;
+}
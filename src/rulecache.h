@@ -0,0 +1,74 @@
+
+#ifndef RULECACHE_H_
+#define RULECACHE_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "dfa.h"
+#include "rules.h"
+#include "suffix.h"
+
+/*
+ * Rule inside a cache file. The strings are offsets inside 'RuleCache.strings',
+ * and 'args' is the index of the first template inside 'RuleCache.args', or -1
+ * if the rule has no templates.
+ */
+typedef struct RuleCacheRule {
+    int32_t name, pattern, cmd;
+    int32_t args;
+    int32_t kind, mode, matcher;
+} RuleCacheRule;
+
+/*
+ * Rule set saved by 'rulecache_save', mapped in memory. The DFA and the suffix
+ * tables point inside the mapping, so they don't need to be built again, but
+ * they can't be modified or freed.
+ */
+typedef struct RuleCache {
+    void* map;
+    size_t map_sz;
+
+    const RuleCacheRule* rules;
+    int rules_num;
+    const int32_t* args; /* Offsets of the templates, -1 after each list */
+    int args_num;
+    const char* strings;
+
+    Dfa dfa;
+    SuffixTable extensions;
+    SuffixTable filenames;
+} RuleCache;
+
+/*
+ * Write the path of the cache of the rules file at 'rules_path' to 'buf', which
+ * has 'buf_sz' bytes. The cache is stored in "$XDG_CACHE_HOME/plumber" or in
+ * "$HOME/.cache/plumber". Returns false if the path can't be built.
+ */
+bool rulecache_path(const char* rules_path, char* buf, size_t buf_sz);
+
+/*
+ * Map the cache at 'path' in memory. Returns false if the cache doesn't exist,
+ * if it was written by a different version of the program, or if it wasn't
+ * built from the rules file whose status is 'src' (i.e. the file was modified
+ * after writing the cache). The cache should be closed with 'rulecache_close'.
+ */
+bool rulecache_open(RuleCache* cache, const char* path, const struct stat* src);
+
+/*
+ * Unmap a cache opened with 'rulecache_open'.
+ */
+void rulecache_close(RuleCache* cache);
+
+/*
+ * Save the rule set, which was built from the rules file whose status is 'src',
+ * to the cache at 'path'. The rule set should be frozen, see 'ruleset_freeze'.
+ * The cache is replaced atomically, so it can be saved while other processes
+ * are reading it. Returns false on errors.
+ */
+bool rulecache_save(const RuleSet* set, const char* path,
+                    const struct stat* src);
+
+#endif /* RULECACHE_H_ */
@@ -0,0 +1,825 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* strdup, fstat, O_CLOEXEC */
+
+#include "rules.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dfa.h"
+#include "launch.h"
+#include "pattern.h"
+#include "rulecache.h"
+#include "suffix.h"
+#include "trace.h"
+#include "util.h"
+#include "config.h"
+
+/*
+ * Maximum number of argument templates of a rule in a rules file, leaving room
+ * for the terminal and the command in the vector of 'launch_argv'.
+ */
+#define MAX_TEMPLATES (LAUNCH_MAX_ARGS - 3)
+
+/* Launch modes of a rules file */
+#define MODE_DIRECT   "LAUNCH"
+#define MODE_TERMINAL "ST_LAUNCH"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Name, command and launch mode associated to each rule kind.
+ */
+static const struct {
+    const char* name;
+    const char* cmd;
+    enum ELaunchMode mode;
+} kinds[] = {
+    [RULE_URL]     = { "url", CMD_BROWSER, LAUNCHMODE_DIRECT },
+    [RULE_PDF]     = { "pdf", CMD_PDF, LAUNCHMODE_DIRECT },
+    [RULE_MAN]     = { "man", CMD_MAN, LAUNCHMODE_TERMINAL },
+    [RULE_LINECOL] = { "linecol", CMD_EDITOR, LAUNCHMODE_TERMINAL },
+    [RULE_IMAGE]   = { "image", CMD_IMAGE, LAUNCHMODE_DIRECT },
+    [RULE_VIDEO]   = { "video", CMD_VIDEO, LAUNCHMODE_DIRECT },
+    [RULE_EDITOR]  = { "editor", CMD_EDITOR, LAUNCHMODE_TERMINAL },
+    [RULE_CUSTOM]  = { "custom", NULL, LAUNCHMODE_DIRECT },
+};
+
+/*----------------------------------------------------------------------------*/
+
+static void push_rule(RuleSet* set, const char* pattern, enum ERuleKind kind,
+                      const char* const* args) {
+    Rule* rule    = &set->rules[set->num++];
+    rule->name    = kinds[kind].name;
+    rule->pattern = pattern;
+    rule->cmd     = kinds[kind].cmd;
+    rule->kind    = kind;
+    rule->mode    = kinds[kind].mode;
+    rule->args    = args;
+}
+
+/*
+ * Compile the pattern of the specified rule with regcomp(3), if it wasn't
+ * compiled already. Returns false if it can't be compiled.
+ */
+static bool compile_rule(RuleSet* set, int i) {
+    if (!set->is_compiled[i])
+        set->is_compiled[i] =
+          pattern_compile(&set->compiled[i], set->rules[i].pattern);
+
+    return set->is_compiled[i];
+}
+
+/*
+ * Choose the fastest matcher for the pattern of the specified rule, and add the
+ * pattern to it. Returns false if the pattern can't be compiled.
+ */
+static bool add_matcher(RuleSet* set, int i) {
+    const char* pattern = set->rules[i].pattern;
+
+    /* The groups of the pattern are needed for building the arguments */
+    if (set->rules[i].args != NULL && !compile_rule(set, i))
+        return false;
+
+    char literal[256];
+    int len;
+    if ((len = suffix_parse_extension(pattern, literal, sizeof(literal))) > 0) {
+        set->matchers[i] = MATCHER_EXTENSION;
+        return suffix_add(&set->extensions, literal, len, i);
+    }
+
+    if ((len = suffix_parse_filename(pattern, literal, sizeof(literal))) > 0) {
+        set->matchers[i] = MATCHER_FILENAME;
+        return suffix_add(&set->filenames, literal, len, i);
+    }
+
+    if (dfa_add(&set->dfa, pattern, i)) {
+        set->matchers[i] = MATCHER_DFA;
+        return true;
+    }
+
+    set->matchers[i] = MATCHER_REGEX;
+    return compile_rule(set, i);
+}
+
+/*
+ * Allocate the arrays of an empty rule set, with room for 'max_rules' rules.
+ * Returns false on allocation errors, in which case the rule set doesn't need
+ * to be freed.
+ */
+static bool alloc_rules(RuleSet* set, int max_rules) {
+    set->num         = 0;
+    set->rules       = malloc(max_rules * sizeof(Rule));
+    set->matchers    = malloc(max_rules * sizeof(enum ERuleMatcher));
+    set->compiled    = malloc(max_rules * sizeof(regex_t));
+    set->is_compiled = calloc(max_rules, sizeof(bool));
+    set->path        = NULL;
+    set->text        = NULL;
+    set->args_pool   = NULL;
+    set->map         = NULL;
+    set->map_sz      = 0;
+    set->order       = NULL;
+    set->order_num   = 0;
+    set->run_ends    = NULL;
+    set->runs_num    = 0;
+    set->hits        = NULL;
+    suffix_init(&set->extensions);
+    suffix_init(&set->filenames);
+    dfa_init(&set->dfa);
+    if (set->rules == NULL || set->matchers == NULL || set->compiled == NULL ||
+        set->is_compiled == NULL) {
+        ERR("Could not allocate rule set.");
+        ruleset_free(set);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Add the matchers of all the rules, and prepare them for matching. Returns
+ * false on errors, in which case the rule set is freed.
+ */
+static bool add_matchers(RuleSet* set) {
+    for (int i = 0; i < set->num; i++) {
+        if (!add_matcher(set, i)) {
+            ruleset_free(set);
+            return false;
+        }
+    }
+
+    if (!dfa_finish(&set->dfa)) {
+        ERR("Could not build the DFA for the rule set.");
+        ruleset_free(set);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Read the next word of a line of a rules file, starting at '*pos', and
+ * null-terminate it in-place, removing the quotes. Returns NULL if there are no
+ * more words, or if a quote is not closed, in which case 'unclosed' is set.
+ */
+static char* next_word(char** pos, bool* unclosed) {
+    char* p = *pos;
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        p++;
+    if (*p == '\0' || *p == '#')
+        return NULL;
+
+    char* word  = p;
+    char* out   = p;
+    bool quoted = false;
+    for (; *p != '\0'; p++) {
+        if (*p == '\'') {
+            /* Two quotes inside a quoted word are a literal quote */
+            if (!quoted || p[1] != '\'') {
+                quoted = !quoted;
+                continue;
+            }
+            p++;
+        } else if (!quoted && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            break;
+        }
+        *out++ = *p;
+    }
+
+    if (quoted) {
+        *unclosed = true;
+        return NULL;
+    }
+
+    *pos = (*p == '\0') ? p : p + 1;
+    *out = '\0';
+    return word;
+}
+
+/*
+ * Return the kind of the rules with the specified name, or RULE_CUSTOM if none
+ * of the kinds in "config.h" has that name.
+ */
+static enum ERuleKind kind_from_name(const char* name) {
+    for (int i = 0; i < RULE_CUSTOM; i++)
+        if (!strcmp(kinds[i].name, name))
+            return i;
+
+    return RULE_CUSTOM;
+}
+
+/*
+ * Parse a line of a rules file into the next rule of the set, whose argument
+ * templates are stored at '*args'. Returns false on syntax errors.
+ */
+static bool parse_line(RuleSet* set, char* line, const char*** args,
+                       const char* path, int line_num) {
+    char* words[4 + MAX_TEMPLATES];
+    int num       = 0;
+    bool unclosed = false;
+
+    char* word;
+    while ((word = next_word(&line, &unclosed)) != NULL) {
+        if (num >= LENGTH(words)) {
+            ERR("%s:%d: Too many arguments, the maximum is %d.",
+                path,
+                line_num,
+                MAX_TEMPLATES);
+            return false;
+        }
+        words[num++] = word;
+    }
+
+    if (unclosed) {
+        ERR("%s:%d: Unclosed quote.", path, line_num);
+        return false;
+    }
+    if (num == 0)
+        return true;
+    if (num < 4) {
+        ERR("%s:%d: Expected a name, a launch mode, a pattern and a command.",
+            path,
+            line_num);
+        return false;
+    }
+
+    Rule* rule    = &set->rules[set->num++];
+    rule->name    = words[0];
+    rule->kind    = kind_from_name(words[0]);
+    rule->pattern = words[2];
+    rule->cmd     = words[3];
+    rule->args    = NULL;
+
+    if (!strcmp(words[1], MODE_DIRECT)) {
+        rule->mode = LAUNCHMODE_DIRECT;
+    } else if (!strcmp(words[1], MODE_TERMINAL)) {
+        rule->mode = LAUNCHMODE_TERMINAL;
+    } else {
+        ERR("%s:%d: Invalid launch mode \"%s\", expected \"%s\" or \"%s\".",
+            path,
+            line_num,
+            words[1],
+            MODE_DIRECT,
+            MODE_TERMINAL);
+        return false;
+    }
+
+    if (num > 4) {
+        rule->args = *args;
+        for (int i = 4; i < num; i++)
+            *(*args)++ = words[i];
+        *(*args)++ = NULL;
+    }
+
+    return true;
+}
+
+/*
+ * Read the rules file at 'fd' into the empty rule set. Returns false on errors,
+ * in which case the rule set is freed.
+ */
+static bool parse_rules(RuleSet* set, int fd, size_t size, const char* path) {
+    /* The strings of the rules point to the text, so it's never freed */
+    char* text = malloc(size + 1);
+    if (text == NULL) {
+        ERR("Could not allocate the rules file.");
+        return false;
+    }
+
+    size_t len = 0;
+    while (len < size) {
+        const ssize_t result = read(fd, &text[len], size - len);
+        if (result == 0)
+            break;
+        if (result < 0 && errno != EINTR) {
+            ERR("Could not read the rules file \"%s\": %s",
+                path,
+                strerror(errno));
+            free(text);
+            return false;
+        }
+        if (result > 0)
+            len += result;
+    }
+    text[len] = '\0';
+
+    int lines = 1;
+    for (size_t i = 0; i < len; i++)
+        if (text[i] == '\n')
+            lines++;
+
+    if (!alloc_rules(set, lines)) {
+        free(text);
+        return false;
+    }
+    set->text      = text;
+    set->args_pool = malloc(lines * (MAX_TEMPLATES + 1) * sizeof(char*));
+    if (set->args_pool == NULL) {
+        ERR("Could not allocate rule set.");
+        ruleset_free(set);
+        return false;
+    }
+
+    const char** args = set->args_pool;
+    char* line        = text;
+    for (int line_num = 1; line != NULL; line_num++) {
+        char* next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+
+        if (!parse_line(set, line, &args, path, line_num)) {
+            ruleset_free(set);
+            return false;
+        }
+        line = next;
+    }
+
+    if (set->num == 0) {
+        ERR("The rules file \"%s\" doesn't have any rules.", path);
+        ruleset_free(set);
+        return false;
+    }
+
+    return add_matchers(set);
+}
+
+/*
+ * Divide the rules matched with regcomp(3) in runs for 'ruleset_reorder',
+ * extending each run while the next pattern is disjoint with all of its
+ * patterns. Returns false on allocation errors.
+ */
+static bool build_order(RuleSet* set) {
+    free(set->order);
+    free(set->run_ends);
+    free(set->hits);
+    set->order     = malloc((set->num + 1) * sizeof(int));
+    set->run_ends  = malloc((set->num + 1) * sizeof(int));
+    set->hits      = calloc(set->num + 1, sizeof(uint64_t));
+    set->order_num = 0;
+    set->runs_num  = 0;
+    if (set->order == NULL || set->run_ends == NULL || set->hits == NULL) {
+        ERR("Could not allocate rule set.");
+        return false;
+    }
+
+    int run_start = 0;
+    for (int i = 0; i < set->num; i++) {
+        if (set->matchers[i] != MATCHER_REGEX)
+            continue;
+
+        for (int k = run_start; k < set->order_num; k++) {
+            if (!pattern_disjoint(set->rules[set->order[k]].pattern,
+                                  set->rules[i].pattern)) {
+                set->run_ends[set->runs_num++] = set->order_num;
+                run_start                      = set->order_num;
+                break;
+            }
+        }
+        set->order[set->order_num++] = i;
+    }
+    if (set->order_num > 0)
+        set->run_ends[set->runs_num++] = set->order_num;
+
+    return true;
+}
+
+/*
+ * Check if rule 'a' should be tried before rule 'b', which belong to the same
+ * run of 'RuleSet.order'.
+ */
+static bool tried_before(const RuleSet* set, int a, int b) {
+    return set->hits[a] > set->hits[b] ||
+           (set->hits[a] == set->hits[b] && a < b);
+}
+
+/*
+ * Build the rule set from a cache opened with 'rulecache_open', which belongs
+ * to the rule set afterwards. Returns false on errors, in which case the rule
+ * set and the cache are freed.
+ */
+static bool load_cache(RuleSet* set, RuleCache* cache) {
+    if (!alloc_rules(set, cache->rules_num)) {
+        rulecache_close(cache);
+        return false;
+    }
+    set->map    = cache->map;
+    set->map_sz = cache->map_sz;
+
+    if (cache->args_num > 0) {
+        set->args_pool = malloc(cache->args_num * sizeof(char*));
+        if (set->args_pool == NULL) {
+            ERR("Could not allocate rule set.");
+            ruleset_free(set);
+            return false;
+        }
+    }
+    for (int i = 0; i < cache->args_num; i++)
+        set->args_pool[i] =
+          (cache->args[i] < 0) ? NULL : &cache->strings[cache->args[i]];
+
+    set->num = cache->rules_num;
+    for (int i = 0; i < set->num; i++) {
+        const RuleCacheRule* entry = &cache->rules[i];
+        Rule* rule                 = &set->rules[i];
+        rule->name    = &cache->strings[entry->name];
+        rule->pattern = &cache->strings[entry->pattern];
+        rule->cmd     = &cache->strings[entry->cmd];
+        rule->kind    = entry->kind;
+        rule->mode    = entry->mode;
+        rule->args = (entry->args < 0) ? NULL : &set->args_pool[entry->args];
+        set->matchers[i] = entry->matcher;
+    }
+
+    set->dfa        = cache->dfa;
+    set->extensions = cache->extensions;
+    set->filenames  = cache->filenames;
+
+    /* The compiled patterns can't be saved */
+    for (int i = 0; i < set->num; i++) {
+        if ((set->matchers[i] == MATCHER_REGEX || set->rules[i].args != NULL) &&
+            !compile_rule(set, i)) {
+            ruleset_free(set);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool ruleset_init(RuleSet* set) {
+    const int max_rules = 5 + LENGTH(image_patterns) + LENGTH(video_patterns) +
+                          LENGTH(editor_patterns);
+
+    if (!alloc_rules(set, max_rules))
+        return false;
+
+    /*
+     * NOTE: The order of the rules determines their priority, so the most
+     * specific ones should be pushed first.
+     */
+    push_rule(set, REGEX_URL, RULE_URL, NULL);
+    push_rule(set, REGEX_PDF, RULE_PDF, NULL);
+    push_rule(set, REGEX_MAN, RULE_MAN, NULL);
+    push_rule(set, REGEX_LINECOL, RULE_LINECOL, linecol_args);
+    push_rule(set, REGEX_MSVC, RULE_LINECOL, linecol_args);
+    for (int i = 0; i < LENGTH(image_patterns); i++)
+        push_rule(set, image_patterns[i], RULE_IMAGE, NULL);
+    for (int i = 0; i < LENGTH(video_patterns); i++)
+        push_rule(set, video_patterns[i], RULE_VIDEO, NULL);
+    for (int i = 0; i < LENGTH(editor_patterns); i++)
+        push_rule(set, editor_patterns[i], RULE_EDITOR, NULL);
+
+    return add_matchers(set);
+}
+
+bool ruleset_load(RuleSet* set, const char* path) {
+    if (path == NULL)
+        return ruleset_init(set);
+
+    char* path_copy = strdup(path);
+    if (path_copy == NULL) {
+        ERR("Could not allocate rule set.");
+        return false;
+    }
+
+    /* The status of the opened file, in case it's replaced while reading it */
+    struct stat st;
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        ERR("Could not open the rules file \"%s\": %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        free(path_copy);
+        return false;
+    }
+
+    char cache_path[RULES_PATH_SZ];
+    const bool has_cache =
+      rulecache_path(path, cache_path, sizeof(cache_path));
+
+    RuleCache cache;
+    bool ok;
+    if (has_cache && rulecache_open(&cache, cache_path, &st)) {
+        ok = load_cache(set, &cache);
+    } else {
+        /* The cache is an optimization, so it is fine if it cannot be saved */
+        ok = parse_rules(set, fd, st.st_size, path);
+        if (ok && !ruleset_freeze(set, false)) {
+            ERR("Could not prepare the rule set for matching.");
+            ruleset_free(set);
+            ok = false;
+        }
+        if (ok && has_cache)
+            rulecache_save(set, cache_path, &st);
+    }
+
+    close(fd);
+    if (!ok) {
+        free(path_copy);
+        return false;
+    }
+
+    set->path = path_copy;
+    return true;
+}
+
+bool ruleset_file_path(char* buf, size_t buf_sz) {
+    int written;
+
+    const char* env    = getenv("PLUMBER_RULES");
+    const char* config = getenv("XDG_CONFIG_HOME");
+    const char* home   = getenv("HOME");
+    if (env != NULL && *env != '\0')
+        written = snprintf(buf, buf_sz, "%s", env);
+    else if (config != NULL && *config != '\0')
+        written = snprintf(buf, buf_sz, "%s/plumber/rules", config);
+    else if (home != NULL && *home != '\0')
+        written = snprintf(buf, buf_sz, "%s/.config/plumber/rules", home);
+    else
+        return false;
+
+    return written > 0 && (size_t)written < buf_sz;
+}
+
+bool ruleset_default_path(char* buf, size_t buf_sz) {
+    return ruleset_file_path(buf, buf_sz) && access(buf, F_OK) == 0;
+}
+
+void ruleset_free(RuleSet* set) {
+    for (int i = 0; i < set->num; i++)
+        if (set->is_compiled[i])
+            regfree(&set->compiled[i]);
+
+    /* The tables of a cache are inside the mapping */
+    if (set->map != NULL) {
+        munmap(set->map, set->map_sz);
+    } else {
+        suffix_free(&set->extensions);
+        suffix_free(&set->filenames);
+        dfa_free(&set->dfa);
+    }
+
+    free(set->rules);
+    free(set->matchers);
+    free(set->compiled);
+    free(set->is_compiled);
+    free(set->path);
+    free(set->text);
+    free(set->args_pool);
+    free(set->order);
+    free(set->run_ends);
+    free(set->hits);
+    set->rules       = NULL;
+    set->matchers    = NULL;
+    set->compiled    = NULL;
+    set->is_compiled = NULL;
+    set->path        = NULL;
+    set->text        = NULL;
+    set->args_pool   = NULL;
+    set->map         = NULL;
+    set->order       = NULL;
+    set->run_ends    = NULL;
+    set->hits        = NULL;
+    set->order_num   = 0;
+    set->runs_num    = 0;
+    set->num         = 0;
+}
+
+bool ruleset_freeze(RuleSet* set, bool reference) {
+    if (reference) {
+        for (int i = 0; i < set->num; i++)
+            if (!compile_rule(set, i))
+                return false;
+        return true;
+    }
+
+    if (dfa_build_all(&set->dfa))
+        return build_order(set);
+
+    /*
+     * The DFA is too big to be built in advance, so match its patterns with
+     * regcomp(3) instead, and replace it with an empty one.
+     */
+    for (int i = 0; i < set->num; i++) {
+        if (set->matchers[i] != MATCHER_DFA)
+            continue;
+        set->matchers[i] = MATCHER_REGEX;
+        if (!compile_rule(set, i))
+            return false;
+    }
+
+    dfa_free(&set->dfa);
+    return dfa_finish(&set->dfa) && dfa_build_all(&set->dfa) &&
+           build_order(set);
+}
+
+int ruleset_match(RuleSet* set, const char* str) {
+    return ruleset_match_len(set, str, strlen(str));
+}
+
+int ruleset_match_len(RuleSet* set, const char* str, size_t len) {
+    int64_t start = TRACE_START();
+    int best      = suffix_match_extension(&set->extensions, str, len);
+    const int filename = suffix_match_filename(&set->filenames, str, len);
+    if (best < 0 || (filename >= 0 && filename < best))
+        best = filename;
+    TRACE_END(TRACE_SUFFIX, best, start);
+    if (best < 0)
+        best = set->num;
+
+    /* The DFA only needs to look for rules with more priority */
+    start         = TRACE_START();
+    const int dfa = dfa_match(&set->dfa, str, len, best);
+    TRACE_END(TRACE_DFA, dfa, start);
+    if (dfa == DFA_FAIL)
+        return ruleset_match_reference_len(set, str, len);
+    if (dfa >= 0)
+        best = dfa;
+
+    /*
+     * Same for the rules that are not supported by the DFA, in the order of
+     * 'ruleset_reorder' if the rule set is frozen.
+     */
+    const int num = (set->order != NULL) ? set->order_num : best;
+    for (int k = 0; k < num; k++) {
+        const int i = (set->order != NULL) ? set->order[k] : k;
+        if (i >= best || set->matchers[i] != MATCHER_REGEX)
+            continue;
+
+        start              = TRACE_START();
+        const bool matches = pattern_matches_len(str, len, &set->compiled[i]);
+        TRACE_END(TRACE_REGEXEC, i, start);
+        if (matches) {
+            if (set->hits != NULL)
+                __atomic_fetch_add(&set->hits[i], 1, __ATOMIC_RELAXED);
+            return i;
+        }
+    }
+
+    return (best < set->num) ? best : -1;
+}
+
+int ruleset_match_reference(RuleSet* set, const char* str) {
+    for (int i = 0; i < set->num; i++)
+        if (compile_rule(set, i) &&
+            pattern_matches_compiled(str, &set->compiled[i]))
+            return i;
+
+    return -1;
+}
+
+int ruleset_match_reference_len(RuleSet* set, const char* str, size_t len) {
+    for (int i = 0; i < set->num; i++)
+        if (compile_rule(set, i) &&
+            pattern_matches_len(str, len, &set->compiled[i]))
+            return i;
+
+    return -1;
+}
+
+int ruleset_match_after(RuleSet* set, const char* str, size_t len, int rule) {
+    /*
+     * The rules before 'rule' didn't match, so the first rule of the suffix
+     * tables that matches is after it, and their patterns don't need to be
+     * compiled.
+     */
+    int best = suffix_match_extension(&set->extensions, str, len);
+    const int filename = suffix_match_filename(&set->filenames, str, len);
+    if (best <= rule || (filename > rule && filename < best))
+        best = filename;
+    if (best <= rule)
+        best = set->num;
+
+    for (int i = rule + 1; i < best; i++)
+        if (set->matchers[i] != MATCHER_EXTENSION &&
+            set->matchers[i] != MATCHER_FILENAME && compile_rule(set, i) &&
+            pattern_matches_len(str, len, &set->compiled[i]))
+            return i;
+
+    return (best < set->num) ? best : -1;
+}
+
+int ruleset_find_kind(const RuleSet* set, enum ERuleKind kind) {
+    for (int i = 0; i < set->num; i++)
+        if (set->rules[i].kind == kind && set->rules[i].args == NULL)
+            return i;
+
+    return -1;
+}
+
+void ruleset_reorder(RuleSet* set) {
+    /* Insertion sort of each run, which are usually short and sorted */
+    for (int r = 0; r < set->runs_num; r++) {
+        const int start = (r == 0) ? 0 : set->run_ends[r - 1];
+        for (int k = start + 1; k < set->run_ends[r]; k++) {
+            const int rule = set->order[k];
+            int j          = k;
+            for (; j > start && tried_before(set, rule, set->order[j - 1]); j--)
+                set->order[j] = set->order[j - 1];
+            set->order[j] = rule;
+        }
+    }
+
+    for (int i = 0; i < set->num; i++)
+        set->hits[i] /= 2;
+}
+
+bool ruleset_order_steps(const RuleSet* set, double* by_priority,
+                         double* by_hits) {
+    uint64_t total = 0, priority_steps = 0, hits_steps = 0;
+    for (int k = 0; k < set->order_num; k++) {
+        const int rule = set->order[k];
+
+        /* The rules before it, in the order of the rules */
+        int position = 0;
+        for (int j = 0; j < set->order_num; j++)
+            if (set->order[j] < rule)
+                position++;
+
+        total += set->hits[rule];
+        priority_steps += set->hits[rule] * (position + 1);
+        hits_steps += set->hits[rule] * (k + 1);
+    }
+    if (total == 0)
+        return false;
+
+    *by_priority = (double)priority_steps / total;
+    *by_hits     = (double)hits_steps / total;
+    return true;
+}
+
+uint64_t ruleset_hash(const RuleSet* set) {
+    /* FNV-1a, including the null bytes between the patterns */
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < set->num; i++)
+        for (const char* p = set->rules[i].pattern;; p++) {
+            hash = (hash ^ (unsigned char)*p) * 0x100000001B3ULL;
+            if (*p == '\0')
+                break;
+        }
+
+    return hash;
+}
+
+const char* rule_kind_name(enum ERuleKind kind) {
+    return kinds[kind].name;
+}
+
+const char* rule_kind_cmd(enum ERuleKind kind) {
+    return kinds[kind].cmd;
+}
+
+enum ELaunchMode rule_kind_mode(enum ERuleKind kind) {
+    return kinds[kind].mode;
+}
+
+bool rule_kind_opens_source(enum ERuleKind kind) {
+    return kind == RULE_EDITOR || kind == RULE_LINECOL;
+}
+
+bool rule_kind_prefetches(enum ERuleKind kind) {
+    return kind == RULE_PDF || kind == RULE_IMAGE || kind == RULE_VIDEO;
+}
+
+size_t rule_kind_path_len(enum ERuleKind kind, const char* str, size_t len) {
+    if (rule_kind_prefetches(kind))
+        return len;
+    if (!rule_kind_opens_source(kind))
+        return 0;
+
+    /* Same as 'fileindex_resolve' */
+    size_t path_len = 0;
+    while (path_len < len && str[path_len] != ':' && str[path_len] != '(')
+        path_len++;
+    return path_len;
+}
@@ -0,0 +1,269 @@
+
+#ifndef RULES_H_
+#define RULES_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <regex.h>
+
+#include "dfa.h"
+#include "suffix.h"
+
+/*
+ * Size of the buffers for the paths of the rules file and its cache.
+ */
+#define RULES_PATH_SZ 4096
+
+/*
+ * How the command of a rule should be executed.
+ */
+enum ELaunchMode {
+    LAUNCHMODE_DIRECT,   /* Execute the command directly */
+    LAUNCHMODE_TERMINAL, /* Execute from new st(1) instance */
+};
+
+/*
+ * Category of a rule, used to decide how the arguments of the command should
+ * be built.
+ */
+enum ERuleKind {
+    RULE_URL,
+    RULE_PDF,
+    RULE_MAN,
+    RULE_LINECOL,
+    RULE_IMAGE,
+    RULE_VIDEO,
+    RULE_EDITOR,
+    RULE_CUSTOM, /* Rules of a rules file with a different name */
+};
+
+/*
+ * Method used for matching the pattern of a rule. See 'RuleSet'.
+ */
+enum ERuleMatcher {
+    MATCHER_REGEX,     /* Compiled with regcomp(3), tried in order */
+    MATCHER_DFA,       /* Part of 'RuleSet.dfa' */
+    MATCHER_EXTENSION, /* Part of 'RuleSet.extensions' */
+    MATCHER_FILENAME,  /* Part of 'RuleSet.filenames' */
+};
+
+typedef struct Rule {
+    const char* name;
+    const char* pattern;
+    const char* cmd;
+    enum ERuleKind kind;
+    enum ELaunchMode mode;
+
+    /*
+     * NULL-terminated templates of the arguments for 'cmd', which can refer to
+     * the groups of the pattern; or NULL for using the matched string as the
+     * only argument. See 'launch_argv'.
+     */
+    const char* const* args;
+} Rule;
+
+/*
+ * List of rules, sorted by priority, along with their compiled patterns.
+ *
+ * Patterns in the format of REGEX_EXTENSION and REGEX_FILENAME are simple
+ * lookups in a hash table. The other patterns supported by the 'Dfa' are all
+ * matched at once, in a single pass. The rest of them are compiled with
+ * regcomp(3) and tried in order.
+ */
+typedef struct RuleSet {
+    Rule* rules;
+    int num;
+
+    enum ERuleMatcher* matchers;
+    SuffixTable extensions;
+    SuffixTable filenames;
+    Dfa dfa;
+
+    regex_t* compiled;
+    bool* is_compiled; /* True if the 'compiled' pattern is valid */
+
+    /*
+     * Order in which the MATCHER_REGEX rules are tried, divided in runs of
+     * rules that can't match the same strings: the run K is 'order[S]' to
+     * 'order[run_ends[K] - 1]', where S is 'run_ends[K - 1]', or 0. The runs
+     * are sorted by priority, but the rules of each run can be tried in any
+     * order, since only one of them can match; so they are sorted by their
+     * number of 'hits'. See 'ruleset_reorder'.
+     */
+    int* order;
+    int order_num;
+    int* run_ends;
+    int runs_num;
+    uint64_t* hits;
+
+    /*
+     * Rules file used by 'ruleset_load', or NULL for the rules of "config.h".
+     * The strings of the rules point to 'text', or to the mapped cache of the
+     * file; in the latter case, the DFA and the suffix tables are inside the
+     * cache too, and they are not freed.
+     */
+    char* path;
+    char* text;
+    const char** args_pool;
+    void* map;
+    size_t map_sz;
+} RuleSet;
+
+/*
+ * Build the rule set from the patterns and commands in "config.h", choosing the
+ * fastest matcher for each pattern. The patterns of the rules with argument
+ * templates are always compiled with regcomp(3) too, for getting their groups.
+ * Returns true on success; on failure, the rule set doesn't need to be freed.
+ */
+bool ruleset_init(RuleSet* set);
+
+/*
+ * Build the rule set from the rules file at 'path', or from "config.h" if it's
+ * NULL. Returns true on success; on failure, the rule set doesn't need to be
+ * freed.
+ *
+ * The rules file is only parsed if it changed since the last call, since the
+ * rule set is saved to a cache (see "rulecache.h"), which is mapped in memory
+ * on the next call. Rule sets loaded from a file are always frozen, see
+ * 'ruleset_freeze'.
+ *
+ * Each line of the rules file is a rule, and the rules are sorted by priority.
+ * A rule consists of its name, its launch mode ("LAUNCH" for executing the
+ * command directly, or "ST_LAUNCH" for executing it from a terminal), its
+ * pattern, its command, and optionally the argument templates for the command
+ * (see 'launch_argv'). These words are separated by spaces, and they can be
+ * quoted with single quotes, where two quotes are a literal one. Empty lines
+ * and lines starting with '#' are ignored.
+ */
+bool ruleset_load(RuleSet* set, const char* path);
+
+/*
+ * Write the path of the rules file of the user to 'buf', which has 'buf_sz'
+ * bytes: "$PLUMBER_RULES", "$XDG_CONFIG_HOME/plumber/rules", or
+ * "$HOME/.config/plumber/rules". Returns false if the path can't be built.
+ */
+bool ruleset_file_path(char* buf, size_t buf_sz);
+
+/*
+ * Same as 'ruleset_file_path', but return false if the file doesn't exist, in
+ * which case the rules of "config.h" should be used.
+ */
+bool ruleset_default_path(char* buf, size_t buf_sz);
+
+/*
+ * Free all the memory used by a rule set initialized with 'ruleset_init' or
+ * 'ruleset_load'.
+ */
+void ruleset_free(RuleSet* set);
+
+/*
+ * Return the index of the first rule (i.e. the one with more priority) that
+ * matches 'str', or -1 if none of them matched.
+ *
+ * The input is scanned once by the DFA, which is built lazily, so the rule set
+ * is modified unless 'ruleset_freeze' was called. Extensions and file names are
+ * looked up without scanning.
+ */
+int ruleset_match(RuleSet* set, const char* str);
+
+/*
+ * Same as 'ruleset_match', but for the 'len' bytes of 'str', which don't need
+ * to be null-terminated.
+ */
+int ruleset_match_len(RuleSet* set, const char* str, size_t len);
+
+/*
+ * Same as 'ruleset_match', but try each pattern in order with regexec(3). It is
+ * much slower, but it's useful as a reference for 'ruleset_match'. The missing
+ * patterns are compiled when needed.
+ */
+int ruleset_match_reference(RuleSet* set, const char* str);
+int ruleset_match_reference_len(RuleSet* set, const char* str, size_t len);
+
+/*
+ * Return the index of the first rule after 'rule' that matches the 'len' bytes
+ * of 'str', or -1 if none of them matched; for ignoring a rule that matched,
+ * e.g. because the manual page doesn't exist. The rules before 'rule' should
+ * not match the string (i.e. 'rule' was returned by 'ruleset_match_len'). The
+ * patterns that are not in the suffix tables are tried with regexec(3), like in
+ * 'ruleset_match_reference', so it's slower than 'ruleset_match_len'.
+ */
+int ruleset_match_after(RuleSet* set, const char* str, size_t len, int rule);
+
+/*
+ * Return the index of the first rule of 'kind' whose command receives the
+ * matched string as its only argument, or -1 if there are none. Used for files
+ * that are classified by their contents, see "magic.h".
+ */
+int ruleset_find_kind(const RuleSet* set, enum ERuleKind kind);
+
+/*
+ * Sort the rules that are tried with regexec(3) by the number of times they
+ * matched, without changing the result of 'ruleset_match_len': only the rules
+ * that can't match the same strings are reordered (see 'pattern_disjoint').
+ * The counts are halved afterwards, so the order adapts to recent matches.
+ *
+ * Since the order is modified, this function can't be called while matching
+ * from other threads. The rule set should be frozen, see 'ruleset_freeze'.
+ */
+void ruleset_reorder(RuleSet* set);
+
+/*
+ * Return the average number of patterns that 'ruleset_match_len' tries with
+ * regexec(3) for a string that matches one of them, weighted by the recent
+ * 'hits' of each rule: in the order of the rules ('*by_priority') and in the
+ * current order ('*by_hits'). Returns false if none of them matched.
+ */
+bool ruleset_order_steps(const RuleSet* set, double* by_priority,
+                         double* by_hits);
+
+/*
+ * Return a hash of the patterns of the rule set, in order. Two rule sets with
+ * the same hash return the same rule for the same string, so it identifies the
+ * results that were cached with a different rule set.
+ */
+uint64_t ruleset_hash(const RuleSet* set);
+
+/*
+ * Do all the work that the matching functions would do lazily, so they don't
+ * modify the rule set anymore, and they can be called from multiple threads at
+ * once: build the whole DFA or, if 'reference' is true, compile all the
+ * patterns for 'ruleset_match_reference'. Returns false on errors.
+ *
+ * If the DFA would be too big, its patterns are matched with regcomp(3)
+ * instead. The order of the patterns matched with regcomp(3) is reset, see
+ * 'ruleset_reorder'.
+ */
+bool ruleset_freeze(RuleSet* set, bool reference);
+
+/*
+ * Get the name, command and launch mode associated to a rule kind in
+ * "config.h".
+ */
+const char* rule_kind_name(enum ERuleKind kind);
+const char* rule_kind_cmd(enum ERuleKind kind);
+enum ELaunchMode rule_kind_mode(enum ERuleKind kind);
+
+/*
+ * Check if the rules of a kind open source files, whose paths might be relative
+ * to a different directory (e.g. the build directory of a compiler), so they
+ * should be resolved with 'fileindex_resolve'.
+ */
+bool rule_kind_opens_source(enum ERuleKind kind);
+
+/*
+ * Check if the rules of a kind open big local files (e.g. videos), which should
+ * be read ahead with 'prefetch_file' while the command starts.
+ */
+bool rule_kind_prefetches(enum ERuleKind kind);
+
+/*
+ * If the rules of a kind open local files, return the length of the path in
+ * the 'len' bytes of 'str': the whole string, or the part before the line
+ * number for source files (e.g. "foo.c" in "foo.c:42"). Otherwise, returns
+ * zero.
+ */
+size_t rule_kind_path_len(enum ERuleKind kind, const char* str, size_t len);
+
+#endif /* RULES_H_ */
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* snprintf, access */
+
+#include "server.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fileindex.h"
+#include "ipc.h"
+#include "launch.h"
+#include "magic.h"
+#include "manindex.h"
+#include "prefetch.h"
+#include "rules.h"
+#include "trace.h"
+#include "transform.h"
+#include "util.h"
+
+/*----------------------------------------------------------------------------*/
+
+static Rules* rules_build(const char* path) {
+    const int64_t start = TRACE_START();
+
+    Rules* rules = malloc(sizeof(Rules));
+    if (rules == NULL) {
+        ERR("Could not allocate rule set.");
+        return NULL;
+    }
+    rules->next = NULL;
+
+    const bool has_file = (path != NULL && access(path, F_OK) == 0);
+    if (!ruleset_load(&rules->set, has_file ? path : NULL)) {
+        free(rules);
+        return NULL;
+    }
+
+    if (!ruleset_freeze(&rules->set, false)) {
+        ERR("Could not prepare the rule set for matching.");
+        ruleset_free(&rules->set);
+        free(rules);
+        return NULL;
+    }
+
+    TRACE_END(TRACE_LOAD, -1, start);
+    return rules;
+}
+
+static void rules_destroy(Rules* rules) {
+    ruleset_free(&rules->set);
+    free(rules);
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool server_rules_init(ServerRules* rules, const char* path) {
+    rules->retired = NULL;
+    rules->current = rules_build(path);
+    return rules->current != NULL;
+}
+
+void server_rules_free(ServerRules* rules) {
+    server_rules_reclaim(rules);
+    if (rules->current != NULL)
+        rules_destroy(rules->current);
+    rules->current = NULL;
+}
+
+bool server_rules_reload(ServerRules* rules, const char* path) {
+    Rules* new_rules = rules_build(path);
+    if (new_rules == NULL)
+        return false;
+
+    Rules* old =
+      __atomic_exchange_n(&rules->current, new_rules, __ATOMIC_ACQ_REL);
+    if (old == NULL)
+        return true;
+
+    old->next = __atomic_load_n(&rules->retired, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rules->retired, &old->next, old, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        continue;
+    return true;
+}
+
+RuleSet* server_rules_get(ServerRules* rules) {
+    return &__atomic_load_n(&rules->current, __ATOMIC_ACQUIRE)->set;
+}
+
+void server_rules_reclaim(ServerRules* rules) {
+    Rules* retired =
+      __atomic_exchange_n(&rules->retired, NULL, __ATOMIC_ACQUIRE);
+    while (retired != NULL) {
+        Rules* next = retired->next;
+        rules_destroy(retired);
+        retired = next;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool server_handle_request(RuleSet* rules, MagicCache* magic, Client* client,
+                           const char* frame) {
+    const int64_t request_start = TRACE_START();
+
+    const char* req[IPC_MAX_STRINGS + 1];
+    const int num = ipc_unpack(frame, req, IPC_MAX_STRINGS);
+    if (num < 1)
+        return false;
+
+    const bool launch   = !strcmp(req[0], IPC_LAUNCH);
+    const bool classify = !strcmp(req[0], IPC_CLASSIFY);
+    if (!(launch && num == 3) && !(classify && (num == 2 || num == 3)))
+        return false;
+    const char* cwd = (num == 3) ? req[1] : NULL;
+
+    /* The argument is normalized in-place, so copy it first */
+    static char buf_arg[IPC_MAX_FRAME];
+    size_t len    = strlen(req[num - 1]);
+    int64_t start = TRACE_START();
+    memcpy(buf_arg, req[num - 1], len + 1);
+    const char* arg = transform_normalize(buf_arg, &len, sizeof(buf_arg));
+    TRACE_END(TRACE_NORMALIZE, -1, start);
+
+    const char* reply[LAUNCH_MAX_ARGS + 2];
+    int reply_num = 1;
+
+    char idx_str[16];
+    char* buf = NULL;
+    int idx   = ruleset_match_len(rules, arg, len);
+
+    /* Manual pages that are not installed are left to the next rules */
+    idx = manindex_filter(rules, arg, len, idx);
+
+    /* Files without a known name might still be recognized */
+    if (idx < 0) {
+        start          = TRACE_START();
+        const int kind = magic_classify(magic, cwd, arg);
+        if (kind >= 0)
+            idx = ruleset_find_kind(rules, kind);
+        TRACE_END(TRACE_SNIFF, idx, start);
+    }
+
+    /* Source files might be relative to another directory */
+    static char resolved[IPC_MAX_FRAME];
+    start = TRACE_START();
+    const size_t resolved_len =
+      (idx < 0 || !rule_kind_opens_source(rules->rules[idx].kind))
+        ? 0
+        : fileindex_resolve(cwd, arg, len, resolved, sizeof(resolved), false);
+    if (resolved_len > 0 &&
+        ruleset_match_len(rules, resolved, resolved_len) == idx) {
+        arg = resolved;
+        len = resolved_len;
+    }
+    TRACE_END(TRACE_RESOLVE, -1, start);
+
+    if (idx >= 0) {
+        start               = TRACE_START();
+        const size_t buf_sz = launch_argv_size(rules, idx, len);
+        buf                 = malloc(buf_sz);
+
+        const char** argv = &reply[1];
+        const int argc =
+          (buf == NULL) ? -1
+                        : launch_argv(rules, idx, arg, len, buf, buf_sz, argv);
+        TRACE_END(TRACE_ARGV, idx, start);
+
+        /*
+         * Start reading big files while the client launches the command, or
+         * while the text is hovered.
+         */
+        if (argc >= 0 && rule_kind_prefetches(rules->rules[idx].kind)) {
+            start = TRACE_START();
+            prefetch_file(cwd, arg, len);
+            TRACE_END(TRACE_PREFETCH, idx, start);
+        }
+
+        if (argc < 0)
+            idx = -1;
+        else if (!launch)
+            reply_num += argc;
+        else if (!launch_command(cwd, argv))
+            idx = -1;
+    }
+
+    snprintf(idx_str, sizeof(idx_str), "%d", idx);
+    reply[0] = idx_str;
+
+    client->out_len = ipc_pack(client->out, sizeof(client->out), reply,
+                               reply_num);
+    client->out_pos = 0;
+    free(buf);
+    TRACE_END(TRACE_REQUEST, idx, request_start);
+    return client->out_len > 0;
+}
@@ -0,0 +1,89 @@
+
+#ifndef SERVER_H_
+#define SERVER_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ipc.h"
+#include "magic.h"
+#include "rules.h"
+
+/*
+ * Connection with a client. Requests are read into 'in', and each reply is
+ * written from 'out' before handling the next request, so clients can keep the
+ * connection open for multiple requests.
+ */
+typedef struct Client {
+    int fd;
+    char in[IPC_MAX_FRAME];
+    size_t in_len;
+    char out[IPC_MAX_FRAME];
+    size_t out_len, out_pos;
+} Client;
+
+/*
+ * Rule set of the server, inside the list of retired rule sets.
+ */
+typedef struct Rules {
+    RuleSet set;
+    struct Rules* next;
+} Rules;
+
+/*
+ * Current rule set, which is replaced by the reload thread with an atomic
+ * exchange, and read by the main thread without locks.
+ *
+ * The old rule sets are pushed to the 'retired' list instead of being freed,
+ * since the main thread might still be using them. The main thread frees them
+ * itself between events, when it doesn't hold any pointer to a rule set (i.e.
+ * in a quiescent state, in RCU terms). This relies on the main thread being
+ * the only reader.
+ */
+typedef struct ServerRules {
+    Rules* current;
+    Rules* retired;
+} ServerRules;
+
+/*
+ * Build the first rule set from the rules file at 'path', or from "config.h" if
+ * the path is NULL or the file doesn't exist. The rule set is frozen, so
+ * matching doesn't modify it. Returns false on errors.
+ */
+bool server_rules_init(ServerRules* rules, const char* path);
+
+/*
+ * Free the current and retired rule sets. The reload thread must have stopped.
+ */
+void server_rules_free(ServerRules* rules);
+
+/*
+ * Build a new rule set from 'path', like 'server_rules_init', and replace the
+ * current one, which is retired. Returns false if the new rules are invalid; in
+ * that case, the current rule set is kept.
+ */
+bool server_rules_reload(ServerRules* rules, const char* path);
+
+/*
+ * Return the current rule set. It's valid until the next call to
+ * 'server_rules_reclaim'.
+ */
+RuleSet* server_rules_get(ServerRules* rules);
+
+/*
+ * Free the retired rule sets. Should only be called from the thread that reads
+ * the rule sets, while it doesn't hold any pointer to them.
+ */
+void server_rules_reclaim(ServerRules* rules);
+
+/*
+ * Handle a complete request frame (see "ipc.h"), matching it against 'rules',
+ * and write the reply frame to the output buffer of the client. The kinds of
+ * the files classified by their contents are remembered in 'magic'. Returns
+ * false if the request is invalid: an unknown request, or a wrong number of
+ * strings.
+ */
+bool server_handle_request(RuleSet* rules, MagicCache* magic, Client* client,
+                           const char* frame);
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,348 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _DEFAULT_SOURCE /* syscall */
+
+#include "statcache.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#include "trace.h"
+
+/* Number of slots of the hash table, must be a power of two */
+#define STATCACHE_SLOTS (STATCACHE_MAX_ENTRIES * 2)
+
+/*----------------------------------------------------------------------------*/
+
+static uint64_t hash_path(const char* str, size_t len) {
+    /* FNV-1a */
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)str[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+static enum EStatKind kind_from_mode(mode_t mode) {
+    if (S_ISREG(mode))
+        return STAT_REGULAR;
+    if (S_ISDIR(mode))
+        return STAT_DIRECTORY;
+    return STAT_OTHER;
+}
+
+static void reset(StatCache* cache) {
+    cache->entries_num = 0;
+    cache->strings_len = 0;
+    for (int i = 0; i < STATCACHE_SLOTS; i++)
+        cache->slots[i] = -1;
+}
+
+/*----------------------------------------------------------------------------*/
+/* io_uring(7) */
+
+#ifdef HAVE_IO_URING
+struct StatRing {
+    int fd;
+    void* sq_map;
+    void* cq_map; /* Same as 'sq_map' with IORING_FEAT_SINGLE_MMAP */
+    size_t sq_map_sz, cq_map_sz;
+    struct io_uring_sqe* sqes;
+    size_t sqes_sz;
+
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* Written by the kernel, one for each path of the batch */
+    struct statx results[STATCACHE_BATCH];
+    int in_flight;
+};
+
+static void ring_free(StatRing* ring) {
+    if (ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_sz);
+    if (ring->sq_map != MAP_FAILED)
+        munmap(ring->sq_map, ring->sq_map_sz);
+    close(ring->fd);
+
+    /* The kernel might still write the results of the pending requests */
+    if (ring->in_flight == 0)
+        free(ring);
+}
+
+/*
+ * Create a ring with room for STATCACHE_BATCH requests. Returns NULL if the
+ * kernel doesn't support io_uring(7), or if it's disabled.
+ */
+static StatRing* ring_new(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const int fd = syscall(__NR_io_uring_setup, STATCACHE_BATCH, &params);
+    if (fd < 0)
+        return NULL;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    StatRing* ring = malloc(sizeof(StatRing));
+    if (ring == NULL) {
+        close(fd);
+        return NULL;
+    }
+    ring->fd        = fd;
+    ring->in_flight = 0;
+    ring->sq_map_sz =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_sz =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Newer kernels map both rings at once */
+    const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_map_sz > ring->sq_map_sz)
+        ring->sq_map_sz = ring->cq_map_sz;
+
+    ring->sq_map = mmap(NULL, ring->sq_map_sz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, IORING_OFF_SQ_RING);
+    ring->cq_map = single ? ring->sq_map
+                          : mmap(NULL, ring->cq_map_sz, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, IORING_OFF_CQ_RING);
+    ring->sqes   = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED ||
+        ring->sqes == MAP_FAILED) {
+        ring_free(ring);
+        return NULL;
+    }
+
+    char* sq       = ring->sq_map;
+    char* cq       = ring->cq_map;
+    ring->sq_tail  = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask  = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head  = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail  = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask  = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+/*
+ * Store the kinds of the completed requests, and return how many there were.
+ * If the kernel doesn't support statx(2) requests, the entries stay
+ * STAT_PENDING and '*supported' is set to false.
+ */
+static int ring_reap(StatCache* cache, bool* supported) {
+    StatRing* ring      = cache->ring;
+    unsigned head       = *ring->cq_head;
+    const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    int reaped = 0;
+    for (; head != tail; head++, reaped++) {
+        const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        const int i                    = cqe->user_data;
+        StatEntry* entry               = &cache->entries[cache->queue[i]];
+        if (cqe->res == -EINVAL)
+            *supported = false;
+        else if (cqe->res < 0)
+            entry->kind = STAT_MISSING;
+        else
+            entry->kind = kind_from_mode(ring->results[i].stx_mode);
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+/*
+ * Check the queued paths with a statx(2) request for each of them, submitted at
+ * once. Returns false if the ring can't be used; the entries that were not
+ * checked are still STAT_PENDING.
+ */
+static bool ring_run(StatCache* cache) {
+    StatRing* ring = cache->ring;
+    unsigned tail  = *ring->sq_tail;
+    for (int i = 0; i < cache->queue_num; i++, tail++) {
+        const StatEntry* entry   = &cache->entries[cache->queue[i]];
+        const unsigned idx       = tail & *ring->sq_mask;
+        struct io_uring_sqe* sqe = &ring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode         = IORING_OP_STATX;
+        sqe->fd             = AT_FDCWD;
+        sqe->addr           = (uintptr_t)&cache->strings[entry->off];
+        sqe->len            = STATX_TYPE;
+        sqe->off            = (uintptr_t)&ring->results[i];
+        sqe->user_data      = i;
+        ring->sq_array[idx] = idx;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    bool supported     = true;
+    unsigned to_submit = cache->queue_num;
+    ring->in_flight    = cache->queue_num;
+    while (ring->in_flight > 0) {
+        const int submitted =
+          syscall(__NR_io_uring_enter, ring->fd, to_submit, ring->in_flight,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0 && errno == EINTR)
+            continue;
+        if (submitted < 0)
+            return false;
+        to_submit -= submitted;
+        ring->in_flight -= ring_reap(cache, &supported);
+    }
+
+    return supported;
+}
+#else
+struct StatRing {
+    int unused;
+};
+
+static void ring_free(StatRing* ring) {
+    free(ring);
+}
+
+static StatRing* ring_new(void) {
+    return NULL;
+}
+
+static bool ring_run(StatCache* cache) {
+    (void)cache;
+    return false;
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+
+bool statcache_init(StatCache* cache) {
+    cache->entries = malloc(STATCACHE_MAX_ENTRIES * sizeof(StatEntry));
+    cache->slots   = malloc(STATCACHE_SLOTS * sizeof(int32_t));
+    cache->strings = malloc(STATCACHE_STRINGS_SZ);
+    if (cache->entries == NULL || cache->slots == NULL ||
+        cache->strings == NULL) {
+        free(cache->entries);
+        free(cache->slots);
+        free(cache->strings);
+        return false;
+    }
+
+    reset(cache);
+    cache->queue_num = 0;
+    cache->ring      = ring_new();
+    return true;
+}
+
+void statcache_free(StatCache* cache) {
+    if (cache->ring != NULL)
+        ring_free(cache->ring);
+    free(cache->entries);
+    free(cache->slots);
+    free(cache->strings);
+}
+
+int statcache_add(StatCache* cache, const char* path, size_t len) {
+    /* They can't exist, and neither can the empty path */
+    if (len >= STATCACHE_PATH_SZ)
+        len = 0;
+
+    const uint64_t hash = hash_path(path, len);
+    uint32_t slot       = hash & (STATCACHE_SLOTS - 1);
+    for (; cache->slots[slot] >= 0; slot = (slot + 1) & (STATCACHE_SLOTS - 1)) {
+        const StatEntry* entry = &cache->entries[cache->slots[slot]];
+        if (entry->hash == hash && entry->len == len &&
+            !memcmp(&cache->strings[entry->off], path, len))
+            return cache->slots[slot];
+    }
+
+    /* The kinds of the pending paths are still needed by the caller */
+    if (cache->entries_num == STATCACHE_MAX_ENTRIES ||
+        cache->strings_len + len + 1 > STATCACHE_STRINGS_SZ) {
+        if (cache->queue_num > 0)
+            return -1;
+        reset(cache);
+        slot = hash & (STATCACHE_SLOTS - 1);
+    }
+
+    const int id     = cache->entries_num++;
+    StatEntry* entry = &cache->entries[id];
+    entry->hash      = hash;
+    entry->off       = cache->strings_len;
+    entry->len       = len;
+    entry->kind      = STAT_PENDING;
+    cache->slots[slot] = id;
+
+    memcpy(&cache->strings[entry->off], path, len);
+    cache->strings[entry->off + len] = '\0';
+    cache->strings_len += len + 1;
+
+    cache->queue[cache->queue_num++] = id;
+    if (cache->queue_num == STATCACHE_BATCH)
+        statcache_run(cache);
+    return id;
+}
+
+void statcache_run(StatCache* cache) {
+    if (cache->queue_num == 0)
+        return;
+
+    const int64_t start = TRACE_START();
+
+    /* If the ring fails once, it's not used again */
+    if (cache->ring != NULL && !ring_run(cache)) {
+        ring_free(cache->ring);
+        cache->ring = NULL;
+    }
+
+    for (int i = 0; i < cache->queue_num; i++) {
+        StatEntry* entry = &cache->entries[cache->queue[i]];
+        if (entry->kind != STAT_PENDING)
+            continue;
+
+        struct stat st;
+        entry->kind = (stat(&cache->strings[entry->off], &st) != 0)
+                        ? STAT_MISSING
+                        : kind_from_mode(st.st_mode);
+    }
+    cache->queue_num = 0;
+
+    TRACE_END(TRACE_STAT, -1, start);
+}
+
+enum EStatKind statcache_kind(const StatCache* cache, int id) {
+    return cache->entries[id].kind;
+}
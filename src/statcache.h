@@ -0,0 +1,109 @@
+
+#ifndef STATCACHE_H_
+#define STATCACHE_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Number of paths checked at once, with a single system call when io_uring(7)
+ * is available.
+ */
+#define STATCACHE_BATCH 64
+
+/*
+ * Maximum number of different paths remembered by a 'StatCache', and total
+ * size of their strings. When either is exceeded, the cache is emptied.
+ */
+#define STATCACHE_MAX_ENTRIES 4096
+#define STATCACHE_STRINGS_SZ  (256 * 1024)
+
+/*
+ * Paths of this size or longer are never checked, they are always missing.
+ */
+#define STATCACHE_PATH_SZ 4096
+
+/*
+ * Type of the file at a path, see 'statcache_kind'.
+ */
+enum EStatKind {
+    STAT_PENDING,   /* Not checked yet, see 'statcache_run' */
+    STAT_MISSING,   /* Doesn't exist, or can't be accessed */
+    STAT_REGULAR,   /* Regular file, or a link to one */
+    STAT_DIRECTORY, /* Directory, or a link to one */
+    STAT_OTHER,     /* FIFO, socket or device */
+};
+
+/*
+ * Path added to a 'StatCache', with the offset of its string.
+ */
+typedef struct StatEntry {
+    uint64_t hash;
+    uint32_t off, len;
+    enum EStatKind kind;
+} StatEntry;
+
+/*
+ * Ring shared with the kernel for submitting the system calls, private to
+ * "statcache.c".
+ */
+typedef struct StatRing StatRing;
+
+/*
+ * Types of the files at some paths, relative to the current directory. The
+ * paths are added to the cache and checked in batches of STATCACHE_BATCH, with
+ * statx(2) requests submitted through io_uring(7); or with stat(2) if the
+ * kernel doesn't support it. Each path is only checked once, until the cache is
+ * emptied. A cache can't be used from multiple threads at once.
+ */
+typedef struct StatCache {
+    StatEntry* entries;
+    int entries_num;
+    int32_t* slots; /* Indexes of 'entries' by the hash of their paths, or -1 */
+    char* strings;
+    size_t strings_len;
+
+    /* Entries that are still STAT_PENDING */
+    int queue[STATCACHE_BATCH];
+    int queue_num;
+
+    StatRing* ring; /* NULL if io_uring(7) can't be used */
+} StatCache;
+
+/*
+ * Initialize an empty cache. Returns false on errors; in that case, the cache
+ * doesn't need to be freed.
+ */
+bool statcache_init(StatCache* cache);
+
+/*
+ * Free the contents of a cache.
+ */
+void statcache_free(StatCache* cache);
+
+/*
+ * Add the path in the 'len' bytes of 'path', which don't need to be
+ * null-terminated, and return its identifier for 'statcache_kind'. If the path
+ * was already added, its previous identifier is returned. When there are
+ * STATCACHE_BATCH new paths, they are checked with 'statcache_run'.
+ *
+ * If there is no room for the path, and some paths were not checked yet,
+ * returns -1; the caller should call 'statcache_run', read the kinds that it
+ * needs, and try again, which empties the cache. Therefore, the identifiers are
+ * only valid until the next call to this function.
+ */
+int statcache_add(StatCache* cache, const char* path, size_t len);
+
+/*
+ * Check the paths that were added since the last call, at once.
+ */
+void statcache_run(StatCache* cache);
+
+/*
+ * Return the kind of the file with the specified identifier, which is
+ * STAT_PENDING until 'statcache_run' is called.
+ */
+enum EStatKind statcache_kind(const StatCache* cache, int id);
+
+#endif /* STATCACHE_H_ */
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "suffix.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+ * Prefixes and suffix used by REGEX_EXTENSION and REGEX_FILENAME in "config.h".
+ * See 'suffix_parse_extension'.
+ */
+#define EXTENSION_PREFIX "^.+\\."
+#define FILENAME_PREFIX  "^(.*/)?"
+#define LITERAL_SUFFIX   "$"
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Same as tolower(3) in the "C" locale, but without a function call, since it's
+ * used for each byte of the lookups.
+ */
+static inline char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static uint32_t hash_lower(const char* str, size_t len) {
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint32_t)(unsigned char)lower(str[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool equal_lower(const char* key, const char* str, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        if (key[i] != lower(str[i]))
+            return false;
+    return true;
+}
+
+static bool grow_entries(SuffixTable* table) {
+    const int new_sz = (table->entries_sz > 0) ? table->entries_sz * 2 : 64;
+    SuffixEntry* new_entries = malloc(new_sz * sizeof(SuffixEntry));
+    if (new_entries == NULL)
+        return false;
+
+    for (int i = 0; i < new_sz; i++)
+        new_entries[i].id = -1;
+
+    for (int i = 0; i < table->entries_sz; i++) {
+        const SuffixEntry* entry = &table->entries[i];
+        if (entry->id < 0)
+            continue;
+
+        uint32_t pos = entry->hash & (new_sz - 1);
+        while (new_entries[pos].id >= 0)
+            pos = (pos + 1) & (new_sz - 1);
+        new_entries[pos] = *entry;
+    }
+
+    free(table->entries);
+    table->entries    = new_entries;
+    table->entries_sz = new_sz;
+    return true;
+}
+
+/*
+ * Parse a literal made of alphanumeric characters, dashes, underscores and
+ * escaped dots, followed by LITERAL_SUFFIX. Returns its length, or -1.
+ */
+static int parse_literal(const char* pat, char* out, size_t out_sz) {
+    size_t len = 0;
+    while (*pat != '\0' && strcmp(pat, LITERAL_SUFFIX) != 0) {
+        char c = *pat++;
+        if (c == '\\' && *pat == '.')
+            c = *pat++;
+        else if (!isalnum((unsigned char)c) && c != '-' && c != '_')
+            return -1;
+
+        if (len + 1 >= out_sz)
+            return -1;
+        out[len++] = lower(c);
+    }
+
+    if (*pat == '\0' || len == 0)
+        return -1;
+
+    out[len] = '\0';
+    return len;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void suffix_init(SuffixTable* table) {
+    memset(table, 0, sizeof(SuffixTable));
+}
+
+void suffix_free(SuffixTable* table) {
+    free(table->entries);
+    free(table->strings);
+    suffix_init(table);
+}
+
+bool suffix_add(SuffixTable* table, const char* key, size_t len, int id) {
+    /* Keep the table at most half full */
+    if ((table->entries_num + 1) * 2 > table->entries_sz &&
+        !grow_entries(table))
+        return false;
+
+    const uint32_t mask = table->entries_sz - 1;
+    const uint32_t hash = hash_lower(key, len);
+    uint32_t pos        = hash & mask;
+    for (; table->entries[pos].id >= 0; pos = (pos + 1) & mask) {
+        SuffixEntry* entry = &table->entries[pos];
+        if (entry->hash == hash && (size_t)entry->len == len &&
+            equal_lower(&table->strings[entry->str_off], key, len)) {
+            if (id < entry->id)
+                entry->id = id;
+            return true;
+        }
+    }
+
+    const int needed = table->strings_num + len + 1;
+    if (needed > table->strings_sz) {
+        int new_sz = (table->strings_sz > 0) ? table->strings_sz : 256;
+        while (new_sz < needed)
+            new_sz *= 2;
+
+        char* new_strings = realloc(table->strings, new_sz);
+        if (new_strings == NULL)
+            return false;
+        table->strings    = new_strings;
+        table->strings_sz = new_sz;
+    }
+
+    SuffixEntry* entry = &table->entries[pos];
+    entry->hash        = hash;
+    entry->str_off     = table->strings_num;
+    entry->len         = len;
+    entry->id          = id;
+
+    for (size_t i = 0; i < len; i++)
+        table->strings[table->strings_num++] = lower(key[i]);
+    table->strings[table->strings_num++] = '\0';
+
+    if ((int)len > table->max_len)
+        table->max_len = len;
+    table->entries_num++;
+    return true;
+}
+
+int suffix_lookup(const SuffixTable* table, const char* key, size_t len) {
+    if (table->entries_num == 0 || (int)len > table->max_len)
+        return -1;
+
+    const uint32_t mask = table->entries_sz - 1;
+    const uint32_t hash = hash_lower(key, len);
+    uint32_t pos        = hash & mask;
+    for (; table->entries[pos].id >= 0; pos = (pos + 1) & mask) {
+        const SuffixEntry* entry = &table->entries[pos];
+        if (entry->hash == hash && (size_t)entry->len == len &&
+            equal_lower(&table->strings[entry->str_off], key, len))
+            return entry->id;
+    }
+
+    return -1;
+}
+
+int suffix_match_extension(const SuffixTable* table,
+                           const char* str,
+                           size_t len) {
+    if (table->entries_num == 0)
+        return -1;
+
+    /*
+     * Try every dot that could start one of the extensions, since they can
+     * contain dots themselves (e.g. "tar.gz"). The dot can't be the first
+     * character, since the pattern needs at least one character before it.
+     */
+    int best = -1;
+    for (size_t i = len; i-- > 1 && len - i - 1 <= (size_t)table->max_len;) {
+        if (str[i] != '.')
+            continue;
+
+        const int id = suffix_lookup(table, &str[i + 1], len - i - 1);
+        if (id >= 0 && (best < 0 || id < best))
+            best = id;
+    }
+
+    return best;
+}
+
+int suffix_match_filename(const SuffixTable* table,
+                          const char* str,
+                          size_t len) {
+    if (table->entries_num == 0)
+        return -1;
+
+    /* The base name can't be longer than the longest key */
+    size_t start = len;
+    while (start > 0 && str[start - 1] != '/') {
+        if (len - start >= (size_t)table->max_len)
+            return -1;
+        start--;
+    }
+
+    return suffix_lookup(table, &str[start], len - start);
+}
+
+int suffix_parse_extension(const char* pat, char* out, size_t out_sz) {
+    const size_t prefix_len = strlen(EXTENSION_PREFIX);
+    if (strncmp(pat, EXTENSION_PREFIX, prefix_len) != 0)
+        return -1;
+
+    return parse_literal(pat + prefix_len, out, out_sz);
+}
+
+int suffix_parse_filename(const char* pat, char* out, size_t out_sz) {
+    const size_t prefix_len = strlen(FILENAME_PREFIX);
+    if (strncmp(pat, FILENAME_PREFIX, prefix_len) != 0)
+        return -1;
+
+    return parse_literal(pat + prefix_len, out, out_sz);
+}
@@ -0,0 +1,76 @@
+
+#ifndef SUFFIX_H_
+#define SUFFIX_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct SuffixEntry {
+    uint32_t hash;
+    int str_off, len; /* Lowercase key, inside 'SuffixTable.strings' */
+    int id;           /* Negative if the entry is empty */
+} SuffixEntry;
+
+/*
+ * Case-insensitive hash table of literal strings, used for matching file
+ * extensions and file names without a regex engine.
+ */
+typedef struct SuffixTable {
+    SuffixEntry* entries;
+    int entries_num, entries_sz; /* The size is always a power of two */
+    char* strings;
+    int strings_num, strings_sz;
+    int max_len;
+} SuffixTable;
+
+/*
+ * Initialize an empty table.
+ */
+void suffix_init(SuffixTable* table);
+
+/*
+ * Free all the memory used by the table.
+ */
+void suffix_free(SuffixTable* table);
+
+/*
+ * Add the literal 'key' of 'len' bytes to the table, which will be reported as
+ * 'id'. If the key already exists, the lowest ID is kept. Returns false on
+ * allocation errors.
+ */
+bool suffix_add(SuffixTable* table, const char* key, size_t len, int id);
+
+/*
+ * Return the ID of 'key', or -1 if it's not in the table.
+ */
+int suffix_lookup(const SuffixTable* table, const char* key, size_t len);
+
+/*
+ * Return the lowest ID of the extensions in the table that 'str' ends with,
+ * with the same semantics as the REGEX_EXTENSION patterns in "config.h": the
+ * extension is preceded by a dot, and there is at least one more character
+ * before it. Returns -1 if there is no match.
+ */
+int suffix_match_extension(const SuffixTable* table,
+                           const char* str,
+                           size_t len);
+
+/*
+ * Return the ID of the base name of 'str' (i.e. after the last slash), with the
+ * same semantics as the REGEX_FILENAME patterns in "config.h". Returns -1 if
+ * there is no match.
+ */
+int suffix_match_filename(const SuffixTable* table,
+                          const char* str,
+                          size_t len);
+
+/*
+ * If 'pat' has the exact format of REGEX_EXTENSION (or REGEX_FILENAME) in
+ * "config.h" and the extension (or file name) is a literal string, write the
+ * literal to 'out' and return its length. Otherwise, return -1.
+ */
+int suffix_parse_extension(const char* pat, char* out, size_t out_sz);
+int suffix_parse_filename(const char* pat, char* out, size_t out_sz);
+
+#endif /* SUFFIX_H_ */
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of plumber.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, O_CLOEXEC */
+
+#include "trace.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/* Size of the buffer of each line of the output */
+#define LINE_SZ 32768
+
+bool g_trace_enabled = false;
+
+static enum ETraceMode g_mode;
+static int g_fd = -1;
+
+/*
+ * Number of measurements of each phase in each bucket. The value V of the
+ * bucket B is V < 2^TRACE_SUB_BITS if B is V, or it has the same
+ * TRACE_SUB_BITS + 1 most significant bits as 'bucket_value(B)' otherwise.
+ */
+static uint64_t g_histograms[TRACE_PHASES_NUM][TRACE_BUCKETS];
+
+static const char* phase_names[] = {
+    [TRACE_DAEMON]    = "daemon",
+    [TRACE_LOAD]      = "load",
+    [TRACE_NORMALIZE] = "normalize",
+    [TRACE_SUFFIX]    = "suffix",
+    [TRACE_DFA]       = "dfa",
+    [TRACE_REGEXEC]   = "regexec",
+    [TRACE_SNIFF]     = "sniff",
+    [TRACE_MAN]       = "man",
+    [TRACE_STAT]      = "stat",
+    [TRACE_RESOLVE]   = "resolve",
+    [TRACE_ARGV]      = "argv",
+    [TRACE_REMOTE]    = "remote",
+    [TRACE_EXEC]      = "exec",
+    [TRACE_PREFETCH]  = "prefetch",
+    [TRACE_REQUEST]   = "request",
+};
+
+/*----------------------------------------------------------------------------*/
+
+static int bucket_of(int64_t ns) {
+    const uint64_t value = (ns < 0) ? 0 : (uint64_t)ns;
+    if (value < (1 << TRACE_SUB_BITS))
+        return value;
+
+    int bits = 0;
+    while ((value >> bits) > 1)
+        bits++;
+    if (bits >= TRACE_MAX_BITS)
+        return TRACE_BUCKETS - 1;
+
+    /* The most significant bit, and the next TRACE_SUB_BITS */
+    const int sub =
+      (value >> (bits - TRACE_SUB_BITS)) & ((1 << TRACE_SUB_BITS) - 1);
+    return ((bits - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS) + sub;
+}
+
+/*
+ * Return the smallest value of a bucket, see 'bucket_of'.
+ */
+static uint64_t bucket_value(int bucket) {
+    if (bucket < (1 << TRACE_SUB_BITS))
+        return bucket;
+
+    const int bits     = (bucket >> TRACE_SUB_BITS) + TRACE_SUB_BITS - 1;
+    const uint64_t sub = bucket & ((1 << TRACE_SUB_BITS) - 1);
+    return ((1ULL << TRACE_SUB_BITS) | sub) << (bits - TRACE_SUB_BITS);
+}
+
+/*
+ * Write a line to the output with a single call, so the lines of different
+ * processes are not mixed when they are appended to the same file.
+ */
+static void write_line(const char* line, size_t len) {
+    while (len > 0) {
+        const ssize_t written = write(g_fd, line, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        line += written;
+        len -= written;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool trace_init(enum ETraceMode mode) {
+    const char* env = getenv("PLUMBER_TRACE");
+    if (env == NULL || *env == '\0')
+        return false;
+
+    /* The output of a previous call is replaced */
+    if (g_fd > STDERR_FILENO)
+        close(g_fd);
+
+    if (!strcmp(env, "1") || !strcmp(env, "-")) {
+        g_fd = STDERR_FILENO;
+    } else {
+        g_fd = open(env, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (g_fd < 0) {
+            ERR("Could not open the trace file \"%s\": %s", env,
+                strerror(errno));
+            return false;
+        }
+    }
+
+    g_mode          = mode;
+    g_trace_enabled = true;
+    return true;
+}
+
+int64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_add(enum ETracePhase phase, int rule, int64_t ns) {
+    if (g_mode == TRACE_HISTOGRAMS) {
+        __atomic_fetch_add(&g_histograms[phase][bucket_of(ns)], 1,
+                           __ATOMIC_RELAXED);
+        return;
+    }
+
+    char line[128];
+    int len;
+    if (rule < 0)
+        len = snprintf(line, sizeof(line),
+                       "{\"pid\": %d, \"phase\": \"%s\", \"ns\": %lld}\n",
+                       (int)getpid(), phase_names[phase], (long long)ns);
+    else
+        len = snprintf(line, sizeof(line),
+                       "{\"pid\": %d, \"phase\": \"%s\", \"rule\": %d, "
+                       "\"ns\": %lld}\n",
+                       (int)getpid(), phase_names[phase], rule, (long long)ns);
+    if (len > 0 && (size_t)len < sizeof(line))
+        write_line(line, len);
+}
+
+void trace_counter(const char* name, uint64_t value) {
+    if (!g_trace_enabled)
+        return;
+
+    char line[128];
+    const int len =
+      snprintf(line, sizeof(line),
+               "{\"pid\": %d, \"counter\": \"%s\", \"value\": %llu}\n",
+               (int)getpid(), name, (unsigned long long)value);
+    if (len > 0 && (size_t)len < sizeof(line))
+        write_line(line, len);
+}
+
+void trace_dump(void) {
+    if (!g_trace_enabled || g_mode != TRACE_HISTOGRAMS)
+        return;
+
+    static char line[LINE_SZ];
+    for (int phase = 0; phase < TRACE_PHASES_NUM; phase++) {
+        /* Measurements added meanwhile are kept for the next dump */
+        static uint64_t counts[TRACE_BUCKETS];
+        uint64_t total = 0;
+        for (int i = 0; i < TRACE_BUCKETS; i++) {
+            counts[i] = __atomic_exchange_n(&g_histograms[phase][i], 0,
+                                            __ATOMIC_RELAXED);
+            total += counts[i];
+        }
+        if (total == 0)
+            continue;
+
+        /* The percentiles are the smallest value of their bucket */
+        static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        uint64_t values[LENGTH(percentiles)];
+        uint64_t seen = 0;
+        int next      = 0;
+        for (int i = 0; i < TRACE_BUCKETS && next < LENGTH(percentiles); i++) {
+            seen += counts[i];
+            while (next < LENGTH(percentiles) &&
+                   seen > percentiles[next] * total)
+                values[next++] = bucket_value(i);
+        }
+
+        size_t len = snprintf(line, sizeof(line),
+                              "{\"pid\": %d, \"phase\": \"%s\", "
+                              "\"count\": %llu, \"p50_ns\": %llu, "
+                              "\"p90_ns\": %llu, \"p99_ns\": %llu, "
+                              "\"p999_ns\": %llu, \"buckets\": [",
+                              (int)getpid(), phase_names[phase],
+                              (unsigned long long)total,
+                              (unsigned long long)values[0],
+                              (unsigned long long)values[1],
+                              (unsigned long long)values[2],
+                              (unsigned long long)values[3]);
+
+        /* Pairs of the smallest value of each bucket and its count */
+        bool first = true;
+        for (int i = 0; i < TRACE_BUCKETS && len < sizeof(line); i++) {
+            if (counts[i] == 0)
+                continue;
+            len += snprintf(&line[len], sizeof(line) - len, "%s[%llu, %llu]",
+                            first ? "" : ", ",
+                            (unsigned long long)bucket_value(i),
+                            (unsigned long long)counts[i]);
+            first = false;
+        }
+        if (len < sizeof(line))
+            len += snprintf(&line[len], sizeof(line) - len, "]}\n");
+        if (len < sizeof(line))
+            write_line(line, len);
+    }
+}
@@ -0,0 +1,101 @@
+
+#ifndef TRACE_H_
+#define TRACE_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Number of sub-buckets of each power of two in the histograms, as a power of
+ * two. The values are recorded with a precision of about 1/16, and the
+ * histograms cover up to 2^TRACE_MAX_BITS nanoseconds (almost two days).
+ */
+#define TRACE_SUB_BITS 4
+#define TRACE_MAX_BITS 47
+#define TRACE_BUCKETS  ((TRACE_MAX_BITS - TRACE_SUB_BITS + 2) << TRACE_SUB_BITS)
+
+/*
+ * Phases of the handling of a string, measured between 'TRACE_START' and
+ * 'TRACE_END'.
+ */
+enum ETracePhase {
+    TRACE_DAEMON,    /* Asking the daemon for the command */
+    TRACE_LOAD,      /* Building the rule set */
+    TRACE_NORMALIZE, /* See 'transform_normalize' */
+    TRACE_SUFFIX,    /* Looking up the extension and the file name */
+    TRACE_DFA,       /* Matching the patterns of the DFA */
+    TRACE_REGEXEC,   /* Matching a single pattern with regexec(3) */
+    TRACE_SNIFF,     /* Reading the first bytes of the file, see "magic.h" */
+    TRACE_MAN,       /* Looking up the manual page, see "manindex.h" */
+    TRACE_STAT,      /* Checking a batch of files, see "statcache.h" */
+    TRACE_RESOLVE,   /* Looking up the file in the projects */
+    TRACE_ARGV,      /* Building the arguments of the command */
+    TRACE_REMOTE,    /* Sending the arguments to a running editor */
+    TRACE_EXEC,      /* Creating the process of the command */
+    TRACE_PREFETCH,  /* Starting to read the file, see "prefetch.h" */
+    TRACE_REQUEST,   /* Whole request to the daemon, including the rest */
+    TRACE_PHASES_NUM,
+};
+
+/*
+ * What is written for each measurement, see 'trace_init'.
+ */
+enum ETraceMode {
+    TRACE_RECORDS,    /* A line for each measurement */
+    TRACE_HISTOGRAMS, /* A histogram of each phase, with 'trace_dump' */
+};
+
+/* True if tracing was enabled by 'trace_init' */
+extern bool g_trace_enabled;
+
+/*
+ * Enable tracing if "$PLUMBER_TRACE" is set: the output is appended to the file
+ * at that path, or written to the standard error if it's "1" or "-". Each line
+ * of the output is a JSON object. Returns true if tracing was enabled.
+ *
+ * Short-lived programs should use TRACE_RECORDS. Programs that handle many
+ * strings should use TRACE_HISTOGRAMS, and call 'trace_dump' from time to
+ * time; the measurements can then be added from multiple threads at once.
+ */
+bool trace_init(enum ETraceMode mode);
+
+/*
+ * Return the time of the monotonic clock, in nanoseconds.
+ */
+int64_t trace_now(void);
+
+/*
+ * Add a measurement of 'ns' nanoseconds of 'phase', for 'rule' (or -1). Called
+ * by 'TRACE_END'.
+ */
+void trace_add(enum ETracePhase phase, int rule, int64_t ns);
+
+/*
+ * Write the histograms of the phases that were measured since the last call,
+ * and reset them. Does nothing unless the mode is TRACE_HISTOGRAMS.
+ */
+void trace_dump(void);
+
+/*
+ * Write the current 'value' of a counter with the specified 'name', e.g. the
+ * number of bytes of a cache. Does nothing unless tracing is enabled.
+ */
+void trace_counter(const char* name, uint64_t value);
+
+/*
+ * Return the current time for 'TRACE_END', or zero if tracing is not enabled,
+ * so it costs a single branch in that case.
+ */
+#define TRACE_START() (g_trace_enabled ? trace_now() : 0)
+
+/*
+ * Measure the time of 'PHASE' since 'START', returned by 'TRACE_START'. The
+ * 'RULE' is written along with the measurement, unless it's negative.
+ */
+#define TRACE_END(PHASE, RULE, START)                                          \
+    do {                                                                       \
+        if (g_trace_enabled)                                                   \
+            trace_add(PHASE, RULE, trace_now() - (START));                     \
+    } while (0)
+
+#endif /* TRACE_H_ */
@@ -18,79 +18,242 @@
 
 #include "transform.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
-#include "pattern.h" /* pattern_find() */
+/* Scheme of the URIs of local files */
+#define FILE_SCHEME "file://"
 
 /*----------------------------------------------------------------------------*/
 
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+           c == '\f';
+}
+
+/* Removed from both ends */
+static inline bool is_quote(char c) {
+    return c == '\'' || c == '\"' || c == '`';
+}
+
+/* Removed from the start */
+static inline bool is_opening(char c) {
+    return c == '(' || c == '[' || c == '{' || c == '<';
+}
+
+/* Removed from the end */
+static inline bool is_punctuation(char c) {
+    return c == '.' || c == ',' || c == ';' || c == ':' || c == '!' ||
+           c == '?' || c == '>';
+}
+
+/* Removed from the end, if they are not balanced */
+static inline char closing_pair(char c) {
+    switch (c) {
+        case ')':
+            return '(';
+        case ']':
+            return '[';
+        case '}':
+            return '{';
+        default:
+            return '\0';
+    }
+}
+
+static inline int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
 /*
- * These will be used by 'transform_trim_quotes' to remove quotes from the start
- * and end of its input.
+ * Return the length of the escape sequence at the start of the 'len' bytes of
+ * 'str', which start with ESC. Control sequences ("ESC [ ... m") end with a
+ * byte in the 0x40..0x7E range, and operating system commands ("ESC ] ...")
+ * end with BEL or "ESC \". Incomplete sequences extend to the end of the text.
  */
-#define REGEX_QUOTE       "(\'|\")"
-#define REGEX_QUOTE_START "^\\s*" REGEX_QUOTE
-#define REGEX_QUOTE_END   REGEX_QUOTE "\\s*$"
-
-/*----------------------------------------------------------------------------*/
+static size_t escape_len(const char* str, size_t len) {
+    if (len < 2)
+        return len;
 
-const char* transform_line_to_vim(char* str) {
-    static char ret[] = "+call cursor(999999,999999)";
-    char* pLine       = &ret[13];
+    size_t i = 2;
+    if (str[1] == '[') {
+        while (i < len && !(str[i] >= 0x40 && str[i] <= 0x7E))
+            i++;
+        return (i < len) ? i + 1 : len;
+    }
 
-    /* Skip "file:" */
-    while (*str != ':')
-        str++;
+    if (str[1] == ']') {
+        for (; i < len; i++) {
+            if (str[i] == '\a')
+                return i + 1;
+            if (str[i] == '\x1B' && i + 1 < len && str[i + 1] == '\\')
+                return i + 2;
+        }
+        return len;
+    }
 
-    /* End filename string where the ':' start */
-    *str++ = '\0';
+    /* Two-byte sequences, like "ESC =" */
+    return 2;
+}
 
-    /* Save "line" part */
-    while (isdigit(*str))
-        *pLine++ = *str++;
+/*
+ * Remove the escape sequences and control characters from the 'len' bytes of
+ * 'str', and return the new length. Nothing is written until the first removed
+ * byte.
+ */
+static size_t strip_controls(char* str, size_t len) {
+    size_t dst = 0;
+    for (size_t src = 0; src < len;) {
+        const unsigned char c = (unsigned char)str[src];
+        if (c == 0x1B) {
+            src += escape_len(&str[src], len - src);
+            continue;
+        }
+        if ((c < ' ' && !is_space(c)) || c == 0x7F) {
+            src++;
+            continue;
+        }
 
-    /* If there is no colon after line, there is no column; just use 0 */
-    if (*str != ':' || !isdigit(str[1])) {
-        strcpy(pLine, ",0)");
-        return ret;
+        if (dst != src)
+            str[dst] = c;
+        dst++;
+        src++;
     }
 
-    *pLine++ = ',';
-    str++;
+    return dst;
+}
+
+/*
+ * Replace the "%XX" sequences of the 'len' bytes of 'str' with the bytes they
+ * represent, and return the new length. Encoded null bytes are not decoded.
+ */
+static size_t percent_decode(char* str, size_t len) {
+    size_t dst = 0;
+    for (size_t src = 0; src < len; dst++) {
+        if (str[src] == '%' && src + 2 < len) {
+            const int hi = hex_value(str[src + 1]);
+            const int lo = hex_value(str[src + 2]);
+            if (hi >= 0 && lo >= 0 && (hi | lo) != 0) {
+                str[dst] = (char)(hi << 4 | lo);
+                src += 3;
+                continue;
+            }
+        }
 
-    /* No digit after the line number (e.g. regex outputs) */
-    if (!isdigit(*str)) {
-        strcpy(pLine, "0)");
-        return ret;
+        str[dst] = str[src++];
     }
 
-    /* Save "col" part */
-    while (isdigit(*str))
-        *pLine++ = *str++;
+    return dst;
+}
+
+/*
+ * If the 'len' bytes of 'str' are the URI of a local file, remove its scheme
+ * and decode its path in-place. Returns the new start of the text, and the new
+ * length is stored in 'len'.
+ */
+static char* decode_file_uri(char* str, size_t* len) {
+    const size_t scheme_len = sizeof(FILE_SCHEME) - 1;
+    if (*len <= scheme_len || strncmp(str, FILE_SCHEME, scheme_len) != 0)
+        return str;
 
-    /* Close string */
-    *pLine++ = ')';
-    *pLine++ = '\0';
+    /* The host should be empty or "localhost" */
+    const char* host     = &str[scheme_len];
+    const size_t rest    = *len - scheme_len;
+    const char* path     = memchr(host, '/', rest);
+    const size_t host_sz = (path == NULL) ? rest : (size_t)(path - host);
+    if (path == NULL ||
+        (host_sz != 0 && !(host_sz == 9 && !strncmp(host, "localhost", 9))))
+        return str;
 
-    return ret;
+    char* start = &str[scheme_len + host_sz];
+    *len        = percent_decode(start, *len - scheme_len - host_sz);
+    return start;
 }
 
-char* transform_trim_quotes(char* str) {
-    /* Find the real start of the string */
-    int prefix_start, prefix_end;
-    if (pattern_find(str, REGEX_QUOTE_START, 1, &prefix_start, &prefix_end)) {
-        /* Shift string 'prefix_end' characters */
-        for (int i = 0; str[i] != '\0'; i++)
-            str[i] = str[i + prefix_end];
-    }
+/*
+ * Replace the leading "~" of the '*len' bytes of 'str' with "$HOME", using the
+ * room before 'str' (up to 'before' bytes) or after its end (up to 'after'
+ * bytes). Returns the new start of the text, and its length is stored in 'len'.
+ */
+static char* expand_home(char* str, size_t* len, size_t before, size_t after) {
+    if (*len == 0 || str[0] != '~' || (*len > 1 && str[1] != '/'))
+        return str;
+
+    const char* home = getenv("HOME");
+    if (home == NULL || *home == '\0')
+        return str;
 
-    /* Find the real end of the string */
-    int subfix_start, subfix_end;
-    if (pattern_find(str, REGEX_QUOTE_END, -1, &subfix_start, &subfix_end)) {
-        /* End string at 'subfix_start' */
-        str[subfix_start] = '\0';
+    /* The '~' itself is replaced */
+    const size_t extra = strlen(home) - 1;
+    if (extra <= before) {
+        str -= extra;
+    } else if (extra <= after) {
+        memmove(&str[extra + 1], &str[1], *len - 1);
+    } else {
+        return str;
     }
 
+    memcpy(str, home, extra + 1);
+    *len += extra;
     return str;
 }
+
+/*----------------------------------------------------------------------------*/
+
+void transform_trim(const char* str, size_t* start, size_t* end) {
+    while (*start < *end) {
+        const char c = str[*start];
+        if (!is_space(c) && !is_quote(c) && !is_opening(c))
+            break;
+        (*start)++;
+    }
+
+    while (*end > *start) {
+        const char c = str[*end - 1];
+        if (is_space(c) || is_quote(c) || is_punctuation(c)) {
+            (*end)--;
+            continue;
+        }
+
+        const char opening = closing_pair(c);
+        if (opening == '\0')
+            break;
+
+        int depth = 0;
+        for (size_t i = *start; i < *end; i++) {
+            if (str[i] == opening)
+                depth++;
+            else if (str[i] == c)
+                depth--;
+        }
+        if (depth >= 0)
+            break;
+        (*end)--;
+    }
+}
+
+char* transform_normalize(char* str, size_t* len, size_t size) {
+    size_t end   = strip_controls(str, *len);
+    size_t start = 0;
+    transform_trim(str, &start, &end);
+
+    size_t new_len = end - start;
+    char* text     = decode_file_uri(&str[start], &new_len);
+
+    /* Room around the text, keeping one byte for the null terminator */
+    const size_t before = text - str;
+    const size_t after  = size - before - new_len - 1;
+    text                = expand_home(text, &new_len, before, after);
+
+    text[new_len] = '\0';
+    *len          = new_len;
+    return text;
+}
@@ -2,19 +2,30 @@
 #ifndef TRANSFORM_H_
 #define TRANSFORM_H_ 1
 
+#include <stddef.h>
+
 /*
- * Convert "file:line:col" (or just "file:line") to vim argument format:
- * "+call cursor(line,col)"
- *
- * Modifies the 'str' argument, and returns a static string that should not be
- * freed by the caller.
+ * Remove the text around the span in ['*start', '*end') of 'str' that is not
+ * supposed to be part of it: spaces and quotes; opening brackets at the start;
+ * and trailing punctuation and unbalanced closing brackets at the end.
  */
-const char* transform_line_to_vim(char* str);
+void transform_trim(const char* str, size_t* start, size_t* end);
 
 /*
- * Remove spaces, single quotes and double quotes of start and end string
- * in-place; return `str'.
+ * Normalize the text selected by the user, for matching it against the rules.
+ * The text consists of the '*len' bytes at 'str', which is inside a buffer with
+ * 'size' bytes available from 'str' (at least '*len' + 1). These steps are
+ * applied in order:
+ *
+ *   1. ANSI escape sequences and other control characters are removed.
+ *   2. The text around the selection is removed, see 'transform_trim'.
+ *   3. File URIs like "file:///a%20b" become paths like "/a b".
+ *   4. A leading "~" is replaced by "$HOME", if the buffer has room for it.
+ *
+ * The text is modified in-place, without allocating memory. Returns the start
+ * of the normalized text inside the buffer, which is null-terminated; and its
+ * length is stored in 'len'.
  */
-char* transform_trim_quotes(char* str);
+char* transform_normalize(char* str, size_t* len, size_t size);
 
 #endif /* TRANSFORM_H_ */
@@ -0,0 +1,535 @@
+
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, mkdtemp, readlink */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../src/pattern.h"
+#include "../src/rulecache.h"
+#include "../src/rules.h"
+#include "../src/transform.h"
+#include "../src/util.h"
+
+/* Minimum time spent in each measurement, in nanoseconds */
+#define MIN_TIME_NS 50000000
+
+/* Number of strings in the corpus, and their maximum size */
+#define CORPUS_NUM 4096
+#define STR_SZ     128
+
+/* Number of times the command is launched, see 'bench_launch' */
+#define LAUNCH_RUNS 25
+
+/* Maximum time to wait for the stub handler, in milliseconds */
+#define LAUNCH_TIMEOUT_MS 5000
+
+/* Size of the buffers for the temporary paths */
+#define PATH_SZ 4096
+
+enum EExitCodes {
+    EXITSUCCESS     = 0,
+    EXITFAILURE     = 1,
+    EXITINVALIDARGS = 2,
+};
+
+/*
+ * Strings that are classified, as they would be selected in a terminal. See
+ * 'corpus_init'.
+ */
+typedef struct Corpus {
+    char strs[CORPUS_NUM][STR_SZ];
+    size_t lens[CORPUS_NUM];
+    size_t bytes;
+} Corpus;
+
+/* Function measured by 'measure', which processes 'num' items of 'ctx' */
+typedef void (*BenchFunc)(void* ctx, int num);
+
+/* Results are stored here, so the measured code is not optimized out */
+static volatile int g_sink;
+
+/*----------------------------------------------------------------------------*/
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Call 'func' until MIN_TIME_NS have passed, and return the average time of
+ * each of the 'num' items, in nanoseconds.
+ */
+static double measure(BenchFunc func, void* ctx, int num) {
+    /* Warm up the caches, and the lazy parts of the rule set */
+    func(ctx, num);
+
+    int64_t elapsed = 0;
+    long rounds     = 0;
+    while (elapsed < MIN_TIME_NS) {
+        const int64_t start = now_ns();
+        func(ctx, num);
+        elapsed += now_ns() - start;
+        rounds++;
+    }
+
+    return (double)elapsed / ((double)rounds * num);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Print a string in JSON. The names and patterns of the rules come from the
+ * rules file, so they might need escaping.
+ */
+static void print_json_string(const char* str) {
+    putchar('"');
+    for (const unsigned char* p = (const unsigned char*)str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\')
+            printf("\\%c", *p);
+        else if (*p < 0x20)
+            printf("\\u%04x", *p);
+        else
+            putchar(*p);
+    }
+    putchar('"');
+}
+
+/*----------------------------------------------------------------------------*/
+/* Corpus */
+
+/*
+ * Fill the corpus with a deterministic mix of URLs, paths, manual pages,
+ * compiler diagnostics and words that don't match any rule, in roughly the
+ * proportions of a terminal session.
+ */
+static void corpus_init(Corpus* corpus) {
+    static const char* man[] = {
+        "mmap(2)", "printf(3)", "ls(1)", "epoll_wait(2)",
+        "regex(7)", "pthread_create(3)", "make(1)", "inotify(7)",
+    };
+    static const char* words[] = {
+        "hello", "foo_bar", "the", "-Wall", "0x7ffd", "user@host", "[ok]",
+    };
+
+    uint32_t seed = 1;
+    corpus->bytes = 0;
+    for (int i = 0; i < CORPUS_NUM; i++) {
+        seed        = seed * 1103515245 + 12345;
+        const int r = (seed >> 16) % 100;
+        const int n = (seed >> 8) % 1000;
+
+        char* str = corpus->strs[i];
+        if (r < 20)
+            snprintf(str, STR_SZ, "https://example.com/docs/page%d?id=%d", n,
+                     r);
+        else if (r < 25)
+            snprintf(str, STR_SZ, "http://host%d.org/", n);
+        else if (r < 40)
+            snprintf(str, STR_SZ, "src/module%d.c:%d:%d", n % 50, n, r);
+        else if (r < 45)
+            snprintf(str, STR_SZ, "lib\\file%d.cpp(%d,%d): error C2065", n,
+                     n, r);
+        else if (r < 55)
+            snprintf(str, STR_SZ, "%s", man[n % LENGTH(man)]);
+        else if (r < 62)
+            snprintf(str, STR_SZ, "/home/user/papers/paper%d.pdf", n);
+        else if (r < 68)
+            snprintf(str, STR_SZ, "img/photo_%d.png", n);
+        else if (r < 71)
+            snprintf(str, STR_SZ, "videos/clip%d.mkv", n);
+        else if (r < 80)
+            snprintf(str, STR_SZ, "src/util%d.h", n);
+        else if (r < 83)
+            snprintf(str, STR_SZ, "project%d/Makefile", n);
+        else
+            snprintf(str, STR_SZ, "%s", words[n % LENGTH(words)]);
+
+        corpus->lens[i] = strlen(str);
+        corpus->bytes += corpus->lens[i];
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Classification */
+
+typedef struct ClassifyCtx {
+    RuleSet* rules;
+    const Corpus* corpus;
+    const int* items; /* Indexes in the corpus, or NULL for all of them */
+    const regex_t* regex;
+} ClassifyCtx;
+
+static void classify_all(void* arg, int num) {
+    ClassifyCtx* ctx = arg;
+    int sum          = 0;
+    for (int i = 0; i < num; i++) {
+        const int item = (ctx->items == NULL) ? i : ctx->items[i];
+        sum += ruleset_match_len(ctx->rules, ctx->corpus->strs[item],
+                                 ctx->corpus->lens[item]);
+    }
+    g_sink = sum;
+}
+
+static void classify_reference(void* arg, int num) {
+    ClassifyCtx* ctx = arg;
+    int sum          = 0;
+    for (int i = 0; i < num; i++)
+        sum += ruleset_match_reference_len(ctx->rules, ctx->corpus->strs[i],
+                                           ctx->corpus->lens[i]);
+    g_sink = sum;
+}
+
+static void regexec_all(void* arg, int num) {
+    ClassifyCtx* ctx = arg;
+    int sum          = 0;
+    for (int i = 0; i < num; i++)
+        sum += pattern_matches_len(ctx->corpus->strs[i], ctx->corpus->lens[i],
+                                   ctx->regex);
+    g_sink = sum;
+}
+
+typedef struct CompileCtx {
+    const char* pattern;
+} CompileCtx;
+
+static void regcomp_pattern(void* arg, int num) {
+    CompileCtx* ctx = arg;
+    for (int i = 0; i < num; i++) {
+        regex_t regex;
+        if (pattern_compile(&regex, ctx->pattern))
+            regfree(&regex);
+    }
+}
+
+/*
+ * Print the cost of classifying the corpus with the whole rule set, and with
+ * each of its rules: the time of the strings classified by the rule, the time
+ * of matching the whole corpus with its pattern alone, and the time of
+ * compiling its pattern.
+ */
+static bool bench_classify(const Corpus* corpus) {
+    const int64_t start = now_ns();
+    RuleSet rules;
+    if (!ruleset_init(&rules))
+        return false;
+    if (!ruleset_freeze(&rules, false)) {
+        ruleset_free(&rules);
+        return false;
+    }
+    const int64_t build_ns = now_ns() - start;
+
+    ClassifyCtx ctx = {
+        .rules  = &rules,
+        .corpus = corpus,
+        .items  = NULL,
+        .regex  = NULL,
+    };
+    const double cascade_ns   = measure(classify_all, &ctx, CORPUS_NUM);
+    const double reference_ns = measure(classify_reference, &ctx, CORPUS_NUM);
+
+    printf("  \"ruleset_build_us\": %.1f,\n", build_ns / 1e3);
+    printf("  \"classify\": {\"cascade_ns\": %.1f, \"reference_ns\": %.1f},\n",
+           cascade_ns, reference_ns);
+
+    /* Strings of the corpus grouped by their rule */
+    static int items[CORPUS_NUM];
+    static int results[CORPUS_NUM];
+    for (int i = 0; i < CORPUS_NUM; i++)
+        results[i] = ruleset_match_len(&rules, corpus->strs[i],
+                                       corpus->lens[i]);
+
+    printf("  \"rules\": [\n");
+    for (int rule = -1; rule < rules.num; rule++) {
+        int num = 0;
+        for (int i = 0; i < CORPUS_NUM; i++)
+            if (results[i] == rule)
+                items[num++] = i;
+
+        /* Names are not unique, e.g. the image rules of "config.h" */
+        printf("    {\"index\": %d, \"name\": ", rule);
+        print_json_string((rule < 0) ? "-" : rules.rules[rule].name);
+        if (rule >= 0) {
+            printf(", \"pattern\": ");
+            print_json_string(rules.rules[rule].pattern);
+        }
+        printf(", \"inputs\": %d", num);
+
+        /* Rules that match none of the corpus are only measured with regexec */
+        if (num > 0) {
+            ctx.items = items;
+            printf(", \"cascade_ns\": %.1f", measure(classify_all, &ctx, num));
+        }
+
+        /* The patterns of the set are compiled lazily, so use our own */
+        regex_t regex;
+        if (rule >= 0 && pattern_compile(&regex, rules.rules[rule].pattern)) {
+            ctx.regex              = &regex;
+            const double regex_ns  = measure(regexec_all, &ctx, CORPUS_NUM);
+            CompileCtx compile_ctx = { rules.rules[rule].pattern };
+            const double regcomp_ns =
+              measure(regcomp_pattern, &compile_ctx, 1);
+            regfree(&regex);
+
+            printf(", \"regexec_ns\": %.1f, \"regcomp_ns\": %.1f", regex_ns,
+                   regcomp_ns);
+        }
+        printf("}%s\n", (rule < rules.num - 1) ? "," : "");
+    }
+    printf("  ],\n");
+
+    ruleset_free(&rules);
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Normalization */
+
+typedef struct TransformCtx {
+    const Corpus* corpus;
+    char buf[STR_SZ * 2];
+} TransformCtx;
+
+static void normalize_all(void* arg, int num) {
+    TransformCtx* ctx = arg;
+    size_t sum        = 0;
+    for (int i = 0; i < num; i++) {
+        size_t len = ctx->corpus->lens[i];
+        memcpy(ctx->buf, ctx->corpus->strs[i], len + 1);
+        sum += transform_normalize(ctx->buf, &len, sizeof(ctx->buf)) - ctx->buf;
+        sum += len;
+    }
+    g_sink = sum;
+}
+
+static void trim_all(void* arg, int num) {
+    TransformCtx* ctx = arg;
+    size_t sum        = 0;
+    for (int i = 0; i < num; i++) {
+        size_t start = 0, end = ctx->corpus->lens[i];
+        transform_trim(ctx->corpus->strs[i], &start, &end);
+        sum += end - start;
+    }
+    g_sink = sum;
+}
+
+/*
+ * Print the cost of normalizing the corpus, as selected (mostly clean) and with
+ * the decorations that terminal selections usually have.
+ */
+static void bench_transform(const Corpus* corpus) {
+    static const char* decorations[][2] = {
+        { "'", "'" },
+        { "(", ")," },
+        { "<", ">" },
+        { "\x1b[1m", "\x1b[0m" },
+        { "file://", "" },
+        { "  ", ".\n" },
+    };
+
+    static Corpus decorated;
+    decorated.bytes = 0;
+    for (int i = 0; i < CORPUS_NUM; i++) {
+        const int d = i % LENGTH(decorations);
+        snprintf(decorated.strs[i], STR_SZ, "%s%s%s", decorations[d][0],
+                 corpus->strs[i], decorations[d][1]);
+        decorated.lens[i] = strlen(decorated.strs[i]);
+        decorated.bytes += decorated.lens[i];
+    }
+
+    static TransformCtx ctx;
+    ctx.corpus                 = corpus;
+    const double normalize_ns  = measure(normalize_all, &ctx, CORPUS_NUM);
+    const double trim_ns       = measure(trim_all, &ctx, CORPUS_NUM);
+    ctx.corpus                 = &decorated;
+    const double decorated_ns  = measure(normalize_all, &ctx, CORPUS_NUM);
+    const double decorated_tns = measure(trim_all, &ctx, CORPUS_NUM);
+
+    printf("  \"transform\": {\"normalize_ns\": %.1f, \"trim_ns\": %.1f, "
+           "\"normalize_decorated_ns\": %.1f, \"trim_decorated_ns\": %.1f},\n",
+           normalize_ns, trim_ns, decorated_ns, decorated_tns);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Launching */
+
+/*
+ * Entry point of the stub handler, executed by plumber(1) instead of a real
+ * program: write the time when it started to the FIFO at 'fifo'.
+ */
+static int stub_main(const char* fifo) {
+    const int64_t start = now_ns();
+    const int fd        = open(fifo, O_WRONLY);
+    if (fd < 0)
+        return EXITFAILURE;
+
+    const bool ok = write(fd, &start, sizeof(start)) == sizeof(start);
+    close(fd);
+    return ok ? EXITSUCCESS : EXITFAILURE;
+}
+
+/*
+ * Wait for the time written by the stub handler to the FIFO 'fd'. Returns -1
+ * on timeout.
+ */
+static int64_t read_stub_time(int fd) {
+    struct pollfd pfd = {
+        .fd     = fd,
+        .events = POLLIN,
+    };
+
+    int64_t result;
+    if (poll(&pfd, 1, LAUNCH_TIMEOUT_MS) <= 0 ||
+        read(fd, &result, sizeof(result)) != sizeof(result))
+        return -1;
+    return result;
+}
+
+static void print_percentiles(const char* name, double* values, int num) {
+    qsort(values, num, sizeof(double), compare_doubles);
+    printf("\"%s\": {\"min\": %.1f, \"median\": %.1f, \"p90\": %.1f}", name,
+           values[0], values[num / 2], values[num * 9 / 10]);
+}
+
+/*
+ * Print the latency of the 'plumber' program when launching a command: from
+ * the start of the process to the execution of the command, and to the exit of
+ * the process. The command is this program, as a stub handler, selected by a
+ * temporary rules file; and the daemon is not used.
+ */
+static bool bench_launch(const char* plumber, const char* self) {
+    char dir[] = "/tmp/plumber-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        return false;
+
+    char rules[PATH_SZ], fifo[PATH_SZ], socket[PATH_SZ];
+    snprintf(rules, sizeof(rules), "%s/rules", dir);
+    snprintf(fifo, sizeof(fifo), "%s/fifo", dir);
+    snprintf(socket, sizeof(socket), "%s/none.sock", dir);
+
+    FILE* fp = fopen(rules, "w");
+    if (fp == NULL) {
+        rmdir(dir);
+        return false;
+    }
+    fprintf(fp, "stub LAUNCH '^bench-[0-9]+$' '%s' --stub '%s' $0\n", self,
+            fifo);
+    fclose(fp);
+
+    /* Opened for writing too, so it doesn't block or reach EOF */
+    const int fifo_fd =
+      (mkfifo(fifo, 0600) == 0) ? open(fifo, O_RDWR | O_CLOEXEC) : -1;
+
+    setenv("PLUMBER_RULES", rules, 1);
+    setenv("PLUMBER_SOCKET", socket, 1);
+    setenv("XDG_CACHE_HOME", dir, 1);
+    setenv("PLUMBER_DEDUP_MS", "0", 1);
+    extern char** environ;
+
+    double exec_us[LAUNCH_RUNS], exit_us[LAUNCH_RUNS];
+    bool ok = fifo_fd >= 0;
+
+    /* The first run writes the cache of the rules file, so it's not counted */
+    for (int i = -1; ok && i < LAUNCH_RUNS; i++) {
+        char arg[32];
+        snprintf(arg, sizeof(arg), "bench-%d", i + 1);
+        char* argv[] = { (char*)plumber, arg, NULL };
+
+        pid_t pid;
+        int status;
+        const int64_t start = now_ns();
+        ok = posix_spawn(&pid, plumber, NULL, NULL, argv, environ) == 0 &&
+             waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+             WEXITSTATUS(status) == 0;
+        const int64_t exited = now_ns();
+
+        const int64_t executed = ok ? read_stub_time(fifo_fd) : -1;
+        ok                     = executed >= 0;
+        if (ok && i >= 0) {
+            exec_us[i] = (executed - start) / 1e3;
+            exit_us[i] = (exited - start) / 1e3;
+        }
+    }
+
+    if (ok) {
+        printf("  \"launch\": {\"runs\": %d, ", LAUNCH_RUNS);
+        print_percentiles("exec_us", exec_us, LAUNCH_RUNS);
+        printf(", ");
+        print_percentiles("exit_us", exit_us, LAUNCH_RUNS);
+        printf("},\n");
+    }
+
+    /* The stub handlers are children of plumber(1), which already exited */
+    if (fifo_fd >= 0)
+        close(fifo_fd);
+    char cache[PATH_SZ];
+    if (rulecache_path(rules, cache, sizeof(cache))) {
+        unlink(cache);
+        *strrchr(cache, '/') = '\0';
+        rmdir(cache);
+    }
+    unlink(fifo);
+    unlink(rules);
+    rmdir(dir);
+    return ok;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+    if (argc >= 3 && !strcmp(argv[1], "--stub"))
+        return stub_main(argv[2]);
+
+    if (argc > 2) {
+        fprintf(stderr,
+                "Usage: %s [PLUMBER]\n"
+                "Measure the performance of plumber, and print it as JSON.\n"
+                "The launch latency is only measured if the path of the\n"
+                "plumber program is specified.\n",
+                argv[0]);
+        return EXITINVALIDARGS;
+    }
+
+    static Corpus corpus;
+    corpus_init(&corpus);
+
+    printf("{\n");
+    printf("  \"corpus\": {\"inputs\": %d, \"bytes\": %zu},\n", CORPUS_NUM,
+           corpus.bytes);
+
+    bool ok = bench_classify(&corpus);
+    bench_transform(&corpus);
+
+    if (ok && argc == 2) {
+        char self[PATH_SZ];
+        const ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        if (len > 0) {
+            self[len] = '\0';
+            ok        = bench_launch(argv[1], self);
+        } else {
+            ok = false;
+        }
+        if (!ok)
+            ERR("Could not measure the launch latency.");
+    }
+
+    printf("  \"ok\": %s\n", ok ? "true" : "false");
+    printf("}\n");
+    return ok ? EXITSUCCESS : EXITFAILURE;
+}
@@ -1,9 +1,43 @@
 
-#include "test.h"
+#define _POSIX_C_SOURCE 200809L /* fileno, ftruncate */
 
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "test.h"
 
+#include "../src/batch.h"
+#include "../src/decisions.h"
+#include "../src/dedup.h"
+#include "../src/dfa.h"
+#include "../src/extract.h"
+#include "../src/fileindex.h"
+#include "../src/ipc.h"
+#include "../src/launch.h"
+#include "../src/linecache.h"
+#include "../src/magic.h"
+#include "../src/mapfile.h"
+#include "../src/manindex.h"
+#include "../src/nvim.h"
 #include "../src/pattern.h"
+#include "../src/plumber.h"
+#include "../src/prefetch.h"
+#include "../src/rulecache.h"
+#include "../src/rules.h"
+#include "../src/server.h"
+#include "../src/statcache.h"
+#include "../src/suffix.h"
+#include "../src/trace.h"
+#include "../src/transform.h"
 #include "../src/util.h"
 #include "../src/config.h"
 
@@ -16,17 +50,1854 @@ static void test_patterns(void) {
     TEST_PATTERN(REGEX_LINECOL, "main.c:123");
     TEST_PATTERN(REGEX_LINECOL, "main.c:111:22");
     TEST_PATTERN(REGEX_LINECOL, "main.c:111:22: Error!");
+    TEST_PATTERN(REGEX_MSVC, "main.c(111)");
+    TEST_PATTERN(REGEX_MSVC, "main.c(111,22): error C2065");
+
+    TEST_PATTERN(editor_patterns[0], "main.c");
+    TEST_PATTERN(image_patterns[0], "image.png");
+    TEST_PATTERN(image_patterns[0], "/tmp/IMAGE.PNG");
+    TEST_PATTERN(video_patterns[0], "video.mp4");
+}
+
+static void test_rules(void) {
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules));
+
+    TEST_RULE(&rules, "https://example.com/", RULE_URL);
+    TEST_RULE(&rules, "https://example.com/document.pdf", RULE_URL);
+    TEST_RULE(&rules, "document.pdf", RULE_PDF);
+    TEST_RULE(&rules, "mmap(2)", RULE_MAN);
+    TEST_RULE(&rules, "main.c:111:22", RULE_LINECOL);
+    TEST_RULE(&rules, "main.c(111,22)", RULE_LINECOL);
+    TEST_RULE(&rules, "image.jpeg", RULE_IMAGE);
+    TEST_RULE(&rules, "video.webm", RULE_VIDEO);
+    TEST_RULE(&rules, "main.c", RULE_EDITOR);
+    TEST_RULE(&rules, "src/Makefile", RULE_EDITOR);
+    TEST_COND(ruleset_match(&rules, "file.unknown") < 0);
+    TEST_COND(ruleset_match(&rules, "NotMakefile") < 0);
+
+    /* Only the irregular patterns should need a regex engine */
+    for (int i = 0; i < rules.num; i++) {
+        const enum ERuleKind kind = rules.rules[i].kind;
+        if (kind == RULE_URL || kind == RULE_MAN || kind == RULE_LINECOL)
+            TEST_COND(rules.matchers[i] == MATCHER_DFA);
+        else
+            TEST_COND(rules.matchers[i] == MATCHER_EXTENSION ||
+                      rules.matchers[i] == MATCHER_FILENAME);
+    }
+
+    ruleset_free(&rules);
+}
+
+static void test_suffix(void) {
+    char literal[64];
+    TEST_COND(suffix_parse_extension(REGEX_EXTENSION("tar\\.gz"),
+                                     literal,
+                                     sizeof(literal)) == 6);
+    TEST_COND(!strcmp(literal, "tar.gz"));
+    TEST_COND(suffix_parse_filename(REGEX_FILENAME("Makefile"),
+                                    literal,
+                                    sizeof(literal)) == 8);
+    TEST_COND(!strcmp(literal, "makefile"));
+    TEST_COND(suffix_parse_extension(REGEX_EXTENSION("mk?"),
+                                     literal,
+                                     sizeof(literal)) < 0);
+    TEST_COND(
+      suffix_parse_filename("^Makefile$", literal, sizeof(literal)) < 0);
+
+    SuffixTable table;
+    suffix_init(&table);
+    TEST_COND(suffix_add(&table, "gz", 2, 3));
+    TEST_COND(suffix_add(&table, "tar.gz", 6, 1));
+    TEST_COND(suffix_add(&table, "GZ", 2, 5));
+    TEST_COND(suffix_match_extension(&table, "a.tar.gz", 8) == 1);
+    TEST_COND(suffix_match_extension(&table, "a.TGZ.GZ", 8) == 3);
+    TEST_COND(suffix_match_extension(&table, ".gz", 3) == -1);
+    TEST_COND(suffix_match_extension(&table, "a.gzip", 6) == -1);
+    suffix_free(&table);
+}
+
+static void test_matchers(void) {
+    static const char* corpus[] = {
+        "",
+        "http://",
+        "https://example.com/",
+        "HTTPS://EXAMPLE.COM/",
+        "ftp://example.com/file.png",
+        "xhttp://example.com/",
+        "https:/example.com/",
+        "document.pdf",
+        ".pdf",
+        "document.pdf.bak",
+        "mmap(2)",
+        "mmap(22)",
+        "mmap()",
+        "my_func-2(3)",
+        "f.c(3)",
+        "main.c:123",
+        "main.c:111:22",
+        "main.c:111:22: Error!",
+        ":12",
+        "main.c:",
+        "main.c:x",
+        "12:30:00",
+        "a:b:12",
+        "main.c(12)",
+        "main.c(12,5):",
+        "main.c(12,)",
+        "mmap(22)",
+        "image.png",
+        "image.PNG",
+        "/tmp/a.b.c/image.jpeg",
+        "image.png/",
+        "png",
+        "video.webm",
+        "archive.tar.gz",
+        "file.txt",
+        "file.c.txt",
+        "file.cpp",
+        "file.hpp.c",
+        "Makefile",
+        "/usr/src/Makefile",
+        "src/makefile",
+        "NotMakefile",
+        "Makefile.am",
+        "line\nbreak.c",
+        "\xff\xfe.png",
+        "spaces in name.md",
+    };
+
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules));
+
+    for (int i = 0; i < LENGTH(corpus); i++) {
+        const int dfa_idx       = ruleset_match(&rules, corpus[i]);
+        const int reference_idx = ruleset_match_reference(&rules, corpus[i]);
+        if (dfa_idx != reference_idx)
+            TEST_DIE("Matchers disagree on '%s' (DFA: %d, reference: %d).",
+                     corpus[i],
+                     dfa_idx,
+                     reference_idx);
+    }
+
+    ruleset_free(&rules);
+}
+
+static void test_dfa(void) {
+    static const struct {
+        const char* pat;
+        const char* str;
+    } cases[] = {
+        { "a{2,3}", "xaax" },       { "^a{2,3}$", "aaaa" },
+        { "^(ab|cd)+$", "abcdab" }, { "[[:digit:]]+x", "a12x" },
+        { "[^a-z]", "abc" },        { "[]a]", "]" },
+        { "^$", "" },               { "a|^b", "cb" },
+        { "x?$", "abc" },           { "^[a-c-]+$", "a-c" },
+        { "(a|)b", "b" },           { "^.\\.$", "a." },
+        { "$^", "a" },              { "(a*){2}b", "b" },
+    };
+
+    for (int i = 0; i < LENGTH(cases); i++) {
+        Dfa dfa;
+        dfa_init(&dfa);
+        TEST_COND(dfa_add(&dfa, cases[i].pat, 0));
+        TEST_COND(dfa_finish(&dfa));
+
+        const bool expected = pattern_matches(cases[i].str, cases[i].pat);
+        const int result =
+          dfa_match(&dfa, cases[i].str, strlen(cases[i].str), INT_MAX);
+        if ((result == 0) != expected)
+            TEST_DIE("DFA result for '%s' on '%s' was %d, expected %d.",
+                     cases[i].pat,
+                     cases[i].str,
+                     result,
+                     expected);
+        dfa_free(&dfa);
+    }
+
+    /* Unsupported syntax is rejected, instead of being matched incorrectly */
+    Dfa dfa;
+    dfa_init(&dfa);
+    TEST_COND(!dfa_add(&dfa, "(a)\\1", 0));
+    TEST_COND(!dfa_add(&dfa, "\\w+", 0));
+    TEST_COND(!dfa_add(&dfa, "[[.a.]]", 0));
+    TEST_COND(!dfa_add(&dfa, "a{1", 0));
+    TEST_COND(!dfa_add(&dfa, "^\\<foo$", 0));
+    TEST_COND(!dfa_add(&dfa, "foo\\>", 0));
+    TEST_COND(!dfa_add(&dfa, "\\`foo", 0));
+    TEST_COND(!dfa_add(&dfa, "x\\'", 0));
+    dfa_free(&dfa);
+}
+
+static void test_extract(void) {
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules));
+
+    /* The padding makes the spans cross the blocks of the SIMD prefilter */
+    static const char text[] =
+      "see mmap(2)). Open <https://x.org/a_(b)>                   or "
+      "(src/main.c:12:5:) and \"img.PNG\", 1.5 foo/bar Makefile done.\n"
+      "last.pdf";
+    static const struct {
+        const char* str;
+        enum ERuleKind kind;
+    } expected[] = {
+        { "mmap(2)", RULE_MAN },
+        { "https://x.org/a_(b)", RULE_URL },
+        { "src/main.c:12:5", RULE_LINECOL },
+        { "img.PNG", RULE_IMAGE },
+        { "last.pdf", RULE_PDF },
+    };
+
+    static Extractor ex;
+    extract_init(&ex, &rules, text, sizeof(text) - 1);
+
+    ExtractSpan span;
+    for (int i = 0; i < LENGTH(expected); i++) {
+        TEST_COND(extract_next(&ex, &span));
+        if (span.len != strlen(expected[i].str) ||
+            memcmp(&text[span.off], expected[i].str, span.len) != 0 ||
+            rules.rules[span.rule].kind != expected[i].kind)
+            TEST_DIE("Expected span '%s', got '%.*s' (rule %d).",
+                     expected[i].str,
+                     (int)span.len,
+                     &text[span.off],
+                     span.rule);
+    }
+    TEST_COND(!extract_next(&ex, &span));
+
+    ruleset_free(&rules);
+}
+
+static void test_transform(void) {
+    static const struct {
+        const char* input;
+        const char* expected;
+    } tests[] = {
+        { "  'main.c'  ", "main.c" },
+        { "\"mmap(2)\".", "mmap(2)" },
+        { "(src/main.c:12:5:)", "src/main.c:12:5" },
+        { "<https://x.org/a_(b)>,", "https://x.org/a_(b)" },
+        { "`foo.c`", "foo.c" },
+        { "\x1B[1;31mmain.c\x1B[0m", "main.c" },
+        { "\x1B]8;;file:///a\x1B\\a.txt\x1B]8;;\a", "a.txt" },
+        { "a\x01" "b.c\x1B[", "ab.c" },
+        { "file:///tmp/a%20b%2Fc.pdf", "/tmp/a b/c.pdf" },
+        { "file://localhost/a%2.pdf", "/a%2.pdf" },
+        { "file:///a%00b", "/a%00b" },
+        { "file://host/a.pdf", "file://host/a.pdf" },
+        { "https://x.org/a%20b", "https://x.org/a%20b" },
+        { "~/notes.txt", "/home/user/notes.txt" },
+        { "'~'", "/home/user" },
+        { "~user/a", "~user/a" },
+        { "a~/b", "a~/b" },
+        { "  ''  ", "" },
+    };
+
+    TEST_COND(setenv("HOME", "/home/user", 1) == 0);
+
+    char buf[64];
+    for (int i = 0; i < LENGTH(tests); i++) {
+        size_t len = strlen(tests[i].input);
+        memcpy(buf, tests[i].input, len + 1);
+        const char* str = transform_normalize(buf, &len, sizeof(buf));
+        if (strcmp(str, tests[i].expected) != 0 || len != strlen(str))
+            TEST_DIE("Expected '%s', got '%s'.", tests[i].expected, str);
+    }
+
+    /* Without room for "$HOME", the "~" is kept */
+    strcpy(buf, "~/a");
+    size_t len = strlen(buf);
+    TEST_COND(!strcmp(transform_normalize(buf, &len, len + 1), "~/a"));
+
+    /* The trimmed text before the "~" is enough */
+    strcpy(buf, "         \"~/a\"");
+    len = strlen(buf);
+    TEST_COND(!strcmp(transform_normalize(buf, &len, len + 1), "/home/user/a"));
+}
+
+static void test_ipc(void) {
+    /* Frames with the payload size in the header, and the received bytes */
+    static const struct {
+        const char* payload;
+        size_t len;        /* Bytes of the payload that were received */
+        ipc_len_t declared; /* Size of the payload in the header */
+        long size;         /* Result of 'ipc_frame_size' */
+        int num;           /* Result of 'ipc_unpack', if complete */
+    } tests[] = {
+        { "classify\0a.c\0", 13, 13, 17, 2 },
+        { "\0\0", 2, 2, 6, 2 },
+        { "", 0, 0, 4, 0 },
+        { "classify\0a.c\0", 13, 20, 0, 0 },
+        { "classify\0a.c\0", 5, 14, 0, 0 },
+        { "classify\0a.c", 12, 12, 16, -1 },
+        { "classify\0a.c\0x", 14, 14, 18, -1 },
+        { "a\0b\0c\0d\0e\0f\0g\0h\0i\0j\0k\0l\0m\0n\0o\0p\0", 32, 32,
+          36, IPC_MAX_STRINGS },
+        { "a\0b\0c\0d\0e\0f\0g\0h\0i\0j\0k\0l\0m\0n\0o\0p\0q\0", 34,
+          34, 38, -1 },
+        { "", 0, IPC_MAX_FRAME - sizeof(ipc_len_t), 0, 0 },
+        { "", 0, IPC_MAX_FRAME - sizeof(ipc_len_t) + 1, -1, 0 },
+        { "", 0, 0xFFFFFFFF, -1, 0 },
+    };
+
+    static char frame[IPC_MAX_FRAME];
+    const char* strs[IPC_MAX_STRINGS + 1];
+    for (int i = 0; i < LENGTH(tests); i++) {
+        memcpy(frame, &tests[i].declared, sizeof(ipc_len_t));
+        memcpy(&frame[sizeof(ipc_len_t)], tests[i].payload, tests[i].len);
+
+        const long size =
+          ipc_frame_size(frame, sizeof(ipc_len_t) + tests[i].len);
+        if (size != tests[i].size)
+            TEST_DIE("Frame %d: expected size %ld, got %ld.", i,
+                     tests[i].size, size);
+        if (size <= 0)
+            continue;
+
+        const int num = ipc_unpack(frame, strs, IPC_MAX_STRINGS);
+        if (num != tests[i].num)
+            TEST_DIE("Frame %d: expected %d strings, got %d.", i,
+                     tests[i].num, num);
+        TEST_COND(num < 0 || strs[num] == NULL);
+    }
+
+    /* Incomplete headers */
+    TEST_COND(ipc_frame_size(frame, 0) == 0);
+    TEST_COND(ipc_frame_size(frame, sizeof(ipc_len_t) - 1) == 0);
+
+    /* Packing, which fails if the frame doesn't fit */
+    const char* req[] = { IPC_CLASSIFY, "/tmp", "a.c" };
+    const size_t len = ipc_pack(frame, sizeof(frame), req, LENGTH(req));
+    TEST_COND(len == sizeof(ipc_len_t) + 9 + 5 + 4);
+    TEST_COND(ipc_frame_size(frame, len) == (long)len);
+    TEST_COND(ipc_frame_size(frame, len - 1) == 0);
+    TEST_COND(ipc_unpack(frame, strs, IPC_MAX_STRINGS) == 3);
+    TEST_COND(!strcmp(strs[0], IPC_CLASSIFY) && !strcmp(strs[2], "a.c"));
+    TEST_COND(ipc_unpack(frame, strs, 2) == -1);
+    TEST_COND(ipc_pack(frame, len - 1, req, LENGTH(req)) == 0);
+
+    static char big[IPC_MAX_FRAME];
+    memset(big, 'a', sizeof(big) - 1);
+    const char* big_req[] = { big };
+    static char big_frame[2 * IPC_MAX_FRAME];
+    TEST_COND(ipc_pack(big_frame, sizeof(big_frame), big_req, 1) == 0);
+}
+
+static void test_server(void) {
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules) && ruleset_freeze(&rules, false));
+    MagicCache magic;
+    magic_cache_init(&magic);
+
+    /* Requests, and the name of the matched rule or NULL for "-1" */
+    static const struct {
+        const char* strs[5];
+        int num;
+        bool valid;
+        const char* rule;
+    } tests[] = {
+        { { "classify", "https://x.org" }, 2, true, "url" },
+        { { "classify", "/", "https://x.org" }, 3, true, "url" },
+        { { "classify", "/", "nothing" }, 3, true, NULL },
+        { { "classify" }, 1, false, NULL },
+        { { "classify", "/", "a", "b" }, 4, false, NULL },
+        { { "launch", "https://x.org" }, 2, false, NULL },
+        { { "launch", "/", "a", "b" }, 4, false, NULL },
+        { { "open", "/", "https://x.org" }, 3, false, NULL },
+        { { "CLASSIFY", "https://x.org" }, 2, false, NULL },
+        { { "" }, 1, false, NULL },
+    };
+
+    static char frame[IPC_MAX_FRAME];
+    static Client client;
+    const char* reply[IPC_MAX_STRINGS + 1];
+    for (int i = 0; i < LENGTH(tests); i++) {
+        TEST_COND(ipc_pack(frame, sizeof(frame), tests[i].strs,
+                           tests[i].num) > 0);
+        const bool valid =
+          server_handle_request(&rules, &magic, &client, frame);
+        if (valid != tests[i].valid)
+            TEST_DIE("Request %d: expected %s.", i,
+                     tests[i].valid ? "a reply" : "an error");
+        if (!valid)
+            continue;
+
+        const int num = ipc_unpack(client.out, reply, IPC_MAX_STRINGS);
+        TEST_COND(num >= 1 && (size_t)ipc_frame_size(client.out,
+                                                     client.out_len) ==
+                                client.out_len);
+        const int idx = atoi(reply[0]);
+        if (tests[i].rule == NULL) {
+            TEST_COND(idx == -1 && num == 1);
+        } else {
+            TEST_COND(idx >= 0 && idx < rules.num && num >= 3);
+            TEST_COND(!strcmp(rules.rules[idx].name, tests[i].rule));
+            TEST_COND(!strcmp(reply[num - 1], "https://x.org"));
+        }
+    }
+
+    /* Without the terminator of the last string */
+    const ipc_len_t payload = 10;
+    memcpy(frame, &payload, sizeof(payload));
+    memcpy(&frame[sizeof(payload)], "classify\0a", payload);
+    TEST_COND(!server_handle_request(&rules, &magic, &client, frame));
+
+    ruleset_free(&rules);
+}
+
+/*
+ * Check that the spans of 'entry' are the same as the ones of a full scan.
+ */
+static void check_line(RuleSet* rules, const LineEntry* entry,
+                       const char* text) {
+    static Extractor ex;
+    extract_init(&ex, rules, text, strlen(text));
+
+    ExtractSpan span;
+    int num = 0;
+    while (extract_next(&ex, &span)) {
+        TEST_COND(num < entry->spans_num);
+        const ExtractSpan* cached = &entry->spans[num++];
+        if (cached->off != span.off || cached->len != span.len ||
+            cached->rule != span.rule)
+            TEST_DIE("Cached span %d of '%s' is wrong.", num - 1, text);
+    }
+    TEST_COND(num == entry->spans_num);
+}
+
+static void test_linecache(void) {
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules));
+    TEST_COND(ruleset_freeze(&rules, false));
+
+    LineCache cache;
+    TEST_COND(linecache_init(&cache, &rules, 2));
+
+    char line[] = "see main.c:12 and mmap(2) or https://x.org/a.png (b.pdf)";
+    const LineEntry* entry = linecache_get(&cache, 0, line, strlen(line));
+    TEST_COND(entry != NULL && entry->spans_num == 4);
+    check_line(&rules, entry, line);
+
+    /* The same line shouldn't be scanned again, even in a different row */
+    const size_t scanned = cache.scanned;
+    TEST_COND(linecache_get(&cache, 0, line, strlen(line)) != NULL);
+    TEST_COND(linecache_get(&cache, 1, line, strlen(line)) != NULL);
+    TEST_COND(cache.scanned == scanned);
+
+    /* Only the modified word should be scanned */
+    line[strlen("see main.c")] = 'x';
+    entry = linecache_get(&cache, 0, line, strlen(line));
+    TEST_COND(entry != NULL && entry->spans_num == 3);
+    TEST_COND(cache.scanned == scanned + strlen("main.cx12"));
+    check_line(&rules, entry, line);
+
+    /* Random edits, including the ones that join and split words */
+    static const char alphabet[] = "ab.c:1(2) /";
+    srand(1);
+    for (int i = 0; i < 2000; i++) {
+        const size_t pos = rand() % strlen(line);
+        line[pos]        = alphabet[rand() % (sizeof(alphabet) - 1)];
+
+        entry = linecache_get(&cache, i % 3, line, strlen(line));
+        TEST_COND(entry != NULL);
+        check_line(&rules, entry, line);
+    }
+
+    linecache_free(&cache);
+    ruleset_free(&rules);
+}
+
+/* Classify the same strings as 'test_library', from multiple threads */
+static void* classify_thread(void* arg) {
+    static const char* strs[] = {
+        "https://x.org",
+        "mmap(2)",
+        "a.c:1",
+        "b.png",
+    };
+
+    Plumber* plumber = arg;
+    for (int i = 0; i < 10000; i++) {
+        const char* str = strs[i % LENGTH(strs)];
+        const int idx   = plumber_classify(plumber, str, strlen(str));
+        if (idx < 0)
+            return NULL;
+    }
+    return plumber;
+}
+
+static void write_file(const char* path, const char* text) {
+    FILE* fp = fopen(path, "w");
+    TEST_COND(fp != NULL);
+    TEST_COND(fputs(text, fp) >= 0);
+    TEST_COND(fclose(fp) == 0);
+}
+
+static void test_rulefile(void) {
+    static const char* text =
+      "# name  mode       pattern              command  arguments\n"
+      "url     LAUNCH     '^https?://.+'       browser\n"
+      "\n"
+      "linecol ST_LAUNCH  '^([^:]+):([0-9]+)'  editor   $1 '+$2' 'it''s'\n"
+      "source  ST_LAUNCH  '^.+\\.c$'           editor\n"
+      "make    LAUNCH     '^(.*/)?Makefile$'   make     -f $0\n"
+      "twice   LAUNCH     '^(a|b)\\1$'         echo\n";
+
+    /* The cache should be written inside the temporary directory */
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+    TEST_COND(setenv("XDG_CACHE_HOME", dir, 1) == 0);
+
+    char path[RULES_PATH_SZ], cache_path[RULES_PATH_SZ];
+    snprintf(path, sizeof(path), "%s/rules", dir);
+    TEST_COND(rulecache_path(path, cache_path, sizeof(cache_path)));
+    write_file(path, text);
+
+    /* The first time, the file is parsed; then, the cache is used */
+    for (int i = 0; i < 2; i++) {
+        RuleSet rules;
+        TEST_COND(ruleset_load(&rules, path));
+        TEST_COND(rules.num == 5 && (rules.map != NULL) == (i > 0));
+        TEST_COND(rules.matchers[2] == MATCHER_EXTENSION);
+        TEST_COND(rules.matchers[3] == MATCHER_FILENAME);
+        TEST_COND(rules.matchers[4] == MATCHER_REGEX);
+
+        TEST_COND(ruleset_match(&rules, "https://example.com/") == 0);
+        TEST_COND(ruleset_match(&rules, "main.c:12") == 1);
+        TEST_COND(ruleset_match(&rules, "main.c") == 2);
+        TEST_COND(ruleset_match(&rules, "src/Makefile") == 3);
+        TEST_COND(ruleset_match(&rules, "bb") == 4);
+        TEST_COND(ruleset_match(&rules, "ab") < 0);
+        TEST_COND(ruleset_match(&rules, "mmap(2)") < 0);
+        TEST_COND(rules.rules[1].kind == RULE_LINECOL);
+        TEST_COND(rules.rules[2].kind == RULE_CUSTOM);
+        TEST_COND(!strcmp(rules.rules[2].name, "source"));
+        TEST_COND(rules.rules[0].mode == LAUNCHMODE_DIRECT);
+        TEST_COND(rules.rules[1].mode == LAUNCHMODE_TERMINAL);
+
+        char buf[64];
+        const char* argv[LAUNCH_MAX_ARGS + 1];
+        TEST_COND(launch_argv(&rules, 1, "a.c:3", 5, buf, sizeof(buf),
+                              argv) == 6);
+        TEST_COND(!strcmp(argv[2], "editor") && !strcmp(argv[3], "a.c") &&
+                  !strcmp(argv[4], "+3") && !strcmp(argv[5], "it's"));
+        TEST_COND(launch_argv(&rules, 3, "Makefile", 8, buf, sizeof(buf),
+                              argv) == 3);
+        TEST_COND(!strcmp(argv[1], "-f") && !strcmp(argv[2], "Makefile"));
+
+        /* Workers of the batch mode load the same file */
+        TEST_COND(rules.path != NULL && !strcmp(rules.path, path));
+        ruleset_free(&rules);
+    }
+
+    /* Modifying the file should invalidate the cache */
+    write_file(path, "pdf LAUNCH '^.+\\.pdf$' viewer\n");
+    RuleSet rules;
+    TEST_COND(ruleset_load(&rules, path));
+    TEST_COND(rules.num == 1 && rules.map == NULL);
+    TEST_COND(ruleset_match(&rules, "a.pdf") == 0);
+    ruleset_free(&rules);
+
+    /* A corrupted cache should be ignored */
+    FILE* fp = fopen(cache_path, "r+");
+    TEST_COND(fp != NULL);
+    TEST_COND(fseek(fp, -1, SEEK_END) == 0 && fputc('x', fp) != EOF);
+    TEST_COND(fclose(fp) == 0);
+    TEST_COND(ruleset_load(&rules, path));
+    TEST_COND(rules.num == 1 && rules.map == NULL);
+    ruleset_free(&rules);
+
+    /* Syntax errors */
+    static const char* invalid[] = {
+        "url LAUNCH '^https?://.+'\n",
+        "url EXEC '^https?://.+' browser\n",
+        "url LAUNCH '^https?://.+ browser\n",
+        "url LAUNCH '^https?://(.+' browser\n",
+        "url LAUNCH '^https?://.+' browser 1 2 3 4 5 6\n",
+        "# Nothing\n",
+    };
+    for (int i = 0; i < LENGTH(invalid); i++) {
+        write_file(path, invalid[i]);
+        TEST_COND(!ruleset_load(&rules, path));
+    }
+    TEST_COND(!ruleset_load(&rules, "/nonexistent/rules"));
+
+    /* GNU anchors are left to regexec(3), which gives the same results */
+    write_file(path, "word   LAUNCH '^\\<foo$'  a\n"
+                     "end    LAUNCH 'x\\'''      b\n"
+                     "start  LAUNCH '\\`ab'      c\n"
+                     "suffix LAUNCH 'bar\\>$'    d\n");
+    TEST_COND(ruleset_load(&rules, path) && ruleset_freeze(&rules, false));
+    for (int i = 0; i < rules.num; i++)
+        TEST_COND(rules.matchers[i] == MATCHER_REGEX);
+    static const char* anchored[] = {
+        "foo", "xfoo", "x", "x y", "ab", "cab", "bar", "foobar",
+    };
+    for (int i = 0; i < LENGTH(anchored); i++) {
+        const size_t len = strlen(anchored[i]);
+        const int rule   = ruleset_match_len(&rules, anchored[i], len);
+        if (rule != ruleset_match_reference_len(&rules, anchored[i], len))
+            TEST_DIE("Different results for '%s'.", anchored[i]);
+    }
+    TEST_COND(ruleset_match(&rules, "foo") == 0);
+    TEST_COND(ruleset_match(&rules, "x") == 1);
+    TEST_COND(ruleset_match(&rules, "foobar") == 3);
+    TEST_COND(ruleset_match(&rules, "bars") < 0);
+    ruleset_free(&rules);
+
+    unlink(cache_path);
+    unlink(path);
+    *strrchr(cache_path, '/') = '\0';
+    rmdir(cache_path);
+    rmdir(dir);
+}
+
+static void test_reload(void) {
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+    TEST_COND(setenv("XDG_CACHE_HOME", dir, 1) == 0);
+
+    char path[RULES_PATH_SZ], cache_path[RULES_PATH_SZ];
+    snprintf(path, sizeof(path), "%s/rules", dir);
+    TEST_COND(rulecache_path(path, cache_path, sizeof(cache_path)));
+    write_file(path, "pdf LAUNCH '^.+\\.pdf$' viewer\n");
+
+    ServerRules rules;
+    TEST_COND(server_rules_init(&rules, path));
+    RuleSet* first = server_rules_get(&rules);
+    TEST_COND(first->num == 1 && !strcmp(first->rules[0].name, "pdf"));
+    TEST_COND(rules.retired == NULL);
+
+    /* The new rules are used, and the old ones are kept until reclaimed */
+    write_file(path, "url    LAUNCH    '^https?://.+'  browser\n"
+                     "source ST_LAUNCH '^.+\\.c$'      editor\n");
+    TEST_COND(server_rules_reload(&rules, path));
+    RuleSet* second = server_rules_get(&rules);
+    TEST_COND(second != first && second->num == 2);
+    TEST_COND(ruleset_match(second, "a.c") == 1);
+    TEST_COND(ruleset_match(second, "a.pdf") < 0);
+    TEST_COND(rules.retired != NULL && &rules.retired->set == first);
+    TEST_COND(first->num == 1 && ruleset_match(first, "a.pdf") == 0);
+    server_rules_reclaim(&rules);
+    TEST_COND(rules.retired == NULL);
+
+    /* Invalid rules are ignored */
+    write_file(path, "url LAUNCH '^https?://(.+' browser\n");
+    TEST_COND(!server_rules_reload(&rules, path));
+    TEST_COND(server_rules_get(&rules) == second && rules.retired == NULL);
+    TEST_COND(ruleset_match(second, "a.c") == 1);
+
+    /* Without the file, the rules of "config.h" are used */
+    TEST_COND(unlink(path) == 0);
+    TEST_COND(server_rules_reload(&rules, path));
+    RuleSet defaults;
+    TEST_COND(ruleset_init(&defaults));
+    TEST_COND(server_rules_get(&rules)->num == defaults.num);
+    ruleset_free(&defaults);
+
+    server_rules_free(&rules);
+    TEST_COND(rules.current == NULL && rules.retired == NULL);
+
+    unlink(cache_path);
+    *strrchr(cache_path, '/') = '\0';
+    rmdir(cache_path);
+    rmdir(dir);
+}
+
+static void test_reorder(void) {
+    static const struct {
+        const char* a;
+        const char* b;
+        bool disjoint;
+    } pairs[] = {
+        { "^ftp://.+", "^https?://.+", true },
+        { "^https?://.+", "^http://a", false },
+        { "^ABC", "^abd", true },
+        { "^abc", "^ABC", false },
+        { "^.+\\.png$", "^.+\\.jpg$", true },
+        { "^\\.a", "^\\.b", true },
+        { "^a|b", "^c", false },
+        { "^\\<foo", "^foo", false },
+        { "foo\\>$", "foo$", false },
+        { "^\\`foo", "^foo", false },
+        { "foo\\'", "foo$", false },
+        { "^\\bfoo", "^foo", false },
+        { "^\\.a", "^a", true },
+        { "^a[bc]d", "^a[bc]e", false },
+        { "^a{2}b", "^a{2}c", false },
+        { "^ab?", "^ac", false },
+        { "x+$", "y$", false },
+        { "^[[:alpha:]]x$", "^[]]y$", true },
+        { "^(a)x$", "^(a)*x$", false },
+    };
+    for (int i = 0; i < LENGTH(pairs); i++) {
+        TEST_COND(pattern_disjoint(pairs[i].a, pairs[i].b) ==
+                  pairs[i].disjoint);
+        TEST_COND(pattern_disjoint(pairs[i].b, pairs[i].a) ==
+                  pairs[i].disjoint);
+    }
 
     /*
-     * TODO: Test patterns in 'editor_patterns', 'image_patterns' and
-     * 'video_patterns'.
+     * The first three rules can't match the same strings, so they form a run
+     * of 'RuleSet.order', but the last one can match the same strings as them.
      */
+    static const char* text = "a LAUNCH '^x1(.)\\1$' echo\n"
+                              "b LAUNCH '^x2(.)\\1$' echo\n"
+                              "c LAUNCH '^x3(.)\\1$' echo\n"
+                              "d LAUNCH '^x(.)\\1.*$' echo\n";
+    static const char* strs[] = {
+        "x1aa", "x2aa", "x3aa", "x33aa", "xaa", "x3ab", "x1",
+    };
+
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+    TEST_COND(setenv("XDG_CACHE_HOME", dir, 1) == 0);
+    char path[RULES_PATH_SZ], cache_path[RULES_PATH_SZ];
+    snprintf(path, sizeof(path), "%s/rules", dir);
+    TEST_COND(rulecache_path(path, cache_path, sizeof(cache_path)));
+    write_file(path, text);
+
+    RuleSet rules;
+    TEST_COND(ruleset_load(&rules, path) && ruleset_freeze(&rules, false));
+    TEST_COND(rules.order_num == 4 && rules.runs_num == 2);
+    TEST_COND(rules.run_ends[0] == 3 && rules.run_ends[1] == 4);
+
+    double by_priority, by_hits;
+    TEST_COND(!ruleset_order_steps(&rules, &by_priority, &by_hits));
+    for (int i = 0; i < 10; i++)
+        TEST_COND(ruleset_match(&rules, "x3aa") == 2);
+    TEST_COND(ruleset_order_steps(&rules, &by_priority, &by_hits));
+    TEST_COND(by_priority == 3 && by_hits == 3);
+
+    ruleset_reorder(&rules);
+    TEST_COND(rules.order[0] == 2 && rules.order[3] == 3);
+    TEST_COND(ruleset_order_steps(&rules, &by_priority, &by_hits));
+    TEST_COND(by_priority == 3 && by_hits == 1);
+
+    /* The results don't change */
+    for (int i = 0; i < LENGTH(strs); i++) {
+        const size_t len = strlen(strs[i]);
+        TEST_COND(ruleset_match_len(&rules, strs[i], len) ==
+                  ruleset_match_reference_len(&rules, strs[i], len));
+    }
+    ruleset_free(&rules);
+
+    TEST_COND(unsetenv("XDG_CACHE_HOME") == 0);
+    unlink(cache_path);
+    unlink(path);
+    *strrchr(cache_path, '/') = '\0';
+    rmdir(cache_path);
+    rmdir(dir);
+}
+
+static void test_magic(void) {
+#define HEAD(STR) STR, sizeof(STR) - 1
+    static const struct {
+        const char* head;
+        size_t len;
+        int kind;
+    } heads[] = {
+        { HEAD("%PDF-1.7\n%\xE2\xE3"), RULE_PDF },
+        { HEAD("\x89PNG\r\n\x1A\n\0\0\0\rIHDR"), RULE_IMAGE },
+        { HEAD("\xFF\xD8\xFF\xE0\0\x10JFIF"), RULE_IMAGE },
+        { HEAD("RIFF\0\0\0\0WEBPVP8 "), RULE_IMAGE },
+        { HEAD("P6\n640 480\n255\n"), RULE_IMAGE },
+        { HEAD("P1\n# Created by GIMP\n16 8\n0 1"), RULE_IMAGE },
+        { HEAD("P5 2 2 65535 "), RULE_IMAGE },
+        { HEAD("BM\x36\x0C\0\0\0\0\0\0\x36\0\0\0\x28\0\0\0"), RULE_IMAGE },
+        { HEAD("BM\x1A\0\0\0\0\0\0\0\x1A\0\0\0\x0C\0\0\0"), RULE_IMAGE },
+        { HEAD("\0\0\0\x20" "ftypisom"), RULE_VIDEO },
+        { HEAD("\x1A\x45\xDF\xA3\x9F"), RULE_VIDEO },
+        { HEAD("RIFF\0\0\0\0AVI LIST"), RULE_VIDEO },
+        { HEAD("#!/bin/sh\necho \xC3\xA9\n"), RULE_EDITOR },
+        { HEAD(""), RULE_EDITOR },
+        { HEAD("\x7F" "ELF\x02\x01\x01\0"), -1 },
+        { HEAD("RIFF\0\0\0\0WAVE"), -1 },
+
+        /* Text that starts like weak signatures */
+        { HEAD("BMW service notes\nOil changed at 30000 km.\n"), RULE_EDITOR },
+        { HEAD("P1 fix the login bug\nP2 update the docs\n"), RULE_EDITOR },
+        { HEAD("P3 640 480 is the size\n"), RULE_EDITOR },
+        { HEAD("P6\n640 480\n"), RULE_EDITOR },
+        { HEAD("BM\x36\x0C\0\0\0\0\0\0\x36\0\0\0\x29\0\0\0"), -1 },
+    };
+#undef HEAD
+
+    for (int i = 0; i < LENGTH(heads); i++)
+        if (magic_classify_head((const unsigned char*)heads[i].head,
+                                heads[i].len) != heads[i].kind)
+            TEST_DIE("Wrong kind for signature %d.", i);
+
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+
+    char path[RULES_PATH_SZ];
+    snprintf(path, sizeof(path), "%s/document", dir);
+    write_file(path, "%PDF-1");
+
+    static MagicCache cache;
+    magic_cache_init(&cache);
+    TEST_COND(magic_classify(&cache, NULL, path) == RULE_PDF);
+    TEST_COND(magic_classify(&cache, dir, "document") == RULE_PDF);
+    TEST_COND(magic_classify(&cache, dir, "missing") < 0);
+    TEST_COND(magic_classify(&cache, NULL, dir) < 0);
+
+    /* Same inode, size and modification time, so the cache is not updated */
+    struct stat st;
+    TEST_COND(stat(path, &st) == 0);
+    write_file(path, "GIF89a");
+    const struct timespec times[] = { st.st_atim, st.st_mtim };
+    TEST_COND(utimensat(AT_FDCWD, path, times, 0) == 0);
+    TEST_COND(magic_classify(&cache, NULL, path) == RULE_PDF);
+    TEST_COND(magic_classify(NULL, NULL, path) == RULE_IMAGE);
+
+    /* A different modification time invalidates it */
+    const struct timespec later[] = {
+        st.st_atim,
+        { st.st_mtim.tv_sec + 1, st.st_mtim.tv_nsec },
+    };
+    TEST_COND(utimensat(AT_FDCWD, path, later, 0) == 0);
+    TEST_COND(magic_classify(&cache, NULL, path) == RULE_IMAGE);
+
+    /* The rule of each kind receives the path as its argument */
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules));
+    const int rule = ruleset_find_kind(&rules, RULE_IMAGE);
+    TEST_COND(rule >= 0 && rules.rules[rule].kind == RULE_IMAGE);
+    TEST_COND(ruleset_find_kind(&rules, RULE_LINECOL) < 0);
+    ruleset_free(&rules);
+
+    unlink(path);
+    rmdir(dir);
+}
+
+static void test_mapfile(void) {
+    /* Sections are aligned, even after an odd number of bytes */
+    uint64_t end = 3;
+    TEST_COND(mapfile_push_section(&end, 5, 1) == MAPFILE_ALIGN && end == 13);
+    TEST_COND(mapfile_push_section(&end, 2, 4) == 16 && end == 24);
+    TEST_COND(mapfile_push_section(&end, 0, 8) == 24 && end == 24);
+    TEST_COND(mapfile_hash("a") != mapfile_hash("b"));
+
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+    TEST_COND(setenv("XDG_CACHE_HOME", dir, 1) == 0);
+
+    char path[MAPFILE_PATH_SZ];
+    TEST_COND(mapfile_cache_path("test", "key", path, sizeof(path)));
+    TEST_COND(!strncmp(path, dir, strlen(dir)) && strstr(path, "/test-"));
+    TEST_COND(!mapfile_cache_path("test", "key", path, 8));
+
+    struct {
+        MapFileHeader file;
+        char data[8];
+    } contents;
+    memset(&contents, 0, sizeof(contents));
+    mapfile_init_header(&contents.file, "plumbtst", 1, sizeof(MapFileHeader),
+                        sizeof(contents));
+    memcpy(contents.data, "payload", 8);
+
+    /* The parent directory is created */
+    TEST_COND(mapfile_save(path, &contents, sizeof(contents)));
+    size_t size;
+    void* map = mapfile_open(path, "plumbtst", 1, sizeof(MapFileHeader),
+                             &size);
+    TEST_COND(map != NULL && size == sizeof(contents));
+    TEST_COND(!memcmp(map, &contents, sizeof(contents)));
+    mapfile_close(map, size);
+
+    /* Different magic, version, header size, and file size */
+    TEST_COND(!mapfile_open(path, "plumbxxx", 1, sizeof(MapFileHeader),
+                            &size));
+    TEST_COND(!mapfile_open(path, "plumbtst", 2, sizeof(MapFileHeader),
+                            &size));
+    TEST_COND(!mapfile_open(path, "plumbtst", 1, 8, &size));
+    TEST_COND(mapfile_save(path, &contents, sizeof(contents) - 1));
+    TEST_COND(!mapfile_open(path, "plumbtst", 1, sizeof(MapFileHeader),
+                            &size));
+    TEST_COND(!mapfile_open("/nonexistent", "plumbtst", 1,
+                            sizeof(MapFileHeader), &size));
+
+    unlink(path);
+    *strrchr(path, '/') = '\0';
+    rmdir(path);
+    rmdir(dir);
+}
+
+static void test_fileindex(void) {
+    char root[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(root) != NULL);
+    TEST_COND(setenv("XDG_CACHE_HOME", root, 1) == 0);
+
+    static const char* dirs[] = { "src", "src/sub", "build", ".git" };
+    static const char* files[] = {
+        "src/main.c", "src/sub/main.c", "src/util.h", ".git/hidden.c",
+    };
+
+    char path[FILEINDEX_PATH_SZ];
+    for (int i = 0; i < LENGTH(dirs); i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        TEST_COND(mkdir(path, 0700) == 0);
+    }
+    for (int i = 0; i < LENGTH(files); i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+        write_file(path, "");
+    }
+
+    char index_path[FILEINDEX_PATH_SZ], build[FILEINDEX_PATH_SZ],
+      sub[FILEINDEX_PATH_SZ], buf[FILEINDEX_PATH_SZ];
+    snprintf(build, sizeof(build), "%s/build", root);
+    snprintf(sub, sizeof(sub), "%s/src/sub", root);
+    TEST_COND(fileindex_path(root, index_path, sizeof(index_path)));
+    TEST_COND(fileindex_update(root, index_path));
+
+    FileIndex index;
+    TEST_COND(fileindex_open(&index, index_path));
+    TEST_COND(fileindex_find(&index, "util.h", 6, build, buf, sizeof(buf)));
+    snprintf(path, sizeof(path), "%s/src/util.h", root);
+    TEST_COND(!strcmp(buf, path));
+
+    /* The closest file to the working directory, or the one of the path */
+    TEST_COND(fileindex_find(&index, "main.c", 6, sub, buf, sizeof(buf)));
+    snprintf(path, sizeof(path), "%s/src/sub/main.c", root);
+    TEST_COND(!strcmp(buf, path));
+    TEST_COND(fileindex_find(&index, "sub/main.c", 10, build, buf,
+                             sizeof(buf)));
+    TEST_COND(!strcmp(buf, path));
+    TEST_COND(!fileindex_find(&index, "b/main.c", 8, build, buf, sizeof(buf)));
+    TEST_COND(!fileindex_find(&index, "hidden.c", 8, build, buf, sizeof(buf)));
+    TEST_COND(!fileindex_find(&index, "new.c", 5, build, buf, sizeof(buf)));
+    fileindex_close(&index);
+
+    /* Only the modified directories are read again */
+    snprintf(path, sizeof(path), "%s/src/sub/new.c", root);
+    write_file(path, "");
+    TEST_COND(fileindex_update(root, index_path));
+    TEST_COND(fileindex_open(&index, index_path));
+    TEST_COND(fileindex_find(&index, "new.c", 5, build, buf, sizeof(buf)));
+    TEST_COND(!strcmp(buf, path));
+    fileindex_close(&index);
+
+    /* The line and column are kept, and existing files are not resolved */
+    TEST_COND(setenv("PLUMBER_ROOTS", root, 1) == 0);
+    const size_t len =
+      fileindex_resolve(build, "util.h:12:5", 11, buf, sizeof(buf), true);
+    snprintf(path, sizeof(path), "%s/src/util.h:12:5", root);
+    TEST_COND(len == strlen(path) && !strcmp(buf, path));
+    TEST_COND(
+      fileindex_resolve(sub, "main.c:1", 8, buf, sizeof(buf), true) == 0);
+    TEST_COND(
+      fileindex_resolve(build, "none.c:1", 8, buf, sizeof(buf), true) == 0);
+
+    /* The daemon leaves the updates to another thread */
+    TEST_COND(unlink(index_path) == 0);
+    TEST_COND(
+      fileindex_resolve(build, "util.h:1", 8, buf, sizeof(buf), false) == 0);
+    TEST_COND(access(index_path, F_OK) != 0);
+    fileindex_wait_miss();
+    TEST_COND(fileindex_refresh());
+    TEST_COND(
+      fileindex_resolve(build, "util.h:1", 8, buf, sizeof(buf), false) > 0);
+    TEST_COND(unsetenv("PLUMBER_ROOTS") == 0);
+
+    unlink(index_path);
+    *strrchr(index_path, '/') = '\0';
+    rmdir(index_path);
+    snprintf(path, sizeof(path), "%s/src/sub/new.c", root);
+    unlink(path);
+    for (int i = LENGTH(files) - 1; i >= 0; i--) {
+        snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+        unlink(path);
+    }
+    for (int i = LENGTH(dirs) - 1; i >= 0; i--) {
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        rmdir(path);
+    }
+    rmdir(root);
+}
+
+static void test_manindex(void) {
+    char root[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(root) != NULL);
+    TEST_COND(setenv("XDG_CACHE_HOME", root, 1) == 0);
+
+    char roots[MANINDEX_PATH_SZ];
+    TEST_COND(setenv("MANPATH", "/a:/b", 1) == 0);
+    TEST_COND(manindex_roots(roots, sizeof(roots)));
+    TEST_COND(!strcmp(roots, "/a:/b"));
+
+    /* Empty elements are expanded by manpath(1), here a script */
+    char path[PATH_MAX];
+    const char* old_path = getenv("PATH");
+    char saved_path[PATH_MAX];
+    snprintf(saved_path, sizeof(saved_path), "%s", old_path ? old_path : "");
+    snprintf(path, sizeof(path), "%s/manpath", root);
+    write_file(path, "#!/bin/sh\necho \"/x:$MANPATH\"\n");
+    TEST_COND(chmod(path, 0700) == 0);
+    TEST_COND(setenv("PATH", root, 1) == 0);
+    TEST_COND(setenv("MANPATH", "/a::/b", 1) == 0);
+    TEST_COND(manindex_roots(roots, sizeof(roots)));
+    TEST_COND(!strcmp(roots, "/x:/a::/b"));
+    TEST_COND(unlink(path) == 0);
+
+    /* Without manpath(1), they are unknown, and every page might exist */
+    TEST_COND(setenv("MANPATH", ":/c", 1) == 0);
+    TEST_COND(!manindex_roots(roots, sizeof(roots)));
+    TEST_COND(manindex_exists("nosuch(1)", 9));
+
+    /* Its output is stored, so it's not needed for the same variables */
+    TEST_COND(setenv("MANPATH", "/a::/b", 1) == 0);
+    TEST_COND(manindex_roots(roots, sizeof(roots)));
+    TEST_COND(!strcmp(roots, "/x:/a::/b"));
+    char key[PATH_MAX];
+    char roots_path[PATH_MAX];
+    snprintf(key, sizeof(key), "/a::/b\n%s", root);
+    TEST_COND(mapfile_cache_path("roots", key, roots_path, sizeof(roots_path)));
+    TEST_COND(unlink(roots_path) == 0);
+    TEST_COND(setenv("PATH", saved_path, 1) == 0);
+
+    /* Without pages, every page might exist */
+    snprintf(path, sizeof(path), "%s/man", root);
+    TEST_COND(mkdir(path, 0700) == 0);
+    TEST_COND(setenv("MANPATH", path, 1) == 0);
+    TEST_COND(manindex_exists("foo(1)", 6));
+
+    static const char* dirs[]  = { "man/man1", "man/man3" };
+    static const char* files[] = {
+        "man/man1/foo.1.gz",
+        "man/man3/foo.bar.3pm",
+        "man/man3/.hidden.3",
+        "man/man3/baz",
+        "man/man1/new.1",
+    };
+    for (int i = 0; i < LENGTH(dirs); i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        TEST_COND(mkdir(path, 0700) == 0);
+    }
+    for (int i = 0; i < LENGTH(files) - 1; i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+        TEST_COND(close(open(path, O_WRONLY | O_CREAT, 0600)) == 0);
+    }
+
+    /* The index is updated, since the directories changed */
+    TEST_COND(manindex_exists("foo(1)", 6));
+    TEST_COND(manindex_exists("foo.bar(3) and more", 10));
+    TEST_COND(!manindex_exists("foo(3)", 6));
+    TEST_COND(!manindex_exists("fo(1)", 5));
+    TEST_COND(!manindex_exists(".hidden(3)", 10));
+    TEST_COND(!manindex_exists("baz(3)", 6));
+    TEST_COND(!manindex_exists("new(1)", 6));
+
+    char index_path[MANINDEX_PATH_SZ];
+    ManIndex index;
+    TEST_COND(manindex_roots(roots, sizeof(roots)) &&
+              manindex_path(roots, index_path, sizeof(index_path)) &&
+              manindex_open(&index, index_path));
+    TEST_COND(index.pages_num == 2 && index.dirs_num == 3);
+    TEST_COND(manindex_find(&index, "foo", 3, '1'));
+    TEST_COND(!manindex_outdated(&index));
+
+    /* Installed pages are found */
+    snprintf(path, sizeof(path), "%s/%s", root, files[LENGTH(files) - 1]);
+    TEST_COND(close(open(path, O_WRONLY | O_CREAT, 0600)) == 0);
+    TEST_COND(manindex_outdated(&index));
+    manindex_close(&index);
+    TEST_COND(manindex_exists("new(1)", 6));
+
+    /* Missing pages fall through to the next rules */
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules));
+    const int man = ruleset_match(&rules, "nosuch(1)");
+    TEST_COND(man >= 0 && rules.rules[man].kind == RULE_MAN);
+    TEST_COND(manindex_filter(&rules, "nosuch(1)", 9, man) < 0);
+    TEST_COND(manindex_filter(&rules, "foo(1)", 6, man) == man);
+    const int image = ruleset_match(&rules, "image.png");
+    TEST_COND(ruleset_match_after(&rules, "image.png", 9, -1) == image);
+    TEST_COND(ruleset_match_after(&rules, "image.png", 9, image) < 0);
+    ruleset_free(&rules);
+
+    TEST_COND(unsetenv("MANPATH") == 0);
+    TEST_COND(unsetenv("XDG_CACHE_HOME") == 0);
+    unlink(index_path);
+    *strrchr(index_path, '/') = '\0';
+    rmdir(index_path);
+    for (int i = LENGTH(files) - 1; i >= 0; i--) {
+        snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+        unlink(path);
+    }
+    for (int i = LENGTH(dirs) - 1; i >= 0; i--) {
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        rmdir(path);
+    }
+    snprintf(path, sizeof(path), "%s/man", root);
+    rmdir(path);
+    rmdir(root);
+}
+
+static void test_launch(void) {
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules));
+
+    static const struct {
+        const char* str;
+        const char* file;
+        const char* cursor;
+    } tests[] = {
+        { "main.c:12:5", "main.c", "+call cursor(12,5)" },
+        { "main.c:12", "main.c", "+call cursor(12,0)" },
+        { "main.c:12:", "main.c", "+call cursor(12,0)" },
+        { "src/main.c(12,5): error", "src/main.c", "+call cursor(12,5)" },
+        { "main.c(12)", "main.c", "+call cursor(12,0)" },
+        { "a.c:12345678901234567890:1", "a.c",
+          "+call cursor(12345678901234567890,1)" },
+    };
+
+    for (int i = 0; i < LENGTH(tests); i++) {
+        const char* str  = tests[i].str;
+        const size_t len = strlen(str);
+        const int idx    = ruleset_match(&rules, str);
+        TEST_COND(idx >= 0 && rules.rules[idx].kind == RULE_LINECOL);
+        TEST_COND(!strcmp(rules.rules[idx].args[1], linecol_args[1]));
+
+        char buf[256];
+        const char* argv[LAUNCH_MAX_ARGS + 1];
+        TEST_COND(launch_argv_size(&rules, idx, len) <= sizeof(buf));
+        const int argc = launch_argv(&rules, idx, str, len, buf, sizeof(buf),
+                                     argv);
+        TEST_COND(argc == 5 && argv[argc] == NULL);
+        if (strcmp(argv[3], tests[i].file) || strcmp(argv[4], tests[i].cursor))
+            TEST_DIE("Wrong arguments for '%s' ('%s' '%s').",
+                     str,
+                     argv[3],
+                     argv[4]);
+
+        /* Arguments that don't fit should be reported, not truncated */
+        TEST_COND(launch_argv(&rules, idx, str, len, buf, 8, argv) < 0);
+    }
+
+    /* Without templates, the string is the only argument */
+    const char* str = "image.png";
+    const int idx   = ruleset_match(&rules, str);
+    char buf[16];
+    const char* argv[LAUNCH_MAX_ARGS + 1];
+    TEST_COND(launch_argv(&rules, idx, str, strlen(str), buf, sizeof(buf),
+                          argv) == 2);
+    TEST_COND(!strcmp(argv[1], str));
+
+    /* Only the commands that end with their argument are grouped */
+    static const char* cmd_a[]   = { "nsxiv", "a.png", NULL };
+    static const char* cmd_b[]   = { "nsxiv", "b.png", NULL };
+    static const char* cmd_url[] = { "firefox", "https://x.org", NULL };
+    static const char* cmd_col[] = { "nvim", "a.c", "+1", NULL };
+    static const char* cmd_opt[] = { "nsxiv", "-f", "c.png", NULL };
+    LaunchCommand cmds[] = {
+        { cmd_a, true, false },   { cmd_url, true, false },
+        { cmd_col, false, false }, { cmd_b, true, false },
+        { cmd_col, false, false }, { cmd_a, true, false },
+        { cmd_opt, true, false }, { NULL, false, false },
+    };
+    const char* group[LAUNCH_MAX_ARGS + LENGTH(cmds) + 1];
+    TEST_COND(launch_group(cmds, LENGTH(cmds), 0, group) == 3);
+    TEST_COND(!strcmp(group[1], "a.png") && !strcmp(group[2], "b.png") &&
+              group[3] == NULL);
+    TEST_COND(cmds[3].grouped && cmds[5].grouped && !cmds[1].grouped &&
+              !cmds[6].grouped);
+    TEST_COND(launch_group(cmds, LENGTH(cmds), 2, group) == 3);
+    TEST_COND(!cmds[4].grouped);
+
+    ruleset_free(&rules);
+}
+
+/*
+ * Editor that accepts a single connection, stores the request, and sends a
+ * fixed response.
+ */
+typedef struct StubEditor {
+    int fd;
+    const char* response;
+    size_t response_len;
+    char request[NVIM_MAX_MSG];
+    size_t request_len;
+} StubEditor;
+
+static void* stub_editor_thread(void* arg) {
+    StubEditor* stub = arg;
+    const int client = accept(stub->fd, NULL, NULL);
+    if (client < 0)
+        return NULL;
+
+    /* The request of the client is sent with a single write */
+    const ssize_t len = read(client, stub->request, sizeof(stub->request));
+    stub->request_len = (len > 0) ? len : 0;
+    if (send(client, stub->response, stub->response_len, MSG_NOSIGNAL) < 0)
+        stub->request_len = 0;
+
+    close(client);
+    return NULL;
+}
+
+static bool contains(const char* buf, size_t len, const char* str) {
+    const size_t str_len = strlen(str);
+    for (size_t i = 0; i + str_len <= len; i++)
+        if (!memcmp(&buf[i], str, str_len))
+            return true;
+    return false;
+}
+
+/*
+ * Send a request to a stub editor with the specified response, and return the
+ * result of 'launch_remote'.
+ */
+static bool stub_request(StubEditor* stub, const char* path,
+                         const char* response, size_t response_len,
+                         const char* const* argv) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    stub->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    TEST_COND(stub->fd >= 0);
+    TEST_COND(bind(stub->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    TEST_COND(listen(stub->fd, 1) == 0);
+    stub->response     = response;
+    stub->response_len = response_len;
+    stub->request_len  = 0;
+
+    pthread_t thread;
+    TEST_COND(pthread_create(&thread, NULL, stub_editor_thread, stub) == 0);
+    const bool result = launch_remote("/work", argv);
+
+    /* Unblock the thread if the client didn't connect */
+    if (!result) {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        TEST_COND(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        close(fd);
+    }
+
+    TEST_COND(pthread_join(thread, NULL) == 0);
+    close(stub->fd);
+    unlink(path);
+    return result;
+}
+
+static void test_nvim(void) {
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+
+    char path[NVIM_PATH_SZ];
+    snprintf(path, sizeof(path), "%s/nvim.sock", dir);
+    TEST_COND(setenv("PLUMBER_NVIM", path, 1) == 0);
+
+    /* [1, 1, nil, nil] and [1, 1, [0, "E492"], nil] */
+    static const char success[] = { '\x94', 1, 1, '\xC0', '\xC0' };
+    static const char failure[] = {
+        '\x94', 1, 1, '\x92', 0, '\xA4', 'E', '4', '9', '2', '\xC0',
+    };
+
+    static StubEditor stub;
+    const char* edit[] = {
+        "st", "-e", "nvim", "main.c", "+call cursor(3,1)", NULL,
+    };
+    TEST_COND(stub_request(&stub, path, success, sizeof(success), edit));
+    TEST_COND(contains(stub.request, stub.request_len, "nvim_exec_lua"));
+    TEST_COND(contains(stub.request, stub.request_len, "\xA4" "edit"));
+    TEST_COND(contains(stub.request, stub.request_len, "\xA5/work"));
+    TEST_COND(contains(stub.request, stub.request_len,
+                       "\x92\xA6main.c\xB1+call cursor(3,1)"));
+
+    const char* man[] = { "st", "-e", "man", "mmap(2)", NULL };
+    TEST_COND(stub_request(&stub, path, success, sizeof(success), man));
+    TEST_COND(contains(stub.request, stub.request_len, "\xA3man"));
+    TEST_COND(contains(stub.request, stub.request_len, "\x91\xA7mmap(2)"));
+
+    /* Errors of the editor, and other commands, are launched normally */
+    TEST_COND(!stub_request(&stub, path, failure, sizeof(failure), edit));
+    const char* browser[] = { "firefox", "https://example.com/", NULL };
+    TEST_COND(!stub_request(&stub, path, success, sizeof(success), browser));
+    TEST_COND(stub.request_len == 0);
+
+    /* Nothing listening */
+    TEST_COND(!launch_remote(NULL, edit));
+
+    TEST_COND(unsetenv("PLUMBER_NVIM") == 0);
+    rmdir(dir);
+}
+
+static void test_spawn(void) {
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+
+    /* Descriptors of the caller are not inherited, even without O_CLOEXEC */
+    const int fd = open(dir, O_RDONLY);
+    TEST_COND(fd > STDERR_FILENO);
+
+    char script[256];
+    snprintf(script, sizeof(script),
+             "{ [ -e /proc/$$/fd/%d ] && echo leaked || pwd; } > tmp; "
+             "mv tmp out",
+             fd);
+    const char* sh[] = { "sh", "-c", script, NULL };
+    TEST_COND(launch_detached(dir, sh));
+
+    char out_path[PATH_MAX];
+    snprintf(out_path, sizeof(out_path), "%s/out", dir);
+    FILE* out = NULL;
+    for (int i = 0; i < 200 && out == NULL; i++) {
+        out = fopen(out_path, "r");
+        const struct timespec delay = { 0, 10 * 1000 * 1000 };
+        if (out == NULL)
+            nanosleep(&delay, NULL);
+    }
+    TEST_COND(out != NULL);
+
+    char line[PATH_MAX];
+    TEST_COND(fgets(line, sizeof(line), out) != NULL);
+    line[strcspn(line, "\n")] = '\0';
+    TEST_COND(!strcmp(line, dir));
+    fclose(out);
+    close(fd);
+    TEST_COND(waitpid(-1, NULL, 0) > 0);
+
+    const char* missing[] = { "plumber-test-missing-command", NULL };
+    TEST_COND(!launch_detached(NULL, missing));
+
+    /* Identical launches are coalesced, by every process of the user */
+    char pid[32];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    const char* cmd[]   = { "plumber-test", pid, NULL };
+    const char* other[] = { "plumber-test", pid, "other", NULL };
+    TEST_COND(!dedup_check(dir, cmd, 0));
+    TEST_COND(!dedup_check(dir, cmd, 60000));
+    TEST_COND(dedup_check(dir, cmd, 60000));
+    TEST_COND(!dedup_check("/", cmd, 60000));
+    TEST_COND(!dedup_check(dir, other, 60000));
+    const struct timespec window = { 0, 20 * 1000 * 1000 };
+    nanosleep(&window, NULL);
+    TEST_COND(!dedup_check(dir, cmd, 10));
+
+    unlink(out_path);
+    rmdir(dir);
+}
+
+/*
+ * Store and look up strings whose rule is their number, from multiple threads,
+ * so the slots are overwritten while they are read.
+ */
+static void* decisions_thread(void* arg) {
+    DecisionTable* table = arg;
+    for (int i = 0; i < 20000; i++) {
+        char str[32];
+        const int num = i % 3000;
+        const int len = snprintf(str, sizeof(str), "plumber-test-%d", num);
+        int rule      = -1;
+        if (decisions_lookup(table, 1, str, len, &rule) && rule != num)
+            return NULL;
+        decisions_store(table, 1, str, len, num);
+    }
+    return table;
+}
+
+static void test_decisions(void) {
+    RuleSet a, b;
+    TEST_COND(ruleset_init(&a) && ruleset_init(&b));
+    TEST_COND(ruleset_hash(&a) == ruleset_hash(&b));
+    b.rules[0].pattern = "^changed$";
+    TEST_COND(ruleset_hash(&a) != ruleset_hash(&b));
+    ruleset_free(&a);
+    ruleset_free(&b);
+
+    DecisionTable* table = decisions_open();
+    TEST_COND(table != NULL);
+
+    /* Unique strings, since the table is shared with the real program */
+    char str[64];
+    const int len = snprintf(str, sizeof(str), "plumber-test-%d.c:1",
+                             (int)getpid());
+    int rule = 0;
+    TEST_COND(!decisions_lookup(table, 1, str, len, &rule));
+    decisions_store(table, 1, str, len, 3);
+    TEST_COND(decisions_lookup(table, 1, str, len, &rule) && rule == 3);
+    TEST_COND(!decisions_lookup(table, 2, str, len, &rule));
+    TEST_COND(!decisions_lookup(table, 1, str, len - 1, &rule));
+    decisions_store(table, 1, str, len, -1);
+    TEST_COND(decisions_lookup(table, 1, str, len, &rule) && rule == -1);
+
+    /* Slots claimed by writers that died are taken over after a while */
+    DecisionSlot* slot = NULL;
+    for (int i = 0; i < DECISIONS_SLOTS && slot == NULL; i++)
+        if (table->slots[i].len == (uint32_t)len &&
+            !memcmp(table->slots[i].key, str, len))
+            slot = &table->slots[i];
+    TEST_COND(slot != NULL && (slot->seq & 1) == 0);
+
+    struct timespec now;
+    TEST_COND(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+    const uint32_t counter = (uint32_t)slot->seq + 1;
+    slot->seq              = DECISIONS_CLAIM(counter, now.tv_sec);
+    TEST_COND(!decisions_lookup(table, 1, str, len, &rule));
+    decisions_store(table, 1, str, len, 5);
+    TEST_COND(slot->seq == DECISIONS_CLAIM(counter, now.tv_sec));
+
+    slot->seq = DECISIONS_CLAIM(counter, now.tv_sec - DECISIONS_STALE_SEC);
+    decisions_store(table, 1, str, len, 5);
+    TEST_COND(decisions_lookup(table, 1, str, len, &rule) && rule == 5);
+    TEST_COND(slot->seq == counter + 3);
+
+    /* Late writers of a slot that was taken over leave it inconsistent */
+    slot->rule = 6;
+    TEST_COND(!decisions_lookup(table, 1, str, len, &rule));
+    slot->rule = 5;
+    TEST_COND(decisions_lookup(table, 1, str, len, &rule) && rule == 5);
+
+    char long_str[DECISIONS_KEY_SZ + 1];
+    memset(long_str, 'a', sizeof(long_str));
+    decisions_store(table, 1, long_str, sizeof(long_str), 1);
+    TEST_COND(!decisions_lookup(table, 1, long_str, sizeof(long_str), &rule));
+
+    pthread_t threads[4];
+    for (int i = 0; i < LENGTH(threads); i++)
+        TEST_COND(pthread_create(&threads[i], NULL, decisions_thread, table) ==
+                  0);
+    for (int i = 0; i < LENGTH(threads); i++) {
+        void* result;
+        TEST_COND(pthread_join(threads[i], &result) == 0);
+        TEST_COND(result == table);
+    }
+
+    decisions_close(table);
+}
+
+static void test_prefetch(void) {
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/video.mkv", dir);
+
+    /* Sparse, so only the first bytes are requested */
+    const int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    TEST_COND(fd >= 0 && ftruncate(fd, 3 * 1024 * 1024) == 0);
+    close(fd);
+
+    TEST_COND(setenv("PLUMBER_PREFETCH_MB", "2", 1) == 0);
+    const uint64_t total = prefetch_total();
+    TEST_COND(prefetch_file(dir, "video.mkv", 9) == 2 * 1024 * 1024);
+    TEST_COND(prefetch_file(NULL, path, strlen(path)) == 2 * 1024 * 1024);
+    TEST_COND(prefetch_file(dir, "video.mkv.txt", 9) == 2 * 1024 * 1024);
+    TEST_COND(prefetch_file(NULL, dir, strlen(dir)) == 0);
+    TEST_COND(prefetch_file(dir, "missing.mkv", 11) == 0);
+    TEST_COND(prefetch_total() == total + 6 * 1024 * 1024);
+
+    TEST_COND(setenv("PLUMBER_PREFETCH_MB", "0", 1) == 0);
+    TEST_COND(prefetch_file(NULL, path, strlen(path)) == 0);
+    TEST_COND(unsetenv("PLUMBER_PREFETCH_MB") == 0);
+
+    /* Only the files of some rules are prefetched */
+    TEST_COND(rule_kind_prefetches(RULE_VIDEO));
+    TEST_COND(!rule_kind_prefetches(RULE_EDITOR));
+    Plumber* plumber = plumber_new(0);
+    TEST_COND(plumber != NULL);
+    const int video = plumber_classify(plumber, path, strlen(path));
+    TEST_COND(video >= 0 &&
+              plumber_prefetch(plumber, video, NULL, path, strlen(path)) ==
+                3 * 1024 * 1024);
+    const int url = plumber_classify(plumber, "https://x.org", 13);
+    TEST_COND(url >= 0 &&
+              plumber_prefetch(plumber, url, NULL, path, strlen(path)) == 0);
+    plumber_free(plumber);
+
+    TEST_COND(unlink(path) == 0 && rmdir(dir) == 0);
+}
+
+static void test_statcache(void) {
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/file.c", dir);
+    FILE* fp = fopen(path, "w");
+    TEST_COND(fp != NULL);
+    fclose(fp);
+
+    StatCache cache;
+    TEST_COND(statcache_init(&cache));
+
+    /* The same path is only added once, and it's checked when running */
+    const int file = statcache_add(&cache, path, strlen(path));
+    TEST_COND(file >= 0 && statcache_add(&cache, path, strlen(path)) == file);
+    TEST_COND(statcache_kind(&cache, file) == STAT_PENDING);
+    const int missing = statcache_add(&cache, path, strlen(path) - 1);
+    const int subdir  = statcache_add(&cache, dir, strlen(dir));
+    const int null    = statcache_add(&cache, "/dev/null", 9);
+    TEST_COND(missing != file && subdir >= 0 && null >= 0);
+    statcache_run(&cache);
+    TEST_COND(statcache_kind(&cache, file) == STAT_REGULAR);
+    TEST_COND(statcache_kind(&cache, missing) == STAT_MISSING);
+    TEST_COND(statcache_kind(&cache, subdir) == STAT_DIRECTORY);
+    TEST_COND(statcache_kind(&cache, null) == STAT_OTHER);
+
+    /* Full batches are checked by themselves, also without the ring */
+    StatRing* ring = cache.ring;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        cache.ring = (attempt == 0) ? ring : NULL;
+        char name[PATH_MAX];
+        int ids[STATCACHE_BATCH];
+        for (int i = 0; i < STATCACHE_BATCH; i++) {
+            const int len =
+              snprintf(name, sizeof(name), "%s/%d-%d", dir, attempt, i);
+            ids[i] = statcache_add(&cache, name, len);
+        }
+        for (int i = 0; i < STATCACHE_BATCH; i++)
+            TEST_COND(statcache_kind(&cache, ids[i]) == STAT_MISSING);
+        TEST_COND(statcache_add(&cache, path, strlen(path)) == file);
+    }
+    cache.ring = ring;
+
+    /* When the cache is full, the pending paths must be read before */
+    statcache_free(&cache);
+    TEST_COND(statcache_init(&cache));
+    static char long_path[3000];
+    memset(long_path, 'a', sizeof(long_path));
+    const int fit = STATCACHE_STRINGS_SZ / (sizeof(long_path) + 1);
+    for (int i = 0; i <= fit; i++) {
+        long_path[0] = 'a' + i % 26;
+        long_path[1] = 'a' + i / 26;
+        const int id = statcache_add(&cache, long_path, sizeof(long_path));
+        TEST_COND((i < fit) ? id == i : id == -1);
+    }
+    statcache_run(&cache);
+    TEST_COND(statcache_add(&cache, long_path, sizeof(long_path)) == 0);
+    statcache_run(&cache);
+    TEST_COND(statcache_kind(&cache, 0) == STAT_MISSING);
+    statcache_free(&cache);
+
+    TEST_COND(rule_kind_path_len(RULE_LINECOL, "foo.c:1:2", 9) == 5);
+    TEST_COND(rule_kind_path_len(RULE_IMAGE, "a:b.png", 7) == 7);
+    TEST_COND(rule_kind_path_len(RULE_URL, "https://x.org", 13) == 0);
+
+    TEST_COND(unlink(path) == 0 && rmdir(dir) == 0);
+}
+
+static void test_trace(void) {
+    TEST_COND(unsetenv("PLUMBER_TRACE") == 0);
+    TEST_COND(!trace_init(TRACE_RECORDS) && !g_trace_enabled);
+    TEST_COND(TRACE_START() == 0);
+
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/trace", dir);
+    TEST_COND(setenv("PLUMBER_TRACE", path, 1) == 0);
+
+    /* A line for each measurement */
+    TEST_COND(trace_init(TRACE_RECORDS) && g_trace_enabled);
+    const int64_t start = TRACE_START();
+    TEST_COND(start > 0 && trace_now() >= start);
+    trace_add(TRACE_DFA, -1, 42);
+    trace_add(TRACE_REGEXEC, 3, 1000);
+    trace_dump();
+
+    char buf[4096];
+    char expected[256];
+    int fd = open(path, O_RDONLY);
+    TEST_COND(fd >= 0);
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    TEST_COND(len > 0);
+    buf[len] = '\0';
+    snprintf(expected, sizeof(expected),
+             "{\"pid\": %d, \"phase\": \"dfa\", \"ns\": 42}\n"
+             "{\"pid\": %d, \"phase\": \"regexec\", \"rule\": 3, "
+             "\"ns\": 1000}\n",
+             (int)getpid(), (int)getpid());
+    TEST_COND(!strcmp(buf, expected));
+
+    /* A histogram of each phase, when it's dumped */
+    TEST_COND(unlink(path) == 0);
+    TEST_COND(trace_init(TRACE_HISTOGRAMS));
+    for (int i = 0; i < 100; i++)
+        trace_add(TRACE_SUFFIX, -1, (i < 90) ? 10 : 1000);
+    trace_add(TRACE_SUFFIX, -1, 1000000);
+    trace_dump();
+    trace_dump();
+
+    fd = open(path, O_RDONLY);
+    TEST_COND(fd >= 0);
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    TEST_COND(len > 0);
+    buf[len] = '\0';
+    snprintf(expected, sizeof(expected),
+             "{\"pid\": %d, \"phase\": \"suffix\", \"count\": 101, "
+             "\"p50_ns\": 10, \"p90_ns\": 992, \"p99_ns\": 992, "
+             "\"p999_ns\": 983040, "
+             "\"buckets\": [[10, 90], [992, 10], [983040, 1]]}\n",
+             (int)getpid());
+    TEST_COND(!strcmp(buf, expected));
+
+    g_trace_enabled = false;
+    TEST_COND(unsetenv("PLUMBER_TRACE") == 0);
+    TEST_COND(unlink(path) == 0 && rmdir(dir) == 0);
+}
+
+static void test_library(void) {
+    static const int flags[] = {
+        PLUMBER_BUILTIN,
+        PLUMBER_BUILTIN | PLUMBER_REFERENCE,
+    };
+    for (int i = 0; i < LENGTH(flags); i++) {
+        Plumber* plumber = plumber_new(flags[i]);
+        TEST_COND(plumber != NULL);
+
+        /* Only the first 'len' bytes should be used */
+        const char* str = "mmap(2) and more";
+        int idx         = plumber_classify(plumber, str, strlen("mmap(2)"));
+        TEST_COND(idx >= 0 && !strcmp(plumber_rule_name(plumber, idx), "man"));
+        TEST_COND(plumber_classify(plumber, str, strlen(str)) < 0);
+        TEST_COND(plumber_classify(plumber, "", 0) < 0);
+
+        /* The string doesn't need to be null-terminated either */
+        const char* target = "main.c:12:5 and more";
+        const size_t len   = strlen("main.c:12:5");
+        idx                = plumber_classify(plumber, target, len);
+        TEST_COND(idx >= 0);
+
+        char buf[64];
+        const char* argv[PLUMBER_MAX_ARGS + 1];
+        TEST_COND(plumber_argv_size(plumber, idx, len) <= sizeof(buf));
+        const int argc =
+          plumber_argv(plumber, idx, target, len, buf, sizeof(buf), argv);
+        TEST_COND(argc == 5 && argv[argc] == NULL);
+        TEST_COND(!strcmp(argv[3], "main.c"));
+        TEST_COND(!strcmp(argv[4], "+call cursor(12,5)"));
+
+        pthread_t threads[4];
+        for (int j = 0; j < LENGTH(threads); j++)
+            TEST_COND(pthread_create(&threads[j],
+                                     NULL,
+                                     classify_thread,
+                                     plumber) == 0);
+        for (int j = 0; j < LENGTH(threads); j++) {
+            void* result;
+            TEST_COND(pthread_join(threads[j], &result) == 0);
+            TEST_COND(result == plumber);
+        }
+
+        plumber_free(plumber);
+    }
+}
+
+/*
+ * Write the output of 'batch_run' for 'input' to 'out', reading it from a pipe
+ * if 'jobs' is zero, or from a regular file otherwise.
+ */
+static void run_batch(RuleSet* rules, const char* input, FILE* out,
+                      bool existing, int jobs) {
+    int in_fd;
+    FILE* in_file = NULL;
+    if (jobs == 0) {
+        /* The input might not fit in the pipe, so it's written by a child */
+        int fds[2];
+        TEST_COND(pipe(fds) == 0);
+        const pid_t pid = fork();
+        TEST_COND(pid >= 0);
+        if (pid == 0) {
+            close(fds[0]);
+            const ssize_t len = strlen(input);
+            _exit(write(fds[1], input, len) == len ? 0 : 1);
+        }
+        close(fds[1]);
+        in_fd = fds[0];
+    } else {
+        in_file = tmpfile();
+        TEST_COND(in_file != NULL);
+        TEST_COND(fputs(input, in_file) >= 0 && fflush(in_file) == 0);
+        rewind(in_file);
+        in_fd = fileno(in_file);
+    }
+
+    TEST_COND(batch_run(rules, in_fd, fileno(out), '\n', false, existing,
+                        jobs));
+    if (in_file != NULL) {
+        fclose(in_file);
+    } else {
+        int status;
+        close(in_fd);
+        TEST_COND(wait(&status) > 0 && WIFEXITED(status) &&
+                  WEXITSTATUS(status) == 0);
+    }
+}
+
+static void test_batch(void) {
+    RuleSet rules;
+    TEST_COND(ruleset_init(&rules));
+
+    /* Big enough to be split in a few chunks */
+    static char input[3 * BATCH_CHUNK_SZ];
+    static const char* records[] = {
+        "'main.c'", "img.png:1:2", "  \"https://x.org\" ",
+        "mmap(2)",  "",            "foo",
+    };
+    size_t len = 0;
+    for (int i = 0; len + 32 < sizeof(input); i++) {
+        const char* record = records[i % LENGTH(records)];
+        memcpy(&input[len], record, strlen(record));
+        len += strlen(record);
+        input[len++] = '\n';
+    }
+    strcpy(&input[len], "last.pdf");
+
+    FILE* expected = tmpfile();
+    FILE* result   = tmpfile();
+    TEST_COND(expected != NULL && result != NULL);
+    run_batch(&rules, "'main.c'\nfoo", expected, false, 0);
+
+    char buf[64] = { 0 };
+    rewind(expected);
+    TEST_COND(fread(buf, 1, sizeof(buf) - 1, expected) > 0);
+    TEST_COND(!strcmp(buf, "editor\tst\t-e\tnvim\tmain.c\n-\n"));
+
+    /* The parallel output should be the same as the sequential one */
+    TEST_COND(ftruncate(fileno(expected), 0) == 0);
+    rewind(expected);
+    run_batch(&rules, input, expected, false, 0);
+    run_batch(&rules, input, result, false, 3);
+
+    const off_t expected_len = lseek(fileno(expected), 0, SEEK_END);
+    TEST_COND(expected_len > 0 &&
+              expected_len == lseek(fileno(result), 0, SEEK_END));
+    rewind(expected);
+    rewind(result);
+    int c;
+    while ((c = fgetc(expected)) != EOF)
+        TEST_COND(fgetc(result) == c);
+
+    fclose(expected);
+    fclose(result);
+
+    /* Only the files that exist are opened, both in order and in parallel */
+    char dir[] = "/tmp/plumber-test-XXXXXX";
+    TEST_COND(mkdtemp(dir) != NULL);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/a.png", dir);
+    FILE* fp = fopen(path, "w");
+    TEST_COND(fp != NULL);
+    fclose(fp);
+
+    char existing[4 * PATH_MAX];
+    snprintf(existing, sizeof(existing), "%s\n%s/b.png\n%s:1:2\nhttps://x.org",
+             path, dir, dir);
+    for (int jobs = 0; jobs < 3; jobs += 2) {
+        result = tmpfile();
+        TEST_COND(result != NULL);
+        run_batch(&rules, existing, result, true, jobs);
+
+        char expected_buf[2 * PATH_MAX];
+        snprintf(expected_buf, sizeof(expected_buf),
+                 "image\tnsxiv\t%s\n-\n-\nurl\tfirefox\thttps://x.org\n", path);
+        char result_buf[2 * PATH_MAX] = { 0 };
+        rewind(result);
+        TEST_COND(fread(result_buf, 1, sizeof(result_buf) - 1, result) > 0);
+        TEST_COND(!strcmp(result_buf, expected_buf));
+        fclose(result);
+    }
+    TEST_COND(unlink(path) == 0 && rmdir(dir) == 0);
+    ruleset_free(&rules);
+
+    /* Records that are opened at once, without the empty ones */
+    FILE* in = tmpfile();
+    TEST_COND(in != NULL);
+    fputs("a.png\n\nhttps://x.org\nb.png", in);
+    fflush(in);
+    rewind(in);
+    int num;
+    char** strs = batch_read_records(fileno(in), '\n', &num);
+    TEST_COND(strs != NULL && num == 3 && strs[3] == NULL);
+    TEST_COND(!strcmp(strs[0], "a.png") && !strcmp(strs[1], "https://x.org") &&
+              !strcmp(strs[2], "b.png"));
+    free(strs);
+    fclose(in);
 }
 
 int main(void) {
     test_patterns();
     puts("[test] Passed pattern tests.");
 
+    test_rules();
+    puts("[test] Passed rule set tests.");
+
+    test_dfa();
+    puts("[test] Passed DFA tests.");
+
+    test_suffix();
+    puts("[test] Passed suffix table tests.");
+
+    test_matchers();
+    puts("[test] Passed matcher comparison tests.");
+
+    test_extract();
+    puts("[test] Passed extraction tests.");
+
+    test_transform();
+    puts("[test] Passed normalization tests.");
+
+    test_launch();
+    puts("[test] Passed argument tests.");
+
+    test_ipc();
+    puts("[test] Passed protocol tests.");
+
+    test_server();
+    puts("[test] Passed daemon request tests.");
+
+    test_reload();
+    puts("[test] Passed rule set reload tests.");
+
+    test_rulefile();
+    puts("[test] Passed rules file tests.");
+
+    test_reorder();
+    puts("[test] Passed rule ordering tests.");
+
+    test_magic();
+    puts("[test] Passed content sniffing tests.");
+
+    test_mapfile();
+    puts("[test] Passed mapped file tests.");
+
+    test_fileindex();
+    puts("[test] Passed file index tests.");
+
+    test_manindex();
+    puts("[test] Passed manual page index tests.");
+
+    test_batch();
+    puts("[test] Passed batch tests.");
+
+    test_library();
+    puts("[test] Passed library tests.");
+
+    test_decisions();
+    puts("[test] Passed decision cache tests.");
+
+    test_nvim();
+    puts("[test] Passed editor socket tests.");
+
+    test_spawn();
+    puts("[test] Passed detached launch tests.");
+
+    test_linecache();
+    puts("[test] Passed line cache tests.");
+
+    test_prefetch();
+    puts("[test] Passed prefetch tests.");
+
+    test_statcache();
+    puts("[test] Passed file status tests.");
+
+    test_trace();
+    puts("[test] Passed tracing tests.");
+
     puts("[test] Success: All tests passed.");
     return 0;
 }
@@ -87,4 +87,15 @@
         }                                                                      \
     } while (0)
 
+#define TEST_RULE(RULES, STR, KIND)                                            \
+    do {                                                                       \
+        const int idx_ = ruleset_match(RULES, STR);                            \
+        if (idx_ < 0 || (RULES)->rules[idx_].kind != (KIND)) {                 \
+            TEST_DIE("String '%s' didn't match a rule of kind %d (got %d).",   \
+                     STR,                                                      \
+                     KIND,                                                     \
+                     idx_);                                                    \
+        }                                                                      \
+    } while (0)
+
 #endif /* TEST_H_ */